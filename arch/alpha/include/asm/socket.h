@@ -69,6 +69,10 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ACCT_TAG             41
+
+#define SO_TX_DEFER             42
+
 /* O_NONBLOCK clashes with the bits used for socket types.  Therefore we
  * have to define SOCK_NONBLOCK to a different value here.
  */
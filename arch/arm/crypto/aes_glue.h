@@ -0,0 +1,13 @@
+#ifndef _ARM_CRYPTO_AES_GLUE_H
+#define _ARM_CRYPTO_AES_GLUE_H
+
+#include <linux/linkage.h>
+#include <crypto/aes.h>
+
+/* aes-armv4.S: one block, in and out word aligned */
+asmlinkage void aes_arm_encrypt(const struct crypto_aes_ctx *ctx, u8 *out,
+				const u8 *in);
+asmlinkage void aes_arm_decrypt(const struct crypto_aes_ctx *ctx, u8 *out,
+				const u8 *in);
+
+#endif
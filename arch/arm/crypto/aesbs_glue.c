@@ -0,0 +1,479 @@
+/*
+ * linux/arch/arm/crypto/aesbs_glue.c
+ *
+ * Glue code for the bit-sliced NEON version of AES: ECB, CBC, CTR and
+ * XTS modes, eight blocks at a time.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Runs of eight blocks go through aesbs_neon.c inside a
+ * kernel_neon_begin()/kernel_neon_end() section, one section per
+ * blkcipher walk step so preemption is never held off for more than a
+ * page.  Shorter tails, CBC encryption (which is inherently serial) and
+ * callers in interrupt context use the scalar code in aes-armv4.S.
+ */
+
+#include <linux/module.h>
+#include <linux/crypto.h>
+#include <crypto/algapi.h>
+#include <crypto/aes.h>
+#include <crypto/b128ops.h>
+#include <crypto/gf128mul.h>
+#include <asm/neon.h>
+
+#include "aes_glue.h"
+#include "aesbs_neon.h"
+
+#define AESBS_CHUNK	(AESBS_BLOCKS * AES_BLOCK_SIZE)
+
+struct aesbs_ctx {
+	/* bit-sliced round keys for aesbs_neon.c */
+	u8			rk[AESBS_ROUND_KEY_SIZE *
+				   (AES_MAX_KEYLENGTH / AES_BLOCK_SIZE)];
+	/* plain schedule for aes-armv4.S */
+	struct crypto_aes_ctx	key;
+	int			rounds;
+};
+
+struct aesbs_xts_ctx {
+	struct aesbs_ctx	data;
+	struct crypto_aes_ctx	tweak;
+};
+
+/*
+ * Round key r becomes eight planes of 16 bytes, byte j of plane i being
+ * all ones if bit i of key byte j is set.  Keys 1..Nr absorb the S-box
+ * constant 0x63 that aesbs_neon.c leaves out of SubBytes.
+ */
+static void aesbs_convert_key(struct aesbs_ctx *ctx)
+{
+	int r, i, j;
+	u8 b;
+
+	for (r = 0; r <= ctx->rounds; r++) {
+		u8 *rk = ctx->rk + AESBS_ROUND_KEY_SIZE * r;
+
+		for (j = 0; j < AES_BLOCK_SIZE; j++) {
+			b = ctx->key.key_enc[4 * r + j / 4] >> (8 * (j % 4));
+			if (r)
+				b ^= 0x63;
+			for (i = 0; i < 8; i++)
+				rk[AES_BLOCK_SIZE * i + j] = (b >> i) & 1 ? 0xff : 0;
+		}
+	}
+}
+
+static int aesbs_expand_key(struct aesbs_ctx *ctx, const u8 *in_key,
+			    unsigned int key_len, u32 *flags)
+{
+	if (crypto_aes_expand_key(&ctx->key, in_key, key_len)) {
+		*flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	ctx->rounds = 6 + key_len / 4;
+	aesbs_convert_key(ctx);
+	return 0;
+}
+
+static int aesbs_setkey(struct crypto_tfm *tfm, const u8 *in_key,
+			unsigned int key_len)
+{
+	return aesbs_expand_key(crypto_tfm_ctx(tfm), in_key, key_len,
+				&tfm->crt_flags);
+}
+
+/* Key1 (data) is the first half of the key, Key2 (tweak) the second */
+static int aesbs_xts_setkey(struct crypto_tfm *tfm, const u8 *in_key,
+			    unsigned int key_len)
+{
+	struct aesbs_xts_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	if (key_len % 2 ||
+	    crypto_aes_expand_key(&ctx->tweak, in_key + key_len / 2,
+				  key_len / 2)) {
+		tfm->crt_flags |= CRYPTO_TFM_RES_BAD_KEY_LEN;
+		return -EINVAL;
+	}
+	return aesbs_expand_key(&ctx->data, in_key, key_len / 2,
+				&tfm->crt_flags);
+}
+
+static int ecb_crypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		     struct scatterlist *src, unsigned int nbytes, bool enc)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	bool neon = kernel_neon_allowed();
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_CHUNK);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *s = walk.src.virt.addr, *d = walk.dst.virt.addr;
+
+		if (neon && nbytes >= AESBS_CHUNK) {
+			kernel_neon_begin();
+			do {
+				if (enc)
+					aesbs_encrypt8(ctx->rk, ctx->rounds, d, s);
+				else
+					aesbs_decrypt8(ctx->rk, ctx->rounds, d, s);
+				s += AESBS_CHUNK;
+				d += AESBS_CHUNK;
+			} while ((nbytes -= AESBS_CHUNK) >= AESBS_CHUNK);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			if (enc)
+				aes_arm_encrypt(&ctx->key, d, s);
+			else
+				aes_arm_decrypt(&ctx->key, d, s);
+			s += AES_BLOCK_SIZE;
+			d += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int ecb_encrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return ecb_crypt(desc, dst, src, nbytes, true);
+}
+
+static int ecb_decrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return ecb_crypt(desc, dst, src, nbytes, false);
+}
+
+static int cbc_encrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	struct blkcipher_walk walk;
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt(desc, &walk);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *s = walk.src.virt.addr, *d = walk.dst.virt.addr;
+		u8 *iv = walk.iv;
+
+		do {
+			crypto_xor(iv, s, AES_BLOCK_SIZE);
+			aes_arm_encrypt(&ctx->key, d, iv);
+			memcpy(iv, d, AES_BLOCK_SIZE);
+			s += AES_BLOCK_SIZE;
+			d += AES_BLOCK_SIZE;
+		} while ((nbytes -= AES_BLOCK_SIZE) >= AES_BLOCK_SIZE);
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+/*
+ * Everything goes through buf so that in-place requests still see the
+ * ciphertext they need to XOR with.
+ */
+static int cbc_decrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	bool neon = kernel_neon_allowed();
+	struct blkcipher_walk walk;
+	u32 buf[AESBS_CHUNK / sizeof(u32)];
+	int err;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_CHUNK);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *s = walk.src.virt.addr, *d = walk.dst.virt.addr;
+		u8 *iv = walk.iv;
+
+		if (neon && nbytes >= AESBS_CHUNK) {
+			kernel_neon_begin();
+			do {
+				aesbs_decrypt8(ctx->rk, ctx->rounds, (u8 *)buf, s);
+				crypto_xor((u8 *)buf, iv, AES_BLOCK_SIZE);
+				crypto_xor((u8 *)buf + AES_BLOCK_SIZE, s,
+					   AESBS_CHUNK - AES_BLOCK_SIZE);
+				memcpy(iv, s + AESBS_CHUNK - AES_BLOCK_SIZE,
+				       AES_BLOCK_SIZE);
+				memcpy(d, buf, AESBS_CHUNK);
+				s += AESBS_CHUNK;
+				d += AESBS_CHUNK;
+			} while ((nbytes -= AESBS_CHUNK) >= AESBS_CHUNK);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			aes_arm_decrypt(&ctx->key, (u8 *)buf, s);
+			crypto_xor((u8 *)buf, iv, AES_BLOCK_SIZE);
+			memcpy(iv, s, AES_BLOCK_SIZE);
+			memcpy(d, buf, AES_BLOCK_SIZE);
+			s += AES_BLOCK_SIZE;
+			d += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int ctr_crypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		     struct scatterlist *src, unsigned int nbytes)
+{
+	struct aesbs_ctx *ctx = crypto_blkcipher_ctx(desc->tfm);
+	bool neon = kernel_neon_allowed();
+	struct blkcipher_walk walk;
+	u32 ks[AESBS_CHUNK / sizeof(u32)];
+	u8 *ctr;
+	int err, i;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_CHUNK);
+	ctr = walk.iv;
+
+	while ((nbytes = walk.nbytes) >= AES_BLOCK_SIZE) {
+		u8 *s = walk.src.virt.addr, *d = walk.dst.virt.addr;
+
+		if (neon && nbytes >= AESBS_CHUNK) {
+			kernel_neon_begin();
+			do {
+				for (i = 0; i < AESBS_BLOCKS; i++) {
+					memcpy((u8 *)ks + i * AES_BLOCK_SIZE,
+					       ctr, AES_BLOCK_SIZE);
+					crypto_inc(ctr, AES_BLOCK_SIZE);
+				}
+				aesbs_encrypt8(ctx->rk, ctx->rounds, (u8 *)ks,
+					       (u8 *)ks);
+				if (d != s)
+					memcpy(d, s, AESBS_CHUNK);
+				crypto_xor(d, (u8 *)ks, AESBS_CHUNK);
+				s += AESBS_CHUNK;
+				d += AESBS_CHUNK;
+			} while ((nbytes -= AESBS_CHUNK) >= AESBS_CHUNK);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			aes_arm_encrypt(&ctx->key, (u8 *)ks, ctr);
+			crypto_inc(ctr, AES_BLOCK_SIZE);
+			if (d != s)
+				memcpy(d, s, AES_BLOCK_SIZE);
+			crypto_xor(d, (u8 *)ks, AES_BLOCK_SIZE);
+			s += AES_BLOCK_SIZE;
+			d += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+
+	/* Final partial block */
+	if (walk.nbytes) {
+		nbytes = walk.nbytes;
+		aes_arm_encrypt(&ctx->key, (u8 *)ks, ctr);
+		crypto_inc(ctr, AES_BLOCK_SIZE);
+		if (walk.dst.virt.addr != walk.src.virt.addr)
+			memcpy(walk.dst.virt.addr, walk.src.virt.addr, nbytes);
+		crypto_xor(walk.dst.virt.addr, (u8 *)ks, nbytes);
+		err = blkcipher_walk_done(desc, &walk, 0);
+	}
+	return err;
+}
+
+static int xts_crypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		     struct scatterlist *src, unsigned int nbytes, bool enc)
+{
+	struct aesbs_xts_ctx *xctx = crypto_blkcipher_ctx(desc->tfm);
+	struct aesbs_ctx *ctx = &xctx->data;
+	bool neon = kernel_neon_allowed();
+	struct blkcipher_walk walk;
+	u32 buf[AESBS_CHUNK / sizeof(u32)];
+	be128 t[AESBS_BLOCKS];
+	int err, i;
+
+	blkcipher_walk_init(&walk, dst, src, nbytes);
+	err = blkcipher_walk_virt_block(desc, &walk, AESBS_CHUNK);
+	if (!walk.nbytes)
+		return err;
+
+	/* T = E(Key2, IV), then T * x for every block */
+	aes_arm_encrypt(&xctx->tweak, walk.iv, walk.iv);
+	memcpy(&t[0], walk.iv, AES_BLOCK_SIZE);
+
+	while ((nbytes = walk.nbytes)) {
+		u8 *s = walk.src.virt.addr, *d = walk.dst.virt.addr;
+
+		if (neon && nbytes >= AESBS_CHUNK) {
+			kernel_neon_begin();
+			do {
+				for (i = 1; i < AESBS_BLOCKS; i++)
+					gf128mul_x_ble(&t[i], &t[i - 1]);
+				memcpy(buf, s, AESBS_CHUNK);
+				crypto_xor((u8 *)buf, (u8 *)t, AESBS_CHUNK);
+				if (enc)
+					aesbs_encrypt8(ctx->rk, ctx->rounds,
+						       (u8 *)buf, (u8 *)buf);
+				else
+					aesbs_decrypt8(ctx->rk, ctx->rounds,
+						       (u8 *)buf, (u8 *)buf);
+				crypto_xor((u8 *)buf, (u8 *)t, AESBS_CHUNK);
+				memcpy(d, buf, AESBS_CHUNK);
+				gf128mul_x_ble(&t[0], &t[AESBS_BLOCKS - 1]);
+				s += AESBS_CHUNK;
+				d += AESBS_CHUNK;
+			} while ((nbytes -= AESBS_CHUNK) >= AESBS_CHUNK);
+			kernel_neon_end();
+		}
+		for (; nbytes >= AES_BLOCK_SIZE; nbytes -= AES_BLOCK_SIZE) {
+			memcpy(buf, s, AES_BLOCK_SIZE);
+			crypto_xor((u8 *)buf, (u8 *)t, AES_BLOCK_SIZE);
+			if (enc)
+				aes_arm_encrypt(&ctx->key, (u8 *)buf, (u8 *)buf);
+			else
+				aes_arm_decrypt(&ctx->key, (u8 *)buf, (u8 *)buf);
+			crypto_xor((u8 *)buf, (u8 *)t, AES_BLOCK_SIZE);
+			memcpy(d, buf, AES_BLOCK_SIZE);
+			gf128mul_x_ble(&t[0], &t[0]);
+			s += AES_BLOCK_SIZE;
+			d += AES_BLOCK_SIZE;
+		}
+		err = blkcipher_walk_done(desc, &walk, nbytes);
+	}
+	return err;
+}
+
+static int xts_encrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, true);
+}
+
+static int xts_decrypt(struct blkcipher_desc *desc, struct scatterlist *dst,
+		       struct scatterlist *src, unsigned int nbytes)
+{
+	return xts_crypt(desc, dst, src, nbytes, false);
+}
+
+static struct crypto_alg aesbs_algs[] = { {
+	.cra_name		= "ecb(aes)",
+	.cra_driver_name	= "ecb-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.setkey		= aesbs_setkey,
+			.encrypt	= ecb_encrypt,
+			.decrypt	= ecb_decrypt,
+		},
+	},
+}, {
+	.cra_name		= "cbc(aes)",
+	.cra_driver_name	= "cbc-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_setkey,
+			.encrypt	= cbc_encrypt,
+			.decrypt	= cbc_decrypt,
+		},
+	},
+}, {
+	.cra_name		= "ctr(aes)",
+	.cra_driver_name	= "ctr-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= 1,
+	.cra_ctxsize		= sizeof(struct aesbs_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= AES_MIN_KEY_SIZE,
+			.max_keysize	= AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_setkey,
+			.encrypt	= ctr_crypt,
+			.decrypt	= ctr_crypt,
+		},
+	},
+}, {
+	.cra_name		= "xts(aes)",
+	.cra_driver_name	= "xts-aes-neonbs",
+	.cra_priority		= 300,
+	.cra_flags		= CRYPTO_ALG_TYPE_BLKCIPHER,
+	.cra_blocksize		= AES_BLOCK_SIZE,
+	.cra_ctxsize		= sizeof(struct aesbs_xts_ctx),
+	.cra_alignmask		= 3,
+	.cra_type		= &crypto_blkcipher_type,
+	.cra_module		= THIS_MODULE,
+	.cra_u = {
+		.blkcipher = {
+			.min_keysize	= 2 * AES_MIN_KEY_SIZE,
+			.max_keysize	= 2 * AES_MAX_KEY_SIZE,
+			.ivsize		= AES_BLOCK_SIZE,
+			.setkey		= aesbs_xts_setkey,
+			.encrypt	= xts_encrypt,
+			.decrypt	= xts_decrypt,
+		},
+	},
+} };
+
+static int __init aesbs_mod_init(void)
+{
+	int i, err;
+
+	if (!cpu_has_neon())
+		return -ENODEV;
+
+	for (i = 0; i < ARRAY_SIZE(aesbs_algs); i++) {
+		err = crypto_register_alg(&aesbs_algs[i]);
+		if (err)
+			goto unregister;
+	}
+	return 0;
+
+unregister:
+	while (--i >= 0)
+		crypto_unregister_alg(&aesbs_algs[i]);
+	return err;
+}
+
+static void __exit aesbs_mod_exit(void)
+{
+	int i;
+
+	for (i = ARRAY_SIZE(aesbs_algs) - 1; i >= 0; i--)
+		crypto_unregister_alg(&aesbs_algs[i]);
+}
+
+module_init(aesbs_mod_init);
+module_exit(aesbs_mod_exit);
+
+MODULE_DESCRIPTION("Bit-sliced AES using NEON (ECB, CBC, CTR, XTS)");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("ecb(aes)");
+MODULE_ALIAS("cbc(aes)");
+MODULE_ALIAS("ctr(aes)");
+MODULE_ALIAS("xts(aes)");
@@ -0,0 +1,382 @@
+/*
+ * linux/arch/arm/crypto/aesbs_neon.c
+ *
+ * Bit-sliced AES for NEON, eight blocks at a time
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * The eight blocks are transposed into eight 128-bit planes: byte j of
+ * plane i holds bit i of byte j of every block, block k in bit k.
+ * SubBytes then becomes a fixed circuit of 32 ANDs and 83 XORs on whole
+ * planes (Boyar and Peralta's depth-16 circuit), ShiftRows a byte shuffle
+ * of each plane and MixColumns shifts within 32-bit lanes, so there are
+ * no table lookups and no data dependent timing at all.
+ *
+ * The S-box affine constant 0x63 commutes with ShiftRows and
+ * (Inv)MixColumns, so instead of complementing four planes in every
+ * round it is folded into round keys 1..Nr by aesbs_convert_key() in the
+ * glue code; both directions use that one schedule.  The inverse S-box
+ * is the forward circuit wrapped in the inverse affine map.
+ *
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see aesbs_glue.c.
+ */
+
+#include <arm_neon.h>
+
+#include "aesbs_neon.h"
+
+/* ShiftRows and its inverse, as vtbl indices for the two halves */
+static const uint8_t sr_idx[16] = {
+	0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12, 1, 6, 11
+};
+
+static const uint8_t isr_idx[16] = {
+	0, 13, 10, 7, 4, 1, 14, 11, 8, 5, 2, 15, 12, 9, 6, 3
+};
+
+static inline uint8x16_t swapmove(uint8x16_t *a, uint8x16_t b, int n,
+				  uint8_t m)
+{
+	uint8x16_t t;
+
+	t = vandq_u8(veorq_u8(vshrq_n_u8(*a, n), b), vdupq_n_u8(m));
+	*a = veorq_u8(*a, vshlq_n_u8(t, n));
+	return veorq_u8(b, t);
+}
+
+/*
+ * 8x8 bit transpose of every byte position across the eight vectors;
+ * it is its own inverse, so it converts both into and out of planes.
+ */
+static inline void transpose(uint8x16_t q[8])
+{
+	q[1] = swapmove(&q[0], q[1], 1, 0x55);
+	q[3] = swapmove(&q[2], q[3], 1, 0x55);
+	q[5] = swapmove(&q[4], q[5], 1, 0x55);
+	q[7] = swapmove(&q[6], q[7], 1, 0x55);
+	q[2] = swapmove(&q[0], q[2], 2, 0x33);
+	q[3] = swapmove(&q[1], q[3], 2, 0x33);
+	q[6] = swapmove(&q[4], q[6], 2, 0x33);
+	q[7] = swapmove(&q[5], q[7], 2, 0x33);
+	q[4] = swapmove(&q[0], q[4], 4, 0x0f);
+	q[5] = swapmove(&q[1], q[5], 4, 0x0f);
+	q[6] = swapmove(&q[2], q[6], 4, 0x0f);
+	q[7] = swapmove(&q[3], q[7], 4, 0x0f);
+}
+
+/* The S-box without its affine constant, which lives in the round keys */
+static inline void sub_bytes(uint8x16_t q[8])
+{
+	uint8x16_t x0, x1, x2, x3, x4, x5, x6, x7;
+	uint8x16_t y1, y2, y3, y4, y5, y6, y7, y8, y9, y10, y11, y12, y13, y14,
+		   y15, y16, y17, y18, y19, y20, y21;
+	uint8x16_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9, t10, t11, t12, t13,
+		   t14, t15, t16, t17, t18, t19, t20, t21, t22, t23, t24, t25,
+		   t26, t27, t28, t29, t30, t31, t32, t33, t34, t35, t36, t37,
+		   t38, t39, t40, t41, t42, t43, t44, t45, t46, t47, t48, t49,
+		   t50, t51, t52, t53, t54, t55, t56, t57, t58, t59, t60, t61,
+		   t62, t63, t64, t65, t66, t67;
+	uint8x16_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9, z10, z11, z12, z13,
+		   z14, z15, z16, z17;
+	uint8x16_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+	x0 = q[7];
+	x1 = q[6];
+	x2 = q[5];
+	x3 = q[4];
+	x4 = q[3];
+	x5 = q[2];
+	x6 = q[1];
+	x7 = q[0];
+	y14 = veorq_u8(x3, x5);
+	y13 = veorq_u8(x0, x6);
+	y9 = veorq_u8(x0, x3);
+	y8 = veorq_u8(x0, x5);
+	t0 = veorq_u8(x1, x2);
+	y1 = veorq_u8(t0, x7);
+	y4 = veorq_u8(y1, x3);
+	y12 = veorq_u8(y13, y14);
+	y2 = veorq_u8(y1, x0);
+	y5 = veorq_u8(y1, x6);
+	y3 = veorq_u8(y5, y8);
+	t1 = veorq_u8(x4, y12);
+	y15 = veorq_u8(t1, x5);
+	y20 = veorq_u8(t1, x1);
+	y6 = veorq_u8(y15, x7);
+	y10 = veorq_u8(y15, t0);
+	y11 = veorq_u8(y20, y9);
+	y7 = veorq_u8(x7, y11);
+	y17 = veorq_u8(y10, y11);
+	y19 = veorq_u8(y10, y8);
+	y16 = veorq_u8(t0, y11);
+	y21 = veorq_u8(y13, y16);
+	y18 = veorq_u8(x0, y16);
+	t2 = vandq_u8(y12, y15);
+	t3 = vandq_u8(y3, y6);
+	t4 = veorq_u8(t3, t2);
+	t5 = vandq_u8(y4, x7);
+	t6 = veorq_u8(t5, t2);
+	t7 = vandq_u8(y13, y16);
+	t8 = vandq_u8(y5, y1);
+	t9 = veorq_u8(t8, t7);
+	t10 = vandq_u8(y2, y7);
+	t11 = veorq_u8(t10, t7);
+	t12 = vandq_u8(y9, y11);
+	t13 = vandq_u8(y14, y17);
+	t14 = veorq_u8(t13, t12);
+	t15 = vandq_u8(y8, y10);
+	t16 = veorq_u8(t15, t12);
+	t17 = veorq_u8(t4, t14);
+	t18 = veorq_u8(t6, t16);
+	t19 = veorq_u8(t9, t14);
+	t20 = veorq_u8(t11, t16);
+	t21 = veorq_u8(t17, y20);
+	t22 = veorq_u8(t18, y19);
+	t23 = veorq_u8(t19, y21);
+	t24 = veorq_u8(t20, y18);
+	t25 = veorq_u8(t21, t22);
+	t26 = vandq_u8(t21, t23);
+	t27 = veorq_u8(t24, t26);
+	t28 = vandq_u8(t25, t27);
+	t29 = veorq_u8(t28, t22);
+	t30 = veorq_u8(t23, t24);
+	t31 = veorq_u8(t22, t26);
+	t32 = vandq_u8(t31, t30);
+	t33 = veorq_u8(t32, t24);
+	t34 = veorq_u8(t23, t33);
+	t35 = veorq_u8(t27, t33);
+	t36 = vandq_u8(t24, t35);
+	t37 = veorq_u8(t36, t34);
+	t38 = veorq_u8(t27, t36);
+	t39 = vandq_u8(t29, t38);
+	t40 = veorq_u8(t25, t39);
+	t41 = veorq_u8(t40, t37);
+	t42 = veorq_u8(t29, t33);
+	t43 = veorq_u8(t29, t40);
+	t44 = veorq_u8(t33, t37);
+	t45 = veorq_u8(t42, t41);
+	z0 = vandq_u8(t44, y15);
+	z1 = vandq_u8(t37, y6);
+	z2 = vandq_u8(t33, x7);
+	z3 = vandq_u8(t43, y16);
+	z4 = vandq_u8(t40, y1);
+	z5 = vandq_u8(t29, y7);
+	z6 = vandq_u8(t42, y11);
+	z7 = vandq_u8(t45, y17);
+	z8 = vandq_u8(t41, y10);
+	z9 = vandq_u8(t44, y12);
+	z10 = vandq_u8(t37, y3);
+	z11 = vandq_u8(t33, y4);
+	z12 = vandq_u8(t43, y13);
+	z13 = vandq_u8(t40, y5);
+	z14 = vandq_u8(t29, y2);
+	z15 = vandq_u8(t42, y9);
+	z16 = vandq_u8(t45, y14);
+	z17 = vandq_u8(t41, y8);
+	t46 = veorq_u8(z15, z16);
+	t47 = veorq_u8(z10, z11);
+	t48 = veorq_u8(z5, z13);
+	t49 = veorq_u8(z9, z10);
+	t50 = veorq_u8(z2, z12);
+	t51 = veorq_u8(z2, z5);
+	t52 = veorq_u8(z7, z8);
+	t53 = veorq_u8(z0, z3);
+	t54 = veorq_u8(z6, z7);
+	t55 = veorq_u8(z16, z17);
+	t56 = veorq_u8(z12, t48);
+	t57 = veorq_u8(t50, t53);
+	t58 = veorq_u8(z4, t46);
+	t59 = veorq_u8(z3, t54);
+	t60 = veorq_u8(t46, t57);
+	t61 = veorq_u8(z14, t57);
+	t62 = veorq_u8(t52, t58);
+	t63 = veorq_u8(t49, t58);
+	t64 = veorq_u8(z4, t59);
+	t65 = veorq_u8(t61, t62);
+	t66 = veorq_u8(z1, t63);
+	s0 = veorq_u8(t59, t63);
+	s6 = veorq_u8(t56, t62);
+	s7 = veorq_u8(t48, t60);
+	t67 = veorq_u8(t64, t65);
+	s3 = veorq_u8(t53, t66);
+	s4 = veorq_u8(t51, t66);
+	s5 = veorq_u8(t47, t65);
+	s1 = veorq_u8(t64, s3);
+	s2 = veorq_u8(t55, t67);
+	q[7] = s0;
+	q[6] = s1;
+	q[5] = s2;
+	q[4] = s3;
+	q[3] = s4;
+	q[2] = s5;
+	q[1] = s6;
+	q[0] = s7;
+}
+
+/* Inverse of the linear part of the S-box affine map */
+static inline void inv_affine(uint8x16_t q[8])
+{
+	uint8x16_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	uint8x16_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+
+	q[7] = veorq_u8(veorq_u8(q1, q4), q6);
+	q[6] = veorq_u8(veorq_u8(q0, q3), q5);
+	q[5] = veorq_u8(veorq_u8(q7, q2), q4);
+	q[4] = veorq_u8(veorq_u8(q6, q1), q3);
+	q[3] = veorq_u8(veorq_u8(q5, q0), q2);
+	q[2] = veorq_u8(veorq_u8(q4, q7), q1);
+	q[1] = veorq_u8(veorq_u8(q3, q6), q0);
+	q[0] = veorq_u8(veorq_u8(q2, q5), q7);
+}
+
+static inline void inv_sub_bytes(uint8x16_t q[8])
+{
+	inv_affine(q);
+	sub_bytes(q);
+	inv_affine(q);
+}
+
+static inline void shuffle(uint8x16_t q[8], const uint8_t *idx)
+{
+	uint8x8_t lo = vld1_u8(idx), hi = vld1_u8(idx + 8);
+	uint8x8x2_t t;
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		t.val[0] = vget_low_u8(q[i]);
+		t.val[1] = vget_high_u8(q[i]);
+		q[i] = vcombine_u8(vtbl2_u8(t, lo), vtbl2_u8(t, hi));
+	}
+}
+
+/* Row r of a column takes row r + n, i.e. rotate each 32-bit lane */
+static inline uint8x16_t rot_rows1(uint8x16_t x)
+{
+	uint32x4_t v = vreinterpretq_u32_u8(x);
+
+	return vreinterpretq_u8_u32(vsriq_n_u32(vshlq_n_u32(v, 24), v, 8));
+}
+
+static inline uint8x16_t rot_rows2(uint8x16_t x)
+{
+	return vreinterpretq_u8_u16(vrev32q_u16(vreinterpretq_u16_u8(x)));
+}
+
+/* Multiply every byte by x modulo x^8 + x^4 + x^3 + x + 1 */
+static inline void xtime(uint8x16_t q[8])
+{
+	uint8x16_t hi = q[7];
+
+	q[7] = q[6];
+	q[6] = q[5];
+	q[5] = q[4];
+	q[4] = veorq_u8(q[3], hi);
+	q[3] = veorq_u8(q[2], hi);
+	q[2] = q[1];
+	q[1] = veorq_u8(q[0], hi);
+	q[0] = hi;
+}
+
+/* out[r] = 2 a[r] ^ 3 a[r + 1] ^ a[r + 2] ^ a[r + 3] */
+static inline void mix_columns(uint8x16_t q[8])
+{
+	uint8x16_t r1[8], t[8];
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		r1[i] = rot_rows1(q[i]);
+		t[i] = veorq_u8(q[i], r1[i]);
+	}
+	for (i = 0; i < 8; i++)
+		q[i] = veorq_u8(r1[i], rot_rows2(t[i]));
+	xtime(t);
+	for (i = 0; i < 8; i++)
+		q[i] = veorq_u8(q[i], t[i]);
+}
+
+/*
+ * InvMixColumns is MixColumns after a[r] ^= 4 (a[r] ^ a[r + 2]), which
+ * saves spelling out the 9, 11, 13 and 14 multiples.
+ */
+static inline void inv_mix_columns(uint8x16_t q[8])
+{
+	uint8x16_t t[8];
+	int i;
+
+	for (i = 0; i < 8; i++)
+		t[i] = veorq_u8(q[i], rot_rows2(q[i]));
+	xtime(t);
+	xtime(t);
+	for (i = 0; i < 8; i++)
+		q[i] = veorq_u8(q[i], t[i]);
+	mix_columns(q);
+}
+
+static inline void add_round_key(uint8x16_t q[8], const uint8_t *rk)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] = veorq_u8(q[i], vld1q_u8(rk + 16 * i));
+}
+
+static inline void load8(uint8x16_t q[8], const uint8_t *in)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] = vld1q_u8(in + 16 * i);
+	transpose(q);
+}
+
+static inline void store8(uint8x16_t q[8], uint8_t *out)
+{
+	int i;
+
+	transpose(q);
+	for (i = 0; i < 8; i++)
+		vst1q_u8(out + 16 * i, q[i]);
+}
+
+void aesbs_encrypt8(const uint8_t *rk, int rounds, uint8_t *out,
+		    const uint8_t *in)
+{
+	uint8x16_t q[8];
+	int r;
+
+	load8(q, in);
+	add_round_key(q, rk);
+	for (r = 1; r < rounds; r++) {
+		sub_bytes(q);
+		shuffle(q, sr_idx);
+		mix_columns(q);
+		add_round_key(q, rk + AESBS_ROUND_KEY_SIZE * r);
+	}
+	sub_bytes(q);
+	shuffle(q, sr_idx);
+	add_round_key(q, rk + AESBS_ROUND_KEY_SIZE * rounds);
+	store8(q, out);
+}
+
+void aesbs_decrypt8(const uint8_t *rk, int rounds, uint8_t *out,
+		    const uint8_t *in)
+{
+	uint8x16_t q[8];
+	int r;
+
+	load8(q, in);
+	add_round_key(q, rk + AESBS_ROUND_KEY_SIZE * rounds);
+	for (r = rounds - 1; r > 0; r--) {
+		shuffle(q, isr_idx);
+		inv_sub_bytes(q);
+		add_round_key(q, rk + AESBS_ROUND_KEY_SIZE * r);
+		inv_mix_columns(q);
+	}
+	shuffle(q, isr_idx);
+	inv_sub_bytes(q);
+	add_round_key(q, rk);
+	store8(q, out);
+}
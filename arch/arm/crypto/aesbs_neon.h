@@ -0,0 +1,14 @@
+#ifndef _ARM_CRYPTO_AESBS_NEON_H
+#define _ARM_CRYPTO_AESBS_NEON_H
+
+/* Eight planes of 16 bytes for each of the rounds + 1 round keys */
+#define AESBS_ROUND_KEY_SIZE	128
+#define AESBS_BLOCKS		8
+
+/* aesbs_neon.c: eight contiguous blocks, in and out may overlap exactly */
+void aesbs_encrypt8(const uint8_t *rk, int rounds, uint8_t *out,
+		    const uint8_t *in);
+void aesbs_decrypt8(const uint8_t *rk, int rounds, uint8_t *out,
+		    const uint8_t *in);
+
+#endif
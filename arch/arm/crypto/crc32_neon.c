@@ -0,0 +1,129 @@
+/*
+ * linux/arch/arm/crypto/crc32_neon.c
+ *
+ * Reflected CRC32 folding with NEON, without a 64 bit carry-less multiply
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Sixteen bytes of message X, the first eight bytes being the higher
+ * order half H, stand for H x^64 + L.  Appending 8D bytes multiplies that
+ * by x^8D, and since only the value mod P matters,
+ *
+ *	X x^8D = H (x^(8D+64) mod P) + L (x^8D mod P)
+ *
+ * which is a 96 bit product that again fits 16 bytes.  Four running
+ * blocks are folded across 64 bytes at a time like this and then into
+ * each other, and the table code in lib/crc32.c reduces the last one.
+ *
+ * ARMv7 has no 64 bit polynomial multiply, only vmull.p8, which forms
+ * eight 8x8 bit products at once.  Multiplying all eight bytes of H by
+ * byte j of a constant gives partial products that belong 8(i + j) bits
+ * up for byte i; the low bytes of those are added together as they lie,
+ * the high bytes one byte further up.  With bit reflection the constants
+ * lose their x^1 factor, which is why they are x^(8D+63) and x^(8D-1),
+ * and the 95 bit sum lands 32 bits up in the 128 bit result.
+ *
+ * This file is built with -mfpu=neon and must only be called between
+ * kernel_neon_begin() and kernel_neon_end(), see crc32c_neon_glue.c.
+ */
+
+#include <arm_neon.h>
+
+#include "crc32_neon.h"
+
+/* Each byte of a pair of fold constants, duplicated across a register */
+struct fold_k {
+	poly8x8_t	h[4];
+	poly8x8_t	l[4];
+};
+
+static inline void load_k(struct fold_k *fk, const uint32_t *k)
+{
+	int j;
+
+	for (j = 0; j < 4; j++) {
+		fk->h[j] = vdup_n_p8(k[0] >> (8 * j));
+		fk->l[j] = vdup_n_p8(k[1] >> (8 * j));
+	}
+}
+
+static inline uint8x16_t fold(uint8x16_t x, const struct fold_k *fk)
+{
+	static const int64_t shl[4] = { 32, 40, 48, 56 };
+	static const int64_t shr[4] = { -32, -24, -16, -8 };
+	poly8x8_t h = vreinterpret_p8_u8(vget_low_u8(x));
+	poly8x8_t l = vreinterpret_p8_u8(vget_high_u8(x));
+	uint16x8_t p[4];
+	uint8x8_t s0, s1, s2, s3, s4;
+	uint64x2_t s01, s23, lo, hi;
+	int j;
+
+	/* p[j], lane i: bytes i of H and L times byte j of the constants */
+	for (j = 0; j < 4; j++)
+		p[j] = veorq_u16(vreinterpretq_u16_p16(vmull_p8(h, fk->h[j])),
+				 vreinterpretq_u16_p16(vmull_p8(l, fk->l[j])));
+
+	/* s_k: everything that belongs 8k bits up, one byte per lane */
+	s0 = vmovn_u16(p[0]);
+	s1 = veor_u8(vmovn_u16(p[1]), vshrn_n_u16(p[0], 8));
+	s2 = veor_u8(vmovn_u16(p[2]), vshrn_n_u16(p[1], 8));
+	s3 = veor_u8(vmovn_u16(p[3]), vshrn_n_u16(p[2], 8));
+	s4 = vshrn_n_u16(p[3], 8);
+
+	/* the sum of s_k << (32 + 8k), as two 64 bit halves */
+	s01 = vreinterpretq_u64_u8(vcombine_u8(s0, s1));
+	s23 = vreinterpretq_u64_u8(vcombine_u8(s2, s3));
+	lo = veorq_u64(vshlq_u64(s01, vld1q_s64(shl)),
+		       vshlq_u64(s23, vld1q_s64(shl + 2)));
+	hi = veorq_u64(vshlq_u64(s01, vld1q_s64(shr)),
+		       vshlq_u64(s23, vld1q_s64(shr + 2)));
+
+	return vreinterpretq_u8_u64(vcombine_u64(
+			veor_u64(vget_low_u64(lo), vget_high_u64(lo)),
+			veor_u64(veor_u64(vget_low_u64(hi), vget_high_u64(hi)),
+				 vreinterpret_u64_u8(s4))));
+}
+
+void crc32_neon_fold(const struct crc32_neon_consts *k, uint32_t crc,
+		     const uint8_t *in, unsigned int len, uint8_t *out)
+{
+	struct fold_k fk;
+	uint8x16_t x0, x1, x2, x3;
+
+	x0 = veorq_u8(vld1q_u8(in),
+		      vreinterpretq_u8_u32(vsetq_lane_u32(crc,
+						vdupq_n_u32(0), 0)));
+	x1 = vld1q_u8(in + 16);
+	x2 = vld1q_u8(in + 32);
+	x3 = vld1q_u8(in + 48);
+	in += 64;
+	len -= 64;
+
+	load_k(&fk, k->fold[0]);
+	while (len >= 64) {
+		x0 = veorq_u8(fold(x0, &fk), vld1q_u8(in));
+		x1 = veorq_u8(fold(x1, &fk), vld1q_u8(in + 16));
+		x2 = veorq_u8(fold(x2, &fk), vld1q_u8(in + 32));
+		x3 = veorq_u8(fold(x3, &fk), vld1q_u8(in + 48));
+		in += 64;
+		len -= 64;
+	}
+
+	/* x0..x2 are 48, 32 and 16 bytes ahead of x3 */
+	load_k(&fk, k->fold[1]);
+	x3 = veorq_u8(x3, fold(x0, &fk));
+	load_k(&fk, k->fold[2]);
+	x3 = veorq_u8(x3, fold(x1, &fk));
+	load_k(&fk, k->fold[3]);
+	x3 = veorq_u8(x3, fold(x2, &fk));
+
+	while (len >= 16) {
+		x3 = veorq_u8(fold(x3, &fk), vld1q_u8(in));
+		in += 16;
+		len -= 16;
+	}
+
+	vst1q_u8(out, x3);
+}
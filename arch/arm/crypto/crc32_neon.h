@@ -0,0 +1,22 @@
+#ifndef _ARM_CRYPTO_CRC32_NEON_H
+#define _ARM_CRYPTO_CRC32_NEON_H
+
+/*
+ * Fold constants for one reflected polynomial: for each distance D of
+ * 64, 48, 32 and 16 bytes, x^(8D+63) and x^(8D-1) mod P, bit reflected.
+ */
+struct crc32_neon_consts {
+	uint32_t fold[4][2];
+};
+
+#define CRC32_NEON_MIN_LEN	64
+
+/*
+ * crc32_neon.c: folds @len bytes at @in (a multiple of 16, at least
+ * CRC32_NEON_MIN_LEN) with the running CRC @crc into 16 bytes at @out,
+ * whose CRC from a seed of 0 is the CRC of the whole.
+ */
+void crc32_neon_fold(const struct crc32_neon_consts *k, uint32_t crc,
+		     const uint8_t *in, unsigned int len, uint8_t *out);
+
+#endif
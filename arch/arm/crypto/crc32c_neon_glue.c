@@ -0,0 +1,296 @@
+/*
+ * linux/arch/arm/crypto/crc32c_neon_glue.c
+ *
+ * Glue code for CRC32c (Castagnoli) folding with NEON
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * crc32_neon.c reduces runs of 64 bytes or more to 16 bytes inside a
+ * kernel_neon_begin()/kernel_neon_end() section, a page at a time so that
+ * preemption is never held off for long.  The slice by 8 code in
+ * lib/crc32.c does the rest, and everything for short buffers and for
+ * callers in interrupt context.
+ *
+ * vmull.p8 folding does much more work per byte than the tables, so
+ * whether it wins depends on the core.  At load time the folding is
+ * checked against the tables, then both are timed on buffers from 64
+ * bytes to 64KB and NEON is used from the shortest length where it
+ * stays ahead.  If it never does, the driver is not registered at all.
+ */
+
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/crc32.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <crypto/internal/hash.h>
+#include <asm/neon.h>
+
+#include "crc32_neon.h"
+
+#define CHKSUM_BLOCK_SIZE	1
+#define CHKSUM_DIGEST_SIZE	4
+
+#define CRC32C_NEON_CHUNK	PAGE_SIZE
+#define CRC32C_TEST_SIZE	(64 << 10)
+#define CRC32C_TEST_CASES	1000
+#define CRC32C_BENCH_BYTES	(1 << 20)
+
+static struct crc32_neon_consts crc32c_consts;
+
+/* keeps the timing loops from being optimised away */
+static volatile u32 crc32c_sink __initdata;
+
+static unsigned int min_len;
+module_param(min_len, uint, 0444);
+MODULE_PARM_DESC(min_len, "Shortest buffer to fold with NEON "
+		 "(default: measured at load time)");
+
+static u32 crc32c_neon(u32 crc, const u8 *data, unsigned int len)
+{
+	u8 folded[16];
+	unsigned int n;
+
+	if (len < min_len || !kernel_neon_allowed())
+		return __crc32c_le(crc, data, len);
+
+	while (len >= CRC32_NEON_MIN_LEN) {
+		n = min_t(unsigned int, len, CRC32C_NEON_CHUNK) & ~15;
+		kernel_neon_begin();
+		crc32_neon_fold(&crc32c_consts, crc, data, n, folded);
+		kernel_neon_end();
+		crc = __crc32c_le(0, folded, sizeof(folded));
+		data += n;
+		len -= n;
+	}
+	return __crc32c_le(crc, data, len);
+}
+
+/*
+ * Setting the seed allows arbitrary accumulators and flexible XOR policy
+ * If your algorithm starts with ~0, then XOR with ~0 before you set
+ * the seed.
+ */
+static int crc32c_neon_setkey(struct crypto_shash *hash, const u8 *key,
+			      unsigned int keylen)
+{
+	u32 *mctx = crypto_shash_ctx(hash);
+
+	if (keylen != sizeof(u32)) {
+		crypto_shash_set_flags(hash, CRYPTO_TFM_RES_BAD_KEY_LEN);
+		return -EINVAL;
+	}
+	*mctx = le32_to_cpup((__le32 *)key);
+	return 0;
+}
+
+static int crc32c_neon_init(struct shash_desc *desc)
+{
+	u32 *mctx = crypto_shash_ctx(desc->tfm);
+	u32 *crcp = shash_desc_ctx(desc);
+
+	*crcp = *mctx;
+	return 0;
+}
+
+static int crc32c_neon_update(struct shash_desc *desc, const u8 *data,
+			      unsigned int len)
+{
+	u32 *crcp = shash_desc_ctx(desc);
+
+	*crcp = crc32c_neon(*crcp, data, len);
+	return 0;
+}
+
+static int __crc32c_neon_finup(u32 *crcp, const u8 *data, unsigned int len,
+			       u8 *out)
+{
+	*(__le32 *)out = ~cpu_to_le32(crc32c_neon(*crcp, data, len));
+	return 0;
+}
+
+static int crc32c_neon_finup(struct shash_desc *desc, const u8 *data,
+			     unsigned int len, u8 *out)
+{
+	return __crc32c_neon_finup(shash_desc_ctx(desc), data, len, out);
+}
+
+static int crc32c_neon_final(struct shash_desc *desc, u8 *out)
+{
+	u32 *crcp = shash_desc_ctx(desc);
+
+	*(__le32 *)out = ~cpu_to_le32p(crcp);
+	return 0;
+}
+
+static int crc32c_neon_digest(struct shash_desc *desc, const u8 *data,
+			      unsigned int len, u8 *out)
+{
+	return __crc32c_neon_finup(crypto_shash_ctx(desc->tfm), data, len,
+				   out);
+}
+
+static int crc32c_neon_cra_init(struct crypto_tfm *tfm)
+{
+	u32 *key = crypto_tfm_ctx(tfm);
+
+	*key = ~0;
+	return 0;
+}
+
+static struct shash_alg alg = {
+	.setkey			=	crc32c_neon_setkey,
+	.init			=	crc32c_neon_init,
+	.update			=	crc32c_neon_update,
+	.final			=	crc32c_neon_final,
+	.finup			=	crc32c_neon_finup,
+	.digest			=	crc32c_neon_digest,
+	.descsize		=	sizeof(u32),
+	.digestsize		=	CHKSUM_DIGEST_SIZE,
+	.base			=	{
+		.cra_name		=	"crc32c",
+		.cra_driver_name	=	"crc32c-neon",
+		.cra_priority		=	200,
+		.cra_blocksize		=	CHKSUM_BLOCK_SIZE,
+		.cra_ctxsize		=	sizeof(u32),
+		.cra_module		=	THIS_MODULE,
+		.cra_init		=	crc32c_neon_cra_init,
+	}
+};
+
+/* x^n mod P, bit reflected like the polynomial */
+static u32 __init xpow_mod(unsigned int n, u32 poly)
+{
+	u32 r = 0x80000000;
+
+	while (n--)
+		r = (r >> 1) ^ ((r & 1) ? poly : 0);
+	return r;
+}
+
+static void __init crc32_neon_init_consts(struct crc32_neon_consts *k,
+					  u32 poly)
+{
+	unsigned int i, bits;
+
+	for (i = 0; i < ARRAY_SIZE(k->fold); i++) {
+		bits = 8 * (64 - 16 * i);
+		k->fold[i][0] = xpow_mod(bits + 63, poly);
+		k->fold[i][1] = xpow_mod(bits - 1, poly);
+	}
+}
+
+static int __init crc32c_neon_selftest(const u8 *buf)
+{
+	unsigned int i, off, len;
+	u32 seed;
+
+	for (i = 0; i < CRC32C_TEST_CASES; i++) {
+		off = random32() % 16;
+		len = random32() % (3 * CRC32C_NEON_CHUNK);
+		seed = random32();
+		if (crc32c_neon(seed, buf + off, len) !=
+		    __crc32c_le(seed, buf + off, len)) {
+			pr_err("crc32c-neon: wrong result for %u bytes at "
+			       "offset %u\n", len, off);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static s64 __init crc32c_time(const u8 *buf, unsigned int len, bool neon)
+{
+	unsigned int n, loops = CRC32C_BENCH_BYTES / len;
+	ktime_t start = ktime_get();
+	u32 crc = 0;
+
+	for (n = 0; n < loops; n++)
+		crc = neon ? crc32c_neon(crc, buf, len) :
+			     __crc32c_le(crc, buf, len);
+	crc32c_sink = crc;
+	return ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/*
+ * Returns the shortest length from which NEON was faster at every size
+ * measured, or 0 if it never was.
+ */
+static unsigned int __init crc32c_neon_calibrate(const u8 *buf)
+{
+	unsigned int len, best = 0;
+	s64 t_neon, t_table;
+	bool lost = false;
+
+	for (len = CRC32C_TEST_SIZE; len >= CRC32_NEON_MIN_LEN; len >>= 2) {
+		t_table = crc32c_time(buf, len, false);
+		t_neon = crc32c_time(buf, len, true);
+		pr_info("crc32c-neon: %5u bytes: table %5llu MB/s, "
+			"neon %5llu MB/s\n", len,
+			t_table ? div64_u64(1000ULL * CRC32C_BENCH_BYTES,
+					    t_table) : 0,
+			t_neon ? div64_u64(1000ULL * CRC32C_BENCH_BYTES,
+					   t_neon) : 0);
+		if (t_neon >= t_table)
+			lost = true;
+		else if (!lost)
+			best = len;
+	}
+	return best;
+}
+
+static int __init crc32c_neon_mod_init(void)
+{
+	unsigned int forced = min_len;
+	u8 *buf;
+	int err;
+
+	if (!cpu_has_neon())
+		return -ENODEV;
+
+	crc32_neon_init_consts(&crc32c_consts, 0x82F63B78);
+
+	buf = vmalloc(CRC32C_TEST_SIZE + 16);
+	if (!buf)
+		return -ENOMEM;
+	get_random_bytes(buf, CRC32C_TEST_SIZE + 16);
+
+	/* fold everything we can while testing and measuring */
+	min_len = CRC32_NEON_MIN_LEN;
+	err = crc32c_neon_selftest(buf);
+	if (!err && !forced) {
+		min_len = crc32c_neon_calibrate(buf);
+		if (!min_len) {
+			pr_info("crc32c-neon: slower than the tables here, "
+				"not registering\n");
+			err = -ENODEV;
+		}
+	} else if (!err) {
+		min_len = max_t(unsigned int, forced, CRC32_NEON_MIN_LEN);
+	}
+	vfree(buf);
+	if (err)
+		return err;
+
+	pr_info("crc32c-neon: folding buffers of %u bytes and more\n",
+		min_len);
+	return crypto_register_shash(&alg);
+}
+
+static void __exit crc32c_neon_mod_fini(void)
+{
+	crypto_unregister_shash(&alg);
+}
+
+module_init(crc32c_neon_mod_init);
+module_exit(crc32c_neon_mod_fini);
+
+MODULE_DESCRIPTION("CRC32c (Castagnoli), NEON folding for long buffers");
+MODULE_LICENSE("GPL");
+MODULE_ALIAS("crc32c");
+MODULE_ALIAS("crc32c-neon");
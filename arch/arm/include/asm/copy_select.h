@@ -0,0 +1,41 @@
+/*
+ *  arch/arm/include/asm/copy_select.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_COPY_SELECT_H
+#define __ASM_ARM_COPY_SELECT_H
+
+/*
+ * How far ahead of the source the Cortex-A9 copies prefetch, in bytes
+ * and a multiple of 32.  The uaccess copies use it too in kernels built
+ * for ARMv7 only.
+ */
+#define A9_PLD_AHEAD		192
+
+/* memcpy() passes copies of this many bytes and more to arm_memcpy_large */
+#define MEMCPY_SELECT_MIN	256
+
+#ifndef __ASSEMBLY__
+#include <linux/types.h>
+
+struct arm_copy_fns {
+	const char	*name;
+	void		*(*memcpy)(void *, const void *, size_t);
+	void		(*copy_page)(void *, const void *);
+};
+
+/* Every variant built in, terminated by an entry without a name */
+extern const struct arm_copy_fns arm_copy_fns[];
+
+/* The variant in use, chosen at boot from the CPU ID */
+extern void *(*arm_memcpy_large)(void *, const void *, size_t);
+extern void (*arm_copy_page)(void *, const void *);
+
+extern void *__memcpy_std(void *, const void *, size_t);
+extern void __copy_page_std(void *, const void *);
+#endif
+
+#endif /* __ASM_ARM_COPY_SELECT_H */
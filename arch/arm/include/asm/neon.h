@@ -0,0 +1,47 @@
+/*
+ *  arch/arm/include/asm/neon.h
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef __ASM_ARM_NEON_H
+#define __ASM_ARM_NEON_H
+
+#include <linux/hardirq.h>
+#include <linux/percpu.h>
+#include <asm/hwcap.h>
+
+#define cpu_has_neon()		(!!(elf_hwcap & HWCAP_NEON))
+
+DECLARE_PER_CPU(int, kernel_neon_active);
+
+/*
+ * NEON may be used from process context only, and kernel mode NEON
+ * sections do not nest; code that can also run from interrupts, or from
+ * within another NEON section (memcpy() for one), must fall back to its
+ * integer version when this is false.  The per-cpu flag is only ever set
+ * with preemption disabled, so reading it unlocked is fine.
+ */
+#define kernel_neon_allowed()	(cpu_has_neon() && !in_interrupt() && \
+				 !__raw_get_cpu_var(kernel_neon_active))
+
+#ifdef __ARM_NEON__
+
+/*
+ * If you are affected by the BUILD_BUG below, it probably means that you
+ * are using NEON code /and/ calling kernel_neon_begin() from the same
+ * compilation unit.  GCC is free to move or generate NEON instructions
+ * anywhere in such a unit, including outside the begin/end pair, so NEON
+ * code must live in its own compilation unit (or assembly file) and be
+ * called from another one between kernel_neon_begin() and
+ * kernel_neon_end().
+ */
+#define kernel_neon_begin()	BUILD_BUG_ON(1)
+
+#else
+extern void kernel_neon_begin(void);
+#endif
+extern void kernel_neon_end(void);
+
+#endif /* __ASM_ARM_NEON_H */
@@ -11,64 +11,75 @@ static inline void dsb_sev(void)
 	__asm__ __volatile__ (
 		"dsb\n"
 		"sev"
+		: : : "memory"
 	);
 #elif defined(CONFIG_CPU_32v6K)
 	__asm__ __volatile__ (
 		"mcr p15, 0, %0, c7, c10, 4\n"
 		"sev"
-		: : "r" (0)
+		: : "r" (0) : "memory"
 	);
 #endif
 }
 
+#ifdef CONFIG_CPU_32v6K
+#define lock_wfe()	__asm__ __volatile__ ("wfe" : : : "memory")
+#else
+#define lock_wfe()	cpu_relax()
+#endif
+
 /*
- * ARMv6 Spin-locking.
+ * ARMv6 ticket-based spin-locking.
  *
- * We exclusively read the old value.  If it is zero, we may have
- * won the lock, so we try exclusively storing it.  A memory barrier
- * is required after we get a lock, and before we release it, because
- * V6 CPUs are assumed to have weakly ordered memory.
+ * A memory barrier is required after we get a lock, and before we
+ * release it, because V6 CPUs are assumed to have weakly ordered
+ * memory.
  *
- * Unlocked value: 0
- * Locked value: 1
+ * The lock word holds two 16-bit counters.  A CPU takes a ticket by
+ * exclusively incrementing "next", then waits in WFE until "owner"
+ * reaches its ticket; unlocking increments "owner" and signals the
+ * waiters with SEV.  Waiters are served in the order they arrived, and
+ * only the unlock writes the line they are all reading.
+ *
+ * Unlocked value: owner == next
  */
 
-#define arch_spin_is_locked(x)		((x)->lock != 0)
-#define arch_spin_unlock_wait(lock) \
-	do { while (arch_spin_is_locked(lock)) cpu_relax(); } while (0)
-
-#define arch_spin_lock_flags(lock, flags) arch_spin_lock(lock)
-
 static inline void arch_spin_lock(arch_spinlock_t *lock)
 {
 	unsigned long tmp;
+	u32 newval;
+	arch_spinlock_t lockval;
 
 	__asm__ __volatile__(
-"1:	ldrex	%0, [%1]\n"
-"	teq	%0, #0\n"
-#ifdef CONFIG_CPU_32v6K
-"	wfene\n"
-#endif
-"	strexeq	%0, %2, [%1]\n"
-"	teqeq	%0, #0\n"
+"1:	ldrex	%0, [%3]\n"
+"	add	%1, %0, %4\n"
+"	strex	%2, %1, [%3]\n"
+"	teq	%2, #0\n"
 "	bne	1b"
-	: "=&r" (tmp)
-	: "r" (&lock->lock), "r" (1)
+	: "=&r" (lockval), "=&r" (newval), "=&r" (tmp)
+	: "r" (&lock->slock), "I" (1 << TICKET_SHIFT)
 	: "cc");
 
+	while (lockval.tickets.next != lockval.tickets.owner) {
+		lock_wfe();
+		lockval.tickets.owner = ACCESS_ONCE(lock->tickets.owner);
+	}
+
 	smp_mb();
 }
 
 static inline int arch_spin_trylock(arch_spinlock_t *lock)
 {
 	unsigned long tmp;
+	u32 slock;
 
 	__asm__ __volatile__(
-"	ldrex	%0, [%1]\n"
-"	teq	%0, #0\n"
-"	strexeq	%0, %2, [%1]"
-	: "=&r" (tmp)
-	: "r" (&lock->lock), "r" (1)
+"	ldrex	%0, [%2]\n"
+"	subs	%1, %0, %0, ror #16\n"
+"	addeq	%0, %0, %3\n"
+"	strexeq	%1, %0, [%2]"
+	: "=&r" (slock), "=&r" (tmp)
+	: "r" (&lock->slock), "I" (1 << TICKET_SHIFT)
 	: "cc");
 
 	if (tmp == 0) {
@@ -82,15 +93,27 @@ static inline int arch_spin_trylock(arch_spinlock_t *lock)
 static inline void arch_spin_unlock(arch_spinlock_t *lock)
 {
 	smp_mb();
+	lock->tickets.owner++;
+	dsb_sev();
+}
 
-	__asm__ __volatile__(
-"	str	%1, [%0]\n"
-	:
-	: "r" (&lock->lock), "r" (0)
-	: "cc");
+static inline int arch_spin_is_locked(arch_spinlock_t *lock)
+{
+	struct __raw_tickets tickets = ACCESS_ONCE(lock->tickets);
+	return tickets.owner != tickets.next;
+}
 
-	dsb_sev();
+static inline int arch_spin_is_contended(arch_spinlock_t *lock)
+{
+	struct __raw_tickets tickets = ACCESS_ONCE(lock->tickets);
+	return (u16)(tickets.next - tickets.owner) > 1;
 }
+#define arch_spin_is_contended	arch_spin_is_contended
+
+#define arch_spin_unlock_wait(lock) \
+	do { while (arch_spin_is_locked(lock)) cpu_relax(); } while (0)
+
+#define arch_spin_lock_flags(lock, flags) arch_spin_lock(lock)
 
 /*
  * RWLOCKS
@@ -98,12 +121,20 @@ static inline void arch_spin_unlock(arch_spinlock_t *lock)
  *
  * Write locks are easy - we just set bit 31.  When unlocking, we can
  * just write zero since the lock is exclusively held.
+ *
+ * Writers first queue on the ticket lock in rw->wait and hold it until
+ * they unlock, so they get the lock in order and only the first of them
+ * polls rw->lock.  Readers do not queue: read_lock() may nest, e.g. from
+ * an interrupt taken while holding a read lock, and must not wait for a
+ * writer queued behind the outer reader.
  */
 
 static inline void arch_write_lock(arch_rwlock_t *rw)
 {
 	unsigned long tmp;
 
+	arch_spin_lock(&rw->wait);
+
 	__asm__ __volatile__(
 "1:	ldrex	%0, [%1]\n"
 "	teq	%0, #0\n"
@@ -124,6 +155,9 @@ static inline int arch_write_trylock(arch_rwlock_t *rw)
 {
 	unsigned long tmp;
 
+	if (!arch_spin_trylock(&rw->wait))
+		return 0;
+
 	__asm__ __volatile__(
 "1:	ldrex	%0, [%1]\n"
 "	teq	%0, #0\n"
@@ -136,6 +170,7 @@ static inline int arch_write_trylock(arch_rwlock_t *rw)
 		smp_mb();
 		return 1;
 	} else {
+		arch_spin_unlock(&rw->wait);
 		return 0;
 	}
 }
@@ -150,11 +185,13 @@ static inline void arch_write_unlock(arch_rwlock_t *rw)
 	: "r" (&rw->lock), "r" (0)
 	: "cc");
 
+	rw->wait.tickets.owner++;
 	dsb_sev();
 }
 
 /* write_can_lock - would write_trylock() succeed? */
-#define arch_write_can_lock(x)		((x)->lock == 0)
+#define arch_write_can_lock(x) \
+	((x)->lock == 0 && !arch_spin_is_locked(&(x)->wait))
 
 /*
  * Read locks are a bit more hairy:
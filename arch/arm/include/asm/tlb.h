@@ -102,7 +102,23 @@ tlb_end_vma(struct mmu_gather *tlb, struct vm_area_struct *vma)
 }
 
 #define tlb_remove_page(tlb,page)	free_page_and_swap_cache(page)
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * handle_speculative_fault() walks the page tables without mmap_sem, so
+ * unless the whole mm is going away a pte table lives on for a grace
+ * period.
+ */
+extern void pte_free_rcu(struct mm_struct *mm, pgtable_t pte);
+#define pte_free_tlb(tlb, ptep, addr)				\
+	do {							\
+		if ((tlb)->fullmm)				\
+			pte_free((tlb)->mm, ptep);		\
+		else						\
+			pte_free_rcu((tlb)->mm, ptep);		\
+	} while (0)
+#else
 #define pte_free_tlb(tlb, ptep, addr)	pte_free((tlb)->mm, ptep)
+#endif
 #define pmd_free_tlb(tlb, pmdp, addr)	pmd_free((tlb)->mm, pmdp)
 
 #define tlb_migrate_finish(mm)		do { } while (0)
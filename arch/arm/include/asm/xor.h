@@ -132,10 +132,94 @@ static struct xor_block_template xor_block_arm4regs = {
 	.do_5	= xor_arm4regs_5,
 };
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+#include <asm/neon.h>
+
+extern void xor_neon_2(unsigned long, unsigned long *, unsigned long *);
+extern void xor_neon_3(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *);
+extern void xor_neon_4(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *, unsigned long *);
+extern void xor_neon_5(unsigned long, unsigned long *, unsigned long *,
+		       unsigned long *, unsigned long *, unsigned long *);
+
+/*
+ * xor_blocks() may be called where NEON is not allowed; use the integer
+ * routines there.
+ */
+static void
+xor_neon_wrap_2(unsigned long bytes, unsigned long *p1, unsigned long *p2)
+{
+	if (!kernel_neon_allowed()) {
+		xor_arm4regs_2(bytes, p1, p2);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_2(bytes, p1, p2);
+	kernel_neon_end();
+}
+
+static void
+xor_neon_wrap_3(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3)
+{
+	if (!kernel_neon_allowed()) {
+		xor_arm4regs_3(bytes, p1, p2, p3);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_3(bytes, p1, p2, p3);
+	kernel_neon_end();
+}
+
+static void
+xor_neon_wrap_4(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4)
+{
+	if (!kernel_neon_allowed()) {
+		xor_arm4regs_4(bytes, p1, p2, p3, p4);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_4(bytes, p1, p2, p3, p4);
+	kernel_neon_end();
+}
+
+static void
+xor_neon_wrap_5(unsigned long bytes, unsigned long *p1, unsigned long *p2,
+		unsigned long *p3, unsigned long *p4, unsigned long *p5)
+{
+	if (!kernel_neon_allowed()) {
+		xor_arm4regs_5(bytes, p1, p2, p3, p4, p5);
+		return;
+	}
+	kernel_neon_begin();
+	xor_neon_5(bytes, p1, p2, p3, p4, p5);
+	kernel_neon_end();
+}
+
+static struct xor_block_template xor_block_neon = {
+	.name	= "neon",
+	.do_2	= xor_neon_wrap_2,
+	.do_3	= xor_neon_wrap_3,
+	.do_4	= xor_neon_wrap_4,
+	.do_5	= xor_neon_wrap_5,
+};
+
+#define NEON_TEMPLATES					\
+	do {						\
+		if (cpu_has_neon())			\
+			xor_speed(&xor_block_neon);	\
+	} while (0)
+#else
+#define NEON_TEMPLATES	do { } while (0)
+#endif
+
 #undef XOR_TRY_TEMPLATES
 #define XOR_TRY_TEMPLATES			\
 	do {					\
 		xor_speed(&xor_block_arm4regs);	\
 		xor_speed(&xor_block_8regs);	\
 		xor_speed(&xor_block_32regs);	\
+		NEON_TEMPLATES;			\
 	} while (0)
@@ -77,6 +77,7 @@ static const char *arm_pmu_names[] = {
 	[ARM_PERF_PMU_ID_V6MP]	  = "v6mpcore",
 	[ARM_PERF_PMU_ID_CA8]	  = "ARMv7 Cortex-A8",
 	[ARM_PERF_PMU_ID_CA9]	  = "ARMv7 Cortex-A9",
+	[ARM_PERF_PMU_ID_EMUL]	  = "emulated",
 };
 
 struct arm_pmu {
@@ -85,7 +86,7 @@ struct arm_pmu {
 	void		(*enable)(struct hw_perf_event *evt, int idx);
 	void		(*disable)(struct hw_perf_event *evt, int idx);
 	int		(*event_map)(int evt);
-	u64		(*raw_event)(u64);
+	int		(*raw_event)(u64);
 	int		(*get_event_idx)(struct cpu_hw_events *cpuc,
 					 struct hw_perf_event *hwc);
 	u32		(*read_counter)(int idx);
@@ -319,8 +320,10 @@ validate_event(struct cpu_hw_events *cpuc,
 {
 	struct hw_perf_event fake_event = event->hw;
 
-	if (event->pmu && event->pmu != &pmu)
-		return 0;
+	/* Software events, and events that failed, take no counter */
+	if ((event->pmu && event->pmu != &pmu) ||
+	    event->state < PERF_EVENT_STATE_OFF)
+		return 1;
 
 	return armpmu->get_event_idx(cpuc, &fake_event) >= 0;
 }
@@ -352,6 +355,10 @@ armpmu_reserve_hardware(void)
 {
 	int i, err = -ENODEV, irq;
 
+	/* An emulated PMU has no interrupts to ask for */
+	if (!armpmu->handle_irq)
+		return 0;
+
 	pmu_device = reserve_pmu(ARM_PMU_DEVICE_CPU);
 	if (IS_ERR(pmu_device)) {
 		pr_warning("unable to reserve pmu\n");
@@ -398,6 +405,11 @@ armpmu_release_hardware(void)
 {
 	int i, irq;
 
+	if (!armpmu->handle_irq) {
+		armpmu->stop();
+		return;
+	}
+
 	for (i = pmu_device->num_resources - 1; i >= 0; --i) {
 		irq = platform_get_irq(pmu_device, i);
 		if (irq >= 0)
@@ -445,6 +457,12 @@ __hw_perf_event_init(struct perf_event *event)
 		return mapping;
 	}
 
+	/* Without overflow interrupts we can only count */
+	if (!armpmu->handle_irq && event->attr.sample_period) {
+		pr_debug("no sampling with an emulated PMU\n");
+		return -EOPNOTSUPP;
+	}
+
 	/*
 	 * Check whether we need to exclude the counter from certain modes.
 	 * The ARM performance counters are on all of the time so if someone
@@ -501,12 +519,12 @@ hw_perf_event_init(struct perf_event *event)
 
 	event->destroy = hw_perf_event_destroy;
 
+	/*
+	 * There may be more events than counters, across CPUs and tasks
+	 * and within a task; the core rotates them through the counters.
+	 * Only a group that can never fit is refused, in validate_group().
+	 */
 	if (!atomic_inc_not_zero(&active_events)) {
-		if (atomic_read(&active_events) > perf_max_events) {
-			atomic_dec(&active_events);
-			return ERR_PTR(-ENOSPC);
-		}
-
 		mutex_lock(&pmu_reserve_mutex);
 		if (atomic_read(&active_events) == 0) {
 			err = armpmu_reserve_hardware();
@@ -1094,7 +1112,7 @@ armv6mpcore_pmu_event_map(int config)
 	return mapping;
 }
 
-static u64
+static int
 armv6pmu_raw_event(u64 config)
 {
 	return config & 0xff;
@@ -1925,10 +1943,15 @@ void armv7pmu_enable_event(struct hw_perf_event *hwc, int idx)
 
 	/*
 	 * Set event (if destined for PMNx counters)
-	 * We don't need to set the event if it's a cycle count
+	 * We don't need to set the event if it's a cycle count, unless
+	 * the cycle counter was taken and it has to count event 0x11.
 	 */
-	if (idx != ARMV7_CYCLE_COUNTER)
-		armv7_pmnc_write_evtsel(idx, hwc->config_base);
+	if (idx != ARMV7_CYCLE_COUNTER) {
+		if (hwc->config_base == ARMV7_PERFCTR_CPU_CYCLES)
+			armv7_pmnc_write_evtsel(idx, ARMV7_PERFCTR_CLOCK_CYCLES);
+		else
+			armv7_pmnc_write_evtsel(idx, hwc->config_base);
+	}
 
 	/*
 	 * Enable interrupt for this counter
@@ -2064,35 +2087,60 @@ static inline int armv7_a9_pmu_event_map(int config)
 	return mapping;
 }
 
-static u64 armv7pmu_raw_event(u64 config)
+static int armv7pmu_raw_event(u64 config)
 {
 	return config & 0xff;
 }
 
+/*
+ * The events a Cortex-A9 implements, from its TRM: the ARMv7 common
+ * events less 0x08 and 0x0E, and its own. Anything else would count
+ * nothing without telling anyone, so refuse it.
+ */
+static int armv7_a9_raw_event(u64 config)
+{
+	int evt = config & 0xff;
+
+	switch (evt) {
+	case ARMV7_PERFCTR_PMNC_SW_INCR ... ARMV7_PERFCTR_DWRITE:
+	case ARMV7_PERFCTR_EXC_TAKEN ... ARMV7_PERFCTR_PC_IMM_BRANCH:
+	case ARMV7_PERFCTR_UNALIGNED_ACCESS ... ARMV7_PERFCTR_PC_BRANCH_MIS_USED:
+	case ARMV7_PERFCTR_JAVA_HW_BYTECODE_EXEC ... ARMV7_PERFCTR_JAZELLE_BRANCH_EXEC:
+	case ARMV7_PERFCTR_COHERENT_LINE_MISS ... ARMV7_PERFCTR_COHERENT_LINE_HIT:
+	case ARMV7_PERFCTR_ICACHE_DEP_STALL_CYCLES ... ARMV7_PERFCTR_INST_OUT_OF_RENAME_STAGE:
+	case ARMV7_PERFCTR_PREDICTABLE_FUNCT_RETURNS:
+	case ARMV7_PERFCTR_MAIN_UNIT_EXECUTED_INST ... ARMV7_PERFCTR_NEON_EXECUTED_INST:
+	case ARMV7_PERFCTR_PLD_FULL_DEP_STALL_CYCLES ... ARMV7_PERFCTR_DMB_DEP_STALL_CYCLES:
+	case ARMV7_PERFCTR_INTGR_CLK_ENABLED_CYCLES ... ARMV7_PERFCTR_DATA_ENGINE_CLK_EN_CYCLES:
+	case ARMV7_PERFCTR_ISB_INST ... ARMV7_PERFCTR_EXT_INTERRUPTS:
+	case ARMV7_PERFCTR_PLE_CACHE_LINE_RQST_COMPLETED ... ARMV7_PERFCTR_PLE_RQST_PROG:
+	case ARMV7_PERFCTR_CPU_CYCLES:
+		return evt;
+	}
+
+	return -ENOENT;
+}
+
 static int armv7pmu_get_event_idx(struct cpu_hw_events *cpuc,
 				  struct hw_perf_event *event)
 {
 	int idx;
 
-	/* Always place a cycle counter into the cycle counter. */
-	if (event->config_base == ARMV7_PERFCTR_CPU_CYCLES) {
-		if (test_and_set_bit(ARMV7_CYCLE_COUNTER, cpuc->used_mask))
-			return -EAGAIN;
-
+	/*
+	 * Place a cycle count into the cycle counter if it is free, and
+	 * into an event counter otherwise, see armv7pmu_enable_event().
+	 */
+	if (event->config_base == ARMV7_PERFCTR_CPU_CYCLES &&
+	    !test_and_set_bit(ARMV7_CYCLE_COUNTER, cpuc->used_mask))
 		return ARMV7_CYCLE_COUNTER;
-	} else {
-		/*
-		 * For anything other than a cycle counter, try and use
-		 * the events counters
-		 */
-		for (idx = ARMV7_COUNTER0; idx <= armpmu->num_events; ++idx) {
-			if (!test_and_set_bit(idx, cpuc->used_mask))
-				return idx;
-		}
 
-		/* The counters are all in use. */
-		return -EAGAIN;
+	for (idx = ARMV7_COUNTER0; idx <= armpmu->num_events; ++idx) {
+		if (!test_and_set_bit(idx, cpuc->used_mask))
+			return idx;
 	}
+
+	/* The counters are all in use. */
+	return -EAGAIN;
 }
 
 static struct arm_pmu armv7pmu = {
@@ -2282,7 +2330,7 @@ xscalepmu_event_map(int config)
 	return mapping;
 }
 
-static u64
+static int
 xscalepmu_raw_event(u64 config)
 {
 	return config & 0xff;
@@ -2919,6 +2967,152 @@ static const struct arm_pmu xscale2pmu = {
 	.max_period	= (1LLU << 32) - 1,
 };
 
+#ifdef CONFIG_ARM_PMU_EMULATED
+/*
+ * Emulated PMU, to test counter allocation and multiplexing where the
+ * counters do not count, as under QEMU. "armpmu=emulated" selects it.
+ *
+ * It looks like a Cortex-A9, a cycle counter and six event counters,
+ * and takes the same events, but every counter just counts sched_clock()
+ * in units of 1024ns while it is enabled. There is no overflow
+ * interrupt, so sampling events are refused.
+ */
+#define EMUL_NUM_COUNTERS	6
+
+struct emul_counter {
+	u32		base;
+	u64		since;
+	int		enabled;
+};
+
+struct emul_pmu {
+	int			started;
+	struct emul_counter	cnt[ARMV7_COUNTER0 + EMUL_NUM_COUNTERS];
+};
+
+static DEFINE_PER_CPU(struct emul_pmu, emul_pmu);
+
+static int __initdata armpmu_emulated;
+
+static int __init armpmu_setup(char *str)
+{
+	armpmu_emulated = !strcmp(str, "emulated");
+	return 1;
+}
+__setup("armpmu=", armpmu_setup);
+
+static inline u64 emul_now(void)
+{
+	return sched_clock() >> 10;
+}
+
+static u32 emul_value(struct emul_pmu *p, int idx)
+{
+	struct emul_counter *c = &p->cnt[idx];
+
+	if (!p->started || !c->enabled)
+		return c->base;
+	return c->base + (u32)(emul_now() - c->since);
+}
+
+static u32 emul_read_counter(int idx)
+{
+	struct emul_pmu *p = &get_cpu_var(emul_pmu);
+	u32 val = emul_value(p, idx);
+
+	put_cpu_var(emul_pmu);
+	return val;
+}
+
+static void emul_write_counter(int idx, u32 val)
+{
+	struct emul_pmu *p = &get_cpu_var(emul_pmu);
+
+	p->cnt[idx].base = val;
+	p->cnt[idx].since = emul_now();
+	put_cpu_var(emul_pmu);
+}
+
+static void emul_enable_event(struct hw_perf_event *hwc, int idx)
+{
+	struct emul_pmu *p = &get_cpu_var(emul_pmu);
+
+	if (!p->cnt[idx].enabled) {
+		p->cnt[idx].since = emul_now();
+		p->cnt[idx].enabled = 1;
+	}
+	put_cpu_var(emul_pmu);
+}
+
+static void emul_disable_event(struct hw_perf_event *hwc, int idx)
+{
+	struct emul_pmu *p = &get_cpu_var(emul_pmu);
+
+	p->cnt[idx].base = emul_value(p, idx);
+	p->cnt[idx].enabled = 0;
+	put_cpu_var(emul_pmu);
+}
+
+static void emul_start(void)
+{
+	struct emul_pmu *p = &get_cpu_var(emul_pmu);
+	u64 now = emul_now();
+	int idx;
+
+	if (!p->started) {
+		for (idx = 0; idx < ARRAY_SIZE(p->cnt); idx++)
+			p->cnt[idx].since = now;
+		p->started = 1;
+	}
+	put_cpu_var(emul_pmu);
+}
+
+static void emul_stop(void)
+{
+	struct emul_pmu *p = &get_cpu_var(emul_pmu);
+	int idx;
+
+	if (p->started) {
+		for (idx = 0; idx < ARRAY_SIZE(p->cnt); idx++)
+			p->cnt[idx].base = emul_value(p, idx);
+		p->started = 0;
+	}
+	put_cpu_var(emul_pmu);
+}
+
+static const struct arm_pmu emulpmu = {
+	.id		= ARM_PERF_PMU_ID_EMUL,
+	.enable		= emul_enable_event,
+	.disable	= emul_disable_event,
+	.event_map	= armv7_a9_pmu_event_map,
+	.raw_event	= armv7_a9_raw_event,
+	.read_counter	= emul_read_counter,
+	.write_counter	= emul_write_counter,
+	.get_event_idx	= armv7pmu_get_event_idx,
+	.start		= emul_start,
+	.stop		= emul_stop,
+	.num_events	= EMUL_NUM_COUNTERS + 1,
+	.max_period	= (1LLU << 32) - 1,
+};
+
+static int __init armpmu_init_emulated(void)
+{
+	if (!armpmu_emulated)
+		return 0;
+
+	armpmu = &emulpmu;
+	memcpy(armpmu_perf_cache_map, armv7_a9_perf_cache_map,
+		sizeof(armv7_a9_perf_cache_map));
+	perf_max_events = emulpmu.num_events;
+	return 1;
+}
+#else
+static inline int armpmu_init_emulated(void)
+{
+	return 0;
+}
+#endif
+
 static int __init
 init_hw_perf_events(void)
 {
@@ -2926,6 +3120,10 @@ init_hw_perf_events(void)
 	unsigned long implementor = (cpuid & 0xFF000000) >> 24;
 	unsigned long part_number = (cpuid & 0xFFF0);
 
+	/* "armpmu=emulated": leave the hardware alone */
+	if (armpmu_init_emulated())
+		goto out;
+
 	/* ARM Ltd CPUs. */
 	if (0x41 == implementor) {
 		switch (part_number) {
@@ -2961,6 +3159,7 @@ init_hw_perf_events(void)
 			memcpy(armpmu_perf_cache_map, armv7_a9_perf_cache_map,
 				sizeof(armv7_a9_perf_cache_map));
 			armv7pmu.event_map = armv7_a9_pmu_event_map;
+			armv7pmu.raw_event = armv7_a9_raw_event;
 			armpmu = &armv7pmu;
 
 			/* Reset PMNC and read the nb of CNTx counters
@@ -2988,6 +3187,7 @@ init_hw_perf_events(void)
 		}
 	}
 
+out:
 	if (armpmu) {
 		pr_info("enabled with %s PMU driver, %d counters available\n",
 				arm_pmu_names[armpmu->id], armpmu->num_events);
@@ -3025,6 +3225,17 @@ struct frame_tail {
 	unsigned long	    lr;
 } __attribute__((packed));
 
+/*
+ * That is the APCS frame, {fp, ip, lr, pc} with fp pointing at the saved
+ * pc. EABI code built with frame pointers only pushes {fp, lr} and points
+ * fp at the saved lr, so its frame tail starts a word below fp:
+ * (struct frame_tail_eabi *)(xxx->fp + 4)-1
+ */
+struct frame_tail_eabi {
+	struct frame_tail_eabi *fp;
+	unsigned long	    lr;
+} __attribute__((packed));
+
 /*
  * Get the return address for a single stackframe and return a pointer to the
  * next frame tail.
@@ -3053,17 +3264,70 @@ user_backtrace(struct frame_tail *tail,
 	return buftail.fp - 1;
 }
 
+static struct frame_tail_eabi *
+user_backtrace_eabi(struct frame_tail_eabi *tail,
+		    struct perf_callchain_entry *entry)
+{
+	struct frame_tail_eabi buftail;
+	struct frame_tail_eabi *next;
+
+	if (!access_ok(VERIFY_READ, tail, sizeof(buftail)))
+		return NULL;
+	if (__copy_from_user_inatomic(&buftail, tail, sizeof(buftail)))
+		return NULL;
+
+	callchain_store(entry, buftail.lr);
+
+	/* As above, the caller's frame must be higher up the stack */
+	next = (struct frame_tail_eabi *)((unsigned long)buftail.fp + 4) - 1;
+	if (tail >= next)
+		return NULL;
+
+	return next;
+}
+
+/*
+ * Which of the two frame layouts does the frame at @fp have? In an EABI
+ * frame the word below fp is the caller's fp, higher up the stack. In an
+ * APCS frame it is the saved lr, an address in the text, which is below
+ * the stack.
+ */
+static int
+user_frame_is_eabi(unsigned long fp)
+{
+	unsigned long word;
+
+	if (!access_ok(VERIFY_READ, fp - 4, sizeof(word)))
+		return 0;
+	if (__copy_from_user_inatomic(&word, (void __user *)(fp - 4),
+				      sizeof(word)))
+		return 0;
+
+	return word > fp;
+}
+
 static void
 perf_callchain_user(struct pt_regs *regs,
 		    struct perf_callchain_entry *entry)
 {
 	struct frame_tail *tail;
+	struct frame_tail_eabi *tail_eabi;
 
 	callchain_store(entry, PERF_CONTEXT_USER);
 
 	if (!user_mode(regs))
 		regs = task_pt_regs(current);
 
+	callchain_store(entry, regs->ARM_pc);
+
+	if (user_frame_is_eabi(regs->ARM_fp)) {
+		tail_eabi = (struct frame_tail_eabi *)(regs->ARM_fp + 4) - 1;
+
+		while (tail_eabi && !((unsigned long)tail_eabi & 0x3))
+			tail_eabi = user_backtrace_eabi(tail_eabi, entry);
+		return;
+	}
+
 	tail = (struct frame_tail *)regs->ARM_fp - 1;
 
 	while (tail && !((unsigned long)tail & 0x3))
@@ -0,0 +1,145 @@
+/*
+ *  linux/arch/arm/lib/copy_bench.c
+ *
+ *  Times the memcpy() and copy_page() variants from copy_select.c
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  Every variant copies the same number of bytes for each size and
+ *  alignment, so the MB/s figures on a line compare directly.  Sizes past
+ *  the L2 cache show the prefetching, the small ones the call overhead.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/gfp.h>
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/sched.h>
+
+#include <asm/copy_select.h>
+
+#define BENCH_MAX	(1 << 20)
+#define BENCH_BYTES	(16 << 20)
+#define BENCH_PAGES	256
+
+static const unsigned int bench_sizes[] = {
+	64, 256, 1024, 4096, 16384, 65536, 262144, BENCH_MAX,
+};
+
+/* destination and source offsets from a cache line boundary */
+static const unsigned int bench_align[][2] = {
+	{ 0, 0 }, { 1, 1 }, { 0, 3 }, { 2, 0 },
+};
+
+static struct page *pages[BENCH_PAGES] __initdata;
+
+static unsigned long bench_mbps(u64 bytes, s64 ns)
+{
+	return ns > 0 ? div64_u64(bytes * 1000, ns) : 0;
+}
+
+static unsigned long __init bench_memcpy(const struct arm_copy_fns *fns,
+					 u8 *dst, const u8 *src,
+					 unsigned int size)
+{
+	unsigned int i, loops = max_t(unsigned int, BENCH_BYTES / size, 1);
+	ktime_t start = ktime_get();
+
+	for (i = 0; i < loops; i++)
+		fns->memcpy(dst, src, size);
+	return bench_mbps((u64)loops * size,
+			  ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+static unsigned long __init bench_copy_page(const struct arm_copy_fns *fns,
+					    bool cold)
+{
+	unsigned int i, loops = BENCH_BYTES / PAGE_SIZE;
+	unsigned int half = BENCH_PAGES / 2;
+	ktime_t start = ktime_get();
+
+	for (i = 0; i < loops; i++) {
+		unsigned int n = cold ? i % half : 0;
+
+		fns->copy_page(page_address(pages[half + n]),
+			       page_address(pages[n]));
+	}
+	return bench_mbps((u64)loops * PAGE_SIZE,
+			  ktime_to_ns(ktime_sub(ktime_get(), start)));
+}
+
+static int __init copy_bench_init(void)
+{
+	const struct arm_copy_fns *fns;
+	unsigned int s, a, i;
+	char line[128];
+	int len, err = -ENOMEM;
+	u8 *src, *dst;
+
+	src = vmalloc(BENCH_MAX + L1_CACHE_BYTES);
+	dst = vmalloc(BENCH_MAX + L1_CACHE_BYTES);
+	if (!src || !dst)
+		goto out;
+	memset(src, 0x5a, BENCH_MAX + L1_CACHE_BYTES);
+	memset(dst, 0xa5, BENCH_MAX + L1_CACHE_BYTES);
+
+	for (s = 0; s < ARRAY_SIZE(bench_sizes); s++) {
+		for (a = 0; a < ARRAY_SIZE(bench_align); a++) {
+			len = snprintf(line, sizeof(line),
+				       "memcpy %7u bytes, dst+%u src+%u:",
+				       bench_sizes[s], bench_align[a][0],
+				       bench_align[a][1]);
+			for (fns = arm_copy_fns; fns->name; fns++)
+				len += snprintf(line + len, sizeof(line) - len,
+					" %s %lu", fns->name,
+					bench_memcpy(fns,
+						     dst + bench_align[a][0],
+						     src + bench_align[a][1],
+						     bench_sizes[s]));
+			printk(KERN_INFO "copy_bench: %s MB/s\n", line);
+			cond_resched();
+		}
+	}
+
+	for (i = 0; i < BENCH_PAGES; i++) {
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i])
+			goto out_pages;
+		memset(page_address(pages[i]), i, PAGE_SIZE);
+	}
+
+	for (a = 0; a < 2; a++) {
+		len = snprintf(line, sizeof(line), "copy_page %s:",
+			       a ? "cold" : "hot ");
+		for (fns = arm_copy_fns; fns->name; fns++)
+			len += snprintf(line + len, sizeof(line) - len,
+					" %s %lu", fns->name,
+					bench_copy_page(fns, a));
+		printk(KERN_INFO "copy_bench: %s MB/s\n", line);
+		cond_resched();
+	}
+	err = 0;
+
+out_pages:
+	while (i--)
+		__free_page(pages[i]);
+out:
+	vfree(dst);
+	vfree(src);
+	return err;
+}
+
+static void __exit copy_bench_exit(void)
+{
+}
+
+module_init(copy_bench_init);
+module_exit(copy_bench_exit);
+
+MODULE_DESCRIPTION("ARM memcpy() and copy_page() variant benchmark");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,126 @@
+/*
+ *  linux/arch/arm/lib/copy_select.c
+ *
+ *  Boot time choice of memcpy() and copy_page() variants
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  memcpy() hands copies of MEMCPY_SELECT_MIN bytes and more, and
+ *  copy_page() everything, to the pointers below.  They start out on the
+ *  generic routines and are switched once the CPU ID and the NEON hwcap
+ *  are known, which is before userspace and its COW faults start.
+ *
+ *  The NEON variants fall back to the A9 integer ones whenever NEON
+ *  cannot be used: in interrupt context, inside another kernel mode NEON
+ *  section, and for memcpy() below MEMCPY_NEON_MIN bytes, where saving
+ *  and lazily restoring the user's VFP registers costs more than it wins.
+ *  The uaccess copies never use NEON since they may fault and sleep.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include <asm/cputype.h>
+#include <asm/copy_select.h>
+#include <asm/neon.h>
+
+#define MEMCPY_NEON_MIN		4096
+
+extern void *memcpy_a9(void *, const void *, size_t);
+extern void copy_page_a9(void *, const void *);
+
+void *(*arm_memcpy_large)(void *, const void *, size_t) = __memcpy_std;
+void (*arm_copy_page)(void *, const void *) = __copy_page_std;
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+extern void __memcpy_neon(void *, const void *, size_t);
+extern void __copy_page_neon(void *, const void *);
+
+static void *memcpy_neon(void *dest, const void *src, size_t n)
+{
+	size_t bulk = n & ~63;
+
+	if (n < MEMCPY_NEON_MIN || !kernel_neon_allowed())
+		return memcpy_a9(dest, src, n);
+
+	kernel_neon_begin();
+	__memcpy_neon(dest, src, bulk);
+	kernel_neon_end();
+	if (n != bulk)
+		memcpy_a9(dest + bulk, src + bulk, n - bulk);
+	return dest;
+}
+
+static void copy_page_neon(void *to, const void *from)
+{
+	if (!kernel_neon_allowed()) {
+		copy_page_a9(to, from);
+		return;
+	}
+	kernel_neon_begin();
+	__copy_page_neon(to, from);
+	kernel_neon_end();
+}
+#endif
+
+const struct arm_copy_fns arm_copy_fns[] = {
+	{ "generic",	__memcpy_std,	__copy_page_std },
+	{ "a9",		memcpy_a9,	copy_page_a9 },
+#ifdef CONFIG_KERNEL_MODE_NEON
+	{ "neon",	memcpy_neon,	copy_page_neon },
+#endif
+	{ }
+};
+EXPORT_SYMBOL_GPL(arm_copy_fns);
+
+static char *arm_copy_name __initdata;
+
+static int __init arm_copy_setup(char *str)
+{
+	arm_copy_name = str;
+	return 1;
+}
+__setup("arm_copy=", arm_copy_setup);
+
+static const struct arm_copy_fns * __init arm_copy_find(const char *name)
+{
+	const struct arm_copy_fns *fns;
+
+	for (fns = arm_copy_fns; fns->name; fns++)
+		if (!strcmp(fns->name, name))
+			return fns;
+	return NULL;
+}
+
+/*
+ * Runs well after vfp_init() has set HWCAP_NEON.
+ */
+static int __init arm_copy_select(void)
+{
+	const struct arm_copy_fns *fns = NULL;
+
+	if (arm_copy_name) {
+		fns = arm_copy_find(arm_copy_name);
+		if (!fns)
+			pr_warning("arm_copy: unknown variant '%s'\n",
+				   arm_copy_name);
+	}
+
+	if (!fns) {
+		if ((read_cpuid_id() & 0xff00fff0) != 0x4100c090)
+			fns = arm_copy_find("generic");
+		else if (cpu_has_neon() && arm_copy_find("neon"))
+			fns = arm_copy_find("neon");
+		else
+			fns = arm_copy_find("a9");
+	}
+
+	arm_memcpy_large = fns->memcpy;
+	arm_copy_page = fns->copy_page;
+	pr_info("arm_copy: using %s memcpy() and copy_page()\n", fns->name);
+	return 0;
+}
+late_initcall_sync(arm_copy_select);
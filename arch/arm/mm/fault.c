@@ -201,7 +201,7 @@ void do_bad_area(unsigned long addr, unsigned int fsr, struct pt_regs *regs)
  * If we encountered a write fault, we must have write permission, otherwise
  * we allow any permission.
  */
-static inline bool access_error(unsigned int fsr, struct vm_area_struct *vma)
+static inline unsigned int access_mask(unsigned int fsr)
 {
 	unsigned int mask = VM_READ | VM_WRITE | VM_EXEC;
 
@@ -210,7 +210,12 @@ static inline bool access_error(unsigned int fsr, struct vm_area_struct *vma)
 	if (fsr & FSR_LNX_PF)
 		mask = VM_EXEC;
 
-	return vma->vm_flags & mask ? false : true;
+	return mask;
+}
+
+static inline bool access_error(unsigned int fsr, struct vm_area_struct *vma)
+{
+	return vma->vm_flags & access_mask(fsr) ? false : true;
 }
 
 static int __kprobes
@@ -277,6 +282,20 @@ do_page_fault(unsigned long addr, unsigned int fsr, struct pt_regs *regs)
 	if (in_atomic() || !mm)
 		goto no_context;
 
+	/*
+	 * Most faults from user space only need a fresh or page cache
+	 * page: try those without mmap_sem first.
+	 */
+	if (user_mode(regs) &&
+	    !handle_speculative_fault(mm, addr & PAGE_MASK,
+				      (fsr & FSR_WRITE) ? FAULT_FLAG_WRITE : 0,
+				      access_mask(fsr))) {
+		tsk->min_flt++;
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS, 1, 0, regs, addr);
+		perf_sw_event(PERF_COUNT_SW_PAGE_FAULTS_MIN, 1, 0, regs, addr);
+		return 0;
+	}
+
 	/*
 	 * As per x86, we may deadlock here.  However, since the kernel only
 	 * validly references user space from well defined areas of the code,
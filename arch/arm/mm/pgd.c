@@ -10,6 +10,7 @@
 #include <linux/mm.h>
 #include <linux/gfp.h>
 #include <linux/highmem.h>
+#include <linux/rcupdate.h>
 
 #include <asm/pgalloc.h>
 #include <asm/page.h>
@@ -98,3 +99,23 @@ void free_pgd_slow(struct mm_struct *mm, pgd_t *pgd)
 free:
 	free_pages((unsigned long) pgd, 2);
 }
+
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+static void pte_free_rcu_callback(struct rcu_head *head)
+{
+	struct page *pte = container_of((struct list_head *)head,
+					struct page, lru);
+
+	pgtable_page_dtor(pte);
+	__free_page(pte);
+}
+
+/*
+ * The page's lru is unused while it is a pte table; the split pte lock
+ * stays initialised until the grace period is over.
+ */
+void pte_free_rcu(struct mm_struct *mm, pgtable_t pte)
+{
+	call_rcu((struct rcu_head *)&pte->lru, pte_free_rcu_callback);
+}
+#endif
@@ -14,7 +14,11 @@
 #include <linux/signal.h>
 #include <linux/sched.h>
 #include <linux/init.h>
+#include <linux/hardirq.h>
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
+#include <asm/neon.h>
 #include <asm/thread_notify.h>
 #include <asm/vfp.h>
 
@@ -483,6 +487,117 @@ void vfp_flush_hwstate(struct thread_info *thread)
 	put_cpu();
 }
 
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+struct kernel_neon_stats {
+	unsigned long	uses;		/* kernel_neon_begin() calls */
+	unsigned long	saves;		/* VFP contexts saved to make room */
+};
+
+static DEFINE_PER_CPU(struct kernel_neon_stats, kernel_neon_stats);
+
+DEFINE_PER_CPU(int, kernel_neon_active);
+EXPORT_PER_CPU_SYMBOL(kernel_neon_active);
+
+/*
+ * Kernel mode NEON is only allowed outside of interrupt context and runs
+ * with preemption disabled, so the kernel's own NEON register contents
+ * never need preserving.  Whatever VFP context owns the hardware is
+ * saved here and last_VFP_context[] is cleared, so that its owner
+ * reloads it through the usual lazy undef path the next time it touches
+ * VFP/NEON.  Callers that may run in interrupt context must check
+ * kernel_neon_allowed() and fall back to integer code.
+ */
+void kernel_neon_begin(void)
+{
+	struct thread_info *thread = current_thread_info();
+	struct kernel_neon_stats *stats;
+	unsigned int cpu;
+	u32 fpexc;
+
+	BUG_ON(in_interrupt());
+	cpu = get_cpu();
+	BUG_ON(per_cpu(kernel_neon_active, cpu));
+	per_cpu(kernel_neon_active, cpu) = 1;
+	stats = &per_cpu(kernel_neon_stats, cpu);
+	stats->uses++;
+
+	fpexc = fmrx(FPEXC) | FPEXC_EN;
+	fmxr(FPEXC, fpexc);
+
+	/*
+	 * Save the userland NEON/VFP state.  Under UP the owner could be
+	 * a task other than current, which has not been saved yet.
+	 */
+	if (last_VFP_context[cpu] == &thread->vfpstate) {
+		vfp_save_state(&thread->vfpstate, fpexc);
+		stats->saves++;
+	}
+#ifndef CONFIG_SMP
+	else if (last_VFP_context[cpu] != NULL) {
+		vfp_save_state(last_VFP_context[cpu], fpexc);
+		stats->saves++;
+	}
+#endif
+	last_VFP_context[cpu] = NULL;
+}
+EXPORT_SYMBOL(kernel_neon_begin);
+
+void kernel_neon_end(void)
+{
+	/* Disable the NEON/VFP unit, the next user traps and reloads */
+	fmxr(FPEXC, fmrx(FPEXC) & ~FPEXC_EN);
+	__get_cpu_var(kernel_neon_active) = 0;
+	put_cpu();
+}
+EXPORT_SYMBOL(kernel_neon_end);
+
+#ifdef CONFIG_PROC_FS
+static int kernel_neon_proc_show(struct seq_file *m, void *v)
+{
+	unsigned int cpu;
+
+	seq_printf(m, "%-6s %12s %12s\n", "cpu", "uses", "ctx_saves");
+	for_each_possible_cpu(cpu) {
+		struct kernel_neon_stats *stats = &per_cpu(kernel_neon_stats,
+							   cpu);
+
+		seq_printf(m, "cpu%-3u %12lu %12lu\n", cpu,
+			   stats->uses, stats->saves);
+	}
+	return 0;
+}
+
+static int kernel_neon_proc_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, kernel_neon_proc_show, NULL);
+}
+
+static const struct file_operations kernel_neon_proc_fops = {
+	.open		= kernel_neon_proc_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+/*
+ * /proc/cpu is only created by proc_cpu_init() at fs_initcall time,
+ * after vfp_init() has run.
+ */
+static int __init kernel_neon_proc_init(void)
+{
+	if (!cpu_has_neon())
+		return 0;
+
+	if (!proc_create("cpu/neon", S_IRUGO, NULL, &kernel_neon_proc_fops))
+		printk(KERN_WARNING "VFP: unable to create /proc/cpu/neon\n");
+	return 0;
+}
+late_initcall(kernel_neon_proc_init);
+#endif /* CONFIG_PROC_FS */
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
+
 #include <linux/smp.h>
 
 /*
@@ -558,4 +673,8 @@ static int __init vfp_init(void)
 	return 0;
 }
 
-late_initcall(vfp_init);
+/*
+ * Early enough for the NEON xor and RAID6 code to see HWCAP_NEON when
+ * they benchmark their templates at core/subsys initcall time.
+ */
+core_initcall(vfp_init);
@@ -62,4 +62,8 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ACCT_TAG             41
+
+#define SO_TX_DEFER             42
+
 #endif /* __ASM_AVR32_SOCKET_H */
@@ -69,4 +69,8 @@
 
 #define SO_RXQ_OVFL             40
 
+#define SO_ACCT_TAG             41
+
+#define SO_TX_DEFER             42
+
 #endif	/* _ASM_POWERPC_SOCKET_H */
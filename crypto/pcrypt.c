@@ -20,12 +20,27 @@
 
 #include <crypto/algapi.h>
 #include <crypto/internal/aead.h>
+#include <crypto/internal/skcipher.h>
 #include <linux/err.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/slab.h>
 #include <crypto/pcrypt.h>
 
+/*
+ * Block cipher requests of at most this many bytes skip the parallel
+ * machinery when the tfm is idle: they are processed right away in the
+ * caller's context, saving the two workqueue hops and the reorder step.
+ * A second request within the same tick is taken as the start of a
+ * burst and goes parallel. Zero disables this.
+ */
+static unsigned int lowlat_bytes = PAGE_SIZE;
+module_param(lowlat_bytes, uint, 0644);
+MODULE_PARM_DESC(lowlat_bytes, "Largest idle block cipher request that is "
+		 "processed directly (0 = always parallelize)");
+
 static struct padata_instance *pcrypt_enc_padata;
 static struct padata_instance *pcrypt_dec_padata;
 static struct workqueue_struct *encwq;
@@ -41,6 +56,28 @@ struct pcrypt_aead_ctx {
 	unsigned int cb_cpu;
 };
 
+struct pcrypt_ablkcipher_ctx {
+	struct crypto_blkcipher *child;
+	unsigned int cb_cpu;
+	atomic_t inflight;
+	unsigned long last_direct;
+};
+
+static unsigned int pcrypt_next_cb_cpu(struct pcrypt_instance_ctx *ictx)
+{
+	unsigned int cpu, cpu_index, cb_cpu;
+
+	ictx->tfm_count++;
+
+	cpu_index = ictx->tfm_count % cpumask_weight(cpu_active_mask);
+
+	cb_cpu = cpumask_first(cpu_active_mask);
+	for (cpu = 0; cpu < cpu_index; cpu++)
+		cb_cpu = cpumask_next(cb_cpu, cpu_active_mask);
+
+	return cb_cpu;
+}
+
 static int pcrypt_do_parallel(struct padata_priv *padata, unsigned int *cb_cpu,
 			      struct padata_instance *pinst)
 {
@@ -243,19 +280,12 @@ static int pcrypt_aead_givencrypt(struct aead_givcrypt_request *req)
 
 static int pcrypt_aead_init_tfm(struct crypto_tfm *tfm)
 {
-	int cpu, cpu_index;
 	struct crypto_instance *inst = crypto_tfm_alg_instance(tfm);
 	struct pcrypt_instance_ctx *ictx = crypto_instance_ctx(inst);
 	struct pcrypt_aead_ctx *ctx = crypto_tfm_ctx(tfm);
 	struct crypto_aead *cipher;
 
-	ictx->tfm_count++;
-
-	cpu_index = ictx->tfm_count % cpumask_weight(cpu_active_mask);
-
-	ctx->cb_cpu = cpumask_first(cpu_active_mask);
-	for (cpu = 0; cpu < cpu_index; cpu++)
-		ctx->cb_cpu = cpumask_next(ctx->cb_cpu, cpu_active_mask);
+	ctx->cb_cpu = pcrypt_next_cb_cpu(ictx);
 
 	cipher = crypto_spawn_aead(crypto_instance_ctx(inst));
 
@@ -277,6 +307,166 @@ static void pcrypt_aead_exit_tfm(struct crypto_tfm *tfm)
 	crypto_free_aead(ctx->child);
 }
 
+static int pcrypt_ablkcipher_setkey(struct crypto_ablkcipher *parent,
+				    const u8 *key, unsigned int keylen)
+{
+	struct pcrypt_ablkcipher_ctx *ctx = crypto_ablkcipher_ctx(parent);
+	struct crypto_blkcipher *child = ctx->child;
+	int err;
+
+	crypto_blkcipher_clear_flags(child, CRYPTO_TFM_REQ_MASK);
+	crypto_blkcipher_set_flags(child, crypto_ablkcipher_get_flags(parent) &
+					  CRYPTO_TFM_REQ_MASK);
+	err = crypto_blkcipher_setkey(child, key, keylen);
+	crypto_ablkcipher_set_flags(parent, crypto_blkcipher_get_flags(child) &
+					    CRYPTO_TFM_RES_MASK);
+	return err;
+}
+
+static int pcrypt_blkcipher_crypt(struct ablkcipher_request *req, int enc,
+				  u32 flags)
+{
+	struct crypto_ablkcipher *tfm = crypto_ablkcipher_reqtfm(req);
+	struct pcrypt_ablkcipher_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+	struct blkcipher_desc desc = {
+		.tfm = ctx->child,
+		.info = req->info,
+		.flags = flags,
+	};
+
+	if (enc)
+		return crypto_blkcipher_encrypt_iv(&desc, req->dst, req->src,
+						   req->nbytes);
+	return crypto_blkcipher_decrypt_iv(&desc, req->dst, req->src,
+					   req->nbytes);
+}
+
+static void pcrypt_ablkcipher_serial(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+	struct ablkcipher_request *req = preq->data;
+	struct crypto_ablkcipher *tfm = crypto_ablkcipher_reqtfm(req);
+	struct pcrypt_ablkcipher_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+
+	atomic_dec(&ctx->inflight);
+	ablkcipher_request_complete(req, padata->info);
+}
+
+static void pcrypt_ablkcipher_enc(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+
+	padata->info = pcrypt_blkcipher_crypt(preq->data, 1, 0);
+
+	padata_do_serial(padata);
+}
+
+static void pcrypt_ablkcipher_dec(struct padata_priv *padata)
+{
+	struct pcrypt_request *preq = pcrypt_padata_request(padata);
+
+	padata->info = pcrypt_blkcipher_crypt(preq->data, 0, 0);
+
+	padata_do_serial(padata);
+}
+
+/*
+ * A small request on an idle tfm gains nothing from another cpu; with
+ * two cores the round trip through padata would cost more than the
+ * cipher itself.
+ */
+static bool pcrypt_ablkcipher_lowlat(struct pcrypt_ablkcipher_ctx *ctx,
+				     struct ablkcipher_request *req)
+{
+	unsigned long now = jiffies;
+
+	if (req->nbytes > lowlat_bytes || atomic_read(&ctx->inflight))
+		return false;
+
+	if (ctx->last_direct == now)
+		return false;
+
+	ctx->last_direct = now;
+	return true;
+}
+
+static int pcrypt_ablkcipher_crypt(struct ablkcipher_request *req, int enc)
+{
+	int err;
+	struct pcrypt_request *preq = ablkcipher_request_ctx(req);
+	struct padata_priv *padata = pcrypt_request_padata(preq);
+	struct crypto_ablkcipher *tfm = crypto_ablkcipher_reqtfm(req);
+	struct pcrypt_ablkcipher_ctx *ctx = crypto_ablkcipher_ctx(tfm);
+	u32 flags = ablkcipher_request_flags(req);
+
+	if (pcrypt_ablkcipher_lowlat(ctx, req))
+		return pcrypt_blkcipher_crypt(req, enc,
+					      flags & CRYPTO_TFM_REQ_MAY_SLEEP);
+
+	memset(padata, 0, sizeof(struct padata_priv));
+
+	padata->parallel = enc ? pcrypt_ablkcipher_enc : pcrypt_ablkcipher_dec;
+	padata->serial = pcrypt_ablkcipher_serial;
+	preq->data = req;
+
+	atomic_inc(&ctx->inflight);
+	err = pcrypt_do_parallel(padata, &ctx->cb_cpu,
+				 enc ? pcrypt_enc_padata : pcrypt_dec_padata);
+	if (err == -EINPROGRESS)
+		return err;
+	atomic_dec(&ctx->inflight);
+
+	/*
+	 * padata is stopped, or full and the caller allows backlogging:
+	 * do the work here. This is the only case in which a request can
+	 * complete ahead of earlier ones on the same tfm.
+	 */
+	if (!err || (err == -EBUSY && (flags & CRYPTO_TFM_REQ_MAY_BACKLOG)))
+		err = pcrypt_blkcipher_crypt(req, enc,
+					     flags & CRYPTO_TFM_REQ_MAY_SLEEP);
+
+	return err;
+}
+
+static int pcrypt_ablkcipher_encrypt(struct ablkcipher_request *req)
+{
+	return pcrypt_ablkcipher_crypt(req, 1);
+}
+
+static int pcrypt_ablkcipher_decrypt(struct ablkcipher_request *req)
+{
+	return pcrypt_ablkcipher_crypt(req, 0);
+}
+
+static int pcrypt_ablkcipher_init_tfm(struct crypto_tfm *tfm)
+{
+	struct crypto_instance *inst = crypto_tfm_alg_instance(tfm);
+	struct pcrypt_instance_ctx *ictx = crypto_instance_ctx(inst);
+	struct pcrypt_ablkcipher_ctx *ctx = crypto_tfm_ctx(tfm);
+	struct crypto_blkcipher *cipher;
+
+	ctx->cb_cpu = pcrypt_next_cb_cpu(ictx);
+
+	cipher = crypto_spawn_blkcipher(crypto_instance_ctx(inst));
+
+	if (IS_ERR(cipher))
+		return PTR_ERR(cipher);
+
+	ctx->child = cipher;
+	atomic_set(&ctx->inflight, 0);
+	ctx->last_direct = jiffies - 1;
+	tfm->crt_ablkcipher.reqsize = sizeof(struct pcrypt_request);
+
+	return 0;
+}
+
+static void pcrypt_ablkcipher_exit_tfm(struct crypto_tfm *tfm)
+{
+	struct pcrypt_ablkcipher_ctx *ctx = crypto_tfm_ctx(tfm);
+
+	crypto_free_blkcipher(ctx->child);
+}
+
 static struct crypto_instance *pcrypt_alloc_instance(struct crypto_alg *alg)
 {
 	struct crypto_instance *inst;
@@ -352,6 +542,43 @@ out_put_alg:
 	return inst;
 }
 
+static struct crypto_instance *pcrypt_alloc_ablkcipher(struct rtattr **tb)
+{
+	struct crypto_instance *inst;
+	struct crypto_alg *alg;
+
+	/* Only synchronous ciphers are spread over the cpus */
+	alg = crypto_get_attr_alg(tb, CRYPTO_ALG_TYPE_BLKCIPHER,
+				  CRYPTO_ALG_TYPE_MASK | CRYPTO_ALG_ASYNC);
+	if (IS_ERR(alg))
+		return ERR_CAST(alg);
+
+	inst = pcrypt_alloc_instance(alg);
+	if (IS_ERR(inst))
+		goto out_put_alg;
+
+	inst->alg.cra_flags = CRYPTO_ALG_TYPE_ABLKCIPHER | CRYPTO_ALG_ASYNC;
+	inst->alg.cra_type = &crypto_ablkcipher_type;
+
+	inst->alg.cra_ablkcipher.ivsize = alg->cra_blkcipher.ivsize;
+	inst->alg.cra_ablkcipher.min_keysize = alg->cra_blkcipher.min_keysize;
+	inst->alg.cra_ablkcipher.max_keysize = alg->cra_blkcipher.max_keysize;
+	inst->alg.cra_ablkcipher.geniv = alg->cra_blkcipher.geniv;
+
+	inst->alg.cra_ctxsize = sizeof(struct pcrypt_ablkcipher_ctx);
+
+	inst->alg.cra_init = pcrypt_ablkcipher_init_tfm;
+	inst->alg.cra_exit = pcrypt_ablkcipher_exit_tfm;
+
+	inst->alg.cra_ablkcipher.setkey = pcrypt_ablkcipher_setkey;
+	inst->alg.cra_ablkcipher.encrypt = pcrypt_ablkcipher_encrypt;
+	inst->alg.cra_ablkcipher.decrypt = pcrypt_ablkcipher_decrypt;
+
+out_put_alg:
+	crypto_mod_put(alg);
+	return inst;
+}
+
 static struct crypto_instance *pcrypt_alloc(struct rtattr **tb)
 {
 	struct crypto_attr_type *algt;
@@ -363,6 +590,9 @@ static struct crypto_instance *pcrypt_alloc(struct rtattr **tb)
 	switch (algt->type & algt->mask & CRYPTO_ALG_TYPE_MASK) {
 	case CRYPTO_ALG_TYPE_AEAD:
 		return pcrypt_alloc_aead(tb, algt->type, algt->mask);
+	case CRYPTO_ALG_TYPE_BLKCIPHER:
+	case CRYPTO_ALG_TYPE_ABLKCIPHER:
+		return pcrypt_alloc_ablkcipher(tb);
 	}
 
 	return ERR_PTR(-EINVAL);
@@ -21,11 +21,13 @@
 #include <linux/gfp.h>
 #include <linux/module.h>
 #include <linux/scatterlist.h>
+#include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/moduleparam.h>
 #include <linux/jiffies.h>
 #include <linux/timex.h>
 #include <linux/interrupt.h>
+#include <linux/random.h>
 #include "tcrypt.h"
 #include "internal.h"
 
@@ -57,7 +59,7 @@ static char *check[] = {
 	"cast6", "arc4", "michael_mic", "deflate", "crc32c", "tea", "xtea",
 	"khazad", "wp512", "wp384", "wp256", "tnepres", "xeta",  "fcrypt",
 	"camellia", "seed", "salsa20", "rmd128", "rmd160", "rmd256", "rmd320",
-	"lzo", "cts", "zlib", NULL
+	"lzo", "cts", "zlib", "lz4", "lz4hc", NULL
 };
 
 static int test_cipher_jiffies(struct blkcipher_desc *desc, int enc,
@@ -711,6 +713,489 @@ out:
 	crypto_free_ahash(tfm);
 }
 
+/*
+ * Used by test_acipher_speed(): the throughput run keeps this many
+ * requests in flight, so that parallel and async engines have work.
+ */
+#define ACIPHER_DEPTH	8
+
+struct acipher_slot {
+	struct ablkcipher_request *req;
+	struct tcrypt_result result;
+	struct scatterlist sg;
+	char *buf;
+	char iv[128];
+};
+
+static inline int do_one_acipher_op(struct ablkcipher_request *req, int ret)
+{
+	if (ret == -EINPROGRESS || ret == -EBUSY) {
+		struct tcrypt_result *tr = req->base.data;
+
+		wait_for_completion(&tr->completion);
+		ret = tr->err;
+		INIT_COMPLETION(tr->completion);
+	}
+	return ret;
+}
+
+static inline int acipher_submit(struct acipher_slot *slot, int enc)
+{
+	if (enc)
+		return crypto_ablkcipher_encrypt(slot->req);
+	return crypto_ablkcipher_decrypt(slot->req);
+}
+
+static int test_acipher_jiffies(struct acipher_slot *slots, int depth,
+				int enc, int blen, int sec)
+{
+	unsigned long start, end;
+	int ret[ACIPHER_DEPTH];
+	int bcount, err, i;
+
+	for (start = jiffies, end = start + sec * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount += depth) {
+		for (i = 0; i < depth; i++)
+			ret[i] = acipher_submit(&slots[i], enc);
+
+		/* reap all of them, even if one failed */
+		for (err = 0, i = 0; i < depth; i++) {
+			ret[i] = do_one_acipher_op(slots[i].req, ret[i]);
+			if (ret[i] && !err)
+				err = ret[i];
+		}
+		if (err)
+			return err;
+	}
+
+	printk("%d operations in %d seconds (%ld bytes), %d in flight\n",
+	       bcount, sec, (long)bcount * blen, depth);
+	return 0;
+}
+
+static int test_acipher_cycles(struct acipher_slot *slot, int enc, int blen)
+{
+	unsigned long cycles = 0;
+	int ret = 0;
+	int i;
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		ret = do_one_acipher_op(slot->req, acipher_submit(slot, enc));
+		if (ret)
+			goto out;
+	}
+
+	/* The real thing, one request at a time. */
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+		ret = do_one_acipher_op(slot->req, acipher_submit(slot, enc));
+		end = get_cycles();
+
+		if (ret)
+			goto out;
+
+		cycles += end - start;
+	}
+
+out:
+	if (ret == 0)
+		printk("1 operation in %lu cycles (%d bytes)\n",
+		       (cycles + 4) / 8, blen);
+
+	return ret;
+}
+
+/*
+ * With sec set, reports throughput with one request in flight, which
+ * gives the latency, and with ACIPHER_DEPTH in flight.
+ */
+static void test_acipher_speed(const char *algo, int enc, unsigned int sec,
+			       struct cipher_speed_template *template,
+			       unsigned int tcount, u8 *keysize)
+{
+	unsigned int ret, i, j, iv_len;
+	struct crypto_ablkcipher *tfm;
+	struct acipher_slot *slots;
+	const char *key;
+	const char *e;
+	u32 *b_size;
+
+	if (enc == ENCRYPT)
+		e = "encryption";
+	else
+		e = "decryption";
+
+	printk("\ntesting speed of async %s %s\n", algo, e);
+
+	tfm = crypto_alloc_ablkcipher(algo, 0, 0);
+
+	if (IS_ERR(tfm)) {
+		printk("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	slots = kcalloc(ACIPHER_DEPTH, sizeof(*slots), GFP_KERNEL);
+	if (!slots)
+		goto out;
+
+	for (j = 0; j < ACIPHER_DEPTH; j++) {
+		/* room for the largest of block_sizes[] */
+		slots[j].buf = kmalloc(block_sizes[ARRAY_SIZE(block_sizes) - 2],
+				       GFP_KERNEL);
+		slots[j].req = ablkcipher_request_alloc(tfm, GFP_KERNEL);
+		if (!slots[j].buf || !slots[j].req) {
+			printk("acipher request allocation failure\n");
+			goto out_free;
+		}
+		init_completion(&slots[j].result.completion);
+		ablkcipher_request_set_callback(slots[j].req,
+						CRYPTO_TFM_REQ_MAY_BACKLOG,
+						tcrypt_complete,
+						&slots[j].result);
+	}
+
+	i = 0;
+	do {
+
+		b_size = block_sizes;
+		do {
+			printk("test %u (%d bit key, %d byte blocks): ", i,
+					*keysize * 8, *b_size);
+
+			memset(tvmem[0], 0xff, PAGE_SIZE);
+
+			/* set key, plain text and IV */
+			key = tvmem[0];
+			for (j = 0; j < tcount; j++) {
+				if (template[j].klen == *keysize) {
+					key = template[j].key;
+					break;
+				}
+			}
+
+			crypto_ablkcipher_clear_flags(tfm, ~0);
+			ret = crypto_ablkcipher_setkey(tfm, key, *keysize);
+			if (ret) {
+				printk("setkey() failed flags=%x\n",
+						crypto_ablkcipher_get_flags(tfm));
+				goto out_free;
+			}
+
+			iv_len = crypto_ablkcipher_ivsize(tfm);
+			for (j = 0; j < ACIPHER_DEPTH; j++) {
+				memset(slots[j].buf, 0xff, *b_size);
+				memset(slots[j].iv, 0xff, iv_len);
+				sg_init_one(&slots[j].sg, slots[j].buf,
+					    *b_size);
+				ablkcipher_request_set_crypt(slots[j].req,
+							     &slots[j].sg,
+							     &slots[j].sg,
+							     *b_size,
+							     slots[j].iv);
+			}
+
+			if (sec) {
+				ret = test_acipher_jiffies(slots, 1, enc,
+							   *b_size, sec);
+				if (!ret)
+					ret = test_acipher_jiffies(slots,
+								   ACIPHER_DEPTH,
+								   enc, *b_size,
+								   sec);
+			} else
+				ret = test_acipher_cycles(slots, enc, *b_size);
+
+			if (ret) {
+				printk("%s() failed ret=%d\n", e, ret);
+				break;
+			}
+			b_size++;
+			i++;
+		} while (*b_size);
+		keysize++;
+	} while (*keysize);
+
+out_free:
+	for (j = 0; j < ACIPHER_DEPTH; j++) {
+		ablkcipher_request_free(slots[j].req);
+		kfree(slots[j].buf);
+	}
+	kfree(slots);
+out:
+	crypto_free_ablkcipher(tfm);
+}
+
+/*
+ * Used by test_comp_speed() and test_comp_fuzz(): page sized samples
+ * resembling what zram and zcache are asked to compress.
+ */
+enum { COMP_ZERO, COMP_HEAP, COMP_TEXT, COMP_RANDOM, COMP_CORPORA };
+
+static const char *comp_corpus[COMP_CORPORA] = {
+	"zero", "heap", "text", "random"
+};
+
+/* Room for an incompressible page, and poison to catch overruns */
+#define COMP_BUF_SIZE	(2 * PAGE_SIZE)
+#define COMP_POISON	0xa5
+#define COMP_FUZZ_ITERS	1000
+
+static void comp_fill(int corpus, u8 *buf)
+{
+	static const char * const words[] = {
+		"the ", "of ", "page ", "memory ", "kernel ", "\n",
+		"return ", "0, ",
+	};
+	unsigned int i, len;
+	u32 w;
+
+	switch (corpus) {
+	case COMP_ZERO:
+		memset(buf, 0, PAGE_SIZE);
+		break;
+
+	case COMP_HEAP:
+		/* zeroes, pointers into one small arena and small integers */
+		for (i = 0; i < PAGE_SIZE; i += sizeof(w)) {
+			w = random32();
+			if ((w & 7) < 3)
+				w = 0;
+			else if ((w & 7) < 6)
+				w = 0x40000000 | ((w >> 8) & 0xfff0);
+			else
+				w = (w >> 8) % 100;
+			memcpy(buf + i, &w, sizeof(w));
+		}
+		break;
+
+	case COMP_TEXT:
+		for (i = 0; i < PAGE_SIZE; i += len) {
+			const char *word = words[random32() % ARRAY_SIZE(words)];
+
+			len = min_t(unsigned int, strlen(word), PAGE_SIZE - i);
+			memcpy(buf + i, word, len);
+		}
+		break;
+
+	default:
+		get_random_bytes(buf, PAGE_SIZE);
+		break;
+	}
+}
+
+static inline int do_one_comp_op(struct crypto_comp *tfm, int comp,
+				  const u8 *src, unsigned int slen, u8 *dst)
+{
+	unsigned int dlen = comp ? COMP_BUF_SIZE : PAGE_SIZE;
+
+	if (comp)
+		return crypto_comp_compress(tfm, src, slen, dst, &dlen);
+	return crypto_comp_decompress(tfm, src, slen, dst, &dlen);
+}
+
+static int test_comp_jiffies(struct crypto_comp *tfm, int comp, const u8 *src,
+			     unsigned int slen, u8 *dst, int sec)
+{
+	unsigned long start, end;
+	int bcount;
+	int ret;
+
+	for (start = jiffies, end = start + sec * HZ, bcount = 0;
+	     time_before(jiffies, end); bcount++) {
+		ret = do_one_comp_op(tfm, comp, src, slen, dst);
+		if (ret)
+			return ret;
+	}
+
+	printk("%d operations in %d seconds (%ld bytes)\n",
+	       bcount, sec, (long)bcount * PAGE_SIZE);
+	return 0;
+}
+
+static int test_comp_cycles(struct crypto_comp *tfm, int comp, const u8 *src,
+			    unsigned int slen, u8 *dst)
+{
+	unsigned long cycles = 0;
+	int ret = 0;
+	int i;
+
+	local_bh_disable();
+	local_irq_disable();
+
+	/* Warm-up run. */
+	for (i = 0; i < 4; i++) {
+		ret = do_one_comp_op(tfm, comp, src, slen, dst);
+		if (ret)
+			goto out;
+	}
+
+	/* The real thing. */
+	for (i = 0; i < 8; i++) {
+		cycles_t start, end;
+
+		start = get_cycles();
+		ret = do_one_comp_op(tfm, comp, src, slen, dst);
+		end = get_cycles();
+
+		if (ret)
+			goto out;
+
+		cycles += end - start;
+	}
+
+out:
+	local_irq_enable();
+	local_bh_enable();
+
+	if (ret == 0)
+		printk("1 operation in %lu cycles (%lu bytes)\n",
+		       (cycles + 4) / 8, PAGE_SIZE);
+
+	return ret;
+}
+
+static void test_comp_speed(const char *algo, unsigned int sec)
+{
+	struct crypto_comp *tfm;
+	unsigned int clen, dlen;
+	u8 *src = tvmem[0], *dst = tvmem[1];
+	u8 *cbuf;
+	int i, ret;
+
+	printk("\ntesting speed of %s compression\n", algo);
+
+	tfm = crypto_alloc_comp(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		printk("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return;
+	}
+
+	cbuf = kmalloc(COMP_BUF_SIZE, GFP_KERNEL);
+	if (!cbuf)
+		goto out;
+
+	for (i = 0; i < COMP_CORPORA; i++) {
+		comp_fill(i, src);
+
+		clen = COMP_BUF_SIZE;
+		ret = crypto_comp_compress(tfm, src, PAGE_SIZE, cbuf, &clen);
+		dlen = PAGE_SIZE;
+		if (!ret)
+			ret = crypto_comp_decompress(tfm, cbuf, clen, dst,
+						     &dlen);
+		if (ret || dlen != PAGE_SIZE || memcmp(src, dst, PAGE_SIZE)) {
+			printk("%s: round trip of %s page failed\n", algo,
+			       comp_corpus[i]);
+			break;
+		}
+
+		printk("test %d (%s page, %u bytes compressed) compress: ",
+		       i, comp_corpus[i], clen);
+		if (sec)
+			ret = test_comp_jiffies(tfm, 1, src, PAGE_SIZE, cbuf,
+						sec);
+		else
+			ret = test_comp_cycles(tfm, 1, src, PAGE_SIZE, cbuf);
+		if (ret)
+			break;
+
+		printk("test %d (%s page, %u bytes compressed) decompress: ",
+		       i, comp_corpus[i], clen);
+		if (sec)
+			ret = test_comp_jiffies(tfm, 0, cbuf, clen, dst, sec);
+		else
+			ret = test_comp_cycles(tfm, 0, cbuf, clen, dst);
+		if (ret)
+			break;
+	}
+
+	kfree(cbuf);
+out:
+	crypto_free_comp(tfm);
+}
+
+/*
+ * Decompress damaged copies of each corpus: flipped bits, truncated
+ * input and short output buffers.  The result may be an error or some
+ * output, but nothing may be written past the space that was given.
+ */
+static int test_comp_fuzz(const char *algo)
+{
+	struct crypto_comp *tfm;
+	unsigned int clen, flen, olen, dlen;
+	u8 *src = tvmem[0], *cbuf, *fbuf, *dbuf;
+	int i, j, n, bad = 0;
+	int ret = -ENOMEM;
+
+	printk("\nfuzzing %s decompression\n", algo);
+
+	tfm = crypto_alloc_comp(algo, 0, 0);
+	if (IS_ERR(tfm)) {
+		printk("failed to load transform for %s: %ld\n", algo,
+		       PTR_ERR(tfm));
+		return PTR_ERR(tfm);
+	}
+
+	cbuf = kmalloc(COMP_BUF_SIZE, GFP_KERNEL);
+	fbuf = kmalloc(COMP_BUF_SIZE, GFP_KERNEL);
+	dbuf = kmalloc(COMP_BUF_SIZE, GFP_KERNEL);
+	if (!cbuf || !fbuf || !dbuf)
+		goto out;
+
+	for (i = 0; i < COMP_CORPORA; i++) {
+		comp_fill(i, src);
+		clen = COMP_BUF_SIZE;
+		ret = crypto_comp_compress(tfm, src, PAGE_SIZE, cbuf, &clen);
+		if (ret) {
+			printk("%s: compressing %s page failed\n", algo,
+			       comp_corpus[i]);
+			goto out;
+		}
+
+		for (j = 0; j < COMP_FUZZ_ITERS; j++) {
+			memcpy(fbuf, cbuf, clen);
+			for (n = random32() % 4; n >= 0; n--)
+				fbuf[random32() % clen] ^= 1 << (random32() % 8);
+			flen = clen;
+			if (!(random32() % 4))
+				flen = random32() % (clen + 1);
+			olen = PAGE_SIZE;
+			if (random32() % 2)
+				olen = random32() % (PAGE_SIZE + 1);
+
+			memset(dbuf, COMP_POISON, COMP_BUF_SIZE);
+			dlen = olen;
+			crypto_comp_decompress(tfm, fbuf, flen, dbuf, &dlen);
+
+			for (n = olen; n < COMP_BUF_SIZE; n++)
+				if (dbuf[n] != COMP_POISON)
+					break;
+			if (dlen > olen || n < COMP_BUF_SIZE) {
+				printk("%s: %s page, iteration %d: wrote past "
+				       "%u byte output\n", algo,
+				       comp_corpus[i], j, olen);
+				bad++;
+			}
+		}
+	}
+
+	printk("%d decompressions of damaged input, %d overruns\n",
+	       COMP_CORPORA * COMP_FUZZ_ITERS, bad);
+	ret = bad ? -EINVAL : 0;
+
+out:
+	kfree(dbuf);
+	kfree(fbuf);
+	kfree(cbuf);
+	crypto_free_comp(tfm);
+	return ret;
+}
+
 static void test_available(void)
 {
 	char **name = check;
@@ -936,6 +1421,14 @@ static int do_test(int m)
 		ret += tcrypt_test("rfc4309(ccm(aes))");
 		break;
 
+	case 46:
+		ret += tcrypt_test("lz4");
+		break;
+
+	case 47:
+		ret += tcrypt_test("lz4hc");
+		break;
+
 	case 100:
 		ret += tcrypt_test("hmac(md5)");
 		break;
@@ -997,6 +1490,10 @@ static int do_test(int m)
 				speed_template_32_48_64);
 		test_cipher_speed("xts(aes)", DECRYPT, sec, NULL, 0,
 				speed_template_32_48_64);
+		test_cipher_speed("ctr(aes)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("ctr(aes)", DECRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
 		break;
 
 	case 201:
@@ -1063,6 +1560,38 @@ static int do_test(int m)
 				  speed_template_16_32);
 		break;
 
+	case 207:
+		/* mode 200 runs the best AES; these pin the generic C one */
+		test_cipher_speed("ecb(aes-generic)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("ecb(aes-generic)", DECRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("cbc(aes-generic)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("cbc(aes-generic)", DECRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("ctr(aes-generic)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("xts(aes-generic)", ENCRYPT, sec, NULL, 0,
+				speed_template_32_48_64);
+		break;
+
+	case 208:
+		/* ... and the single block assembler one */
+		test_cipher_speed("ecb(aes-asm)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("ecb(aes-asm)", DECRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("cbc(aes-asm)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("cbc(aes-asm)", DECRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("ctr(aes-asm)", ENCRYPT, sec, NULL, 0,
+				speed_template_16_24_32);
+		test_cipher_speed("xts(aes-asm)", ENCRYPT, sec, NULL, 0,
+				speed_template_32_48_64);
+		break;
+
 	case 300:
 		/* fall through */
 
@@ -1138,6 +1667,24 @@ static int do_test(int m)
 		test_hash_speed("ghash-generic", sec, hash_speed_template_16);
 		if (mode > 300 && mode < 400) break;
 
+	case 319:
+		test_hash_speed("sha1-generic", sec, generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 320:
+		test_hash_speed("sha256-generic", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 321:
+		test_hash_speed("crc32c", sec, generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
+	case 322:
+		test_hash_speed("crc32c-generic", sec,
+				generic_hash_speed_template);
+		if (mode > 300 && mode < 400) break;
+
 	case 399:
 		break;
 
@@ -1215,6 +1762,44 @@ static int do_test(int m)
 	case 499:
 		break;
 
+	case 500:
+		test_acipher_speed("cbc(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("cbc(aes)", DECRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("ctr(aes)", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		break;
+
+	case 501:
+		test_acipher_speed("pcrypt(cbc(aes))", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("pcrypt(cbc(aes))", DECRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		test_acipher_speed("pcrypt(ctr(aes))", ENCRYPT, sec, NULL, 0,
+				   speed_template_16_24_32);
+		break;
+
+	case 600:
+		ret += test_comp_fuzz("lzo");
+		test_comp_speed("lzo", sec);
+		break;
+
+	case 601:
+		ret += test_comp_fuzz("lz4");
+		test_comp_speed("lz4", sec);
+		break;
+
+	case 602:
+		ret += test_comp_fuzz("lz4hc");
+		test_comp_speed("lz4hc", sec);
+		break;
+
+	case 603:
+		ret += test_comp_fuzz("deflate");
+		test_comp_speed("deflate", sec);
+		break;
+
 	case 1000:
 		test_available();
 		break;
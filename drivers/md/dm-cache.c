@@ -37,6 +37,7 @@
 #include <linux/spinlock.h>
 #include <linux/workqueue.h>
 #include <linux/pagemap.h>
+#include <linux/math64.h>
 #include "dm.h"
 #include <linux/dm-io.h>
 #include <linux/dm-kcopyd.h>
@@ -72,11 +73,36 @@
 #define RESERVED	2	/* Allocated but data not in place yet */
 #define DIRTY		4	/* Locally modified */
 #define WRITEBACK	8	/* In the process of write back */
+#define DIRTYING	16	/* Dirty, but not recorded on the cache device yet */
 
 #define is_state(x, y)		(x & y)
 #define set_state(x, y)		(x |= y)
 #define clear_state(x, y)	(x &= ~y)
 
+struct cache_c;
+struct cacheblock;
+
+/*
+ * Replacement and promotion policy.
+ * Each device picks one by name. The policy orders the blocks of a set for
+ * eviction and decides whether a missed block is worth bringing into the
+ * cache at all. All hooks are called from the map path.
+ */
+struct cache_policy {
+	const char *name;
+	int (*init)(struct cache_c *dmc);	/* Optional */
+	void (*exit)(struct cache_c *dmc);	/* Optional */
+	void (*hit)(struct cache_c *dmc, struct cacheblock *cb);
+	void (*insert)(struct cache_c *dmc, struct cacheblock *cb);
+	/* The block with the lowest key in a set is replaced first */
+	u64 (*victim_key)(struct cache_c *dmc, struct cacheblock *cb);
+	/* Optional: return 0 to leave a missed block uncached */
+	int (*promote)(struct cache_c *dmc, sector_t block);
+};
+
+#define CACHE_POLICY_NAME_LEN	16
+#define DEFAULT_CACHE_POLICY	"lru"
+
 /*
  * Cache context
  */
@@ -96,6 +122,8 @@ struct cache_c {
 	unsigned long counter;		/* Logical timestamp of last access */
 	unsigned int write_policy;	/* Cache write policy */
 	sector_t dirty_blocks;		/* Number of dirty blocks */
+	struct cache_policy *policy;	/* Replacement and promotion policy */
+	void *policy_data;		/* Private data of the policy */
 
 	spinlock_t lock;		/* Lock to protect page allocation/deallocation */
 	struct page_list *pages;	/* Pages for I/O */
@@ -105,6 +133,16 @@ struct cache_c {
 	atomic_t nr_jobs;		/* Number of I/O jobs */
 	struct dm_io_client *io_client;   /* Client memory pool*/
 
+	/* Jobs of this device, processed by its own kcached thread */
+	struct workqueue_struct *kcached_wq;
+	struct work_struct kcached_work;
+	spinlock_t job_lock;		/* Lock to protect the job lists */
+	struct list_head complete_jobs;
+	struct list_head io_jobs;
+	struct list_head pages_jobs;
+	struct list_head meta_jobs;	/* Waiting for a metadata update */
+	void *meta_buf;			/* Metadata sector, for kcached only */
+
 	/* Stats */
 	unsigned long reads;		/* Number of reads */
 	unsigned long writes;		/* Number of writes */
@@ -112,6 +150,9 @@ struct cache_c {
 	unsigned long replace;		/* Number of cache replacements */
 	unsigned long writeback;	/* Number of replaced dirty blocks */
 	unsigned long dirty;		/* Number of submitted dirty blocks */
+	unsigned long promotions;	/* Number of blocks brought into the cache */
+	unsigned long bypassed;		/* Number of misses left uncached by the policy */
+	unsigned long meta_writes;	/* Number of metadata updates */
 };
 
 /* Cache block metadata structure */
@@ -119,10 +160,16 @@ struct cacheblock {
 	spinlock_t lock;	/* Lock to protect operations on the bio list */
 	sector_t block;		/* Sector number of the cached block */
 	unsigned short state;	/* State of a block */
+	unsigned short freq;	/* Access count, for the mq and lfu policies */
 	unsigned long counter;	/* Logical timestamp of the block's last access */
 	struct bio_list bios;	/* List of pending bios */
 };
 
+/* What a job in meta_jobs does once the metadata is written */
+#define JOB_STORE	0	/* Complete the insertion of a dirty block */
+#define JOB_DIRTY	1	/* Submit the write that made a block dirty */
+#define JOB_CLEAN	2	/* Complete the write back of dirty blocks */
+
 /* Structure for a kcached job */
 struct kcached_job {
 	struct list_head list;
@@ -132,6 +179,9 @@ struct kcached_job {
 	struct dm_io_region dest;
 	struct cacheblock *cacheblock;
 	int rw;
+	int type;		/* JOB_* */
+	int error;
+	unsigned int nr_blocks;	/* Cache blocks from cacheblock on */
 	/*
 	 * When the original bio is not aligned with cache blocks,
 	 * we need extra bvecs and pages for padding.
@@ -293,12 +343,9 @@ static void free_bio_pages(struct cache_c *dmc)
 	dmc->nr_free_pages = dmc->nr_pages = 0;
 }
 
-static struct workqueue_struct *_kcached_wq;
-static struct work_struct _kcached_work;
-
-static inline void wake(void)
+static inline void wake(struct cache_c *dmc)
 {
-	queue_work(_kcached_wq, &_kcached_work);
+	queue_work(dmc->kcached_wq, &dmc->kcached_work);
 }
 
 #define MIN_JOBS 1024
@@ -306,12 +353,6 @@ static inline void wake(void)
 static struct kmem_cache *_job_cache;
 static mempool_t *_job_pool;
 
-static DEFINE_SPINLOCK(_job_lock);
-
-static LIST_HEAD(_complete_jobs);
-static LIST_HEAD(_io_jobs);
-static LIST_HEAD(_pages_jobs);
-
 static int jobs_init(void)
 {
 	_job_cache = kmem_cache_create("kcached-jobs",
@@ -333,10 +374,6 @@ static int jobs_init(void)
 
 static void jobs_exit(void)
 {
-	BUG_ON(!list_empty(&_complete_jobs));
-	BUG_ON(!list_empty(&_io_jobs));
-	BUG_ON(!list_empty(&_pages_jobs));
-
 	mempool_destroy(_job_pool);
 	kmem_cache_destroy(_job_cache);
 	_job_pool = NULL;
@@ -344,31 +381,34 @@ static void jobs_exit(void)
 }
 
 /*
- * Functions to push and pop a job onto the head of a given job list.
+ * Functions to push and pop a job onto the head of one of a device's job
+ * lists.
  */
-static inline struct kcached_job *pop(struct list_head *jobs)
+static inline struct kcached_job *pop(struct cache_c *dmc,
+				      struct list_head *jobs)
 {
 	struct kcached_job *job = NULL;
 	unsigned long flags;
 
-	spin_lock_irqsave(&_job_lock, flags);
+	spin_lock_irqsave(&dmc->job_lock, flags);
 
 	if (!list_empty(jobs)) {
 		job = list_entry(jobs->next, struct kcached_job, list);
 		list_del(&job->list);
 	}
-	spin_unlock_irqrestore(&_job_lock, flags);
+	spin_unlock_irqrestore(&dmc->job_lock, flags);
 
 	return job;
 }
 
 static inline void push(struct list_head *jobs, struct kcached_job *job)
 {
+	struct cache_c *dmc = job->dmc;
 	unsigned long flags;
 
-	spin_lock_irqsave(&_job_lock, flags);
+	spin_lock_irqsave(&dmc->job_lock, flags);
 	list_add_tail(&job->list, jobs);
-	spin_unlock_irqrestore(&_job_lock, flags);
+	spin_unlock_irqrestore(&dmc->job_lock, flags);
 }
 
 
@@ -382,6 +422,7 @@ static inline void push(struct list_head *jobs, struct kcached_job *job)
 static void io_callback(unsigned long error, void *context)
 {
 	struct kcached_job *job = (struct kcached_job *) context;
+	struct cache_c *dmc = job->dmc;
 
 	if (error) {
 		/* TODO */
@@ -391,10 +432,13 @@ static void io_callback(unsigned long error, void *context)
 
 	if (job->rw == READ) {
 		job->rw = WRITE;
-		push(&_io_jobs, job);
-	} else
-		push(&_complete_jobs, job);
-	wake();
+		push(&dmc->io_jobs, job);
+	} else if (is_state(job->cacheblock->state, DIRTY))
+		/* A write back insertion is only done once recorded dirty */
+		push(&dmc->meta_jobs, job);
+	else
+		push(&dmc->complete_jobs, job);
+	wake(dmc);
 }
 
 /*
@@ -656,26 +700,32 @@ static int do_pages(struct kcached_job *job)
 		return 1;
 
 	/* this job is ready for io */
-	push(&_io_jobs, job);
+	push(&job->dmc->io_jobs, job);
 	return 0;
 }
 
+static int cache_write_hit(struct cache_c *dmc, struct bio *bio,
+			   sector_t cache_block);
+static int update_metadata(struct cache_c *dmc, sector_t index,
+			   unsigned int count, struct cacheblock *stored);
+
 /*
- * Flush the bios that are waiting for this cache insertion or write back.
+ * Flush the bios that were waiting for this cache block to settle, once
+ * @done is cleared from its state. Reads have already been remapped to
+ * the cache. Writes go through cache_write_hit() again, as the block may
+ * have to be recorded dirty first.
  */
-static void flush_bios(struct cacheblock *cacheblock)
+static void flush_bios(struct cache_c *dmc, struct cacheblock *cacheblock,
+		       unsigned short done)
 {
+	sector_t index = cacheblock - dmc->cache;
 	struct bio *bio;
 	struct bio *n;
 
 	spin_lock(&cacheblock->lock);
 	bio = bio_list_get(&cacheblock->bios);
-	if (is_state(cacheblock->state, WRITEBACK)) { /* Write back finished */
-		cacheblock->state = VALID;
-	} else { /* Cache insertion finished */
-		set_state(cacheblock->state, VALID);
-		clear_state(cacheblock->state, RESERVED);
-	}
+	clear_state(cacheblock->state, done);
+	set_state(cacheblock->state, VALID);
 	spin_unlock(&cacheblock->lock);
 
 	while (bio) {
@@ -683,11 +733,23 @@ static void flush_bios(struct cacheblock *cacheblock)
 		bio->bi_next = NULL;
 		DPRINTK("Flush bio: %llu->%llu (%u bytes)",
 		        cacheblock->block, bio->bi_sector, bio->bi_size);
-		generic_make_request(bio);
+		if (bio_data_dir(bio) == READ ||
+		    cache_write_hit(dmc, bio, index))
+			generic_make_request(bio);
 		bio = n;
 	}
 }
 
+static void finish_job(struct kcached_job *job)
+{
+	struct cache_c *dmc = job->dmc;
+
+	mempool_free(job, _job_pool);
+
+	if (atomic_dec_and_test(&dmc->nr_jobs))
+		wake_up(&dmc->destroyq);
+}
+
 static int do_complete(struct kcached_job *job)
 {
 	int i, r = 0;
@@ -701,33 +763,94 @@ static int do_complete(struct kcached_job *job)
 		}
 		bio_put(bio);
 	} else
-		bio_endio(bio, 0);
+		bio_endio(bio, job->error);
 
 	if (job->nr_pages > 0) {
 		kfree(job->bvec);
 		kcached_put_pages(job->dmc, job->pages);
 	}
 
-	flush_bios(job->cacheblock);
-	mempool_free(job, _job_pool);
-
-	if (atomic_dec_and_test(&job->dmc->nr_jobs))
-		wake_up(&job->dmc->destroyq);
+	flush_bios(job->dmc, job->cacheblock, RESERVED);
+	finish_job(job);
 
 	return r;
 }
 
+/*
+ * Record a change of dirty state on the cache device, then carry on with
+ * whatever was waiting for it. This runs in the device's kcached thread,
+ * which also keeps the updates of one metadata sector in order.
+ */
+static int do_meta(struct kcached_job *job)
+{
+	struct cache_c *dmc = job->dmc;
+	struct cacheblock *cb = job->cacheblock;
+	sector_t index = cb - dmc->cache;
+	unsigned int i;
+	int r;
+
+	if (job->type == JOB_CLEAN && !job->error) {
+		/* The copy must be on the source before it is clean */
+		r = blkdev_issue_flush(dmc->src_dev->bdev, GFP_NOIO, NULL,
+				       BLKDEV_IFL_WAIT);
+		if (r && r != -EOPNOTSUPP) {
+			DMERR("do_meta: flush of the source device failed");
+			job->error = r;
+		}
+	}
+
+	if (job->type == JOB_CLEAN && job->error) {
+		/* Write back failed, the blocks stay dirty on disk too */
+		DMERR("do_meta: write back of block %llu failed",
+		      (unsigned long long) index);
+		for (i = 0; i < job->nr_blocks; i++)
+			set_state(cb[i].state, DIRTY);
+		dmc->dirty_blocks += job->nr_blocks;
+	} else {
+		if (job->type == JOB_CLEAN)
+			for (i = 0; i < job->nr_blocks; i++)
+				clear_state(cb[i].state, DIRTY);
+
+		r = update_metadata(dmc, index, job->nr_blocks,
+				    job->type == JOB_STORE ? cb : NULL);
+		if (r) {
+			DMERR("do_meta: metadata update for block %llu failed",
+			      (unsigned long long) index);
+			job->error = -EIO;
+		}
+	}
+
+	switch (job->type) {
+	case JOB_STORE:
+		return do_complete(job);
+	case JOB_DIRTY:
+		if (job->error)
+			bio_endio(job->bio, job->error);
+		else
+			generic_make_request(job->bio);
+		flush_bios(dmc, cb, DIRTYING);
+		break;
+	case JOB_CLEAN:
+		for (i = 0; i < job->nr_blocks; i++)
+			flush_bios(dmc, &cb[i], WRITEBACK);
+		break;
+	}
+
+	finish_job(job);
+	return 0;
+}
+
 /*
  * Run through a list for as long as possible.  Returns the count
  * of successful jobs.
  */
-static int process_jobs(struct list_head *jobs,
+static int process_jobs(struct cache_c *dmc, struct list_head *jobs,
 	                    int (*fn) (struct kcached_job *))
 {
 	struct kcached_job *job;
 	int r, count = 0;
 
-	while ((job = pop(jobs))) {
+	while ((job = pop(dmc, jobs))) {
 		r = fn(job);
 
 		if (r < 0) {
@@ -750,21 +873,28 @@ static int process_jobs(struct list_head *jobs,
 	return count;
 }
 
-static void do_work(struct work_struct *ignored)
+static void do_work(struct work_struct *work)
 {
-	process_jobs(&_complete_jobs, do_complete);
-	process_jobs(&_pages_jobs, do_pages);
-	process_jobs(&_io_jobs, do_io);
+	struct cache_c *dmc = container_of(work, struct cache_c, kcached_work);
+
+	process_jobs(dmc, &dmc->complete_jobs, do_complete);
+	process_jobs(dmc, &dmc->meta_jobs, do_meta);
+	process_jobs(dmc, &dmc->pages_jobs, do_pages);
+	process_jobs(dmc, &dmc->io_jobs, do_io);
 }
 
 static void queue_job(struct kcached_job *job)
 {
-	atomic_inc(&job->dmc->nr_jobs);
-	if (job->nr_pages > 0) /* Request pages */
-		push(&_pages_jobs, job);
+	struct cache_c *dmc = job->dmc;
+
+	atomic_inc(&dmc->nr_jobs);
+	if (job->type != JOB_STORE) /* Only update the metadata */
+		push(&dmc->meta_jobs, job);
+	else if (job->nr_pages > 0) /* Request pages */
+		push(&dmc->pages_jobs, job);
 	else /* Go ahead to do I/O */
-		push(&_io_jobs, job);
-	wake();
+		push(&dmc->io_jobs, job);
+	wake(dmc);
 }
 
 static int kcached_init(struct cache_c *dmc)
@@ -780,6 +910,28 @@ static int kcached_init(struct cache_c *dmc)
 		return r;
 	}
 
+	dmc->meta_buf = vmalloc(512);
+	if (!dmc->meta_buf) {
+		DMERR("kcached_init: Unable to allocate memory");
+		free_bio_pages(dmc);
+		return -ENOMEM;
+	}
+
+	dmc->kcached_wq = create_singlethread_workqueue("kcached");
+	if (!dmc->kcached_wq) {
+		DMERR("kcached_init: Could not start kcached");
+		vfree(dmc->meta_buf);
+		free_bio_pages(dmc);
+		return -ENOMEM;
+	}
+	INIT_WORK(&dmc->kcached_work, do_work);
+
+	spin_lock_init(&dmc->job_lock);
+	INIT_LIST_HEAD(&dmc->complete_jobs);
+	INIT_LIST_HEAD(&dmc->io_jobs);
+	INIT_LIST_HEAD(&dmc->pages_jobs);
+	INIT_LIST_HEAD(&dmc->meta_jobs);
+
 	init_waitqueue_head(&dmc->destroyq);
 	atomic_set(&dmc->nr_jobs, 0);
 
@@ -791,6 +943,14 @@ void kcached_client_destroy(struct cache_c *dmc)
 	/* Wait for completion of all jobs submitted by this client. */
 	wait_event(dmc->destroyq, !atomic_read(&dmc->nr_jobs));
 
+	destroy_workqueue(dmc->kcached_wq);
+
+	BUG_ON(!list_empty(&dmc->complete_jobs));
+	BUG_ON(!list_empty(&dmc->io_jobs));
+	BUG_ON(!list_empty(&dmc->pages_jobs));
+	BUG_ON(!list_empty(&dmc->meta_jobs));
+
+	vfree(dmc->meta_buf);
 	free_bio_pages(dmc);
 }
 
@@ -801,28 +961,26 @@ void kcached_client_destroy(struct cache_c *dmc)
  * use and it is not reasonble to reimplement the same function here. But we
  * need to reserve pages for both kcached and kcopyd. TODO: dynamically change
  * the number of reserved pages.
+ * The blocks are only clean once the cache device says so too, so kcached
+ * records that before they leave the WRITEBACK state.
  ****************************************************************************/
 
-static void copy_callback(int read_err, unsigned int write_err, void *context)
+static void copy_callback(int read_err, unsigned long write_err, void *context)
 {
-	struct cacheblock *cacheblock = (struct cacheblock *) context;
+	struct kcached_job *job = (struct kcached_job *) context;
 
-	flush_bios(cacheblock);
-}
+	if (read_err || write_err)
+		job->error = -EIO;
 
-static void copy_block(struct cache_c *dmc, struct dm_io_region src,
-	                   struct dm_io_region dest, struct cacheblock *cacheblock)
-{
-	DPRINTK("Copying: %llu:%llu->%llu:%llu",
-			src.sector, src.count * 512, dest.sector, dest.count * 512);
-	dm_kcopyd_copy(dmc->kcp_client, &src, 1, &dest, 0, \
-			(dm_kcopyd_notify_fn) copy_callback, (void *)cacheblock);
+	push(&job->dmc->meta_jobs, job);
+	wake(job->dmc);
 }
 
 static void write_back(struct cache_c *dmc, sector_t index, unsigned int length)
 {
 	struct dm_io_region src, dest;
 	struct cacheblock *cacheblock = &dmc->cache[index];
+	struct kcached_job *job;
 	unsigned int i;
 
 	DPRINTK("Write back block %llu(%llu, %u)",
@@ -834,10 +992,22 @@ static void write_back(struct cache_c *dmc, sector_t index, unsigned int length)
 	dest.sector = cacheblock->block;
 	dest.count = dmc->block_size * length;
 
+	job = mempool_alloc(_job_pool, GFP_NOIO);
+	memset(job, 0, sizeof(*job));
+	job->dmc = dmc;
+	job->cacheblock = cacheblock;
+	job->type = JOB_CLEAN;
+	job->nr_blocks = length;
+	atomic_inc(&dmc->nr_jobs);
+
 	for (i=0; i<length; i++)
 		set_state(dmc->cache[index+i].state, WRITEBACK);
 	dmc->dirty_blocks -= length;
-	copy_block(dmc, src, dest, cacheblock);
+
+	DPRINTK("Copying: %llu:%llu->%llu:%llu",
+			src.sector, src.count * 512, dest.sector, dest.count * 512);
+	dm_kcopyd_copy(dmc->kcp_client, &src, 1, &dest, 0,
+		       copy_callback, job);
 }
 
 
@@ -877,6 +1047,193 @@ static void cache_reset_counter(struct cache_c *dmc)
 	dmc->counter = 0;
 }
 
+/* Advance the logical clock on an access */
+static unsigned long cache_tick(struct cache_c *dmc)
+{
+	if (dmc->counter == ULONG_MAX)
+		cache_reset_counter(dmc);
+	return ++dmc->counter;
+}
+
+
+/****************************************************************************
+ *  Replacement and promotion policies.
+ ****************************************************************************/
+
+/*
+ * lru: replace the least recently used block of a set, and cache every
+ * missed block.
+ */
+static void lru_hit(struct cache_c *dmc, struct cacheblock *cb)
+{
+	cb->counter = cache_tick(dmc);
+}
+
+static u64 lru_victim_key(struct cache_c *dmc, struct cacheblock *cb)
+{
+	return cb->counter;
+}
+
+static struct cache_policy lru_policy = {
+	.name		= "lru",
+	.hit		= lru_hit,
+	.insert		= lru_hit,
+	.victim_key	= lru_victim_key,
+};
+
+/*
+ * mq: multi-queue replacement. A block accessed 2^n times sits in queue n,
+ * and drops one queue for every lifetime it goes without an access, the
+ * lifetime being as many accesses as the cache has blocks. The block to
+ * replace is the least recently used one of the lowest queue. With a set
+ * associative cache the queues are never built, the level of a block is
+ * worked out whenever it is looked at.
+ */
+#define MQ_LEVELS	8
+
+static unsigned int mq_level(struct cache_c *dmc, struct cacheblock *cb)
+{
+	unsigned int level = min(fls(cb->freq | 1), MQ_LEVELS) - 1;
+	unsigned long expired = (dmc->counter - cb->counter) >> dmc->bits;
+
+	return level > expired ? level - expired : 0;
+}
+
+static void mq_hit(struct cache_c *dmc, struct cacheblock *cb)
+{
+	unsigned int level = mq_level(dmc, cb);
+
+	/* Make an expiry stick */
+	if (level < min(fls(cb->freq | 1), MQ_LEVELS) - 1)
+		cb->freq = 1 << level;
+	if (cb->freq < USHRT_MAX)
+		cb->freq++;
+	cb->counter = cache_tick(dmc);
+}
+
+static void mq_insert(struct cache_c *dmc, struct cacheblock *cb)
+{
+	cb->freq = 1;
+	cb->counter = cache_tick(dmc);
+}
+
+static u64 mq_victim_key(struct cache_c *dmc, struct cacheblock *cb)
+{
+	return ((u64)mq_level(dmc, cb) << 32) | cb->counter;
+}
+
+static struct cache_policy mq_policy = {
+	.name		= "mq",
+	.hit		= mq_hit,
+	.insert		= mq_insert,
+	.victim_key	= mq_victim_key,
+};
+
+/*
+ * lfu: replace the least frequently used block of a set, the least
+ * recently used one among equals. All counts are halved once per as many
+ * accesses as the cache has blocks, so that old popularity fades; like
+ * the mq levels, that is worked out whenever a block is looked at, from
+ * the lifetimes that began since its last access. A missed
+ * block is only cached when it misses a second time while still
+ * remembered in a small table of recent misses, which keeps blocks that
+ * are read once, as in a scan, from evicting the popular ones.
+ */
+static unsigned int lfu_ghost_bits(struct cache_c *dmc)
+{
+	return dmc->bits > 2 ? dmc->bits - 2 : 0;
+}
+
+static int lfu_init(struct cache_c *dmc)
+{
+	size_t size = sizeof(u32) << lfu_ghost_bits(dmc);
+
+	dmc->policy_data = vmalloc(size);
+	if (!dmc->policy_data)
+		return -ENOMEM;
+	memset(dmc->policy_data, 0, size);
+
+	return 0;
+}
+
+static void lfu_exit(struct cache_c *dmc)
+{
+	vfree(dmc->policy_data);
+}
+
+static unsigned int lfu_freq(struct cache_c *dmc, struct cacheblock *cb)
+{
+	unsigned long halvings = (dmc->counter >> dmc->bits) -
+				 (cb->counter >> dmc->bits);
+
+	return halvings < 16 ? cb->freq >> halvings : 0;
+}
+
+static void lfu_hit(struct cache_c *dmc, struct cacheblock *cb)
+{
+	unsigned long now = cache_tick(dmc);
+
+	/* Make the halving stick before counting this access */
+	cb->freq = lfu_freq(dmc, cb);
+	if (cb->freq < USHRT_MAX)
+		cb->freq++;
+	cb->counter = now;
+}
+
+static void lfu_insert(struct cache_c *dmc, struct cacheblock *cb)
+{
+	cb->freq = 1;
+	cb->counter = cache_tick(dmc);
+}
+
+static u64 lfu_victim_key(struct cache_c *dmc, struct cacheblock *cb)
+{
+	return ((u64)lfu_freq(dmc, cb) << 32) | cb->counter;
+}
+
+static int lfu_promote(struct cache_c *dmc, sector_t block)
+{
+	u32 *ghost = dmc->policy_data;
+	unsigned long value = (unsigned long)(block >> dmc->block_shift);
+	unsigned long slot = hash_long(value, lfu_ghost_bits(dmc));
+	u32 tag = (u32)(value + 1);	/* 0 is an empty slot */
+
+	if (ghost[slot] == tag) {
+		ghost[slot] = 0;
+		return 1;
+	}
+
+	ghost[slot] = tag;
+	return 0;
+}
+
+static struct cache_policy lfu_policy = {
+	.name		= "lfu",
+	.init		= lfu_init,
+	.exit		= lfu_exit,
+	.hit		= lfu_hit,
+	.insert		= lfu_insert,
+	.victim_key	= lfu_victim_key,
+	.promote	= lfu_promote,
+};
+
+static struct cache_policy *cache_policies[] = {
+	&lru_policy,
+	&mq_policy,
+	&lfu_policy,
+};
+
+static struct cache_policy *cache_policy_lookup(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cache_policies); i++)
+		if (!strcmp(cache_policies[i]->name, name))
+			return cache_policies[i];
+
+	return NULL;
+}
+
 /*
  * Lookup a block in the cache.
  *
@@ -885,9 +1242,10 @@ static void cache_reset_counter(struct cache_c *dmc)
  *  0: cache miss but frame is allocated for insertion; cache_block stores the
  *     frame's index:
  *      If there are empty frames, then the first encounted is used.
- *      If there are clean frames, then the LRU clean block is replaced.
- *  2: cache miss and frame is not allocated; cache_block stores the LRU dirty
- *     block's index:
+ *      If there are clean frames, then the clean block the policy ranks
+ *      lowest is replaced.
+ *  2: cache miss and frame is not allocated; cache_block stores the index of
+ *     the dirty block the policy ranks lowest:
  *      This happens when the entire set is dirty.
  * -1: cache miss and no room for insertion:
  *      This happens when the entire set in transition modes (RESERVED or
@@ -903,7 +1261,7 @@ static int cache_lookup(struct cache_c *dmc, sector_t block,
 	unsigned int cache_assoc = dmc->assoc;
 	struct cacheblock *cache = dmc->cache;
 	int invalid = -1, oldest = -1, oldest_clean = -1;
-	unsigned long counter = ULONG_MAX, clean_counter = ULONG_MAX;
+	u64 key, counter = ULLONG_MAX, clean_counter = ULLONG_MAX;
 
 	index=set_number * cache_assoc;
 
@@ -912,21 +1270,22 @@ static int cache_lookup(struct cache_c *dmc, sector_t block,
 		    is_state(cache[index].state, RESERVED)) {
 			if (cache[index].block == block) {
 				*cache_block = index;
-				/* Reset all counters if the largest one is going to overflow */
-				if (dmc->counter == ULONG_MAX) cache_reset_counter(dmc);
-				cache[index].counter = ++dmc->counter;
+				dmc->policy->hit(dmc, &cache[index]);
 				break;
 			} else {
 				/* Don't consider blocks that are in the middle of copying */
 				if (!is_state(cache[index].state, RESERVED) &&
-				    !is_state(cache[index].state, WRITEBACK)) {
+				    !is_state(cache[index].state, WRITEBACK) &&
+				    !is_state(cache[index].state, DIRTYING)) {
+					key = dmc->policy->victim_key(dmc,
+								      &cache[index]);
 					if (!is_state(cache[index].state, DIRTY) &&
-					    cache[index].counter < clean_counter) {
-						clean_counter = cache[index].counter;
+					    key < clean_counter) {
+						clean_counter = key;
 						oldest_clean = i;
 					}
-					if (cache[index].counter < counter) {
-						counter = cache[index].counter;
+					if (key < counter) {
+						counter = key;
 						oldest = i;
 					}
 				}
@@ -940,9 +1299,9 @@ static int cache_lookup(struct cache_c *dmc, sector_t block,
 	if (!res) { /* Cache miss */
 		if (invalid != -1) /* Choose the first empty frame */
 			*cache_block = set_number * cache_assoc + invalid;
-		else if (oldest_clean != -1) /* Choose the LRU clean block to replace */
+		else if (oldest_clean != -1) /* Replace the lowest ranked clean block */
 			*cache_block = set_number * cache_assoc + oldest_clean;
-		else if (oldest != -1) { /* Choose the LRU dirty block to evict */
+		else if (oldest != -1) { /* Evict the lowest ranked dirty block */
 			res = 2;
 			*cache_block = set_number * cache_assoc + oldest;
 		} else {
@@ -973,8 +1332,8 @@ static int cache_insert(struct cache_c *dmc, sector_t block,
 	 */
 	cache[cache_block].block = block;
 	cache[cache_block].state = RESERVED;
-	if (dmc->counter == ULONG_MAX) cache_reset_counter(dmc);
-	cache[cache_block].counter = ++dmc->counter;
+	dmc->policy->insert(dmc, &cache[cache_block]);
+	dmc->promotions++;
 
 	return 1;
 }
@@ -996,8 +1355,7 @@ static void cache_invalidate(struct cache_c *dmc, sector_t cache_block)
  *  For READ, serve the request from cache is the block is ready; otherwise,
  *  queue the request for later processing.
  *  For write, invalidate the cache block if write-through. If write-back,
- *  serve the request from cache if the block is ready, or queue the request
- *  for later processing if otherwise.
+ *  see cache_write_hit().
  */
 static int cache_hit(struct cache_c *dmc, struct bio* bio, sector_t cache_block)
 {
@@ -1031,43 +1389,69 @@ static int cache_hit(struct cache_c *dmc, struct bio* bio, sector_t cache_block)
 			return 1;
 		}
 
-		/* Write delay */
-		if (!is_state(cache[cache_block].state, DIRTY)) {
-			set_state(cache[cache_block].state, DIRTY);
-			dmc->dirty_blocks++;
-		}
+		return cache_write_hit(dmc, bio, cache_block);
+	}
+}
 
-		spin_lock(&cache[cache_block].lock);
+static struct kcached_job *new_kcached_job(struct cache_c *dmc, struct bio* bio,
+	                                       sector_t request_block,
+                                           sector_t cache_block);
 
- 		/* In the middle of write back */
-		if (is_state(cache[cache_block].state, WRITEBACK)) {
-			/* Delay this write until the block is written back */
-			bio->bi_bdev = dmc->src_dev->bdev;
-			DPRINTK("Add to bio list %s(%llu)",
-					dmc->src_dev->name, bio->bi_sector);
-			bio_list_add(&cache[cache_block].bios, bio);
-			spin_unlock(&cache[cache_block].lock);
-			return 0;
-		}
+/*
+ * Handle a write hit in write-back mode:
+ *  Queue the request while the block is being inserted or written back, and
+ *  pass it through here again when that is done. Otherwise serve it from the
+ *  cache, but if that makes a clean block dirty, first record the block as
+ *  dirty on the cache device, so that it is still written back after a crash.
+ *  Later writes to the block wait for that too.
+ */
+static int cache_write_hit(struct cache_c *dmc, struct bio *bio,
+			   sector_t cache_block)
+{
+	unsigned int offset = (unsigned int)(bio->bi_sector & dmc->block_mask);
+	struct cacheblock *cb = &dmc->cache[cache_block];
+	struct kcached_job *job;
 
-		/* Cache block not ready yet */
-		if (is_state(cache[cache_block].state, RESERVED)) {
-			bio->bi_bdev = dmc->cache_dev->bdev;
-			bio->bi_sector = (cache_block << dmc->block_shift) + offset;
-			DPRINTK("Add to bio list %s(%llu)",
-					dmc->cache_dev->name, bio->bi_sector);
-			bio_list_add(&cache[cache_block].bios, bio);
-			spin_unlock(&cache[cache_block].lock);
-			return 0;
-		}
+	spin_lock(&cb->lock);
 
-		/* Serve the request from cache */
-		bio->bi_bdev = dmc->cache_dev->bdev;
-		bio->bi_sector = (cache_block << dmc->block_shift) + offset;
+	/* Cache block not ready yet, or in the middle of write back */
+	if (is_state(cb->state, RESERVED) || is_state(cb->state, WRITEBACK)) {
+		DPRINTK("Add to bio list %llu(%llu)",
+				cache_block, bio->bi_sector);
+		bio_list_add(&cb->bios, bio);
+		spin_unlock(&cb->lock);
+		return 0;
+	}
 
-		spin_unlock(&cache[cache_block].lock);
+	/* Serve the request from cache */
+	bio->bi_bdev = dmc->cache_dev->bdev;
+	bio->bi_sector = (cache_block << dmc->block_shift) + offset;
+
+	/* Being recorded dirty */
+	if (is_state(cb->state, DIRTYING)) {
+		DPRINTK("Add to bio list %s(%llu)",
+				dmc->cache_dev->name, bio->bi_sector);
+		bio_list_add(&cb->bios, bio);
+		spin_unlock(&cb->lock);
+		return 0;
+	}
+
+	if (is_state(cb->state, DIRTY)) {
+		spin_unlock(&cb->lock);
 		return 1;
 	}
+
+	/* Write delay */
+	set_state(cb->state, DIRTY);
+	set_state(cb->state, DIRTYING);
+	dmc->dirty_blocks++;
+	spin_unlock(&cb->lock);
+
+	job = new_kcached_job(dmc, bio, cb->block, cache_block);
+	job->type = JOB_DIRTY;
+	queue_job(job);
+
+	return 0;
 }
 
 static struct kcached_job *new_kcached_job(struct cache_c *dmc, struct bio* bio,
@@ -1090,6 +1474,10 @@ static struct kcached_job *new_kcached_job(struct cache_c *dmc, struct bio* bio,
 	job->src = src;
 	job->dest = dest;
 	job->cacheblock = &dmc->cache[cache_block];
+	job->type = JOB_STORE;
+	job->error = 0;
+	job->nr_blocks = 1;
+	job->nr_pages = 0;
 
 	return job;
 }
@@ -1247,9 +1635,15 @@ static int cache_map(struct dm_target *ti, struct bio *bio,
 	res = cache_lookup(dmc, request_block, &cache_block);
 	if (1 == res)  /* Cache hit; server request from cache */
 		return cache_hit(dmc, bio, cache_block);
-	else if (0 == res) /* Cache miss; replacement block is found */
-		return cache_miss(dmc, bio, cache_block);
-	else if (2 == res) { /* Entire cache set is dirty; initiate a write-back */
+	else if (0 == res) { /* Cache miss; replacement block is found */
+		/* Write-through write misses are never cached anyway */
+		if (!dmc->policy->promote ||
+		    (bio_data_dir(bio) == WRITE &&
+		     dmc->write_policy == WRITE_THROUGH) ||
+		    dmc->policy->promote(dmc, request_block))
+			return cache_miss(dmc, bio, cache_block);
+		dmc->bypassed++;
+	} else if (2 == res) { /* Entire cache set is dirty; initiate a write-back */
 		write_back(dmc, cache_block, 1);
 		dmc->writeback++;
 	}
@@ -1260,22 +1654,117 @@ static int cache_map(struct dm_target *ti, struct bio *bio,
 	return 1;
 }
 
+/*
+ * Metadata at the end of the cache device: one 64 bit entry per cache
+ * block, the source sector of the block ORed with whether it is valid and
+ * dirty, followed by a header in the last sector. While the cache is in
+ * use only the dirty entries are kept up to date on disk; the header says
+ * whether the cache was shut down cleanly, which is when the clean entries
+ * and the checksum can be trusted as well.
+ */
+#define META_MAGIC		0x64634d32	/* "dcM2" */
+#define META_VALID		(1ULL << 63)
+#define META_DIRTY		(1ULL << 62)
+#define META_ENTRIES_PER_SECTOR	(512 / sizeof(u64))
+
 struct meta_dmc {
-	sector_t size;
-	unsigned int block_size;
-	unsigned int assoc;
-	unsigned int write_policy;
-	unsigned int chksum;
+	u64 size;
+	u32 block_size;
+	u32 assoc;
+	u32 write_policy;
+	u32 chksum;
+	u32 magic;
+	u32 clean;
+	char policy[CACHE_POLICY_NAME_LEN];
 };
 
+static sector_t meta_sectors(sector_t size)
+{
+	return dm_div_up(size * sizeof(u64), 512);
+}
+
+/*
+ * A reserved block is only valid on disk once its data are in place, that
+ * is for the update done by its own JOB_STORE (@stored).  Until then it
+ * must not be recorded, or a crash would leave stale data marked valid.
+ */
+static u64 meta_entry(struct cacheblock *cb, struct cacheblock *stored)
+{
+	u64 entry;
+
+	if (is_state(cb->state, RESERVED) ? cb != stored :
+	    !is_state(cb->state, VALID))
+		return 0;
+
+	entry = (u64)cb->block | META_VALID;
+	if (is_state(cb->state, DIRTY))
+		entry |= META_DIRTY;
+
+	return entry;
+}
+
+/*
+ * Write metadata behind whatever was written to the cache device before
+ * it, falling back to a plain write if the device cannot do barriers.
+ */
+static int write_meta(struct cache_c *dmc, struct dm_io_region *where,
+		      void *data)
+{
+	unsigned long bits;
+	int r;
+
+	r = dm_io_sync_vm(1, where, WRITE_BARRIER, data, &bits, dmc);
+	if (r == -EOPNOTSUPP)
+		r = dm_io_sync_vm(1, where, WRITE, data, &bits, dmc);
+
+	return r;
+}
+
+/*
+ * Rewrite the metadata sectors holding the entries of @count cache blocks
+ * from @index, @stored being the block whose data were just stored, if any.
+ * Only called from the kcached thread, which owns meta_buf.
+ */
+static int update_metadata(struct cache_c *dmc, sector_t index,
+			   unsigned int count, struct cacheblock *stored)
+{
+	struct dm_io_region where;
+	sector_t dev_size = dmc->cache_dev->bdev->bd_inode->i_size >> 9;
+	sector_t first = index / META_ENTRIES_PER_SECTOR;
+	sector_t last = (index + count - 1) / META_ENTRIES_PER_SECTOR;
+	sector_t n;
+	u64 *entries = dmc->meta_buf;
+	unsigned int i;
+	int r;
+
+	where.bdev = dmc->cache_dev->bdev;
+	where.count = 1;
+	for (; first <= last; first++) {
+		for (i = 0; i < META_ENTRIES_PER_SECTOR; i++) {
+			n = first * META_ENTRIES_PER_SECTOR + i;
+			entries[i] = n < dmc->size ?
+				     meta_entry(&dmc->cache[n], stored) : 0;
+		}
+
+		where.sector = dev_size - 1 - meta_sectors(dmc->size) + first;
+		r = write_meta(dmc, &where, entries);
+		if (r)
+			return r;
+		dmc->meta_writes++;
+	}
+
+	return 0;
+}
+
 /* Load metadata stored by previous session from disk. */
-static int load_metadata(struct cache_c *dmc) {
+static int load_metadata(struct cache_c *dmc, char *policy) {
 	struct dm_io_region where;
 	unsigned long bits;
 	sector_t dev_size = dmc->cache_dev->bdev->bd_inode->i_size >> 9;
-	sector_t meta_size, *meta_data, i, j, index = 0, limit, order;
+	sector_t meta_size, i, j, index = 0, limit, order;
+	u64 *meta_data;
 	struct meta_dmc *meta_dmc;
-	unsigned int chksum = 0, chksum_sav, consecutive_blocks;
+	unsigned int chksum = 0, chksum_sav, consecutive_blocks, clean;
 
 	meta_dmc = (struct meta_dmc *)vmalloc(512);
 	if (!meta_dmc) {
@@ -1293,6 +1782,12 @@ static int load_metadata(struct cache_c *dmc) {
 	        meta_dmc->assoc, meta_dmc->write_policy,
 	        meta_dmc->chksum);
 
+	if (meta_dmc->magic != META_MAGIC) {
+		DMERR("load_metadata: No cache metadata found");
+		vfree((void *)meta_dmc);
+		return 1;
+	}
+
 	dmc->block_size = meta_dmc->block_size;
 	dmc->block_shift = ffs(dmc->block_size) - 1;
 	dmc->block_mask = dmc->block_size - 1;
@@ -1307,6 +1802,10 @@ static int load_metadata(struct cache_c *dmc) {
 
 	dmc->write_policy = meta_dmc->write_policy;
 	chksum_sav = meta_dmc->chksum;
+	clean = meta_dmc->clean;
+
+	if (policy)
+		strlcpy(policy, meta_dmc->policy, CACHE_POLICY_NAME_LEN);
 
 	vfree((void *)meta_dmc);
 
@@ -1327,7 +1826,7 @@ static int load_metadata(struct cache_c *dmc) {
 		return 1;
 	}
 
-	meta_size = dm_div_up(dmc->size * sizeof(sector_t), 512);
+	meta_size = meta_sectors(dmc->size);
 	/* When requesting a new bio, the number of requested bvecs has to be
 	   less than BIO_MAX_PAGES. Otherwise, null is returned. In dm-io.c,
 	   this return value is not checked and kernel Oops may happen. We set
@@ -1335,7 +1834,7 @@ static int load_metadata(struct cache_c *dmc) {
 	   required by dm-io for bookeeping.)
 	 */
 	limit = (BIO_MAX_PAGES - 2) * (PAGE_SIZE >> SECTOR_SHIFT);
-	meta_data = (sector_t *)vmalloc(to_bytes(min(meta_size, limit)));
+	meta_data = (u64 *)vmalloc(to_bytes(min(meta_size, limit)));
 	if (!meta_data) {
 		DMERR("load_metadata: Unable to allocate memory");
 		vfree((void *)dmc->cache);
@@ -1347,12 +1846,20 @@ static int load_metadata(struct cache_c *dmc) {
 		where.count = min(meta_size - index, limit);
 		dm_io_sync_vm(1, &where, READ, meta_data, &bits, dmc);
 
-		for (i=to_bytes(index)/sizeof(sector_t), j=0;
-		     j<to_bytes(where.count)/sizeof(sector_t) && i<dmc->size;
+		/*
+		 * Without a clean shutdown only the dirty blocks are known to
+		 * be in the cache, the others may have been replaced since.
+		 */
+		for (i=to_bytes(index)/sizeof(u64), j=0;
+		     j<to_bytes(where.count)/sizeof(u64) && i<dmc->size;
 		     i++, j++) {
-			if(meta_data[j]) {
-				dmc->cache[i].block = meta_data[j];
-				dmc->cache[i].state = 1;
+			if ((meta_data[j] & META_VALID) &&
+			    (clean || (meta_data[j] & META_DIRTY))) {
+				dmc->cache[i].block = meta_data[j] &
+					~(META_VALID | META_DIRTY);
+				dmc->cache[i].state = VALID;
+				if (meta_data[j] & META_DIRTY)
+					set_state(dmc->cache[i].state, DIRTY);
 			} else
 				dmc->cache[i].state = 0;
 		}
@@ -1362,30 +1869,74 @@ static int load_metadata(struct cache_c *dmc) {
 
 	vfree((void *)meta_data);
 
-	if (chksum != chksum_sav) { /* Check the checksum of the metadata */
+	if (clean && chksum != chksum_sav) { /* Check the checksum of the metadata */
 		DPRINTK("Cache metadata loaded from disk is corrupted");
 		vfree((void *)dmc->cache);
 		return 1;
 	}
 
-	DMINFO("Cache metadata loaded from disk (offset %llu)",
-	       (unsigned long long) dev_size - 1 - (unsigned long long) meta_size);;
+	DMINFO("Cache metadata loaded from disk (offset %llu%s)",
+	       (unsigned long long) dev_size - 1 - (unsigned long long) meta_size,
+	       clean ? "" : ", dirty blocks only");
 
 	return 0;
 }
 
+/*
+ * Store the header onto disk. Until it is written again with @clean set,
+ * only the dirty entries will be trusted.
+ */
+static int dump_header(struct cache_c *dmc, unsigned int chksum,
+		       unsigned int clean) {
+	struct dm_io_region where;
+	sector_t dev_size = dmc->cache_dev->bdev->bd_inode->i_size >> 9;
+	struct meta_dmc *meta_dmc;
+	int r;
+
+	meta_dmc = (struct meta_dmc *)vmalloc(512);
+	if (!meta_dmc) {
+		DMERR("dump_header: Unable to allocate memory");
+		return 1;
+	}
+	memset(meta_dmc, 0, 512);
+
+	meta_dmc->block_size = dmc->block_size;
+	meta_dmc->size = dmc->size;
+	meta_dmc->assoc = dmc->assoc;
+	meta_dmc->write_policy = dmc->write_policy;
+	meta_dmc->chksum = chksum;
+	meta_dmc->magic = META_MAGIC;
+	meta_dmc->clean = clean;
+	strlcpy(meta_dmc->policy, dmc->policy->name, sizeof(meta_dmc->policy));
+
+	DPRINTK("Store metadata to disk: block size(%u), cache size(%llu), " \
+	        "associativity(%u), write policy(%u), checksum(%u)",
+	        meta_dmc->block_size, (unsigned long long) meta_dmc->size,
+	        meta_dmc->assoc, meta_dmc->write_policy,
+	        meta_dmc->chksum);
+
+	where.bdev = dmc->cache_dev->bdev;
+	where.sector = dev_size - 1;
+	where.count = 1;
+	r = write_meta(dmc, &where, meta_dmc);
+
+	vfree((void *)meta_dmc);
+
+	return r;
+}
+
 /* Store metadata onto disk. */
-static int dump_metadata(struct cache_c *dmc) {
+static int dump_metadata(struct cache_c *dmc, unsigned int clean) {
 	struct dm_io_region where;
 	unsigned long bits;
 	sector_t dev_size = dmc->cache_dev->bdev->bd_inode->i_size >> 9;
-	sector_t meta_size, i, j, index = 0, limit, *meta_data;
-	struct meta_dmc *meta_dmc;
+	sector_t meta_size, i, j, index = 0, limit;
+	u64 *meta_data;
 	unsigned int chksum = 0;
 
-	meta_size = dm_div_up(dmc->size * sizeof(sector_t), 512);
+	meta_size = meta_sectors(dmc->size);
 	limit = (BIO_MAX_PAGES - 2) * (PAGE_SIZE >> SECTOR_SHIFT);
-	meta_data = (sector_t *)vmalloc(to_bytes(min(meta_size, limit)));
+	meta_data = (u64 *)vmalloc(to_bytes(min(meta_size, limit)));
 	if (!meta_data) {
 		DMERR("dump_metadata: Unable to allocate memory");
 		return 1;
@@ -1396,14 +1947,11 @@ static int dump_metadata(struct cache_c *dmc) {
 		where.sector = dev_size - 1 - meta_size + index;
 		where.count = min(meta_size - index, limit);
 
-		for (i=to_bytes(index)/sizeof(sector_t), j=0;
-		     j<to_bytes(where.count)/sizeof(sector_t) && i<dmc->size;
-		     i++, j++) {
-			/* Assume all invalid cache blocks store 0. We lose the block that
-			 * is actually mapped to offset 0.
-			 */
-			meta_data[j] = dmc->cache[i].state ? dmc->cache[i].block : 0;
-		}
+		for (i=to_bytes(index)/sizeof(u64), j=0;
+		     j<to_bytes(where.count)/sizeof(u64);
+		     i++, j++)
+			meta_data[j] = i < dmc->size ?
+				       meta_entry(&dmc->cache[i], NULL) : 0;
 		chksum = csum_partial((char *)meta_data, to_bytes(where.count), chksum);
 
 		dm_io_sync_vm(1, &where, WRITE, meta_data, &bits, dmc);
@@ -1412,29 +1960,8 @@ static int dump_metadata(struct cache_c *dmc) {
 
 	vfree((void *)meta_data);
 
-	meta_dmc = (struct meta_dmc *)vmalloc(512);
-	if (!meta_dmc) {
-		DMERR("dump_metadata: Unable to allocate memory");
+	if (dump_header(dmc, chksum, clean))
 		return 1;
-	}
-
-	meta_dmc->block_size = dmc->block_size;
-	meta_dmc->size = dmc->size;
-	meta_dmc->assoc = dmc->assoc;
-	meta_dmc->write_policy = dmc->write_policy;
-	meta_dmc->chksum = chksum;
-
-	DPRINTK("Store metadata to disk: block size(%u), cache size(%llu), " \
-	        "associativity(%u), write policy(%u), checksum(%u)",
-	        meta_dmc->block_size, (unsigned long long) meta_dmc->size,
-	        meta_dmc->assoc, meta_dmc->write_policy,
-	        meta_dmc->chksum);
-
-	where.sector = dev_size - 1;
-	where.count = 1;
-	dm_io_sync_vm(1, &where, WRITE, meta_dmc, &bits, dmc);
-
-	vfree((void *)meta_dmc);
 
 	DMINFO("Cache metadata saved to disk (offset %llu)",
 	       (unsigned long long) dev_size - 1 - (unsigned long long) meta_size);
@@ -1452,6 +1979,8 @@ static int dump_metadata(struct cache_c *dmc) {
  *  arg[4]: cache size (in blocks)
  *  arg[5]: cache associativity
  *  arg[6]: write caching policy
+ *  arg[7]: replacement policy (lru, mq or lfu), also honoured with
+ *          persistence
  */
 static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -1460,6 +1989,7 @@ static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	sector_t localsize, i, order;
 	sector_t data_size, meta_size, dev_size;
 	unsigned long long cache_size;
+	char policy_name[CACHE_POLICY_NAME_LEN] = DEFAULT_CACHE_POLICY;
 	int r = -EINVAL;
 
 	if (argc < 2) {
@@ -1467,7 +1997,7 @@ static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad;
 	}
 
-	dmc = kmalloc(sizeof(*dmc), GFP_KERNEL);
+	dmc = kzalloc(sizeof(*dmc), GFP_KERNEL);
 	if (dmc == NULL) {
 		ti->error = "dm-cache: Failed to allocate cache context";
 		r = ENOMEM;
@@ -1514,8 +2044,11 @@ static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 			goto bad6;
 		}
 	}
+	if (argc >= 8)
+		strlcpy(policy_name, argv[7], sizeof(policy_name));
+
 	if (1 == persistence) {
-		if (load_metadata(dmc)) {
+		if (load_metadata(dmc, argc >= 8 ? NULL : policy_name)) {
 			ti->error = "dm-cache: Invalid cache configuration";
 			r = -EINVAL;
 			goto bad6;
@@ -1578,7 +2111,7 @@ static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	DMINFO("%lld", dmc->cache_dev->bdev->bd_inode->i_size);
 	dev_size = dmc->cache_dev->bdev->bd_inode->i_size >> 9;
 	data_size = dmc->size * dmc->block_size;
-	meta_size = dm_div_up(dmc->size * sizeof(sector_t), 512) + 1;
+	meta_size = meta_sectors(dmc->size) + 1;
 	if ((data_size + meta_size) > dev_size) {
 		DMERR("Requested cache size exeeds the cache device's capacity" \
 		      "(%llu+%llu>%llu)",
@@ -1626,26 +2159,63 @@ static int cache_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 
 init:	/* Initialize the cache structs */
+	dmc->dirty_blocks = 0;
 	for (i=0; i<dmc->size; i++) {
 		bio_list_init(&dmc->cache[i].bios);
 		if(!persistence) dmc->cache[i].state = 0;
+		if (is_state(dmc->cache[i].state, DIRTY))
+			dmc->dirty_blocks++;
 		dmc->cache[i].counter = 0;
+		dmc->cache[i].freq = 0;
 		spin_lock_init(&dmc->cache[i].lock);
 	}
 
 	dmc->counter = 0;
-	dmc->dirty_blocks = 0;
 	dmc->reads = 0;
 	dmc->writes = 0;
 	dmc->cache_hits = 0;
 	dmc->replace = 0;
 	dmc->writeback = 0;
 	dmc->dirty = 0;
+	dmc->promotions = 0;
+	dmc->bypassed = 0;
+	dmc->meta_writes = 0;
+
+	dmc->policy = cache_policy_lookup(policy_name);
+	if (!dmc->policy) {
+		ti->error = "dm-cache: Unknown replacement policy";
+		r = -EINVAL;
+		goto bad7;
+	}
+	if (dmc->policy->init && dmc->policy->init(dmc)) {
+		ti->error = "dm-cache: Unable to initialize replacement policy";
+		r = -ENOMEM;
+		goto bad7;
+	}
+
+	/*
+	 * From now on the metadata on disk is only good for the dirty
+	 * blocks. A new cache starts with no blocks at all.
+	 */
+	if (persistence)
+		r = dump_header(dmc, 0, 0);
+	else
+		r = dump_metadata(dmc, 0);
+	if (r) {
+		ti->error = "dm-cache: Unable to write metadata";
+		r = -EIO;
+		goto bad8;
+	}
 
 	ti->split_io = dmc->block_size;
 	ti->private = dmc;
 	return 0;
 
+bad8:
+	if (dmc->policy->exit)
+		dmc->policy->exit(dmc);
+bad7:
+	vfree((void *)dmc->cache);
 bad6:
 	kcached_client_destroy(dmc);
 bad5:
@@ -1672,8 +2242,10 @@ static void cache_flush(struct cache_c *dmc)
 	DMINFO("Flush dirty blocks (%llu) ...", (unsigned long long) dmc->dirty_blocks);
 	while (i< dmc->size) {
 		j = 1;
-		if (is_state(cache[i].state, DIRTY)) {
+		if (is_state(cache[i].state, DIRTY) &&
+		    !is_state(cache[i].state, WRITEBACK)) {
 			while ((i+j) < dmc->size && is_state(cache[i+j].state, DIRTY)
+			       && !is_state(cache[i+j].state, WRITEBACK)
 			       && (cache[i+j].block == cache[i].block + j *
 			       dmc->block_size)) {
 				j++;
@@ -1685,6 +2257,15 @@ static void cache_flush(struct cache_c *dmc)
 	}
 }
 
+/* Hit rate in tenths of a percent */
+static unsigned long cache_hit_rate(struct cache_c *dmc)
+{
+	unsigned long total = dmc->reads + dmc->writes;
+
+	return total ? (unsigned long)div_u64((u64)dmc->cache_hits * 1000,
+					      total) : 0;
+}
+
 /*
  * Destroy the cache mapping.
  */
@@ -1699,14 +2280,17 @@ static void cache_dtr(struct dm_target *ti)
 	dm_kcopyd_client_destroy(dmc->kcp_client);
 
 	if (dmc->reads + dmc->writes > 0)
-		DMINFO("stats: reads(%lu), writes(%lu), cache hits(%lu, 0.%lu)," \
+		DMINFO("stats: reads(%lu), writes(%lu), cache hits(%lu, %lu.%lu%%)," \
 		       "replacement(%lu), replaced dirty blocks(%lu), " \
-	           "flushed dirty blocks(%lu)",
+	           "flushed dirty blocks(%lu), promotions(%lu), bypassed(%lu)",
 		       dmc->reads, dmc->writes, dmc->cache_hits,
-		       dmc->cache_hits * 100 / (dmc->reads + dmc->writes),
-		       dmc->replace, dmc->writeback, dmc->dirty);
+		       cache_hit_rate(dmc) / 10, cache_hit_rate(dmc) % 10,
+		       dmc->replace, dmc->writeback, dmc->dirty,
+		       dmc->promotions, dmc->bypassed);
 
-	dump_metadata(dmc); /* Always dump metadata to disk before exit */
+	dump_metadata(dmc, 1); /* Always dump metadata to disk before exit */
+	if (dmc->policy->exit)
+		dmc->policy->exit(dmc);
 	vfree((void *)dmc->cache);
 	dm_io_client_destroy(dmc->io_client);
 
@@ -1728,18 +2312,22 @@ static int cache_status(struct dm_target *ti, status_type_t type,
 
 	switch (type) {
 	case STATUSTYPE_INFO:
-		DMEMIT("stats: reads(%lu), writes(%lu), cache hits(%lu, 0.%lu)," \
-	           "replacement(%lu), replaced dirty blocks(%lu)",
+		DMEMIT("stats: reads(%lu), writes(%lu), cache hits(%lu, %lu.%lu%%)," \
+	           "replacement(%lu), replaced dirty blocks(%lu), " \
+	           "promotions(%lu), bypassed(%lu), dirty blocks(%llu), " \
+	           "metadata updates(%lu)",
 	           dmc->reads, dmc->writes, dmc->cache_hits,
-	           (dmc->reads + dmc->writes) > 0 ? \
-	           dmc->cache_hits * 100 / (dmc->reads + dmc->writes) : 0,
-	           dmc->replace, dmc->writeback);
+	           cache_hit_rate(dmc) / 10, cache_hit_rate(dmc) % 10,
+	           dmc->replace, dmc->writeback,
+	           dmc->promotions, dmc->bypassed,
+	           (unsigned long long) dmc->dirty_blocks, dmc->meta_writes);
 		break;
 	case STATUSTYPE_TABLE:
-		DMEMIT("conf: capacity(%lluM), associativity(%u), block size(%uK), %s",
+		DMEMIT("conf: capacity(%lluM), associativity(%u), block size(%uK), %s, %s",
 	           (unsigned long long) dmc->size * dmc->block_size >> 11,
 	           dmc->assoc, dmc->block_size>>(10-SECTOR_SHIFT),
-	           dmc->write_policy ? "write-back":"write-through");
+	           dmc->write_policy ? "write-back":"write-through",
+	           dmc->policy->name);
 		break;
 	}
 	return 0;
@@ -1752,7 +2340,7 @@ static int cache_status(struct dm_target *ti, status_type_t type,
 
 static struct target_type cache_target = {
 	.name   = "cache",
-	.version= {1, 0, 1},
+	.version= {1, 1, 0},
 	.module = THIS_MODULE,
 	.ctr    = cache_ctr,
 	.dtr    = cache_dtr,
@@ -1771,17 +2359,10 @@ int __init dm_cache_init(void)
 	if (r)
 		return r;
 
-	_kcached_wq = create_singlethread_workqueue("kcached");
-	if (!_kcached_wq) {
-		DMERR("failed to start kcached");
-		return -ENOMEM;
-	}
-	INIT_WORK(&_kcached_work, do_work);
-
 	r = dm_register_target(&cache_target);
 	if (r < 0) {
 		DMERR("cache: register failed %d", r);
-		destroy_workqueue(_kcached_wq);
+		jobs_exit();
 	}
 
 	return r;
@@ -1795,7 +2376,6 @@ static void __exit dm_cache_exit(void)
 	dm_unregister_target(&cache_target);
 
 	jobs_exit();
-	destroy_workqueue(_kcached_wq);
 }
 
 module_init(dm_cache_init);
@@ -17,6 +17,8 @@
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
+#include <linux/rbtree.h>
 #include <linux/backing-dev.h>
 #include <asm/atomic.h>
 #include <linux/scatterlist.h>
@@ -53,6 +55,9 @@ struct dm_crypt_io {
 
 	struct convert_context ctx;
 
+	/* in crypt_config.write_tree while waiting for dmcrypt_write */
+	struct rb_node rb_node;
+
 	atomic_t pending;
 	int error;
 	sector_t sector;
@@ -109,6 +114,17 @@ struct crypt_config {
 	struct workqueue_struct *crypt_queue;
 #endif
 
+	/* CPU the last crypto work was queued on */
+	int crypt_cpu;
+
+	/*
+	 * Encrypted writes, sorted by sector, for dmcrypt_write
+	 */
+	struct task_struct *write_thread;
+	wait_queue_head_t write_thread_wait;
+	spinlock_t write_lock;
+	struct rb_root write_tree;
+
 	/*
 	 * crypto related data
 	 */
@@ -135,7 +151,6 @@ struct crypt_config {
 	 * correctly aligned.
 	 */
 	unsigned int dmreq_start;
-	struct ablkcipher_request *req;
 
 	char cipher[CRYPTO_MAX_ALG_NAME];
 	char chainmode[CRYPTO_MAX_ALG_NAME];
@@ -464,23 +479,30 @@ static int crypt_convert_block(struct crypt_config *cc,
 static void kcryptd_async_done(struct crypto_async_request *async_req,
 			       int error);
 static void crypt_alloc_req(struct crypt_config *cc,
-			    struct convert_context *ctx)
+			    struct ablkcipher_request **req)
 {
-	if (!cc->req)
-		cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
-	ablkcipher_request_set_tfm(cc->req, cc->tfm);
-	ablkcipher_request_set_callback(cc->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+	if (!*req)
+		*req = mempool_alloc(cc->req_pool, GFP_NOIO);
+	ablkcipher_request_set_tfm(*req, cc->tfm);
+	ablkcipher_request_set_callback(*req,
+					CRYPTO_TFM_REQ_MAY_BACKLOG |
 					CRYPTO_TFM_REQ_MAY_SLEEP,
 					kcryptd_async_done,
-					dmreq_of_req(cc, cc->req));
+					dmreq_of_req(cc, *req));
 }
 
 /*
  * Encrypt / decrypt data from one bio to another one (can be the same one)
+ *
+ * A request is reused for the next sector as long as the cipher completes
+ * synchronously.  It belongs to this conversion only: the kcryptd threads
+ * of a CPU going offline carry on on another CPU, so nothing here may be
+ * kept per CPU.
  */
 static int crypt_convert(struct crypt_config *cc,
 			 struct convert_context *ctx)
 {
+	struct ablkcipher_request *req = NULL;
 	int r;
 
 	atomic_set(&ctx->pending, 1);
@@ -488,11 +510,11 @@ static int crypt_convert(struct crypt_config *cc,
 	while(ctx->idx_in < ctx->bio_in->bi_vcnt &&
 	      ctx->idx_out < ctx->bio_out->bi_vcnt) {
 
-		crypt_alloc_req(cc, ctx);
+		crypt_alloc_req(cc, &req);
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, cc->req);
+		r = crypt_convert_block(cc, ctx, req);
 
 		switch (r) {
 		/* async */
@@ -501,7 +523,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			cc->req = NULL;
+			req = NULL;
 			ctx->sector++;
 			continue;
 
@@ -515,10 +537,14 @@ static int crypt_convert(struct crypt_config *cc,
 		/* error */
 		default:
 			atomic_dec(&ctx->pending);
+			mempool_free(req, cc->req_pool);
 			return r;
 		}
 	}
 
+	if (req)
+		mempool_free(req, cc->req_pool);
+
 	return 0;
 }
 
@@ -648,14 +674,21 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
 }
 
 /*
- * kcryptd/kcryptd_io:
+ * kcryptd/kcryptd_io/dmcrypt_write:
  *
  * Needed because it would be very unwise to do decryption in an
  * interrupt context.
  *
- * kcryptd performs the actual encryption or decryption.
+ * kcryptd performs the actual encryption or decryption.  It has a
+ * thread on every CPU and bios are spread over them, so one device can
+ * use all the CPUs for crypto.
+ *
+ * kcryptd_io submits reads that could not be submitted from crypt_map
+ * without waiting for memory.
  *
- * kcryptd_io performs the IO submission.
+ * dmcrypt_write submits the encrypted writes.  The kcryptd threads
+ * finish them in no particular order, so they are sorted by sector
+ * first and the device still sees them in ascending order.
  *
  * They must be separated as otherwise the final stages could be
  * starved by new requests which can block in the first stages due
@@ -700,25 +733,25 @@ static void clone_init(struct dm_crypt_io *io, struct bio *clone)
 	clone->bi_destructor = dm_crypt_bio_destructor;
 }
 
-static void kcryptd_io_read(struct dm_crypt_io *io)
+/*
+ * Returns non zero if no clone could be allocated with @gfp
+ */
+static int kcryptd_io_read(struct dm_crypt_io *io, gfp_t gfp)
 {
 	struct crypt_config *cc = io->target->private;
 	struct bio *base_bio = io->base_bio;
 	struct bio *clone;
 
-	crypt_inc_pending(io);
-
 	/*
 	 * The block layer might modify the bvec array, so always
 	 * copy the required bvecs because we need the original
 	 * one in order to decrypt the whole bio data *afterwards*.
 	 */
-	clone = bio_alloc_bioset(GFP_NOIO, bio_segments(base_bio), cc->bs);
-	if (unlikely(!clone)) {
-		io->error = -ENOMEM;
-		crypt_dec_pending(io);
-		return;
-	}
+	clone = bio_alloc_bioset(gfp, bio_segments(base_bio), cc->bs);
+	if (unlikely(!clone))
+		return 1;
+
+	crypt_inc_pending(io);
 
 	clone_init(io, clone);
 	clone->bi_idx = 0;
@@ -729,22 +762,17 @@ static void kcryptd_io_read(struct dm_crypt_io *io)
 	       sizeof(struct bio_vec) * clone->bi_vcnt);
 
 	generic_make_request(clone);
-}
-
-static void kcryptd_io_write(struct dm_crypt_io *io)
-{
-	struct bio *clone = io->ctx.bio_out;
-	generic_make_request(clone);
+	return 0;
 }
 
 static void kcryptd_io(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_io_read(io);
-	else
-		kcryptd_io_write(io);
+	crypt_inc_pending(io);
+	if (kcryptd_io_read(io, GFP_NOIO))
+		io->error = -ENOMEM;
+	crypt_dec_pending(io);
 }
 
 static void kcryptd_queue_io(struct dm_crypt_io *io)
@@ -760,11 +788,53 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 #endif
 }
 
-static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
-					  int error, int async)
+static struct dm_crypt_io *crypt_io_from_node(struct rb_node *node)
+{
+	return rb_entry(node, struct dm_crypt_io, rb_node);
+}
+
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct rb_root write_tree;
+	struct dm_crypt_io *io;
+
+	for (;;) {
+		wait_event_interruptible(cc->write_thread_wait,
+					 !RB_EMPTY_ROOT(&cc->write_tree) ||
+					 kthread_should_stop());
+
+		spin_lock_irq(&cc->write_lock);
+		write_tree = cc->write_tree;
+		cc->write_tree = RB_ROOT;
+		spin_unlock_irq(&cc->write_lock);
+
+		if (RB_EMPTY_ROOT(&write_tree)) {
+			if (kthread_should_stop())
+				break;
+			continue;
+		}
+
+		/*
+		 * Take the lowest sector each time: an io can be freed as
+		 * soon as it is submitted, so rb_next() cannot be used.
+		 */
+		do {
+			io = crypt_io_from_node(rb_first(&write_tree));
+			rb_erase(&io->rb_node, &write_tree);
+			generic_make_request(io->ctx.bio_out);
+		} while (!RB_EMPTY_ROOT(&write_tree));
+	}
+
+	return 0;
+}
+
+static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int error)
 {
 	struct bio *clone = io->ctx.bio_out;
 	struct crypt_config *cc = io->target->private;
+	struct rb_node **p, *parent = NULL;
+	unsigned long flags;
 
 	if (unlikely(error < 0)) {
 		crypt_free_buffer_pages(cc, clone);
@@ -779,10 +849,20 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
-		kcryptd_queue_io(io);
-	else
-		generic_make_request(clone);
+	spin_lock_irqsave(&cc->write_lock, flags);
+	p = &cc->write_tree.rb_node;
+	while (*p) {
+		parent = *p;
+		if (io->sector < crypt_io_from_node(parent)->sector)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, p);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+	spin_unlock_irqrestore(&cc->write_lock, flags);
+
+	wake_up(&cc->write_thread_wait);
 }
 
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
@@ -825,7 +905,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		/* Encryption was already finished, submit io now */
 		if (crypt_finished) {
-			kcryptd_crypt_write_io_submit(io, r, 0);
+			kcryptd_crypt_write_io_submit(io, r);
 
 			/*
 			 * If there was an error, do not try next fragments.
@@ -833,8 +913,6 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			 */
 			if (unlikely(r < 0))
 				break;
-
-			io->sector = sector;
 		}
 
 		/*
@@ -845,10 +923,12 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			congestion_wait(BLK_RW_ASYNC, HZ/100);
 
 		/*
-		 * With async crypto it is unsafe to share the crypto context
-		 * between fragments, so switch to a new dm_crypt_io structure.
+		 * The io waits in write_tree until dmcrypt_write submits
+		 * it, and with async crypto it is unsafe to share the crypto
+		 * context between fragments, so switch to a new dm_crypt_io
+		 * structure.
 		 */
-		if (unlikely(!crypt_finished && remaining)) {
+		if (unlikely(remaining)) {
 			new_io = crypt_io_alloc(io->target, io->base_bio,
 						sector);
 			crypt_inc_pending(new_io);
@@ -923,7 +1003,7 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_done(io, error);
 	else
-		kcryptd_crypt_write_io_submit(io, error, 1);
+		kcryptd_crypt_write_io_submit(io, error);
 }
 
 static void kcryptd_crypt(struct work_struct *work)
@@ -936,17 +1016,30 @@ static void kcryptd_crypt(struct work_struct *work)
 		kcryptd_crypt_write_convert(io);
 }
 
+/*
+ * Hand the bios to the online CPUs in turn.  Left to queue_work() the
+ * writes of one task, or the reads completing on the CPU that takes the
+ * disk interrupt, would all be converted by the same thread.  The CPU
+ * cannot go offline between picking it and queueing the work.
+ */
 static void kcryptd_queue_crypt(struct dm_crypt_io *io)
 {
-#ifndef CONFIG_DM_CRYPT_GLOBAL_WORKQUEUES
 	struct crypt_config *cc = io->target->private;
-#endif
+	int cpu;
+
 	INIT_WORK(&io->work, kcryptd_crypt);
+
+	preempt_disable();
+	cpu = cpumask_next(ACCESS_ONCE(cc->crypt_cpu), cpu_online_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_online_mask);
+	cc->crypt_cpu = cpu;
 #ifdef CONFIG_DM_CRYPT_GLOBAL_WORKQUEUES
-	queue_work(_crypt_queue, &io->work);
+	queue_work_on(cpu, _crypt_queue, &io->work);
 #else
-	queue_work(cc->crypt_queue, &io->work);
+	queue_work_on(cpu, cc->crypt_queue, &io->work);
 #endif
+	preempt_enable();
 }
 
 /*
@@ -1150,8 +1243,6 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		ti->error = "Cannot allocate crypt request mempool";
 		goto bad_req_pool;
 	}
-	cc->req = NULL;
-
 	cc->page_pool = mempool_create_page_pool(MIN_POOL_PAGES, 0);
 	if (!cc->page_pool) {
 		ti->error = "Cannot allocate page mempool";
@@ -1200,7 +1291,7 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	cc->crypt_queue = create_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		destroy_workqueue(cc->io_queue);
@@ -1208,13 +1299,27 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	}
 #endif
 
+	init_waitqueue_head(&cc->write_thread_wait);
+	spin_lock_init(&cc->write_lock);
+	cc->write_tree = RB_ROOT;
+
+	cc->write_thread = kthread_run(dmcrypt_write, cc, "dmcrypt_write");
+	if (IS_ERR(cc->write_thread)) {
+		ti->error = "Couldn't spawn write thread";
+		goto bad_write_thread;
+	}
+
 	ti->num_flush_requests = 1;
 	ti->private = cc;
 	return 0;
-#ifndef CONFIG_DM_CRYPT_GLOBAL_WORKQUEUES 
+
+bad_write_thread:
+#ifndef CONFIG_DM_CRYPT_GLOBAL_WORKQUEUES
+	destroy_workqueue(cc->io_queue);
+	destroy_workqueue(cc->crypt_queue);
 bad_io_queue:
-	kfree(cc->iv_mode);
 #endif
+	kfree(cc->iv_mode);
 bad_ivmode_string:
 	dm_put_device(ti, cc->dev);
 bad_device:
@@ -1244,9 +1349,7 @@ static void crypt_dtr(struct dm_target *ti)
 	destroy_workqueue(cc->io_queue);
 	destroy_workqueue(cc->crypt_queue);
 #endif
-
-	if (cc->req)
-		mempool_free(cc->req, cc->req_pool);
+	kthread_stop(cc->write_thread);
 
 	bioset_free(cc->bs);
 	mempool_destroy(cc->page_pool);
@@ -1277,9 +1380,14 @@ static int crypt_map(struct dm_target *ti, struct bio *bio,
 
 	io = crypt_io_alloc(ti, bio, bio->bi_sector - ti->begin);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_queue_io(io);
-	else
+	/*
+	 * Submit reads right away unless that means waiting for a clone;
+	 * they are decrypted on a kcryptd thread when they complete.
+	 */
+	if (bio_data_dir(io->base_bio) == READ) {
+		if (kcryptd_io_read(io, GFP_NOWAIT))
+			kcryptd_queue_io(io);
+	} else
 		kcryptd_queue_crypt(io);
 
 	return DM_MAPIO_SUBMITTED;
@@ -1438,7 +1546,7 @@ static int __init dm_crypt_init(void)
 		return -ENOMEM;
 	}
 
-	_crypt_queue = create_singlethread_workqueue("kcryptd");
+	_crypt_queue = create_workqueue("kcryptd");
 	if (!_crypt_queue) {
 		DMERR("couldn't create kcryptd queue");
 		destroy_workqueue(_io_queue);
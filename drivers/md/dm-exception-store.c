@@ -201,6 +201,7 @@ int dm_exception_store_create(struct dm_target *ti, int argc, char **argv,
 	struct dm_exception_store_type *type = NULL;
 	struct dm_exception_store *tmp_store;
 	char persistent;
+	unsigned type_argc = 0;
 
 	if (argc < 2) {
 		ti->error = "Insufficient exception store arguments";
@@ -218,8 +219,18 @@ int dm_exception_store_create(struct dm_target *ti, int argc, char **argv,
 		type = get_type("P");
 	else if (persistent == 'N')
 		type = get_type("N");
-	else {
-		ti->error = "Persistent flag is not P or N";
+	else if (persistent == 'S') {
+		/* Shared stores also take the id of the snapshot */
+		if (argc < 3) {
+			ti->error = "Insufficient shared exception store "
+				    "arguments";
+			r = -EINVAL;
+			goto bad_type;
+		}
+		type = get_type("S");
+		type_argc = 1;
+	} else {
+		ti->error = "Persistent flag is not P, N or S";
 		r = -EINVAL;
 		goto bad_type;
 	}
@@ -232,18 +243,19 @@ int dm_exception_store_create(struct dm_target *ti, int argc, char **argv,
 
 	tmp_store->type = type;
 	tmp_store->snap = snap;
+	tmp_store->shared_id = 0;
 
 	r = set_chunk_size(tmp_store, argv[1], &ti->error);
 	if (r)
 		goto bad;
 
-	r = type->ctr(tmp_store, 0, NULL);
+	r = type->ctr(tmp_store, type_argc, type_argc ? argv + 2 : NULL);
 	if (r) {
 		ti->error = "Exception store type constructor failed";
 		goto bad;
 	}
 
-	*args_used = 2;
+	*args_used = 2 + type_argc;
 	*store = tmp_store;
 	return 0;
 
@@ -279,16 +291,25 @@ int dm_exception_store_init(void)
 		goto persistent_fail;
 	}
 
+	r = dm_shared_snapshot_init();
+	if (r) {
+		DMERR("Unable to register shared exception store type");
+		goto shared_fail;
+	}
+
 	return 0;
 
-persistent_fail:
+shared_fail:
 	dm_persistent_snapshot_exit();
+persistent_fail:
+	dm_transient_snapshot_exit();
 transient_fail:
 	return r;
 }
 
 void dm_exception_store_exit(void)
 {
+	dm_shared_snapshot_exit();
 	dm_persistent_snapshot_exit();
 	dm_transient_snapshot_exit();
 }
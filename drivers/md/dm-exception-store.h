@@ -66,6 +66,17 @@ struct dm_exception_store_type {
 	int (*prepare_exception) (struct dm_exception_store *store,
 				  struct dm_exception *e);
 
+	/*
+	 * Optional: store the exception in the same place as the
+	 * exception another snapshot prepared for the same chunk,
+	 * instead of preparing one of its own.  Fails if the stores
+	 * don't share their chunks.
+	 */
+	int (*share_exception) (struct dm_exception_store *store,
+				struct dm_exception *e,
+				struct dm_exception_store *primary_store,
+				struct dm_exception *primary);
+
 	/*
 	 * Update the metadata with this exception.
 	 */
@@ -74,6 +85,13 @@ struct dm_exception_store_type {
 				  void (*callback) (void *, int success),
 				  void *callback_context);
 
+	/*
+	 * Optional: the copy for a prepared exception failed and it
+	 * won't be committed.
+	 */
+	void (*abort_exception) (struct dm_exception_store *store,
+				 struct dm_exception *e);
+
 	/*
 	 * Returns 0 if the exception store is empty.
 	 *
@@ -96,6 +114,12 @@ struct dm_exception_store_type {
 	 */
 	void (*drop_snapshot) (struct dm_exception_store *store);
 
+	/*
+	 * Optional: the snapshot is going away for good, free the
+	 * space it used.
+	 */
+	int (*release_snapshot) (struct dm_exception_store *store);
+
 	unsigned (*status) (struct dm_exception_store *store,
 			    status_type_t status, char *result,
 			    unsigned maxlen);
@@ -122,6 +146,9 @@ struct dm_exception_store {
 	unsigned chunk_mask;
 	unsigned chunk_shift;
 
+	/* Which snapshot this is in a store shared by several */
+	unsigned shared_id;
+
 	void *context;
 };
 
@@ -216,7 +243,7 @@ int dm_exception_store_init(void);
 void dm_exception_store_exit(void);
 
 /*
- * Two exception store implementations.
+ * Three exception store implementations.
  */
 int dm_persistent_snapshot_init(void);
 void dm_persistent_snapshot_exit(void);
@@ -224,4 +251,7 @@ void dm_persistent_snapshot_exit(void);
 int dm_transient_snapshot_init(void);
 void dm_transient_snapshot_exit(void);
 
+int dm_shared_snapshot_init(void);
+void dm_shared_snapshot_exit(void);
+
 #endif /* _LINUX_DM_EXCEPTION_STORE */
@@ -0,0 +1,1298 @@
+/*
+ * Exception store shared by several snapshots of one origin.
+ *
+ * This file is released under the GPL.
+ */
+
+#include "dm-exception-store.h"
+
+#include <linux/btree.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/dm-io.h>
+
+#define DM_MSG_PREFIX "shared snapshot"
+#define DM_CHUNK_SIZE_DEFAULT_SECTORS 32	/* 16KB */
+
+/*-----------------------------------------------------------------
+ * Shared snapshots: one persistent COW device holding the
+ * exceptions of up to 32 snapshots of the same origin.
+ *---------------------------------------------------------------*/
+
+/*
+ * Each snapshot names the COW device and its own id in it.  A chunk
+ * copied from the origin is stored once and belongs to every
+ * snapshot that needed it at the time, so a write to the origin
+ * costs one copy however many snapshots there are.  Chunks shared
+ * like this must not be written through one snapshot, so snapshots
+ * in a shared store are read-only.
+ *
+ * The layout is that of the persistent store: the first chunk holds
+ * the header, then come metadata areas each followed by as many
+ * data chunks as it has room for exceptions.  The areas are a log of
+ * exceptions, each with the set of snapshots that have it, and of
+ * snapshots being released.  When the store is first used the log
+ * is replayed into a B-tree index on the old and new chunk numbers,
+ * which from then on says which snapshots have which chunks.
+ * Releasing a snapshot walks the index to find the chunks nobody
+ * else has, and those get reused.
+ *
+ * All on disk structures are in little-endian format.  The end of
+ * the log is indicated by an entry with a new_chunk of 0, which
+ * would point to the header chunk.  An entry with a new_chunk of
+ * SHARED_RELEASE removes its snapshots from all the entries before
+ * it.
+ */
+
+/*
+ * Magic for shared snapshots: "SnSh"
+ */
+#define SHARED_MAGIC 0x68536e53
+
+/*
+ * The on-disk version of the metadata.
+ */
+#define SHARED_DISK_VERSION 1
+
+#define NUM_SNAPSHOT_HDR_CHUNKS 1
+
+/*
+ * Snapshot sets are kept in the index in place of a pointer.
+ */
+#define SHARED_MAX_SNAPSHOTS 32
+
+#define SHARED_RELEASE ((uint64_t)-1)
+
+/*
+ * Value of the chunks in the tree of free chunks, which can't be NULL.
+ */
+#define FREE_CHUNK ((void *)1)
+
+struct disk_header {
+	uint32_t magic;
+
+	/*
+	 * Simple, incrementing version. no backward
+	 * compatibility.
+	 */
+	uint32_t version;
+
+	/* In sectors */
+	uint32_t chunk_size;
+
+	/* Snapshots created and not released yet */
+	uint32_t in_use;
+
+	/* Those of them that are still usable */
+	uint32_t valid;
+};
+
+struct disk_exception {
+	uint64_t old_chunk;
+	uint64_t new_chunk;
+	uint32_t snapshots;
+	uint32_t unused;
+};
+
+struct commit_callback {
+	void (*callback)(void *, int success);
+	void *context;
+};
+
+/*
+ * One per COW device, shared by the exception stores of all the
+ * snapshots on it.
+ */
+struct shared_store {
+	struct list_head list;
+	struct block_device *bdev;
+
+	/* Exception stores using it, protected by _shared_stores_lock */
+	int count;
+
+	/*
+	 * Protects the log and the index.  Taken to commit exceptions,
+	 * which may complete snapshot exceptions and so take the
+	 * snapshot locks.
+	 */
+	struct mutex lock;
+
+	/*
+	 * Protects the header, in_use and valid.  Taken with snapshot
+	 * locks held, when a snapshot gets invalidated.
+	 */
+	struct mutex header_lock;
+
+	/* Protects next_free and the free chunks */
+	struct mutex alloc_lock;
+
+	int loaded;
+	int error;
+	unsigned chunk_size;
+	unsigned long in_use;
+	unsigned long valid;
+	uint32_t exceptions_per_area;
+
+	void *area;
+	void *zero_area;
+	void *header_area;
+
+	chunk_t current_area;
+	uint32_t current_committed;
+
+	/*
+	 * The next chunk that was never used.  Chunks below it that
+	 * were freed again are in the free tree.
+	 */
+	chunk_t next_free;
+	chunk_t nr_free;
+	struct btree_head64 free;
+
+	/* (old_chunk, new_chunk) -> snapshots */
+	struct btree_head128 index;
+
+	/*
+	 * Exceptions dropped from the index by a release, whose chunks
+	 * are not free yet: another snapshot sharing the chunk may still
+	 * have the same exception in flight, and commit it later.  They
+	 * are freed once no exception is pending.
+	 */
+	struct btree_head128 released;
+
+	atomic_t pending_count;
+	uint32_t callback_count;
+	struct commit_callback *callbacks;
+	struct dm_io_client *io_client;
+
+	struct workqueue_struct *metadata_wq;
+};
+
+/*
+ * One per snapshot.
+ */
+struct sstore {
+	struct shared_store *sh;
+	unsigned id;
+};
+
+static LIST_HEAD(_shared_stores);
+static DEFINE_MUTEX(_shared_stores_lock);
+
+static unsigned sectors_to_pages(unsigned sectors)
+{
+	return DIV_ROUND_UP(sectors, PAGE_SIZE >> 9);
+}
+
+static int alloc_area(struct shared_store *sh)
+{
+	int r = -ENOMEM;
+	size_t len;
+
+	len = sh->chunk_size << SECTOR_SHIFT;
+
+	sh->area = vmalloc(len);
+	if (!sh->area)
+		goto err_area;
+
+	sh->zero_area = vmalloc(len);
+	if (!sh->zero_area)
+		goto err_zero_area;
+	memset(sh->zero_area, 0, len);
+
+	sh->header_area = vmalloc(len);
+	if (!sh->header_area)
+		goto err_header_area;
+
+	return 0;
+
+err_header_area:
+	vfree(sh->zero_area);
+
+err_zero_area:
+	vfree(sh->area);
+
+err_area:
+	return r;
+}
+
+static void free_area(struct shared_store *sh)
+{
+	vfree(sh->area);
+	sh->area = NULL;
+
+	vfree(sh->zero_area);
+	sh->zero_area = NULL;
+
+	vfree(sh->header_area);
+	sh->header_area = NULL;
+}
+
+struct mdata_req {
+	struct dm_io_region *where;
+	struct dm_io_request *io_req;
+	struct work_struct work;
+	int result;
+};
+
+static void do_metadata(struct work_struct *work)
+{
+	struct mdata_req *req = container_of(work, struct mdata_req, work);
+
+	req->result = dm_io(req->io_req, 1, req->where, NULL);
+}
+
+/*
+ * Read or write a chunk aligned and sized block of data from a device.
+ */
+static int chunk_io(struct shared_store *sh, void *area, chunk_t chunk,
+		    int rw, int metadata)
+{
+	struct dm_io_region where = {
+		.bdev = sh->bdev,
+		.sector = sh->chunk_size * chunk,
+		.count = sh->chunk_size,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = area,
+		.client = sh->io_client,
+		.notify.fn = NULL,
+	};
+	struct mdata_req req;
+
+	if (!metadata)
+		return dm_io(&io_req, 1, &where, NULL);
+
+	req.where = &where;
+	req.io_req = &io_req;
+	req.result = 0;
+
+	/*
+	 * Issue the synchronous I/O from a different thread
+	 * to avoid generic_make_request recursion.
+	 */
+	INIT_WORK_ON_STACK(&req.work, do_metadata);
+	queue_work(sh->metadata_wq, &req.work);
+	flush_workqueue(sh->metadata_wq);
+
+	return req.result;
+}
+
+/*
+ * Convert a metadata area index to a chunk index.
+ */
+static chunk_t area_location(struct shared_store *sh, chunk_t area)
+{
+	return NUM_SNAPSHOT_HDR_CHUNKS + ((sh->exceptions_per_area + 1) * area);
+}
+
+static int is_metadata(struct shared_store *sh, chunk_t chunk)
+{
+	if (chunk < NUM_SNAPSHOT_HDR_CHUNKS)
+		return 1;
+
+	return sector_div(chunk, sh->exceptions_per_area + 1) ==
+	       NUM_SNAPSHOT_HDR_CHUNKS;
+}
+
+/*
+ * Move next_free past the metadata area it may have reached.
+ */
+static void skip_metadata(struct shared_store *sh)
+{
+	if (is_metadata(sh, sh->next_free))
+		sh->next_free++;
+}
+
+static int area_io(struct shared_store *sh, int rw)
+{
+	return chunk_io(sh, sh->area, area_location(sh, sh->current_area),
+			rw, 0);
+}
+
+static void zero_memory_area(struct shared_store *sh)
+{
+	memset(sh->area, 0, sh->chunk_size << SECTOR_SHIFT);
+}
+
+static int zero_disk_area(struct shared_store *sh, chunk_t area)
+{
+	return chunk_io(sh, sh->zero_area, area_location(sh, area), WRITE, 0);
+}
+
+static int read_header(struct shared_store *sh,
+		       struct dm_exception_store *store, int *new_store)
+{
+	int r;
+	struct disk_header *dh;
+	unsigned chunk_size;
+	int chunk_size_supplied = 1;
+	char *chunk_err;
+
+	/*
+	 * Use default chunk size (or logical_block_size, if larger)
+	 * if none supplied
+	 */
+	if (!store->chunk_size) {
+		store->chunk_size = max(DM_CHUNK_SIZE_DEFAULT_SECTORS,
+					bdev_logical_block_size(sh->bdev) >> 9);
+		store->chunk_mask = store->chunk_size - 1;
+		store->chunk_shift = ffs(store->chunk_size) - 1;
+		chunk_size_supplied = 0;
+	}
+	sh->chunk_size = store->chunk_size;
+
+	sh->io_client = dm_io_client_create(sectors_to_pages(sh->chunk_size));
+	if (IS_ERR(sh->io_client)) {
+		r = PTR_ERR(sh->io_client);
+		sh->io_client = NULL;
+		return r;
+	}
+
+	r = alloc_area(sh);
+	if (r)
+		return r;
+
+	r = chunk_io(sh, sh->header_area, 0, READ, 1);
+	if (r)
+		return r;
+
+	dh = sh->header_area;
+
+	if (le32_to_cpu(dh->magic) == 0) {
+		*new_store = 1;
+		return 0;
+	}
+
+	if (le32_to_cpu(dh->magic) != SHARED_MAGIC) {
+		DMWARN("Invalid or corrupt shared snapshot store");
+		return -ENXIO;
+	}
+
+	if (le32_to_cpu(dh->version) != SHARED_DISK_VERSION) {
+		DMWARN("unable to handle shared snapshot disk version %d",
+		       le32_to_cpu(dh->version));
+		return -EINVAL;
+	}
+
+	*new_store = 0;
+	sh->in_use = le32_to_cpu(dh->in_use);
+	sh->valid = le32_to_cpu(dh->valid);
+	chunk_size = le32_to_cpu(dh->chunk_size);
+
+	if (store->chunk_size == chunk_size)
+		return 0;
+
+	if (chunk_size_supplied)
+		DMWARN("chunk size %u in device metadata overrides "
+		       "table chunk size of %u.",
+		       chunk_size, store->chunk_size);
+
+	/* We had a bogus chunk_size. Fix stuff up. */
+	free_area(sh);
+
+	r = dm_exception_store_set_chunk_size(store, chunk_size, &chunk_err);
+	if (r) {
+		DMERR("invalid on-disk chunk size %u: %s.",
+		      chunk_size, chunk_err);
+		return r;
+	}
+	sh->chunk_size = chunk_size;
+
+	r = dm_io_client_resize(sectors_to_pages(sh->chunk_size),
+				sh->io_client);
+	if (r)
+		return r;
+
+	return alloc_area(sh);
+}
+
+/*
+ * Called with header_lock held.
+ */
+static int write_header(struct shared_store *sh)
+{
+	struct disk_header *dh;
+
+	memset(sh->header_area, 0, sh->chunk_size << SECTOR_SHIFT);
+
+	dh = sh->header_area;
+	dh->magic = cpu_to_le32(SHARED_MAGIC);
+	dh->version = cpu_to_le32(SHARED_DISK_VERSION);
+	dh->chunk_size = cpu_to_le32(sh->chunk_size);
+	dh->in_use = cpu_to_le32(sh->in_use);
+	dh->valid = cpu_to_le32(sh->valid);
+
+	return chunk_io(sh, sh->header_area, 0, WRITE_BARRIER, 1);
+}
+
+/*
+ * Access functions for the disk exceptions, these do the endian conversions.
+ */
+static struct disk_exception *get_exception(struct shared_store *sh,
+					    uint32_t index)
+{
+	BUG_ON(index >= sh->exceptions_per_area);
+
+	return ((struct disk_exception *) sh->area) + index;
+}
+
+static void read_exception(struct shared_store *sh,
+			   uint32_t index, struct disk_exception *result)
+{
+	struct disk_exception *e = get_exception(sh, index);
+
+	/* copy it */
+	result->old_chunk = le64_to_cpu(e->old_chunk);
+	result->new_chunk = le64_to_cpu(e->new_chunk);
+	result->snapshots = le32_to_cpu(e->snapshots);
+}
+
+static void write_exception(struct shared_store *sh,
+			    uint32_t index, struct disk_exception *de)
+{
+	struct disk_exception *e = get_exception(sh, index);
+
+	/* copy it */
+	e->old_chunk = cpu_to_le64(de->old_chunk);
+	e->new_chunk = cpu_to_le64(de->new_chunk);
+	e->snapshots = cpu_to_le32(de->snapshots);
+	e->unused = 0;
+}
+
+/*
+ * Add @snapshots to the exception from @old to @new in the index.
+ */
+static int index_add(struct shared_store *sh, chunk_t old, chunk_t new,
+		     unsigned long snapshots)
+{
+	unsigned long cur;
+
+	cur = (unsigned long)btree_lookup128(&sh->index, old, new);
+	if (cur)
+		return btree_update128(&sh->index, old, new,
+				       (void *)(cur | snapshots));
+
+	return btree_insert128(&sh->index, old, new, (void *)snapshots,
+			       GFP_NOIO);
+}
+
+static void free_chunk(struct shared_store *sh, chunk_t chunk)
+{
+	mutex_lock(&sh->alloc_lock);
+	/* If this fails the chunk is found again on the next load */
+	if (!btree_insert64(&sh->free, chunk, FREE_CHUNK, GFP_NOIO))
+		sh->nr_free++;
+	mutex_unlock(&sh->alloc_lock);
+}
+
+/*
+ * Remove @snapshots from every exception in the index.  Those left
+ * without a snapshot go, and if @free is set their chunks are queued
+ * to be freed by free_released().
+ */
+static void index_release(struct shared_store *sh, unsigned long snapshots,
+			  int free)
+{
+	u64 old, new;
+	unsigned long cur;
+	void *val;
+
+	btree_for_each_safe128(&sh->index, old, new, val) {
+		cur = (unsigned long)val;
+		if (!(cur & snapshots))
+			continue;
+
+		cur &= ~snapshots;
+		if (cur) {
+			btree_update128(&sh->index, old, new, (void *)cur);
+			continue;
+		}
+
+		btree_remove128(&sh->index, old, new);
+		/* If this fails the chunk is found again on the next load */
+		if (free)
+			btree_insert128(&sh->released, old, new, FREE_CHUNK,
+					GFP_NOIO);
+	}
+}
+
+/*
+ * Free the chunks queued by index_release(), unless a snapshot that
+ * shared the exception has committed it since.  Called with lock held
+ * and no exception pending, so nothing can commit them any more.
+ */
+static void free_released(struct shared_store *sh)
+{
+	u64 old, new;
+	void *val;
+
+	btree_for_each_safe128(&sh->released, old, new, val) {
+		btree_remove128(&sh->released, old, new);
+		if (!btree_lookup128(&sh->index, old, new))
+			free_chunk(sh, new);
+	}
+}
+
+static void forget_chunk(void *elem, unsigned long opaque, u64 key,
+			 size_t index)
+{
+}
+
+static void forget_exception(void *elem, unsigned long opaque, u64 old,
+			     u64 new, size_t index)
+{
+}
+
+/*
+ * Replays the log entries that are present in the current area.
+ * 'full' is filled in to indicate if the area has been filled.
+ */
+static int insert_exceptions(struct shared_store *sh, int *full)
+{
+	int r;
+	unsigned int i;
+	struct disk_exception de;
+
+	/* presume the area is full */
+	*full = 1;
+
+	for (i = 0; i < sh->exceptions_per_area; i++) {
+		read_exception(sh, i, &de);
+
+		/*
+		 * If the new_chunk is pointing at the start of
+		 * the COW device, where the header is, we know
+		 * that we've hit the end of the log.  Therefore
+		 * the area is not full.
+		 */
+		if (de.new_chunk == 0LL) {
+			sh->current_committed = i;
+			*full = 0;
+			break;
+		}
+
+		if (de.new_chunk == SHARED_RELEASE) {
+			index_release(sh, de.snapshots, 0);
+			continue;
+		}
+
+		if (!de.snapshots)
+			continue;
+
+		/*
+		 * Keep track of the start of the free chunks.
+		 */
+		if (sh->next_free <= de.new_chunk)
+			sh->next_free = de.new_chunk + 1;
+
+		r = index_add(sh, de.old_chunk, de.new_chunk, de.snapshots);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static int read_exceptions(struct shared_store *sh)
+{
+	int r, full = 1;
+
+	/*
+	 * Keeping reading chunks and replaying the log until
+	 * we find a partially full area.
+	 */
+	for (sh->current_area = 0; full; sh->current_area++) {
+		r = area_io(sh, READ);
+		if (r)
+			return r;
+
+		r = insert_exceptions(sh, &full);
+		if (r)
+			return r;
+	}
+
+	sh->current_area--;
+
+	return 0;
+}
+
+/*
+ * Put the chunks below next_free that no exception uses into the
+ * free tree: those of released snapshots, and any left behind by
+ * a crash before their exception was committed.
+ */
+static int find_free_chunks(struct shared_store *sh)
+{
+	unsigned long *used;
+	u64 old, new;
+	chunk_t chunk;
+	void *val;
+	int r = 0;
+
+	used = dm_vcalloc(BITS_TO_LONGS(sh->next_free), sizeof(*used));
+	if (!used)
+		return -ENOMEM;
+
+	btree_for_each_safe128(&sh->index, old, new, val)
+		__set_bit((unsigned long)new, used);
+
+	for (chunk = NUM_SNAPSHOT_HDR_CHUNKS; chunk < sh->next_free; chunk++) {
+		if (is_metadata(sh, chunk) ||
+		    test_bit((unsigned long)chunk, used))
+			continue;
+
+		r = btree_insert64(&sh->free, chunk, FREE_CHUNK, GFP_KERNEL);
+		if (r)
+			break;
+		sh->nr_free++;
+	}
+
+	vfree(used);
+
+	return r;
+}
+
+static void unload_store(struct shared_store *sh)
+{
+	btree_grim_visitor128(&sh->index, 0, forget_exception);
+	btree_grim_visitor128(&sh->released, 0, forget_exception);
+	btree_grim_visitor64(&sh->free, 0, forget_chunk);
+	sh->nr_free = 0;
+
+	if (sh->callbacks)
+		vfree(sh->callbacks);
+	sh->callbacks = NULL;
+
+	free_area(sh);
+
+	if (sh->io_client)
+		dm_io_client_destroy(sh->io_client);
+	sh->io_client = NULL;
+
+	sh->loaded = 0;
+}
+
+/*
+ * Read the header and the log of the store, the first time one of
+ * its snapshots is set up.
+ */
+static int load_store(struct shared_store *sh,
+		      struct dm_exception_store *store)
+{
+	int r, uninitialized_var(new_store);
+
+	r = read_header(sh, store, &new_store);
+	if (r)
+		goto bad;
+
+	/*
+	 * Now we know correct chunk_size, complete the initialisation.
+	 */
+	sh->exceptions_per_area = (sh->chunk_size << SECTOR_SHIFT) /
+				  sizeof(struct disk_exception);
+	sh->callbacks = dm_vcalloc(sh->exceptions_per_area,
+				   sizeof(*sh->callbacks));
+	if (!sh->callbacks) {
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	sh->next_free = NUM_SNAPSHOT_HDR_CHUNKS + 1; /* header and 1st area */
+	sh->current_committed = 0;
+	sh->error = 0;
+
+	if (new_store) {
+		mutex_lock(&sh->header_lock);
+		sh->in_use = 0;
+		sh->valid = 0;
+		r = write_header(sh);
+		mutex_unlock(&sh->header_lock);
+		if (r) {
+			DMWARN("write_header failed");
+			goto bad;
+		}
+
+		sh->current_area = 0;
+		zero_memory_area(sh);
+		r = zero_disk_area(sh, 0);
+		if (r) {
+			DMWARN("zero_disk_area(0) failed");
+			goto bad;
+		}
+	} else {
+		r = read_exceptions(sh);
+		if (r)
+			goto bad;
+
+		skip_metadata(sh);
+
+		r = find_free_chunks(sh);
+		if (r)
+			goto bad;
+	}
+
+	sh->loaded = 1;
+
+	return 0;
+
+bad:
+	unload_store(sh);
+	return r;
+}
+
+/*
+ * Snapshots set up after the first take the chunk size of the store.
+ */
+static int adopt_chunk_size(struct shared_store *sh,
+			    struct dm_exception_store *store)
+{
+	char *chunk_err;
+	int r;
+
+	if (store->chunk_size == sh->chunk_size)
+		return 0;
+
+	if (store->chunk_size)
+		DMWARN("chunk size %u of the shared store overrides "
+		       "table chunk size of %u.",
+		       sh->chunk_size, store->chunk_size);
+
+	r = dm_exception_store_set_chunk_size(store, sh->chunk_size,
+					      &chunk_err);
+	if (r)
+		DMERR("invalid shared store chunk size %u: %s.",
+		      sh->chunk_size, chunk_err);
+
+	return r;
+}
+
+/*
+ * Write the current area, and complete the exceptions waiting for
+ * it.  Called with lock held.
+ */
+static void flush_log(struct shared_store *sh)
+{
+	unsigned int i;
+	struct commit_callback *cb;
+
+	/*
+	 * If we completely filled the current area, then wipe the next one.
+	 */
+	if (!sh->error &&
+	    (sh->current_committed == sh->exceptions_per_area) &&
+	    zero_disk_area(sh, sh->current_area + 1))
+		sh->error = -EIO;
+
+	/*
+	 * Commit exceptions to disk.
+	 */
+	if (!sh->error && area_io(sh, WRITE_BARRIER))
+		sh->error = -EIO;
+
+	if (sh->error)
+		DMERR("Unable to write shared snapshot log");
+
+	/*
+	 * Advance to the next area if this one is full.
+	 */
+	if (sh->current_committed == sh->exceptions_per_area) {
+		sh->current_committed = 0;
+		sh->current_area++;
+		zero_memory_area(sh);
+	}
+
+	for (i = 0; i < sh->callback_count; i++) {
+		cb = sh->callbacks + i;
+		cb->callback(cb->context, !sh->error);
+	}
+
+	sh->callback_count = 0;
+}
+
+/*
+ * Add an exception to the log.  One that the previous entry already
+ * has for other snapshots, as when they shared the copy, is added to
+ * that entry.
+ */
+static void log_exception(struct shared_store *sh, chunk_t old, chunk_t new,
+			  unsigned long snapshots)
+{
+	struct disk_exception de;
+
+	if (sh->current_committed) {
+		read_exception(sh, sh->current_committed - 1, &de);
+		if (de.old_chunk == old && de.new_chunk == new &&
+		    de.new_chunk != SHARED_RELEASE) {
+			de.snapshots |= snapshots;
+			write_exception(sh, sh->current_committed - 1, &de);
+			return;
+		}
+	}
+
+	de.old_chunk = old;
+	de.new_chunk = new;
+	de.snapshots = snapshots;
+	write_exception(sh, sh->current_committed++, &de);
+}
+
+static struct sstore *get_info(struct dm_exception_store *store)
+{
+	return (struct sstore *) store->context;
+}
+
+static void shared_usage(struct dm_exception_store *store,
+			 sector_t *total_sectors,
+			 sector_t *sectors_allocated,
+			 sector_t *metadata_sectors)
+{
+	struct shared_store *sh = get_info(store)->sh;
+
+	*sectors_allocated = (sh->next_free - sh->nr_free) * store->chunk_size;
+	*total_sectors = get_dev_size(sh->bdev);
+
+	/*
+	 * First chunk is the fixed header.
+	 * Then there are (sh->current_area + 1) metadata chunks, each one
+	 * separated from the next by sh->exceptions_per_area data chunks.
+	 */
+	*metadata_sectors = (sh->current_area + 1 + NUM_SNAPSHOT_HDR_CHUNKS) *
+			    store->chunk_size;
+}
+
+static void put_shared_store(struct shared_store *sh)
+{
+	mutex_lock(&_shared_stores_lock);
+	if (--sh->count) {
+		mutex_unlock(&_shared_stores_lock);
+		return;
+	}
+	list_del(&sh->list);
+	mutex_unlock(&_shared_stores_lock);
+
+	unload_store(sh);
+	btree_destroy128(&sh->index);
+	btree_destroy128(&sh->released);
+	btree_destroy64(&sh->free);
+	destroy_workqueue(sh->metadata_wq);
+	kfree(sh);
+}
+
+/*
+ * Find the shared store on @bdev, or set up a new one.
+ */
+static struct shared_store *get_shared_store(struct block_device *bdev)
+{
+	struct shared_store *sh;
+
+	mutex_lock(&_shared_stores_lock);
+
+	list_for_each_entry(sh, &_shared_stores, list)
+		if (sh->bdev == bdev) {
+			sh->count++;
+			goto out;
+		}
+
+	sh = kzalloc(sizeof(*sh), GFP_KERNEL);
+	if (!sh)
+		goto out;
+
+	if (btree_init128(&sh->index))
+		goto bad_index;
+
+	if (btree_init128(&sh->released))
+		goto bad_released;
+
+	if (btree_init64(&sh->free))
+		goto bad_free;
+
+	sh->metadata_wq = create_singlethread_workqueue("ksnaphd");
+	if (!sh->metadata_wq) {
+		DMERR("couldn't start header metadata update thread");
+		goto bad_wq;
+	}
+
+	sh->bdev = bdev;
+	sh->count = 1;
+	mutex_init(&sh->lock);
+	mutex_init(&sh->header_lock);
+	mutex_init(&sh->alloc_lock);
+	atomic_set(&sh->pending_count, 0);
+	list_add(&sh->list, &_shared_stores);
+	goto out;
+
+bad_wq:
+	btree_destroy64(&sh->free);
+bad_free:
+	btree_destroy128(&sh->released);
+bad_released:
+	btree_destroy128(&sh->index);
+bad_index:
+	kfree(sh);
+	sh = NULL;
+out:
+	mutex_unlock(&_shared_stores_lock);
+
+	return sh;
+}
+
+static void shared_dtr(struct dm_exception_store *store)
+{
+	struct sstore *ss = get_info(store);
+
+	put_shared_store(ss->sh);
+	kfree(ss);
+}
+
+static int shared_read_metadata(struct dm_exception_store *store,
+				int (*callback)(void *callback_context,
+						chunk_t old, chunk_t new),
+				void *callback_context)
+{
+	struct sstore *ss = get_info(store);
+	struct shared_store *sh = ss->sh;
+	int r, new_snapshot = 0;
+	u64 old, new;
+	void *val;
+
+	mutex_lock(&sh->lock);
+
+	if (sh->loaded)
+		r = adopt_chunk_size(sh, store);
+	else
+		r = load_store(sh, store);
+	if (r)
+		goto out;
+
+	mutex_lock(&sh->header_lock);
+	if (!test_bit(ss->id, &sh->in_use)) {
+		/*
+		 * A new snapshot.
+		 */
+		new_snapshot = 1;
+		set_bit(ss->id, &sh->in_use);
+		set_bit(ss->id, &sh->valid);
+		r = write_header(sh);
+		if (r) {
+			DMWARN("write_header failed");
+			clear_bit(ss->id, &sh->in_use);
+			clear_bit(ss->id, &sh->valid);
+		}
+	} else if (!test_bit(ss->id, &sh->valid))
+		/*
+		 * Metadata are valid, but snapshot is invalidated
+		 */
+		r = 1;
+	mutex_unlock(&sh->header_lock);
+
+	if (r || new_snapshot)
+		goto out;
+
+	btree_for_each_safe128(&sh->index, old, new, val) {
+		if (!((unsigned long)val & (1UL << ss->id)))
+			continue;
+
+		r = callback(callback_context, old, new);
+		if (r)
+			break;
+	}
+
+out:
+	mutex_unlock(&sh->lock);
+
+	return r;
+}
+
+static int shared_prepare_exception(struct dm_exception_store *store,
+				    struct dm_exception *e)
+{
+	struct shared_store *sh = get_info(store)->sh;
+	sector_t size = get_dev_size(sh->bdev);
+	u64 chunk;
+	int r = 0;
+
+	mutex_lock(&sh->alloc_lock);
+
+	if (btree_last64(&sh->free, &chunk)) {
+		btree_remove64(&sh->free, chunk);
+		sh->nr_free--;
+		e->new_chunk = chunk;
+	} else if (size < ((sh->next_free + 1) * store->chunk_size)) {
+		/* Is there enough room ? */
+		r = -ENOSPC;
+	} else {
+		e->new_chunk = sh->next_free++;
+		skip_metadata(sh);
+	}
+
+	if (!r)
+		atomic_inc(&sh->pending_count);
+
+	mutex_unlock(&sh->alloc_lock);
+
+	return r;
+}
+
+static int shared_share_exception(struct dm_exception_store *store,
+				  struct dm_exception *e,
+				  struct dm_exception_store *primary_store,
+				  struct dm_exception *primary)
+{
+	struct shared_store *sh = get_info(store)->sh;
+
+	if (primary_store->type != store->type ||
+	    get_info(primary_store)->sh != sh ||
+	    primary->old_chunk != e->old_chunk)
+		return -EINVAL;
+
+	e->new_chunk = primary->new_chunk;
+	atomic_inc(&sh->pending_count);
+
+	return 0;
+}
+
+static void shared_commit_exception(struct dm_exception_store *store,
+				    struct dm_exception *e,
+				    void (*callback) (void *, int success),
+				    void *callback_context)
+{
+	struct sstore *ss = get_info(store);
+	struct shared_store *sh = ss->sh;
+	struct commit_callback *cb;
+	int failed = 0, last;
+
+	mutex_lock(&sh->lock);
+
+	/*
+	 * Nothing gets logged for a snapshot that was invalidated, it
+	 * may be on its way to being released.
+	 */
+	if (sh->error || !test_bit(ss->id, &sh->valid) ||
+	    index_add(sh, e->old_chunk, e->new_chunk, 1UL << ss->id))
+		failed = 1;
+	else {
+		log_exception(sh, e->old_chunk, e->new_chunk, 1UL << ss->id);
+
+		/*
+		 * Add the callback to the back of the array.  Callbacks
+		 * are only run when the area is written, from here or
+		 * from the other functions that take lock.
+		 */
+		cb = sh->callbacks + sh->callback_count++;
+		cb->callback = callback;
+		cb->context = callback_context;
+	}
+
+	/*
+	 * If there are exceptions in flight and we have not yet
+	 * filled this metadata area there's nothing more to do.
+	 */
+	last = atomic_dec_and_test(&sh->pending_count);
+	if (last ||
+	    sh->current_committed == sh->exceptions_per_area ||
+	    sh->callback_count == sh->exceptions_per_area)
+		flush_log(sh);
+
+	if (last)
+		free_released(sh);
+
+	mutex_unlock(&sh->lock);
+
+	if (failed)
+		callback(callback_context, 0);
+}
+
+static void shared_abort_exception(struct dm_exception_store *store,
+				   struct dm_exception *e)
+{
+	struct shared_store *sh = get_info(store)->sh;
+
+	/*
+	 * The chunk is not freed, if the copy to it failed for one
+	 * snapshot it failed for all that share it.  It is found again
+	 * on the next load.
+	 */
+	mutex_lock(&sh->lock);
+	if (atomic_dec_and_test(&sh->pending_count)) {
+		if (sh->callback_count)
+			flush_log(sh);
+		free_released(sh);
+	}
+	mutex_unlock(&sh->lock);
+}
+
+static void shared_drop_snapshot(struct dm_exception_store *store)
+{
+	struct sstore *ss = get_info(store);
+	struct shared_store *sh = ss->sh;
+
+	mutex_lock(&sh->header_lock);
+	clear_bit(ss->id, &sh->valid);
+	if (write_header(sh))
+		DMWARN("write header failed");
+	mutex_unlock(&sh->header_lock);
+}
+
+/*
+ * The snapshot is being deleted: free the chunks that no other
+ * snapshot has, and let its id be used for a new one.
+ */
+static int shared_release_snapshot(struct dm_exception_store *store)
+{
+	struct sstore *ss = get_info(store);
+	struct shared_store *sh = ss->sh;
+	struct disk_exception de;
+	int r;
+
+	mutex_lock(&sh->lock);
+
+	/*
+	 * Log the release first, none of the chunks may be reused
+	 * before that is on disk.
+	 */
+	de.old_chunk = 0;
+	de.new_chunk = SHARED_RELEASE;
+	de.snapshots = 1UL << ss->id;
+	write_exception(sh, sh->current_committed++, &de);
+	flush_log(sh);
+
+	r = sh->error;
+	if (r)
+		goto out;
+
+	/*
+	 * An exception this snapshot shares with others may have been
+	 * committed for it but not yet for them.  Its chunk must not be
+	 * freed before they are done, see free_released().
+	 */
+	index_release(sh, 1UL << ss->id, 1);
+	if (!atomic_read(&sh->pending_count))
+		free_released(sh);
+
+	mutex_lock(&sh->header_lock);
+	clear_bit(ss->id, &sh->in_use);
+	clear_bit(ss->id, &sh->valid);
+	r = write_header(sh);
+	mutex_unlock(&sh->header_lock);
+
+out:
+	mutex_unlock(&sh->lock);
+
+	return r;
+}
+
+/*
+ * Takes the id of the snapshot in the store.
+ */
+static int shared_ctr(struct dm_exception_store *store,
+		      unsigned argc, char **argv)
+{
+	struct sstore *ss;
+	unsigned long id;
+	char *value;
+
+	if (argc < 1)
+		return -EINVAL;
+
+	id = simple_strtoul(argv[0], &value, 10);
+	if (*argv[0] == '\0' || *value != '\0' || id >= SHARED_MAX_SNAPSHOTS) {
+		DMERR("Invalid snapshot id %s", argv[0]);
+		return -EINVAL;
+	}
+
+	ss = kzalloc(sizeof(*ss), GFP_KERNEL);
+	if (!ss)
+		return -ENOMEM;
+
+	ss->id = id;
+	ss->sh = get_shared_store(dm_snap_cow(store->snap)->bdev);
+	if (!ss->sh) {
+		kfree(ss);
+		return -ENOMEM;
+	}
+
+	store->shared_id = id;
+	store->context = ss;
+
+	return 0;
+}
+
+static unsigned shared_status(struct dm_exception_store *store,
+			      status_type_t status, char *result,
+			      unsigned maxlen)
+{
+	unsigned sz = 0;
+
+	switch (status) {
+	case STATUSTYPE_INFO:
+		break;
+	case STATUSTYPE_TABLE:
+		DMEMIT(" S %llu %u", (unsigned long long)store->chunk_size,
+		       get_info(store)->id);
+	}
+
+	return sz;
+}
+
+static struct dm_exception_store_type _shared_type = {
+	.name = "shared",
+	.module = THIS_MODULE,
+	.ctr = shared_ctr,
+	.dtr = shared_dtr,
+	.read_metadata = shared_read_metadata,
+	.prepare_exception = shared_prepare_exception,
+	.share_exception = shared_share_exception,
+	.commit_exception = shared_commit_exception,
+	.abort_exception = shared_abort_exception,
+	.drop_snapshot = shared_drop_snapshot,
+	.release_snapshot = shared_release_snapshot,
+	.usage = shared_usage,
+	.status = shared_status,
+};
+
+static struct dm_exception_store_type _shared_compat_type = {
+	.name = "S",
+	.module = THIS_MODULE,
+	.ctr = shared_ctr,
+	.dtr = shared_dtr,
+	.read_metadata = shared_read_metadata,
+	.prepare_exception = shared_prepare_exception,
+	.share_exception = shared_share_exception,
+	.commit_exception = shared_commit_exception,
+	.abort_exception = shared_abort_exception,
+	.drop_snapshot = shared_drop_snapshot,
+	.release_snapshot = shared_release_snapshot,
+	.usage = shared_usage,
+	.status = shared_status,
+};
+
+int dm_shared_snapshot_init(void)
+{
+	int r;
+
+	r = dm_exception_store_type_register(&_shared_type);
+	if (r) {
+		DMERR("Unable to register shared exception store type");
+		return r;
+	}
+
+	r = dm_exception_store_type_register(&_shared_compat_type);
+	if (r) {
+		DMERR("Unable to register short shared exception "
+		      "store type");
+		dm_exception_store_type_unregister(&_shared_type);
+		return r;
+	}
+
+	return r;
+}
+
+void dm_shared_snapshot_exit(void)
+{
+	dm_exception_store_type_unregister(&_shared_type);
+	dm_exception_store_type_unregister(&_shared_compat_type);
+}
@@ -40,6 +40,8 @@ static const char dm_snapshot_merge_target_name[] = "snapshot-merge";
  */
 #define SNAPSHOT_COPY_PRIORITY 2
 
+#define MESG_STR(x) x, sizeof(x)
+
 /*
  * Reserve 1MB for each snapshot initially (with minimum of 1 page).
  */
@@ -196,6 +198,14 @@ struct dm_snap_pending_exception {
 	 * kcopyd.
 	 */
 	int started;
+
+	/*
+	 * Exceptions of other snapshots stored in the same chunk, that
+	 * complete with this one's copy, and the entry in that list of
+	 * an exception that is one of them.
+	 */
+	struct list_head sharers;
+	struct list_head share_list;
 };
 
 /*
@@ -377,7 +387,8 @@ static int __find_snapshots_sharing_cow(struct dm_snapshot *snap,
 	list_for_each_entry(s, &o->snapshots, list) {
 		if (dm_target_is_snapshot_merge(s->ti) && snap_merge)
 			*snap_merge = s;
-		if (!bdev_equal(s->cow->bdev, snap->cow->bdev))
+		if (!bdev_equal(s->cow->bdev, snap->cow->bdev) ||
+		    s->store->shared_id != snap->store->shared_id)
 			continue;
 
 		down_read(&s->lock);
@@ -1049,7 +1060,9 @@ static void stop_merge(struct dm_snapshot *s)
 }
 
 /*
- * Construct a snapshot mapping: <origin_dev> <COW-dev> <p/n> <chunk-size>
+ * Construct a snapshot mapping:
+ * <origin_dev> <COW-dev> <p/n> <chunk-size>
+ * <origin_dev> <COW-dev> S <chunk-size> <snapshot id>
  */
 static int snapshot_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 {
@@ -1060,8 +1073,8 @@ static int snapshot_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	unsigned args_used, num_flush_requests = 1;
 	fmode_t origin_mode = FMODE_READ;
 
-	if (argc != 4) {
-		ti->error = "requires exactly 4 arguments";
+	if (argc != 4 && argc != 5) {
+		ti->error = "requires 4 or 5 arguments";
 		r = -EINVAL;
 		goto bad;
 	}
@@ -1109,6 +1122,24 @@ static int snapshot_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 	argv += args_used;
 	argc -= args_used;
 
+	if (argc) {
+		ti->error = "Too many arguments";
+		r = -EINVAL;
+		goto bad_hash_tables;
+	}
+
+	/*
+	 * A chunk in a shared store may belong to other snapshots too,
+	 * so it can't be written through this one.
+	 */
+	if (s->store->type->share_exception &&
+	    (dm_table_get_mode(ti->table) & FMODE_WRITE)) {
+		ti->error = "Snapshots in a shared exception store "
+			    "are read-only";
+		r = -EINVAL;
+		goto bad_hash_tables;
+	}
+
 	s->ti = ti;
 	s->valid = 1;
 	s->active = 0;
@@ -1478,22 +1509,39 @@ static void commit_callback(void *context, int success)
 	pending_complete(pe, success);
 }
 
+static void copy_complete(struct dm_snap_pending_exception *pe, int success)
+{
+	struct dm_snapshot *s = pe->snap;
+
+	if (!success) {
+		if (s->store->type->abort_exception)
+			s->store->type->abort_exception(s->store, &pe->e);
+		pending_complete(pe, 0);
+	} else
+		/* Update the metadata if we are persistent */
+		s->store->type->commit_exception(s->store, &pe->e,
+						 commit_callback, pe);
+}
+
 /*
  * Called when the copy I/O has finished.  kcopyd actually runs
  * this code so don't block.
  */
 static void copy_callback(int read_err, unsigned long write_err, void *context)
 {
-	struct dm_snap_pending_exception *pe = context;
-	struct dm_snapshot *s = pe->snap;
+	struct dm_snap_pending_exception *pe = context, *sharer, *n;
+	int success = !read_err && !write_err;
 
-	if (read_err || write_err)
-		pending_complete(pe, 0);
+	/*
+	 * The sharers were all added before the copy started, and
+	 * they go before the exception they share the copy of.
+	 */
+	list_for_each_entry_safe(sharer, n, &pe->sharers, share_list) {
+		list_del(&sharer->share_list);
+		copy_complete(sharer, success);
+	}
 
-	else
-		/* Update the metadata if we are persistent */
-		s->store->type->commit_exception(s->store, &pe->e,
-						 commit_callback, pe);
+	copy_complete(pe, success);
 }
 
 /*
@@ -1537,12 +1585,17 @@ __lookup_pending_exception(struct dm_snapshot *s, chunk_t chunk)
  * for this chunk, otherwise it allocates a new one and inserts
  * it into the pending table.
  *
+ * If @primary is given, which has not been started yet, the new
+ * exception is stored where that one is if the exception store
+ * allows, and completes when its copy does.
+ *
  * NOTE: a write lock must be held on snap->lock before calling
  * this.
  */
 static struct dm_snap_pending_exception *
 __find_pending_exception(struct dm_snapshot *s,
-			 struct dm_snap_pending_exception *pe, chunk_t chunk)
+			 struct dm_snap_pending_exception *pe, chunk_t chunk,
+			 struct dm_snap_pending_exception *primary)
 {
 	struct dm_snap_pending_exception *pe2;
 
@@ -1556,8 +1609,16 @@ __find_pending_exception(struct dm_snapshot *s,
 	bio_list_init(&pe->origin_bios);
 	bio_list_init(&pe->snapshot_bios);
 	pe->started = 0;
-
-	if (s->store->type->prepare_exception(s->store, &pe->e)) {
+	INIT_LIST_HEAD(&pe->sharers);
+
+	if (primary && s->store->type->share_exception &&
+	    !s->store->type->share_exception(s->store, &pe->e,
+					     primary->snap->store,
+					     &primary->e)) {
+		/* Never started on its own */
+		pe->started = 1;
+		list_add_tail(&pe->share_list, &primary->sharers);
+	} else if (s->store->type->prepare_exception(s->store, &pe->e)) {
 		free_pending_exception(pe);
 		return NULL;
 	}
@@ -1640,7 +1701,7 @@ static int snapshot_map(struct dm_target *ti, struct bio *bio,
 				goto out_unlock;
 			}
 
-			pe = __find_pending_exception(s, pe, chunk);
+			pe = __find_pending_exception(s, pe, chunk, NULL);
 			if (!pe) {
 				__invalidate_snapshot(s, -ENOMEM);
 				r = -EIO;
@@ -1901,6 +1962,38 @@ static int snapshot_status(struct dm_target *ti, status_type_t type,
 	return 0;
 }
 
+/*
+ * Message interface
+ *	release
+ *
+ * Invalidates the snapshot and gives the space it used in a shared
+ * exception store back for the other snapshots.
+ */
+static int snapshot_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct dm_snapshot *snap = ti->private;
+
+	if (argc != 1 || strnicmp(argv[0], MESG_STR("release"))) {
+		DMWARN("Unrecognised snapshot message received.");
+		return -EINVAL;
+	}
+
+	if (!snap->store->type->release_snapshot) {
+		DMWARN("Exception store does not support release.");
+		return -EINVAL;
+	}
+
+	down_write(&snap->lock);
+	__invalidate_snapshot(snap, 0);
+	up_write(&snap->lock);
+
+	/* Let the exceptions that were being copied fail */
+	while (atomic_read(&snap->pending_exceptions_count))
+		msleep(1);
+
+	return snap->store->type->release_snapshot(snap->store);
+}
+
 static int snapshot_iterate_devices(struct dm_target *ti,
 				    iterate_devices_callout_fn fn, void *data)
 {
@@ -1929,6 +2022,10 @@ static int snapshot_iterate_devices(struct dm_target *ti,
  * If further exceptions are required, DM_MAPIO_SUBMITTED is returned
  * and any supplied bio is added to a list to be submitted once all
  * the necessary exceptions exist.
+ *
+ * Snapshots whose exception store can share chunks between them
+ * get their new exceptions from a single copy, which is started
+ * once all of them have been added to it.
  */
 static int __origin_write(struct list_head *snapshots, sector_t sector,
 			  struct bio *bio)
@@ -1939,6 +2036,7 @@ static int __origin_write(struct list_head *snapshots, sector_t sector,
 	struct dm_snap_pending_exception *pe;
 	struct dm_snap_pending_exception *pe_to_start_now = NULL;
 	struct dm_snap_pending_exception *pe_to_start_last = NULL;
+	struct dm_snap_pending_exception *pe_to_share = NULL;
 	chunk_t chunk;
 
 	/* Do all the snapshots on this origin */
@@ -1992,11 +2090,23 @@ static int __origin_write(struct list_head *snapshots, sector_t sector,
 				goto next_snapshot;
 			}
 
-			pe = __find_pending_exception(snap, pe, chunk);
+			pe = __find_pending_exception(snap, pe, chunk,
+						      pe_to_share);
 			if (!pe) {
 				__invalidate_snapshot(snap, -ENOMEM);
 				goto next_snapshot;
 			}
+
+			/*
+			 * The first new exception of a sharing store
+			 * holds the copy, started after the others
+			 * joined it.
+			 */
+			if (!pe_to_share && !pe->started &&
+			    snap->store->type->share_exception) {
+				pe->started = 1;
+				pe_to_share = pe;
+			}
 		}
 
 		r = DM_MAPIO_SUBMITTED;
@@ -2030,6 +2140,9 @@ static int __origin_write(struct list_head *snapshots, sector_t sector,
 		}
 	}
 
+	if (pe_to_share)
+		start_copy(pe_to_share);
+
 	/*
 	 * Submit the exception against which the bio is queued last,
 	 * to give the other exceptions a head start.
@@ -2193,7 +2306,7 @@ static struct target_type origin_target = {
 
 static struct target_type snapshot_target = {
 	.name    = "snapshot",
-	.version = {1, 9, 0},
+	.version = {1, 10, 0},
 	.module  = THIS_MODULE,
 	.ctr     = snapshot_ctr,
 	.dtr     = snapshot_dtr,
@@ -2203,6 +2316,7 @@ static struct target_type snapshot_target = {
 	.preresume  = snapshot_preresume,
 	.resume  = snapshot_resume,
 	.status  = snapshot_status,
+	.message = snapshot_message,
 	.iterate_devices = snapshot_iterate_devices,
 };
 
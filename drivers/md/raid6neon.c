@@ -0,0 +1,61 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6neon.c
+ *
+ * NEON RAID-6 syndrome functions: the kernel_neon_begin()/end() wrappers
+ * around the NEON code in raid6neon$#.c, which lives in units of its own
+ * so that the compiler cannot move NEON instructions outside of them.
+ * Where NEON may not be used, e.g. from an async_tx callback or inside
+ * another NEON section, the integer code of the same unroll does it.
+ */
+
+#include <linux/raid/pq.h>
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+#ifdef __KERNEL__
+#include <asm/neon.h>
+#endif
+
+static int raid6_have_neon(void)
+{
+	return cpu_has_neon();
+}
+
+#define RAID6_NEON_WRAPPER(_n)						\
+	void raid6_neon ## _n ## _gen_syndrome_real(int disks,		\
+					unsigned long bytes, void **ptrs); \
+	static void raid6_neon ## _n ## _gen_syndrome(int disks,	\
+					size_t bytes, void **ptrs)	\
+	{								\
+		if (!kernel_neon_allowed()) {				\
+			raid6_intx ## _n.gen_syndrome(disks, bytes, ptrs); \
+			return;						\
+		}							\
+		kernel_neon_begin();					\
+		raid6_neon ## _n ## _gen_syndrome_real(disks,		\
+					(unsigned long)bytes, ptrs);	\
+		kernel_neon_end();					\
+	}								\
+	const struct raid6_calls raid6_neonx ## _n = {			\
+		raid6_neon ## _n ## _gen_syndrome,			\
+		raid6_have_neon,					\
+		"neonx" #_n,						\
+		0							\
+	}
+
+RAID6_NEON_WRAPPER(1);
+RAID6_NEON_WRAPPER(2);
+RAID6_NEON_WRAPPER(4);
+RAID6_NEON_WRAPPER(8);
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
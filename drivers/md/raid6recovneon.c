@@ -0,0 +1,141 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recovneon.c
+ *
+ * RAID-6 dual failure recovery with NEON.  Same as raid6recov.c, except
+ * that the GF(2^8) multiplies are done sixteen bytes at a time as two
+ * vtbl lookups, one for each nibble; the setup is done here and the
+ * NEON loops are in raid6recovneon_inner.c.
+ */
+
+#include <linux/raid/pq.h>
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+#ifdef __KERNEL__
+#include <asm/neon.h>
+#endif
+
+void __raid6_2data_recov_neon(int bytes, u8 *p, u8 *q, u8 *dp, u8 *dq,
+			      const u8 *pbmul, const u8 *qmul);
+void __raid6_datap_recov_neon(int bytes, u8 *p, u8 *q, u8 *dq,
+			      const u8 *qmul);
+
+static int raid6_has_neon(void)
+{
+	return cpu_has_neon();
+}
+
+/*
+ * Split one row of raid6_gfmul into the products with the low nibbles
+ * and with the high nibbles, 16 bytes each.
+ */
+static void raid6_neon_mul_table(u8 *tbl, const u8 *mul)
+{
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		tbl[i] = mul[i];
+		tbl[16 + i] = mul[i << 4];
+	}
+}
+
+/*
+ * Recover two failed data blocks.  Like the syndrome functions, this
+ * falls back to the integer code where NEON may not be used.
+ */
+static void raid6_2data_recov_neon(int disks, size_t bytes, int faila,
+				   int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	u8 pbmul[32], qmul[32];
+
+	if (!kernel_neon_allowed()) {
+		raid6_recov_intx1.data2(disks, bytes, faila, failb, ptrs);
+		return;
+	}
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	raid6_neon_mul_table(pbmul, raid6_gfmul[raid6_gfexi[failb-faila]]);
+	raid6_neon_mul_table(qmul, raid6_gfmul[raid6_gfinv[raid6_gfexp[faila] ^
+						     raid6_gfexp[failb]]]);
+
+	kernel_neon_begin();
+	__raid6_2data_recov_neon(bytes, p, q, dp, dq, pbmul, qmul);
+	kernel_neon_end();
+}
+
+/* Recover failure of one data block plus the P block */
+static void raid6_datap_recov_neon(int disks, size_t bytes, int faila,
+				   void **ptrs)
+{
+	u8 *p, *q, *dq;
+	u8 qmul[32];
+
+	if (!kernel_neon_allowed()) {
+		raid6_recov_intx1.datap(disks, bytes, faila, ptrs);
+		return;
+	}
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	raid6_neon_mul_table(qmul, raid6_gfmul[raid6_gfinv[raid6_gfexp[faila]]]);
+
+	kernel_neon_begin();
+	__raid6_datap_recov_neon(bytes, p, q, dq, qmul);
+	kernel_neon_end();
+}
+
+const struct raid6_recov_calls raid6_recov_neon = {
+	.data2 = raid6_2data_recov_neon,
+	.datap = raid6_datap_recov_neon,
+	.valid = raid6_has_neon,
+	.name = "neon",
+	.priority = 10,
+};
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
@@ -0,0 +1,84 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recovneon_inner.c
+ *
+ * NEON loops for raid6recovneon.c.  Built with -mfpu=neon, so it must not
+ * include kernel headers; bytes is a multiple of 16.
+ *
+ * Each multiplier table holds the products with 0x00..0x0f followed by
+ * those with 0x00..0xf0 in steps of 0x10, so that c * x is
+ * tbl[x & 15] ^ tbl[16 + (x >> 4)].
+ */
+
+#ifdef CONFIG_KERNEL_MODE_NEON
+
+#include <arm_neon.h>
+
+/* 16 lookups into a 16 byte table */
+static inline uint8x16_t vtbl16(uint8x16_t tbl, uint8x16_t idx)
+{
+	uint8x8x2_t t = { { vget_low_u8(tbl), vget_high_u8(tbl) } };
+
+	return vcombine_u8(vtbl2_u8(t, vget_low_u8(idx)),
+			   vtbl2_u8(t, vget_high_u8(idx)));
+}
+
+static inline uint8x16_t gfmul(uint8x16_t lo, uint8x16_t hi, uint8x16_t x)
+{
+	return veorq_u8(vtbl16(lo, vandq_u8(x, vdupq_n_u8(0x0f))),
+			vtbl16(hi, vshrq_n_u8(x, 4)));
+}
+
+void __raid6_2data_recov_neon(int bytes, uint8_t *p, uint8_t *q,
+			      uint8_t *dp, uint8_t *dq,
+			      const uint8_t *pbmul, const uint8_t *qmul)
+{
+	uint8x16_t pm0 = vld1q_u8(pbmul), pm1 = vld1q_u8(pbmul + 16);
+	uint8x16_t qm0 = vld1q_u8(qmul), qm1 = vld1q_u8(qmul + 16);
+	uint8x16_t px, qx, db;
+
+	while (bytes) {
+		px = veorq_u8(vld1q_u8(p), vld1q_u8(dp));
+		qx = gfmul(qm0, qm1, veorq_u8(vld1q_u8(q), vld1q_u8(dq)));
+		db = veorq_u8(gfmul(pm0, pm1, px), qx);
+
+		vst1q_u8(dq, db);		/* Reconstructed B */
+		vst1q_u8(dp, veorq_u8(db, px));	/* Reconstructed A */
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dp += 16;
+		dq += 16;
+	}
+}
+
+void __raid6_datap_recov_neon(int bytes, uint8_t *p, uint8_t *q,
+			      uint8_t *dq, const uint8_t *qmul)
+{
+	uint8x16_t qm0 = vld1q_u8(qmul), qm1 = vld1q_u8(qmul + 16);
+	uint8x16_t vx;
+
+	while (bytes) {
+		vx = gfmul(qm0, qm1, veorq_u8(vld1q_u8(q), vld1q_u8(dq)));
+
+		vst1q_u8(dq, vx);
+		vst1q_u8(p, veorq_u8(vld1q_u8(p), vx));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dq += 16;
+	}
+}
+
+#endif /* CONFIG_KERNEL_MODE_NEON */
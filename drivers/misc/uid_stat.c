@@ -24,7 +24,6 @@
 #include <linux/spinlock.h>
 #include <linux/stat.h>
 #include <linux/uid_stat.h>
-#include <net/activity_stats.h>
 
 static DEFINE_SPINLOCK(uid_lock);
 static LIST_HEAD(uid_list);
@@ -131,7 +130,6 @@ static struct uid_stat *get_uid_stat(uid_t uid) {
 
 int uid_stat_tcp_snd(uid_t uid, int size) {
 	struct uid_stat *entry;
-	activity_stats_update();
 	if ((entry = get_uid_stat(uid)) == NULL) {
 		return -1;
 	}
@@ -142,7 +140,6 @@ int uid_stat_tcp_snd(uid_t uid, int size) {
 
 int uid_stat_tcp_rcv(uid_t uid, int size) {
 	struct uid_stat *entry;
-	activity_stats_update();
 	if ((entry = get_uid_stat(uid)) == NULL) {
 		return -1;
 	}
@@ -153,7 +150,6 @@ int uid_stat_tcp_rcv(uid_t uid, int size) {
 
 int uid_stat_udp_snd(uid_t uid, int size) {
 	struct uid_stat *entry;
-	activity_stats_update();
 	if ((entry = get_uid_stat(uid)) == NULL) {
 		return -1;
 	}
@@ -164,7 +160,6 @@ int uid_stat_udp_snd(uid_t uid, int size) {
 
 int uid_stat_udp_rcv(uid_t uid, int size) {
 	struct uid_stat *entry;
-	activity_stats_update();
 	if ((entry = get_uid_stat(uid)) == NULL) {
 		return -1;
 	}
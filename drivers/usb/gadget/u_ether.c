@@ -328,9 +328,10 @@ static void rx_complete(struct usb_ep *ep, struct usb_request *req)
 			dev->net->stats.rx_bytes += skb2->len;
 
 			/* no buffer copies needed, unless hardware can't
-			 * use skb buffers.
+			 * use skb buffers.  Segments that arrive back to
+			 * back (RNDIS/ECM bursts) are merged by GRO.
 			 */
-			status = netif_rx(skb2);
+			status = netif_rx_gro(skb2);
 next_frame:
 			skb2 = skb_dequeue(&dev->rx_frames);
 		}
@@ -840,6 +841,9 @@ int gether_setup(struct usb_gadget *g, u8 ethaddr[ETH_ALEN])
 
 	SET_ETHTOOL_OPS(net, &ops);
 
+	/* no receive checksum offload, GRO verifies the sum in software */
+	net->features |= NETIF_F_GRO;
+
 	/* two kinds of host-initiated state changes:
 	 *  - iff DATA transfer is active, carrier is "on"
 	 *  - tx queueing enabled if open *and* carrier is "on"
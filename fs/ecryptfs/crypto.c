@@ -31,22 +31,15 @@
 #include <linux/key.h>
 #include <linux/namei.h>
 #include <linux/crypto.h>
+#include <crypto/hash.h>
 #include <linux/file.h>
 #include <linux/scatterlist.h>
 #include <linux/slab.h>
 #include <asm/unaligned.h>
 #include "ecryptfs_kernel.h"
 
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv);
+#define DECRYPT		0
+#define ENCRYPT		1
 
 /**
  * ecryptfs_to_hex
@@ -82,6 +75,19 @@ void ecryptfs_from_hex(char *dst, char *src, int dst_size)
 	}
 }
 
+static int ecryptfs_md5_digest(struct crypto_shash *tfm, char *src, int len,
+			       char *dst)
+{
+	struct {
+		struct shash_desc shash;
+		char ctx[crypto_shash_descsize(tfm)];
+	} desc;
+
+	desc.shash.tfm = tfm;
+	desc.shash.flags = CRYPTO_TFM_REQ_MAY_SLEEP;
+	return crypto_shash_digest(&desc.shash, (u8 *)src, len, (u8 *)dst);
+}
+
 /**
  * ecryptfs_calculate_md5 - calculates the md5 of @src
  * @dst: Pointer to 16 bytes of allocated memory
@@ -90,56 +96,39 @@ void ecryptfs_from_hex(char *dst, char *src, int dst_size)
  * @len: Length of @src
  *
  * Uses the allocated crypto context that crypt_stat references to
- * generate the MD5 sum of the contents of src.
+ * generate the MD5 sum of the contents of src. The hash state lives on
+ * the stack, so cs_hash_tfm_mutex only covers allocating the context.
  */
 static int ecryptfs_calculate_md5(char *dst,
 				  struct ecryptfs_crypt_stat *crypt_stat,
 				  char *src, int len)
 {
-	struct scatterlist sg;
-	struct hash_desc desc = {
-		.tfm = crypt_stat->hash_tfm,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
+	struct crypto_shash *tfm;
 	int rc = 0;
 
 	mutex_lock(&crypt_stat->cs_hash_tfm_mutex);
-	sg_init_one(&sg, (u8 *)src, len);
-	if (!desc.tfm) {
-		desc.tfm = crypto_alloc_hash(ECRYPTFS_DEFAULT_HASH, 0,
-					     CRYPTO_ALG_ASYNC);
-		if (IS_ERR(desc.tfm)) {
-			rc = PTR_ERR(desc.tfm);
+	tfm = crypt_stat->hash_tfm;
+	if (!tfm) {
+		tfm = crypto_alloc_shash(ECRYPTFS_DEFAULT_HASH, 0, 0);
+		if (IS_ERR(tfm)) {
+			rc = PTR_ERR(tfm);
 			ecryptfs_printk(KERN_ERR, "Error attempting to "
 					"allocate crypto context; rc = [%d]\n",
 					rc);
+			mutex_unlock(&crypt_stat->cs_hash_tfm_mutex);
 			goto out;
 		}
-		crypt_stat->hash_tfm = desc.tfm;
+		crypt_stat->hash_tfm = tfm;
 	}
-	rc = crypto_hash_init(&desc);
-	if (rc) {
-		printk(KERN_ERR
-		       "%s: Error initializing crypto hash; rc = [%d]\n",
-		       __func__, rc);
-		goto out;
-	}
-	rc = crypto_hash_update(&desc, &sg, len);
-	if (rc) {
-		printk(KERN_ERR
-		       "%s: Error updating crypto hash; rc = [%d]\n",
-		       __func__, rc);
-		goto out;
-	}
-	rc = crypto_hash_final(&desc, dst);
+	mutex_unlock(&crypt_stat->cs_hash_tfm_mutex);
+	rc = ecryptfs_md5_digest(tfm, src, len, dst);
 	if (rc) {
 		printk(KERN_ERR
-		       "%s: Error finalizing crypto hash; rc = [%d]\n",
+		       "%s: Error computing crypto hash; rc = [%d]\n",
 		       __func__, rc);
 		goto out;
 	}
 out:
-	mutex_unlock(&crypt_stat->cs_hash_tfm_mutex);
 	return rc;
 }
 
@@ -243,9 +232,9 @@ void ecryptfs_destroy_crypt_stat(struct ecryptfs_crypt_stat *crypt_stat)
 	struct ecryptfs_key_sig *key_sig, *key_sig_tmp;
 
 	if (crypt_stat->tfm)
-		crypto_free_blkcipher(crypt_stat->tfm);
+		crypto_free_ablkcipher(crypt_stat->tfm);
 	if (crypt_stat->hash_tfm)
-		crypto_free_hash(crypt_stat->hash_tfm);
+		crypto_free_shash(crypt_stat->hash_tfm);
 	list_for_each_entry_safe(key_sig, key_sig_tmp,
 				 &crypt_stat->keysig_list, crypt_stat_list) {
 		list_del(&key_sig->crypt_stat_list);
@@ -324,53 +313,111 @@ int virt_to_scatterlist(const void *addr, int size, struct scatterlist *sg,
 }
 
 /**
- * encrypt_scatterlist
- * @crypt_stat: Pointer to the crypt_stat struct to initialize.
- * @dest_sg: Destination of encrypted data
- * @src_sg: Data to be encrypted
- * @size: Length of data to be encrypted
- * @iv: iv to use during encryption
+ * ecryptfs_extent_req - One extent in flight on a crypt batch
+ * @list: Entry on the batch's request list
+ * @batch: Batch to report completion to
+ * @src_sg: Extent to encrypt or decrypt
+ * @dst_sg: Where the result goes; may describe the same memory
+ * @iv: IV derived for the extent
+ * @req: Cipher request, followed by the cipher's own request context
+ */
+struct ecryptfs_extent_req {
+	struct list_head list;
+	struct ecryptfs_crypt_batch *batch;
+	struct scatterlist src_sg;
+	struct scatterlist dst_sg;
+	char iv[ECRYPTFS_MAX_IV_BYTES];
+	struct ablkcipher_request req;	/* must be last */
+};
+
+void ecryptfs_init_crypt_batch(struct ecryptfs_crypt_batch *batch)
+{
+	atomic_set(&batch->pending, 1);
+	batch->rc = 0;
+	init_completion(&batch->done);
+	INIT_LIST_HEAD(&batch->reqs);
+}
+
+static void ecryptfs_extent_done(struct ecryptfs_crypt_batch *batch, int rc)
+{
+	if (rc)
+		batch->rc = rc;
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+static void ecryptfs_extent_complete(struct crypto_async_request *areq,
+				     int rc)
+{
+	struct ecryptfs_extent_req *ext = areq->data;
+
+	/* A backlogged request has been started; its completion follows */
+	if (rc == -EINPROGRESS)
+		return;
+	ecryptfs_extent_done(ext->batch, rc);
+}
+
+/**
+ * ecryptfs_wait_crypt_batch
+ * @batch: Batch whose extents have all been queued
+ *
+ * Waits for every extent queued on @batch and releases their requests.
+ * The batch must be initialized again before it is reused.
+ *
+ * Returns zero if all extents were processed; negative on error
+ */
+int ecryptfs_wait_crypt_batch(struct ecryptfs_crypt_batch *batch)
+{
+	struct ecryptfs_extent_req *ext, *ext_tmp;
+
+	if (!atomic_dec_and_test(&batch->pending))
+		wait_for_completion(&batch->done);
+	list_for_each_entry_safe(ext, ext_tmp, &batch->reqs, list)
+		kzfree(ext);
+	INIT_LIST_HEAD(&batch->reqs);
+	return batch->rc;
+}
+
+/**
+ * ecryptfs_set_key
+ * @crypt_stat: Cryptographic context
+ *
+ * Keys the inode's cipher the first time it is used. Requests carry
+ * their own IV and state, so once the key is set any number of them can
+ * run on the one cipher at the same time; cs_tfm_mutex only guards the
+ * setkey.
  *
- * Returns the number of bytes encrypted; negative value on error
+ * Returns zero on success; non-zero on error
  */
-static int encrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
+static int ecryptfs_set_key(struct ecryptfs_crypt_stat *crypt_stat)
 {
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
 	int rc = 0;
 
-	BUG_ON(!crypt_stat || !crypt_stat->tfm
-	       || !(crypt_stat->flags & ECRYPTFS_STRUCT_INITIALIZED));
+	if (likely(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
+		smp_rmb();
+		return 0;
+	}
 	if (unlikely(ecryptfs_verbosity > 0)) {
 		ecryptfs_printk(KERN_DEBUG, "Key size [%d]; key:\n",
 				crypt_stat->key_size);
 		ecryptfs_dump_hex(crypt_stat->key,
 				  crypt_stat->key_size);
 	}
-	/* Consider doing this once, when the file is opened */
 	mutex_lock(&crypt_stat->cs_tfm_mutex);
 	if (!(crypt_stat->flags & ECRYPTFS_KEY_SET)) {
-		rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-					     crypt_stat->key_size);
-		crypt_stat->flags |= ECRYPTFS_KEY_SET;
-	}
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-				rc);
-		mutex_unlock(&crypt_stat->cs_tfm_mutex);
-		rc = -EINVAL;
-		goto out;
+		rc = crypto_ablkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
+					      crypt_stat->key_size);
+		if (rc) {
+			ecryptfs_printk(KERN_ERR, "Error setting key; "
+					"rc = [%d]\n", rc);
+			rc = -EINVAL;
+		} else {
+			/* key before flag, see the check above */
+			smp_wmb();
+			crypt_stat->flags |= ECRYPTFS_KEY_SET;
+		}
 	}
-	ecryptfs_printk(KERN_DEBUG, "Encrypting [%d] bytes.\n", size);
-	crypto_blkcipher_encrypt_iv(&desc, dest_sg, src_sg, size);
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
-out:
 	return rc;
 }
 
@@ -387,71 +434,81 @@ static void ecryptfs_lower_offset_for_extent(loff_t *offset, loff_t extent_num,
 }
 
 /**
- * ecryptfs_encrypt_extent
- * @enc_extent_page: Allocated page into which to encrypt the data in
- *                   @page
+ * ecryptfs_queue_extent
+ * @batch: Batch to account the extent to
  * @crypt_stat: crypt_stat containing cryptographic context for the
- *              encryption operation
- * @page: Page containing plaintext data extent to encrypt
- * @extent_offset: Page extent offset for use in generating IV
+ *              operation
+ * @dst_page: Page to write the result into
+ * @src_page: Page containing the extent; may be @dst_page
+ * @extent_offset: Page extent offset; the extent is at the same offset
+ *                 in @src_page and @dst_page
+ * @op: ENCRYPT or DECRYPT
  *
- * Encrypts one extent of data.
+ * Derives the IV for one extent and submits it to the cipher without
+ * waiting for the result. Errors from the cipher itself are reported
+ * by ecryptfs_wait_crypt_batch().
  *
- * Return zero on success; non-zero otherwise
+ * Returns zero if the extent was queued; non-zero otherwise
  */
-static int ecryptfs_encrypt_extent(struct page *enc_extent_page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *page,
-				   unsigned long extent_offset)
+static int ecryptfs_queue_extent(struct ecryptfs_crypt_batch *batch,
+				 struct ecryptfs_crypt_stat *crypt_stat,
+				 struct page *dst_page, struct page *src_page,
+				 unsigned long extent_offset, int op)
 {
+	struct page *page = (op == ENCRYPT) ? src_page : dst_page;
+	struct ecryptfs_extent_req *ext;
 	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
 	int rc;
 
+	ext = kmalloc(sizeof(*ext) + crypto_ablkcipher_reqsize(crypt_stat->tfm),
+		      GFP_NOFS);
+	if (!ext) {
+		ecryptfs_printk(KERN_ERR, "Error allocating memory for "
+				"extent request\n");
+		return -ENOMEM;
+	}
 	extent_base = (((loff_t)page->index)
 		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
+	rc = ecryptfs_derive_iv(ext->iv, crypt_stat,
 				(extent_base + extent_offset));
 	if (rc) {
 		ecryptfs_printk(KERN_ERR, "Error attempting to "
 				"derive IV for extent [0x%.16x]; "
 				"rc = [%d]\n", (extent_base + extent_offset),
 				rc);
-		goto out;
+		kfree(ext);
+		return rc;
 	}
 	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Encrypting extent "
-				"with iv:\n");
-		ecryptfs_dump_hex(extent_iv, crypt_stat->iv_bytes);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes before "
-				"encryption:\n");
-		ecryptfs_dump_hex((char *)
-				  (page_address(page)
-				   + (extent_offset * crypt_stat->extent_size)),
-				  8);
-	}
-	rc = ecryptfs_encrypt_page_offset(crypt_stat, enc_extent_page, 0,
-					  page, (extent_offset
-						 * crypt_stat->extent_size),
-					  crypt_stat->extent_size, extent_iv);
-	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to encrypt page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
-		goto out;
-	}
-	rc = 0;
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Encrypt extent [0x%.16x]; "
-				"rc = [%d]\n", (extent_base + extent_offset),
-				rc);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes after "
-				"encryption:\n");
-		ecryptfs_dump_hex((char *)(page_address(enc_extent_page)), 8);
-	}
-out:
-	return rc;
+		ecryptfs_printk(KERN_DEBUG, "%s extent [0x%.16x] with iv:\n",
+				op == ENCRYPT ? "Encrypting" : "Decrypting",
+				(extent_base + extent_offset));
+		ecryptfs_dump_hex(ext->iv, crypt_stat->iv_bytes);
+	}
+	sg_init_table(&ext->src_sg, 1);
+	sg_set_page(&ext->src_sg, src_page, crypt_stat->extent_size,
+		    extent_offset * crypt_stat->extent_size);
+	sg_init_table(&ext->dst_sg, 1);
+	sg_set_page(&ext->dst_sg, dst_page, crypt_stat->extent_size,
+		    extent_offset * crypt_stat->extent_size);
+	ext->batch = batch;
+	ablkcipher_request_set_tfm(&ext->req, crypt_stat->tfm);
+	ablkcipher_request_set_callback(&ext->req,
+					CRYPTO_TFM_REQ_MAY_BACKLOG
+					| CRYPTO_TFM_REQ_MAY_SLEEP,
+					ecryptfs_extent_complete, ext);
+	ablkcipher_request_set_crypt(&ext->req, &ext->src_sg, &ext->dst_sg,
+				     crypt_stat->extent_size, ext->iv);
+	list_add_tail(&ext->list, &batch->reqs);
+	atomic_inc(&batch->pending);
+	if (op == ENCRYPT)
+		rc = crypto_ablkcipher_encrypt(&ext->req);
+	else
+		rc = crypto_ablkcipher_decrypt(&ext->req);
+	/* -EBUSY: backlogged, the callback will still be called */
+	if (rc != -EINPROGRESS && rc != -EBUSY)
+		ecryptfs_extent_done(batch, rc);
+	return 0;
 }
 
 /**
@@ -460,7 +517,9 @@ out:
  *        decrypted content that needs to be encrypted (to a temporary
  *        page; not in place) and written out to the lower file
  *
- * Encrypt an eCryptfs page. This is done on a per-extent basis. Note
+ * Encrypt an eCryptfs page. This is done on a per-extent basis, with
+ * all of the page's extents submitted to the cipher together, and the
+ * result is written to the lower file in one go. Note
  * that eCryptfs pages may straddle the lower pages -- for instance,
  * if the file was created on a machine with an 8K page size
  * (resulting in an 8K header), and then the file is copied onto a
@@ -474,15 +533,20 @@ int ecryptfs_encrypt_page(struct page *page)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
+	struct ecryptfs_crypt_batch batch;
 	char *enc_extent_virt;
 	struct page *enc_extent_page = NULL;
-	loff_t extent_offset;
-	int rc = 0;
+	unsigned long extent_offset;
+	loff_t lower_offset;
+	int rc = 0, batch_rc;
 
 	ecryptfs_inode = page->mapping->host;
 	crypt_stat =
 		&(ecryptfs_inode_to_private(ecryptfs_inode)->crypt_stat);
 	BUG_ON(!(crypt_stat->flags & ECRYPTFS_ENCRYPTED));
+	rc = ecryptfs_set_key(crypt_stat);
+	if (rc)
+		goto out;
 	enc_extent_page = alloc_page(GFP_USER);
 	if (!enc_extent_page) {
 		rc = -ENOMEM;
@@ -490,272 +554,134 @@ int ecryptfs_encrypt_page(struct page *page)
 				"encrypted extent\n");
 		goto out;
 	}
-	enc_extent_virt = kmap(enc_extent_page);
+	ecryptfs_init_crypt_batch(&batch);
 	for (extent_offset = 0;
 	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
 	     extent_offset++) {
-		loff_t offset;
-
-		rc = ecryptfs_encrypt_extent(enc_extent_page, crypt_stat, page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
-			goto out;
-		}
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((((loff_t)page->index)
-				   * (PAGE_CACHE_SIZE
-				      / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt,
-					  offset, crypt_stat->extent_size);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to write lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-	}
-	rc = 0;
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
+		rc = ecryptfs_queue_extent(&batch, crypt_stat, enc_extent_page,
+					   page, extent_offset, ENCRYPT);
+		if (rc)
+			break;
 	}
-	return rc;
-}
-
-static int ecryptfs_decrypt_extent(struct page *page,
-				   struct ecryptfs_crypt_stat *crypt_stat,
-				   struct page *enc_extent_page,
-				   unsigned long extent_offset)
-{
-	loff_t extent_base;
-	char extent_iv[ECRYPTFS_MAX_IV_BYTES];
-	int rc;
-
-	extent_base = (((loff_t)page->index)
-		       * (PAGE_CACHE_SIZE / crypt_stat->extent_size));
-	rc = ecryptfs_derive_iv(extent_iv, crypt_stat,
-				(extent_base + extent_offset));
+	batch_rc = ecryptfs_wait_crypt_batch(&batch);
+	if (!rc)
+		rc = batch_rc;
 	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error attempting to "
-				"derive IV for extent [0x%.16x]; "
-				"rc = [%d]\n", (extent_base + extent_offset),
-				rc);
+		printk(KERN_ERR "%s: Error encrypting page with "
+		       "page->index = [%ld]; rc = [%d]\n", __func__,
+		       page->index, rc);
 		goto out;
 	}
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Decrypting extent "
-				"with iv:\n");
-		ecryptfs_dump_hex(extent_iv, crypt_stat->iv_bytes);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes before "
-				"decryption:\n");
-		ecryptfs_dump_hex((char *)
-				  (page_address(enc_extent_page)
-				   + (extent_offset * crypt_stat->extent_size)),
-				  8);
-	}
-	rc = ecryptfs_decrypt_page_offset(crypt_stat, page,
-					  (extent_offset
-					   * crypt_stat->extent_size),
-					  enc_extent_page, 0,
-					  crypt_stat->extent_size, extent_iv);
+	ecryptfs_lower_offset_for_extent(
+		&lower_offset, (((loff_t)page->index)
+				* (PAGE_CACHE_SIZE / crypt_stat->extent_size)),
+		crypt_stat);
+	enc_extent_virt = kmap(enc_extent_page);
+	rc = ecryptfs_write_lower(ecryptfs_inode, enc_extent_virt, lower_offset,
+				  PAGE_CACHE_SIZE);
+	kunmap(enc_extent_page);
 	if (rc < 0) {
-		printk(KERN_ERR "%s: Error attempting to decrypt to page with "
-		       "page->index = [%ld], extent_offset = [%ld]; "
-		       "rc = [%d]\n", __func__, page->index, extent_offset,
-		       rc);
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to write lower page; rc = [%d]"
+				"\n", rc);
 		goto out;
 	}
 	rc = 0;
-	if (unlikely(ecryptfs_verbosity > 0)) {
-		ecryptfs_printk(KERN_DEBUG, "Decrypt extent [0x%.16x]; "
-				"rc = [%d]\n", (extent_base + extent_offset),
-				rc);
-		ecryptfs_printk(KERN_DEBUG, "First 8 bytes after "
-				"decryption:\n");
-		ecryptfs_dump_hex((char *)(page_address(page)
-					   + (extent_offset
-					      * crypt_stat->extent_size)), 8);
-	}
 out:
+	if (enc_extent_page)
+		__free_page(enc_extent_page);
 	return rc;
 }
 
 /**
- * ecryptfs_decrypt_page
- * @page: Page mapped from the eCryptfs inode for the file; data read
- *        and decrypted from the lower file will be written into this
- *        page
+ * ecryptfs_decrypt_page_batched
+ * @page: Page mapped from the eCryptfs inode for the file
+ * @batch: Batch to queue the page's extents on
  *
- * Decrypt an eCryptfs page. This is done on a per-extent basis. Note
- * that eCryptfs pages may straddle the lower pages -- for instance,
- * if the file was created on a machine with an 8K page size
- * (resulting in an 8K header), and then the file is copied onto a
- * host with a 32K page size, then when reading page 0 of the eCryptfs
- * file, 24K of page 0 of the lower file will be read and decrypted,
- * and then 8K of page 1 of the lower file will be read and decrypted.
+ * Reads the lower data for @page straight into @page and queues all of
+ * its extents for decryption in place. @page must not be used until
+ * @batch has been waited on.
  *
- * Returns zero on success; negative on error
+ * Returns zero on success; negative on error. Errors are also recorded
+ * in @batch.
  */
-int ecryptfs_decrypt_page(struct page *page)
+int ecryptfs_decrypt_page_batched(struct page *page,
+				  struct ecryptfs_crypt_batch *batch)
 {
 	struct inode *ecryptfs_inode;
 	struct ecryptfs_crypt_stat *crypt_stat;
-	char *enc_extent_virt;
-	struct page *enc_extent_page = NULL;
 	unsigned long extent_offset;
+	loff_t lower_offset;
+	char *page_virt;
 	int rc = 0;
 
 	ecryptfs_inode = page->mapping->host;
 	crypt_stat =
 		&(ecryptfs_inode_to_private(ecryptfs_inode)->crypt_stat);
 	BUG_ON(!(crypt_stat->flags & ECRYPTFS_ENCRYPTED));
-	enc_extent_page = alloc_page(GFP_USER);
-	if (!enc_extent_page) {
-		rc = -ENOMEM;
-		ecryptfs_printk(KERN_ERR, "Error allocating memory for "
-				"encrypted extent\n");
+	rc = ecryptfs_set_key(crypt_stat);
+	if (rc)
+		goto out;
+	ecryptfs_lower_offset_for_extent(
+		&lower_offset, (((loff_t)page->index)
+				* (PAGE_CACHE_SIZE / crypt_stat->extent_size)),
+		crypt_stat);
+	page_virt = kmap(page);
+	rc = ecryptfs_read_lower(page_virt, lower_offset, PAGE_CACHE_SIZE,
+				 ecryptfs_inode);
+	if (rc >= 0 && rc < PAGE_CACHE_SIZE)
+		memset(page_virt + rc, 0, PAGE_CACHE_SIZE - rc);
+	kunmap(page);
+	if (rc < 0) {
+		ecryptfs_printk(KERN_ERR, "Error attempting "
+				"to read lower page; rc = [%d]"
+				"\n", rc);
 		goto out;
 	}
-	enc_extent_virt = kmap(enc_extent_page);
 	for (extent_offset = 0;
 	     extent_offset < (PAGE_CACHE_SIZE / crypt_stat->extent_size);
 	     extent_offset++) {
-		loff_t offset;
-
-		ecryptfs_lower_offset_for_extent(
-			&offset, ((page->index * (PAGE_CACHE_SIZE
-						  / crypt_stat->extent_size))
-				  + extent_offset), crypt_stat);
-		rc = ecryptfs_read_lower(enc_extent_virt, offset,
-					 crypt_stat->extent_size,
-					 ecryptfs_inode);
-		if (rc < 0) {
-			ecryptfs_printk(KERN_ERR, "Error attempting "
-					"to read lower page; rc = [%d]"
-					"\n", rc);
-			goto out;
-		}
-		rc = ecryptfs_decrypt_extent(page, crypt_stat, enc_extent_page,
-					     extent_offset);
-		if (rc) {
-			printk(KERN_ERR "%s: Error encrypting extent; "
-			       "rc = [%d]\n", __func__, rc);
+		rc = ecryptfs_queue_extent(batch, crypt_stat, page, page,
+					   extent_offset, DECRYPT);
+		if (rc)
 			goto out;
-		}
-	}
-out:
-	if (enc_extent_page) {
-		kunmap(enc_extent_page);
-		__free_page(enc_extent_page);
-	}
-	return rc;
-}
-
-/**
- * decrypt_scatterlist
- * @crypt_stat: Cryptographic context
- * @dest_sg: The destination scatterlist to decrypt into
- * @src_sg: The source scatterlist to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
- *
- * Returns the number of bytes decrypted; negative value on error
- */
-static int decrypt_scatterlist(struct ecryptfs_crypt_stat *crypt_stat,
-			       struct scatterlist *dest_sg,
-			       struct scatterlist *src_sg, int size,
-			       unsigned char *iv)
-{
-	struct blkcipher_desc desc = {
-		.tfm = crypt_stat->tfm,
-		.info = iv,
-		.flags = CRYPTO_TFM_REQ_MAY_SLEEP
-	};
-	int rc = 0;
-
-	/* Consider doing this once, when the file is opened */
-	mutex_lock(&crypt_stat->cs_tfm_mutex);
-	rc = crypto_blkcipher_setkey(crypt_stat->tfm, crypt_stat->key,
-				     crypt_stat->key_size);
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error setting key; rc = [%d]\n",
-				rc);
-		mutex_unlock(&crypt_stat->cs_tfm_mutex);
-		rc = -EINVAL;
-		goto out;
 	}
-	ecryptfs_printk(KERN_DEBUG, "Decrypting [%d] bytes.\n", size);
-	rc = crypto_blkcipher_decrypt_iv(&desc, dest_sg, src_sg, size);
-	mutex_unlock(&crypt_stat->cs_tfm_mutex);
-	if (rc) {
-		ecryptfs_printk(KERN_ERR, "Error decrypting; rc = [%d]\n",
-				rc);
-		goto out;
-	}
-	rc = size;
+	rc = 0;
 out:
+	if (rc)
+		batch->rc = rc;
 	return rc;
 }
 
 /**
- * ecryptfs_encrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to encrypt into
- * @dst_offset: The offset in the page to encrypt into
- * @src_page: The page to encrypt from
- * @src_offset: The offset in the page to encrypt from
- * @size: The number of bytes to encrypt
- * @iv: The initialization vector to use for the encryption
+ * ecryptfs_decrypt_page
+ * @page: Page mapped from the eCryptfs inode for the file; data read
+ *        and decrypted from the lower file will be written into this
+ *        page
  *
- * Returns the number of bytes encrypted
- */
-static int
-ecryptfs_encrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
-{
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_init_table(&dst_sg, 1);
-
-	sg_set_page(&src_sg, src_page, size, src_offset);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
-	return encrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
-}
-
-/**
- * ecryptfs_decrypt_page_offset
- * @crypt_stat: The cryptographic context
- * @dst_page: The page to decrypt into
- * @dst_offset: The offset in the page to decrypt into
- * @src_page: The page to decrypt from
- * @src_offset: The offset in the page to decrypt from
- * @size: The number of bytes to decrypt
- * @iv: The initialization vector to use for the decryption
+ * Decrypt an eCryptfs page. This is done on a per-extent basis. Note
+ * that eCryptfs pages may straddle the lower pages -- for instance,
+ * if the file was created on a machine with an 8K page size
+ * (resulting in an 8K header), and then the file is copied onto a
+ * host with a 32K page size, then when reading page 0 of the eCryptfs
+ * file, 24K of page 0 of the lower file will be read and decrypted,
+ * and then 8K of page 1 of the lower file will be read and decrypted.
  *
- * Returns the number of bytes decrypted
+ * Returns zero on success; negative on error
  */
-static int
-ecryptfs_decrypt_page_offset(struct ecryptfs_crypt_stat *crypt_stat,
-			     struct page *dst_page, int dst_offset,
-			     struct page *src_page, int src_offset, int size,
-			     unsigned char *iv)
+int ecryptfs_decrypt_page(struct page *page)
 {
-	struct scatterlist src_sg, dst_sg;
-
-	sg_init_table(&src_sg, 1);
-	sg_set_page(&src_sg, src_page, size, src_offset);
-
-	sg_init_table(&dst_sg, 1);
-	sg_set_page(&dst_sg, dst_page, size, dst_offset);
+	struct ecryptfs_crypt_batch batch;
+	int rc;
 
-	return decrypt_scatterlist(crypt_stat, &dst_sg, &src_sg, size, iv);
+	ecryptfs_init_crypt_batch(&batch);
+	ecryptfs_decrypt_page_batched(page, &batch);
+	rc = ecryptfs_wait_crypt_batch(&batch);
+	if (rc)
+		printk(KERN_ERR "%s: Error decrypting page with "
+		       "page->index = [%ld]; rc = [%d]\n", __func__,
+		       page->index, rc);
+	return rc;
 }
 
 #define ECRYPTFS_MAX_SCATTERLIST_LEN 4
@@ -792,8 +718,7 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 						    crypt_stat->cipher, "cbc");
 	if (rc)
 		goto out_unlock;
-	crypt_stat->tfm = crypto_alloc_blkcipher(full_alg_name, 0,
-						 CRYPTO_ALG_ASYNC);
+	crypt_stat->tfm = crypto_alloc_ablkcipher(full_alg_name, 0, 0);
 	kfree(full_alg_name);
 	if (IS_ERR(crypt_stat->tfm)) {
 		rc = PTR_ERR(crypt_stat->tfm);
@@ -803,7 +728,7 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat)
 				crypt_stat->cipher);
 		goto out_unlock;
 	}
-	crypto_blkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
+	crypto_ablkcipher_set_flags(crypt_stat->tfm, CRYPTO_TFM_REQ_WEAK_KEY);
 	rc = 0;
 out_unlock:
 	mutex_unlock(&crypt_stat->cs_tfm_mutex);
@@ -36,6 +36,7 @@
 #include <linux/hash.h>
 #include <linux/nsproxy.h>
 #include <linux/backing-dev.h>
+#include <linux/completion.h>
 
 /* Version verification for shared data structures w/ userspace */
 #define ECRYPTFS_VERSION_MAJOR 0x00
@@ -280,9 +281,9 @@ struct ecryptfs_crypt_stat {
 	size_t extent_shift;
 	unsigned int extent_mask;
 	struct ecryptfs_mount_crypt_stat *mount_crypt_stat;
-	struct crypto_blkcipher *tfm;
-	struct crypto_hash *hash_tfm; /* Crypto context for generating
-				       * the initialization vectors */
+	struct crypto_ablkcipher *tfm;
+	struct crypto_shash *hash_tfm; /* Crypto context for generating
+					* the initialization vectors */
 	unsigned char cipher[ECRYPTFS_MAX_CIPHER_NAME_SIZE];
 	unsigned char key[ECRYPTFS_MAX_KEY_BYTES];
 	unsigned char root_iv[ECRYPTFS_MAX_IV_BYTES];
@@ -293,6 +294,25 @@ struct ecryptfs_crypt_stat {
 	struct mutex cs_mutex;
 };
 
+/**
+ * ecryptfs_crypt_batch - Extents handed to the cipher together
+ * @pending: Extents still in flight, plus one held by the submitter
+ * @rc: Error reported by any extent of the batch
+ * @done: Completed when @pending drops to zero
+ * @reqs: Cipher requests to free once the batch is done
+ *
+ * Every extent has its own IV, so extents cannot share one cipher
+ * request, but they can all be in flight at the same time. With an
+ * asynchronous cipher the submitter sleeps once per batch rather than
+ * once per extent.
+ */
+struct ecryptfs_crypt_batch {
+	atomic_t pending;
+	int rc;
+	struct completion done;
+	struct list_head reqs;
+};
+
 /* inode private data. */
 struct ecryptfs_inode_info {
 	struct inode vfs_inode;
@@ -658,6 +678,10 @@ int ecryptfs_init_crypt_ctx(struct ecryptfs_crypt_stat *crypt_stat);
 int ecryptfs_write_inode_size_to_metadata(struct inode *ecryptfs_inode);
 int ecryptfs_encrypt_page(struct page *page);
 int ecryptfs_decrypt_page(struct page *page);
+void ecryptfs_init_crypt_batch(struct ecryptfs_crypt_batch *batch);
+int ecryptfs_wait_crypt_batch(struct ecryptfs_crypt_batch *batch);
+int ecryptfs_decrypt_page_batched(struct page *page,
+				  struct ecryptfs_crypt_batch *batch);
 int ecryptfs_write_metadata(struct dentry *ecryptfs_dentry);
 int ecryptfs_read_metadata(struct dentry *ecryptfs_dentry);
 int ecryptfs_new_file_context(struct dentry *ecryptfs_dentry);
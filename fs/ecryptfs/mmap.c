@@ -243,6 +243,79 @@ out:
 	return rc;
 }
 
+/* Pages read ahead between waits for the cipher */
+#define ECRYPTFS_READPAGES_BATCH 32
+
+static void ecryptfs_finish_readpages(struct page **pages, unsigned nr_pages,
+				      struct ecryptfs_crypt_batch *batch)
+{
+	int rc = ecryptfs_wait_crypt_batch(batch);
+	unsigned i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (rc)
+			ClearPageUptodate(pages[i]);
+		else
+			SetPageUptodate(pages[i]);
+		unlock_page(pages[i]);
+		page_cache_release(pages[i]);
+	}
+	ecryptfs_init_crypt_batch(batch);
+}
+
+/**
+ * ecryptfs_readpages
+ *
+ * Read-ahead. For files that are decrypted on read, each page gets its
+ * lower data read into it and its extents queued for decryption without
+ * waiting, so that an asynchronous cipher works on the pages already
+ * read while the following ones are fetched from the lower file. The
+ * pages are unlocked once their batch is done; if anything in a batch
+ * failed, all of its pages are left !Uptodate for ->readpage to retry.
+ *
+ * Returns zero
+ */
+static int ecryptfs_readpages(struct file *file, struct address_space *mapping,
+			      struct list_head *pages, unsigned nr_pages)
+{
+	struct ecryptfs_crypt_stat *crypt_stat =
+		&ecryptfs_inode_to_private(mapping->host)->crypt_stat;
+	struct page *batch_pages[ECRYPTFS_READPAGES_BATCH];
+	struct ecryptfs_crypt_batch batch;
+	unsigned nr_batched = 0;
+	int decrypt;
+
+	decrypt = (crypt_stat->flags & ECRYPTFS_ENCRYPTED)
+		  && !(crypt_stat->flags & (ECRYPTFS_NEW_FILE
+					    | ECRYPTFS_VIEW_AS_ENCRYPTED));
+	ecryptfs_init_crypt_batch(&batch);
+	while (!list_empty(pages)) {
+		struct page *page = list_entry(pages->prev, struct page, lru);
+
+		list_del(&page->lru);
+		if (add_to_page_cache_lru(page, mapping, page->index,
+					  GFP_KERNEL)) {
+			page_cache_release(page);
+			continue;
+		}
+		if (!decrypt) {
+			ecryptfs_readpage(file, page);
+			page_cache_release(page);
+			continue;
+		}
+		ecryptfs_decrypt_page_batched(page, &batch);
+		batch_pages[nr_batched++] = page;
+		if (nr_batched == ECRYPTFS_READPAGES_BATCH) {
+			ecryptfs_finish_readpages(batch_pages, nr_batched,
+						  &batch);
+			nr_batched = 0;
+		}
+	}
+	if (nr_batched)
+		ecryptfs_finish_readpages(batch_pages, nr_batched, &batch);
+	return 0;
+}
+
 /**
  * Called with lower inode mutex held.
  */
@@ -551,6 +624,7 @@ static sector_t ecryptfs_bmap(struct address_space *mapping, sector_t block)
 const struct address_space_operations ecryptfs_aops = {
 	.writepage = ecryptfs_writepage,
 	.readpage = ecryptfs_readpage,
+	.readpages = ecryptfs_readpages,
 	.write_begin = ecryptfs_write_begin,
 	.write_end = ecryptfs_write_end,
 	.bmap = ecryptfs_bmap,
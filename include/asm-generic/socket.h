@@ -64,4 +64,8 @@
 #define SO_DOMAIN		39
 
 #define SO_RXQ_OVFL             40
+
+#define SO_ACCT_TAG             41
+
+#define SO_TX_DEFER             42
 #endif /* __ASM_GENERIC_SOCKET_H */
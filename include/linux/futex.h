@@ -176,6 +176,7 @@ union futex_key {
 #ifdef CONFIG_FUTEX
 extern void exit_robust_list(struct task_struct *curr);
 extern void exit_pi_state_list(struct task_struct *curr);
+extern void futex_hash_free(struct mm_struct *mm);
 extern int futex_cmpxchg_enabled;
 #else
 static inline void exit_robust_list(struct task_struct *curr)
@@ -184,6 +185,9 @@ static inline void exit_robust_list(struct task_struct *curr)
 static inline void exit_pi_state_list(struct task_struct *curr)
 {
 }
+static inline void futex_hash_free(struct mm_struct *mm)
+{
+}
 #endif
 #endif /* __KERNEL__ */
 
@@ -0,0 +1,40 @@
+#ifndef __LZ4_H__
+#define __LZ4_H__
+/*
+ *  LZ4 Kernel Interface
+ *
+ *  LZ4 is a byte oriented LZ77 block format designed by Yann Collet,
+ *  with decompression several times faster than LZO:
+ *  http://code.google.com/p/lz4/
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define LZ4_MEM_COMPRESS	(4096 * sizeof(unsigned int))
+#define LZ4HC_MEM_COMPRESS	(256 * 1024)
+
+#define lz4_worst_compress(x)	((x) + ((x) / 255) + 16)
+
+/*
+ * The compressors need 'wrkmem' of the size given above, and room for
+ * lz4_worst_compress(src_len) bytes at dst.  lz4hc_compress() is several
+ * times slower than lz4_compress() and compresses better; both produce
+ * the same format.
+ */
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+int lz4hc_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem);
+
+/*
+ * Safe decompression of untrusted input: *dst_len is the room at dst on
+ * entry and the decompressed length on return.  Returns 0, or a negative
+ * value if the input is malformed or does not fit.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+#endif
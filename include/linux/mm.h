@@ -844,6 +844,42 @@ static inline int handle_mm_fault(struct mm_struct *mm,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags,
+			unsigned long vm_flags);
+
+/*
+ * Bracket changes to a vma's range, flags or page tables that a
+ * speculative fault must not race with.  mmap_sem must be held for
+ * writing.  An unlinked vma gets vma_write_begin() only.
+ */
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+	write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+	write_seqcount_end(&vma->vm_sequence);
+}
+#else
+static inline int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, unsigned int flags,
+			unsigned long vm_flags)
+{
+	return VM_FAULT_RETRY;
+}
+
+static inline void vma_write_begin(struct vm_area_struct *vma)
+{
+}
+
+static inline void vma_write_end(struct vm_area_struct *vma)
+{
+}
+#endif
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 
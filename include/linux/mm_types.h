@@ -9,6 +9,8 @@
 #include <linux/prio_tree.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/rcu_types.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
 #include <linux/page-debug-flags.h>
@@ -183,6 +185,15 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Odd while vm_start, vm_end, vm_pgoff, vm_flags or the page
+	 * tables under the vma are being changed, and forever once the
+	 * vma is unlinked.  Freed after a grace period.
+	 */
+	seqcount_t vm_sequence;
+	struct rcu_head vm_rcu_head;
+#endif
 };
 
 struct core_thread {
@@ -301,6 +312,10 @@ struct mm_struct {
 	 */
 	struct task_struct *owner;
 #endif
+#ifdef CONFIG_FUTEX
+	/* Hash of the PROCESS_PRIVATE futexes, set up on first use */
+	struct futex_hash *futex_hash;
+#endif
 
 #ifdef CONFIG_PROC_FS
 	/* store ref to file /proc/<pid>/exe symlink points to */
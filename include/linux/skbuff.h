@@ -306,6 +306,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
+ *	@rx_gro: queued by netif_rx_gro(), backlog passes it through GRO
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -383,13 +384,15 @@ struct sk_buff {
 	__u16			queue_mapping:16;
 #ifdef CONFIG_IPV6_NDISC_NODETYPE
 	__u8			ndisc_nodetype:2,
-				deliver_no_wcard:1;
+				deliver_no_wcard:1,
+				rx_gro:1;
 #else
-	__u8			deliver_no_wcard:1;
+	__u8			deliver_no_wcard:1,
+				rx_gro:1;
 #endif
 	kmemcheck_bitfield_end(flags2);
 
-	/* 0/14 bit hole */
+	/* 0/13 bit hole */
 
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
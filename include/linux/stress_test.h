@@ -0,0 +1,35 @@
+/*
+ * Helpers shared by the stress and latency test modules
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#ifndef _LINUX_STRESS_TEST_H
+#define _LINUX_STRESS_TEST_H
+
+#include <linux/types.h>
+
+/*
+ * Latencies go into four buckets per power of two of nanoseconds, which
+ * is fine enough for percentiles and covers up to 2^32 ns.
+ */
+#define LAT_HIST_SUB_BITS	2
+#define LAT_HIST_BUCKETS	(33 << LAT_HIST_SUB_BITS)
+
+struct lat_hist {
+	unsigned long count;
+	u64 max_ns;
+	unsigned long buckets[LAT_HIST_BUCKETS];
+};
+
+extern void lat_hist_add(struct lat_hist *h, u64 ns);
+extern void lat_hist_merge(struct lat_hist *to, const struct lat_hist *from);
+extern u64 lat_hist_percentile(const struct lat_hist *h,
+			       unsigned int permille);
+extern void lat_hist_print(const struct lat_hist *h, const char *prefix);
+
+extern int stress_run_threads(int (*fn)(void *), void *data, size_t size,
+			      int nthreads, int seconds, const char *name);
+
+#endif /* _LINUX_STRESS_TEST_H */
@@ -0,0 +1,44 @@
+#ifndef _LINUX_TRACE_MMAP_H
+#define _LINUX_TRACE_MMAP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * A per CPU ring buffer mapped through per_cpu/cpuN/trace_pipe_raw.
+ *
+ * The first page of the mapping is a struct trace_buffer_meta, followed
+ * by nr_subbufs sub-buffers of subbuf_size bytes each, sub-buffer N at
+ * offset meta_page_size + N * subbuf_size.  Each sub-buffer starts with
+ * a 64 bit time stamp and a long holding the number of bytes of events
+ * that follow it.
+ *
+ * Only the reader sub-buffer, reader.id, is safe to read: the writer has
+ * left it or is still appending to it, but never overwrites it.  Events
+ * start at reader.read the first time a sub-buffer becomes the reader.
+ * Once everything up to its commit has been read, TRACE_MMAP_IOCTL_GET_READER
+ * hands the next sub-buffer to the reader, or leaves reader.id alone when
+ * the writer has nothing newer, in which case reading goes on from where
+ * it stopped.
+ */
+struct trace_buffer_meta {
+	__u32	meta_page_size;
+	__u32	meta_struct_len;
+
+	__u32	subbuf_size;
+	__u32	nr_subbufs;
+
+	struct {
+		__u64	lost_events;	/* dropped before this sub-buffer */
+		__u32	id;
+		__u32	read;
+	} reader;
+
+	__u64	entries;
+	__u64	overrun;
+	__u64	read;
+};
+
+#define TRACE_MMAP_IOCTL_GET_READER	_IO('R', 0x20)
+
+#endif /* _LINUX_TRACE_MMAP_H */
@@ -81,6 +81,11 @@ struct udp_sock {
 	 * For encapsulation sockets.
 	 */
 	int (*encap_rcv)(struct sock *sk, struct sk_buff *skb);
+	/*
+	 * Datagrams already moved off sk_receive_queue, see
+	 * udp_recv_datagram().
+	 */
+	struct sk_buff_head reader_queue;
 };
 
 static inline struct udp_sock *udp_sk(const struct sock *sk)
@@ -16,10 +16,24 @@
 #ifndef __activity_stats_h
 #define __activity_stats_h
 
+struct sock;
+struct sk_buff;
+struct net_device;
+
 #ifdef CONFIG_NET_ACTIVITY_STATS
-void activity_stats_update(void);
+int activity_stats_xmit(struct sk_buff *skb, struct net_device *dev);
+void activity_stats_rx(struct sock *sk, const struct sk_buff *skb);
 #else
-#define activity_stats_update(void) {}
+static inline int activity_stats_xmit(struct sk_buff *skb,
+				      struct net_device *dev)
+{
+	return 0;
+}
+
+static inline void activity_stats_rx(struct sock *sk,
+				     const struct sk_buff *skb)
+{
+}
 #endif
 
 #endif /* _NET_ACTIVITY_STATS_H */
@@ -20,6 +20,7 @@ struct unix_address {
 	atomic_t	refcnt;
 	int		len;
 	unsigned	hash;
+	struct rcu_head	rcu;		/* Lockless name lookups	*/
 	struct sockaddr_un name[0];
 };
 
@@ -59,6 +60,7 @@ struct unix_sock {
 	unsigned int		gc_maybe_cycle : 1;
 	unsigned char		recursion_level;
 	struct socket_wq	peer_wq;
+	struct sk_buff_head	skb_ring;	/* Recycled small dgram skbs */
 };
 #define unix_sk(__sk) ((struct unix_sock *)__sk)
 
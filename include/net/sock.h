@@ -211,6 +211,10 @@ struct sock_common {
   *	@sk_send_head: front of stuff to transmit
   *	@sk_security: used by security modules
   *	@sk_mark: generic packet mark
+  *	@sk_acct_uid: owner charged by per-UID traffic accounting
+  *	@sk_acct_tag: accounting tag set with %SO_ACCT_TAG
+  *	@sk_acct_cache: last accounting entry this socket was charged to
+  *	@sk_tx_defer: how long (ms) sends may wait for the radio, %SO_TX_DEFER
   *	@sk_write_pending: a write to stream socket waits to start
   *	@sk_state_change: callback to indicate change in the state of the sock
   *	@sk_data_ready: callback to indicate there is data to be processed
@@ -313,6 +317,14 @@ struct sock {
 #endif
 	__u32			sk_mark;
 	u32			sk_classid;
+#ifdef CONFIG_NET_UID_ACCT
+	uid_t			sk_acct_uid;
+	u32			sk_acct_tag;
+	struct uid_acct_entry	*sk_acct_cache;
+#endif
+#ifdef CONFIG_NET_ACTIVITY_STATS
+	u32			sk_tx_defer;
+#endif
 	void			(*sk_state_change)(struct sock *sk);
 	void			(*sk_data_ready)(struct sock *sk, int bytes);
 	void			(*sk_write_space)(struct sock *sk);
@@ -1558,6 +1570,9 @@ static inline void sk_wake_async(struct sock *sk, int how, int band)
 #define SOCK_MIN_SNDBUF 2048
 #define SOCK_MIN_RCVBUF 256
 
+/* Longest a SO_TX_DEFER socket lets its packets wait, in ms */
+#define SOCK_TX_DEFER_MAX 60000
+
 static inline void sk_stream_moderate_sndbuf(struct sock *sk)
 {
 	if (!(sk->sk_userlocks & SOCK_SNDBUF_LOCK)) {
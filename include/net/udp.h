@@ -172,6 +172,11 @@ extern int	udp_sendmsg(struct kiocb *iocb, struct sock *sk,
 extern void	udp_flush_pending_frames(struct sock *sk);
 
 extern int	udp_rcv(struct sk_buff *skb);
+extern int	udp_init_sock(struct sock *sk);
+extern struct sk_buff *udp_recv_datagram(struct sock *sk, unsigned int flags,
+					 int *peeked, int *err);
+extern int	udp_kill_datagram(struct sock *sk, struct sk_buff *skb,
+				  unsigned int flags);
 extern int	udp_ioctl(struct sock *sk, int cmd, unsigned long arg);
 extern int	udp_disconnect(struct sock *sk, int flags);
 extern unsigned int udp_poll(struct file *file, struct socket *sock,
@@ -0,0 +1,134 @@
+/*
+ * Per-UID traffic accounting without netfilter.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _NET_UID_ACCT_H
+#define _NET_UID_ACCT_H
+
+#include <linux/netdevice.h>
+#include <linux/seqlock.h>
+#include <linux/skbuff.h>
+#include <net/sock.h>
+
+enum {
+	UID_ACCT_RX,
+	UID_ACCT_TX,
+	UID_ACCT_DIRS,
+};
+
+/* Radio events charged by activity_stats */
+enum {
+	UID_ACCT_TX_PROMOTIONS,	/* sends that found the radio idle */
+	UID_ACCT_RX_PROMOTIONS,	/* receives that found the radio idle */
+	UID_ACCT_WAKEUPS,	/* first receive after resume */
+	UID_ACCT_DEFERRED,	/* packets held for the next active window */
+	UID_ACCT_SAVED,		/* promotions avoided by deferring */
+	UID_ACCT_EVENTS,
+};
+
+#ifdef CONFIG_NET_UID_ACCT
+/*
+ * Per-CPU counters of an entry.  Each CPU only writes its own copy,
+ * with interrupts disabled.  On 32-bit the u64 counters are updated
+ * inside @seq, so that readers on other CPUs never see a torn value.
+ */
+struct uid_acct_counters {
+#if BITS_PER_LONG == 32
+	seqcount_t	seq;
+#endif
+	u64		bytes[UID_ACCT_DIRS];
+	u64		packets[UID_ACCT_DIRS];
+#ifdef CONFIG_NET_ACTIVITY_STATS
+	unsigned long	events[UID_ACCT_EVENTS];
+#endif
+};
+
+/*
+ * Entries are created from the packet path on first use and are never
+ * freed, which lets sockets cache the last entry they hit in
+ * sk_acct_cache without holding a reference.
+ */
+struct uid_acct_entry {
+	struct hlist_node	node;
+	struct list_head	list;
+	uid_t			uid;
+	u32			tag;
+	int			ifindex;
+	char			ifname[IFNAMSIZ];
+	struct uid_acct_counters __percpu *counters;
+};
+
+/* All entries, in creation order; walk under rcu_read_lock() */
+extern struct list_head uid_acct_list;
+
+extern void uid_acct_skb(struct sock *sk, const struct sk_buff *skb,
+			 int ifindex, int dir);
+#ifdef CONFIG_NET_ACTIVITY_STATS
+extern void uid_acct_event(uid_t uid, u32 tag, int ifindex, int event);
+#endif
+
+static inline int uid_acct_wanted(const struct sock *sk)
+{
+	return sk->sk_family == PF_INET || sk->sk_family == PF_INET6;
+}
+
+/* Called once a socket has accepted @skb, see sk_filter() */
+static inline void uid_acct_rx(struct sock *sk, const struct sk_buff *skb)
+{
+	if (uid_acct_wanted(sk))
+		uid_acct_skb(sk, skb, skb->skb_iif, UID_ACCT_RX);
+}
+
+/* Called from the IP output path once @skb is routed to @dev */
+static inline void uid_acct_tx(const struct sk_buff *skb,
+			       const struct net_device *dev)
+{
+	if (skb->sk && uid_acct_wanted(skb->sk))
+		uid_acct_skb(skb->sk, skb, dev->ifindex, UID_ACCT_TX);
+}
+
+static inline uid_t uid_acct_sk_uid(const struct sock *sk)
+{
+	return sk->sk_acct_uid;
+}
+
+static inline u32 uid_acct_sk_tag(const struct sock *sk)
+{
+	return sk->sk_acct_tag;
+}
+#else
+static inline void uid_acct_rx(struct sock *sk, const struct sk_buff *skb)
+{
+}
+
+static inline void uid_acct_tx(const struct sk_buff *skb,
+			       const struct net_device *dev)
+{
+}
+
+static inline uid_t uid_acct_sk_uid(struct sock *sk)
+{
+	return sock_i_uid(sk);
+}
+
+static inline u32 uid_acct_sk_tag(const struct sock *sk)
+{
+	return 0;
+}
+
+static inline void uid_acct_event(uid_t uid, u32 tag, int ifindex,
+				  int event)
+{
+}
+#endif
+
+#endif /* _NET_UID_ACCT_H */
@@ -68,6 +68,10 @@ int __read_mostly futex_cmpxchg_enabled;
 
 #define FUTEX_HASHBITS (CONFIG_BASE_SMALL ? 4 : 8)
 
+/* Bounds for the size of the per-mm hash of PROCESS_PRIVATE futexes */
+#define FUTEX_PRIVATE_HASHBITS_MIN	4
+#define FUTEX_PRIVATE_HASHBITS_MAX	FUTEX_HASHBITS
+
 /*
  * Priority Inheritance state:
  */
@@ -126,23 +130,136 @@ struct futex_q {
  * Hash buckets are shared by all the futex_keys that hash to the same
  * location.  Each key may have multiple futex_q structures, one for each task
  * waiting on a futex.
+ *
+ * @waiters counts the futex_qs queued on @chain, plus tasks between
+ * queue_lock() and queue_me() and requeues in progress towards this
+ * bucket, so that futex_wake() can return without taking @lock when
+ * nobody is waiting.  See hb_waiters_inc() for the ordering.
  */
 struct futex_hash_bucket {
+	atomic_t waiters;
 	spinlock_t lock;
 	struct plist_head chain;
 };
 
+/*
+ * Shared futexes are hashed in the global futex_queues.  PROCESS_PRIVATE
+ * futexes can only be waited on and woken from within one mm, and are
+ * hashed in a table of that mm's own, so that processes do not share
+ * buckets (or bucket locks) with each other.  The table cannot be resized
+ * once in use: queued waiters, and PI waiters blocked on an rt_mutex, hold
+ * on to their bucket's lock.  So it is sized for the most threads the mm
+ * can run at once, 16 buckets per possible CPU, rather than for the
+ * threads it happens to have when it first uses a private futex, often
+ * just one.  If it cannot be allocated, the mm uses the global table.
+ */
+struct futex_hash {
+	unsigned int bits;
+	struct futex_hash_bucket *buckets;
+};
+
 static struct futex_hash_bucket futex_queues[1<<FUTEX_HASHBITS];
 
+static struct futex_hash futex_global_hash = {
+	.bits		= FUTEX_HASHBITS,
+	.buckets	= futex_queues,
+};
+
+static void futex_hash_bucket_init(struct futex_hash_bucket *hb)
+{
+	atomic_set(&hb->waiters, 0);
+	plist_head_init(&hb->chain, &hb->lock);
+	spin_lock_init(&hb->lock);
+}
+
+/*
+ * Set up the private futex hash of @mm, see struct futex_hash.  Called
+ * without locks held; racing threads of the same mm agree through the
+ * cmpxchg().
+ */
+static void futex_private_hash_alloc(struct mm_struct *mm)
+{
+	struct futex_hash *fh;
+	unsigned int i, bits;
+
+	bits = order_base_2(16 * num_possible_cpus());
+	bits = clamp_t(unsigned int, bits, FUTEX_PRIVATE_HASHBITS_MIN,
+		       FUTEX_PRIVATE_HASHBITS_MAX);
+
+	fh = kmalloc(sizeof(*fh) + (sizeof(struct futex_hash_bucket) << bits),
+		     GFP_KERNEL);
+	if (fh) {
+		fh->bits = bits;
+		fh->buckets = (struct futex_hash_bucket *)(fh + 1);
+		for (i = 0; i < (1 << bits); i++)
+			futex_hash_bucket_init(&fh->buckets[i]);
+	} else {
+		fh = &futex_global_hash;
+	}
+
+	if (cmpxchg(&mm->futex_hash, NULL, fh) != NULL &&
+	    fh != &futex_global_hash)
+		kfree(fh);
+}
+
+/*
+ * Called from __mmdrop(): nobody can look up a private futex of @mm any
+ * more.
+ */
+void futex_hash_free(struct mm_struct *mm)
+{
+	if (mm->futex_hash != &futex_global_hash)
+		kfree(mm->futex_hash);
+}
+
 /*
  * We hash on the keys returned from get_futex_key (see below).
  */
 static struct futex_hash_bucket *hash_futex(union futex_key *key)
 {
+	struct futex_hash *fh = &futex_global_hash;
 	u32 hash = jhash2((u32*)&key->both.word,
 			  (sizeof(key->both.word)+sizeof(key->both.ptr))/4,
 			  key->both.offset);
-	return &futex_queues[hash & ((1 << FUTEX_HASHBITS)-1)];
+
+	if (!(key->both.offset & (FUT_OFF_INODE|FUT_OFF_MMSHARED))) {
+		/* Set up by get_futex_key() */
+		fh = ACCESS_ONCE(key->private.mm->futex_hash);
+		smp_read_barrier_depends();
+	}
+	return &fh->buckets[hash & ((1 << fh->bits)-1)];
+}
+
+/*
+ * Waiters count themselves in before taking the bucket lock and reading
+ * the futex value, wakers check the count after userspace changed the
+ * value:
+ *
+ *   waiter			waker
+ *   hb_waiters_inc(hb)		*futex = newval	(userspace)
+ *   smp_mb()			smp_mb()
+ *   spin_lock(&hb->lock)	if (!hb_waiters_pending(hb))
+ *   uval = *futex			return 0;
+ *   if (uval == val)		spin_lock(&hb->lock)
+ *     queue_me()		...
+ *
+ * so either the waker sees the waiter, and takes the lock, or the waiter
+ * sees the new value and does not sleep.
+ */
+static inline void hb_waiters_inc(struct futex_hash_bucket *hb)
+{
+	atomic_inc(&hb->waiters);
+	smp_mb__after_atomic_inc();
+}
+
+static inline void hb_waiters_dec(struct futex_hash_bucket *hb)
+{
+	atomic_dec(&hb->waiters);
+}
+
+static inline int hb_waiters_pending(struct futex_hash_bucket *hb)
+{
+	return atomic_read(&hb->waiters);
 }
 
 /*
@@ -240,6 +357,8 @@ get_futex_key(u32 __user *uaddr, int fshared, union futex_key *key)
 	if (!fshared) {
 		if (unlikely(!access_ok(VERIFY_WRITE, uaddr, sizeof(u32))))
 			return -EFAULT;
+		if (unlikely(!mm->futex_hash))
+			futex_private_hash_alloc(mm);
 		key->private.mm = mm;
 		key->private.address = address;
 		get_futex_key_refs(key);
@@ -758,6 +877,18 @@ retry:
 	return ret;
 }
 
+/*
+ * Take @q off its hash bucket, which must be locked (q->lock_ptr).
+ */
+static void __unqueue_futex(struct futex_q *q)
+{
+	struct futex_hash_bucket *hb;
+
+	hb = container_of(q->lock_ptr, struct futex_hash_bucket, lock);
+	plist_del(&q->list, &q->list.plist);
+	hb_waiters_dec(hb);
+}
+
 /*
  * The hash bucket lock must be held when this is called.
  * Afterwards, the futex_q must not be accessed.
@@ -775,7 +906,7 @@ static void wake_futex(struct futex_q *q)
 	 */
 	get_task_struct(p);
 
-	plist_del(&q->list, &q->list.plist);
+	__unqueue_futex(q);
 	/*
 	 * The waiting task can free the futex_q as soon as
 	 * q->lock_ptr = NULL is written, without taking any locks. A
@@ -917,6 +1048,16 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 		goto out;
 
 	hb = hash_futex(&key);
+
+	/*
+	 * Nobody queued here, nothing to wake.  The barrier orders the
+	 * check after userspace's update of the futex, see
+	 * hb_waiters_inc().
+	 */
+	smp_mb();
+	if (!hb_waiters_pending(hb))
+		goto out_put_key;
+
 	spin_lock(&hb->lock);
 	head = &hb->chain;
 
@@ -938,6 +1079,7 @@ static int futex_wake(u32 __user *uaddr, int fshared, int nr_wake, u32 bitset)
 	}
 
 	spin_unlock(&hb->lock);
+out_put_key:
 	put_futex_key(fshared, &key);
 out:
 	return ret;
@@ -1052,7 +1194,9 @@ void requeue_futex(struct futex_q *q, struct futex_hash_bucket *hb1,
 	 */
 	if (likely(&hb1->chain != &hb2->chain)) {
 		plist_del(&q->list, &hb1->chain);
+		hb_waiters_dec(hb1);
 		plist_add(&q->list, &hb2->chain);
+		hb_waiters_inc(hb2);
 		q->lock_ptr = &hb2->lock;
 #ifdef CONFIG_DEBUG_PI_LIST
 		q->list.plist.spinlock = &hb2->lock;
@@ -1084,7 +1228,7 @@ void requeue_pi_wake_futex(struct futex_q *q, union futex_key *key,
 	q->key = *key;
 
 	WARN_ON(plist_node_empty(&q->list));
-	plist_del(&q->list, &q->list.plist);
+	__unqueue_futex(q);
 
 	WARN_ON(!q->rt_waiter);
 	q->rt_waiter = NULL;
@@ -1231,6 +1375,12 @@ retry:
 	hb2 = hash_futex(&key2);
 
 retry_private:
+	/*
+	 * Count ourselves in on hb2 while we may requeue waiters to it, so
+	 * that a concurrent futex_wake() on key2 serializes against us on
+	 * hb2->lock instead of finding no waiters.
+	 */
+	hb_waiters_inc(hb2);
 	double_lock_hb(hb1, hb2);
 
 	if (likely(cmpval != NULL)) {
@@ -1240,6 +1390,7 @@ retry_private:
 
 		if (unlikely(ret)) {
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 
 			ret = get_user(curval, uaddr1);
 			if (ret)
@@ -1289,6 +1440,7 @@ retry_private:
 			break;
 		case -EFAULT:
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 			put_futex_key(fshared, &key2);
 			put_futex_key(fshared, &key1);
 			ret = fault_in_user_writeable(uaddr2);
@@ -1298,6 +1450,7 @@ retry_private:
 		case -EAGAIN:
 			/* The owner was exiting, try again. */
 			double_unlock_hb(hb1, hb2);
+			hb_waiters_dec(hb2);
 			put_futex_key(fshared, &key2);
 			put_futex_key(fshared, &key1);
 			cond_resched();
@@ -1370,6 +1523,7 @@ retry_private:
 
 out_unlock:
 	double_unlock_hb(hb1, hb2);
+	hb_waiters_dec(hb2);
 
 	/*
 	 * drop_futex_key_refs() must be called outside the spinlocks. During
@@ -1390,7 +1544,11 @@ out:
 	return ret ? ret : task_count;
 }
 
-/* The key must be already stored in q->key. */
+/*
+ * The key must be already stored in q->key.  The waiter count taken here
+ * is dropped by queue_unlock(), or when the futex_q is unqueued after
+ * queue_me().
+ */
 static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 {
 	struct futex_hash_bucket *hb;
@@ -1398,6 +1556,7 @@ static inline struct futex_hash_bucket *queue_lock(struct futex_q *q)
 	hb = hash_futex(&q->key);
 	q->lock_ptr = &hb->lock;
 
+	hb_waiters_inc(hb);
 	spin_lock(&hb->lock);
 	return hb;
 }
@@ -1406,6 +1565,7 @@ static inline void
 queue_unlock(struct futex_q *q, struct futex_hash_bucket *hb)
 {
 	spin_unlock(&hb->lock);
+	hb_waiters_dec(hb);
 }
 
 /**
@@ -1483,7 +1643,7 @@ retry:
 			goto retry;
 		}
 		WARN_ON(plist_node_empty(&q->list));
-		plist_del(&q->list, &q->list.plist);
+		__unqueue_futex(q);
 
 		BUG_ON(q->pi_state);
 
@@ -1503,7 +1663,7 @@ retry:
 static void unqueue_me_pi(struct futex_q *q)
 {
 	WARN_ON(plist_node_empty(&q->list));
-	plist_del(&q->list, &q->list.plist);
+	__unqueue_futex(q);
 
 	BUG_ON(!q->pi_state);
 	free_pi_state(q->pi_state);
@@ -2171,6 +2331,7 @@ int handle_early_requeue_pi_wakeup(struct futex_hash_bucket *hb,
 		 * Unqueue the futex_q and determine which it was.
 		 */
 		plist_del(&q->list, &q->list.plist);
+		hb_waiters_dec(hb);
 
 		/* Handle spurious wakeups gracefully */
 		ret = -EWOULDBLOCK;
@@ -2687,10 +2848,8 @@ static int __init futex_init(void)
 	if (curval == -EFAULT)
 		futex_cmpxchg_enabled = 1;
 
-	for (i = 0; i < ARRAY_SIZE(futex_queues); i++) {
-		plist_head_init(&futex_queues[i].chain, &futex_queues[i].lock);
-		spin_lock_init(&futex_queues[i].lock);
-	}
+	for (i = 0; i < ARRAY_SIZE(futex_queues); i++)
+		futex_hash_bucket_init(&futex_queues[i]);
 
 	return 0;
 }
@@ -264,7 +264,9 @@ static void padata_reorder(struct parallel_data *pd)
 	struct padata_priv *padata;
 	struct padata_queue *queue;
 	struct padata_instance *pinst = pd->pinst;
+	int seen;
 
+again:
 	/*
 	 * We need to ensure that only one cpu can work on dequeueing of
 	 * the reorder queue the time. Calculating in which percpu reorder
@@ -279,6 +281,13 @@ static void padata_reorder(struct parallel_data *pd)
 		return;
 
 	while (1) {
+		/*
+		 * Objects are counted after they are queued, so anything
+		 * counted here is visible to padata_get_next().
+		 */
+		seen = atomic_read(&pd->reorder_objects);
+		smp_rmb();
+
 		padata = padata_get_next(pd);
 
 		/*
@@ -314,9 +323,18 @@ static void padata_reorder(struct parallel_data *pd)
 
 	/*
 	 * The next object that needs serialization might have arrived to
-	 * the reorder queues in the meantime, we will be called again
-	 * from the timer function if noone else cares for it.
+	 * the reorder queues in the meantime, and its cpu failed the
+	 * trylock above. On a machine with few cpus nobody else is likely
+	 * to come along and pick it up, and waiting for the timer would
+	 * stall the stream for a whole second, so look again if anything
+	 * was queued since the last check.
 	 */
+	smp_mb();
+	if (atomic_read(&pd->reorder_objects) > seen
+	    && !(pinst->flags & PADATA_RESET))
+		goto again;
+
+	/* Otherwise the timer function calls us again if noone else does */
 	if (atomic_read(&pd->reorder_objects)
 			&& !(pinst->flags & PADATA_RESET))
 		mod_timer(&pd->timer, jiffies + HZ);
@@ -381,12 +399,16 @@ void padata_do_serial(struct padata_priv *padata)
 	queue = per_cpu_ptr(pd->queue, cpu);
 
 	spin_lock(&queue->reorder.lock);
-	atomic_inc(&pd->reorder_objects);
 	list_add_tail(&padata->list, &queue->reorder.list);
+	smp_wmb();
+	atomic_inc(&pd->reorder_objects);
 	spin_unlock(&queue->reorder.lock);
 
 	put_cpu();
 
+	/* Pairs with the smp_mb() after dropping pd->lock in padata_reorder */
+	smp_mb();
+
 	padata_reorder(pd);
 }
 EXPORT_SYMBOL(padata_do_serial);
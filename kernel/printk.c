@@ -28,6 +28,7 @@
 #include <linux/moduleparam.h>
 #include <linux/interrupt.h>			/* For in_interrupt() */
 #include <linux/delay.h>
+#include <linux/kthread.h>
 #include <linux/smp.h>
 #include <linux/security.h>
 #include <linux/bootmem.h>
@@ -37,6 +38,7 @@
 #include <linux/ratelimit.h>
 #include <linux/kmsg_dump.h>
 #include <linux/syslog.h>
+#include <linux/suspend.h>
 
 #include <asm/uaccess.h>
 #include <mach/sec_debug.h>
@@ -69,6 +71,15 @@ extern void printascii(char *);
 
 DECLARE_WAIT_QUEUE_HEAD(log_wait);
 
+/* What printk_tick() has to do on this cpu: wake klogd, or the consoles */
+#define PRINTK_PENDING_WAKEUP	0x01
+#define PRINTK_PENDING_OUTPUT	0x02
+
+static DEFINE_PER_CPU(int, printk_pending);
+
+/* Prints what printk() leaves to the consoles, see printk_console_thread() */
+static struct task_struct *printk_console_task;
+
 int console_printk[4] = {
 	DEFAULT_CONSOLE_LOGLEVEL,	/* console_loglevel */
 	DEFAULT_MESSAGE_LOGLEVEL,	/* default_message_loglevel */
@@ -766,8 +777,8 @@ asmlinkage int printk(const char *fmt, ...)
 	return r;
 }
 
-/* cpu currently holding logbuf_lock */
-static volatile unsigned int printk_cpu = UINT_MAX;
+/* set while this cpu is in vprintk(), to catch recursion */
+static DEFINE_PER_CPU(int, printk_active);
 
 /*
  * Can we actually use the console at this time on this cpu?
@@ -817,7 +828,7 @@ static int acquire_console_semaphore_for_printk(unsigned int cpu)
 			retval = 0;
 		}
 	}
-	printk_cpu = UINT_MAX;
+	per_cpu(printk_active, cpu) = 0;
 	spin_unlock(&logbuf_lock);
 	return retval;
 }
@@ -825,7 +836,33 @@ static const char recursion_bug_msg [] =
 		KERN_CRIT "BUG: recent printk recursion!\n";
 static int recursion_bug;
 static int new_text_line = 1;
-static char printk_buf[1024];
+
+/*
+ * Messages are formatted into a buffer of the printing cpu, so that only
+ * the copy into log_buf needs logbuf_lock.
+ */
+static DEFINE_PER_CPU(char [1024], printk_buf);
+
+/*
+ * Console output of printk() is left to printk_console_thread(), so that
+ * callers do not wait for slow consoles, unless printk.synchronous is set
+ * or the thread can not be relied on to get it out: before it runs, while
+ * oopsing or panicking, from the start of a suspend or hibernation until
+ * tasks are thawed again (system_state stays SYSTEM_RUNNING meanwhile,
+ * see printk_pm_notify()), and on the way to a reboot, halt or power off.
+ */
+static int printk_sync;
+module_param_named(synchronous, printk_sync, bool, S_IRUGO | S_IWUSR);
+
+static int printk_pm_sync;
+
+static inline int printk_defer_console(void)
+{
+	return printk_console_task && !printk_sync && !printk_pm_sync &&
+		!oops_in_progress &&
+		(system_state == SYSTEM_BOOTING ||
+		 system_state == SYSTEM_RUNNING);
+}
 
 int printk_delay_msec __read_mostly;
 
@@ -841,58 +878,15 @@ static inline void printk_delay(void)
 	}
 }
 
-asmlinkage int vprintk(const char *fmt, va_list args)
+/*
+ * Copy the text at @p into log_buf, with a loglevel token, and the time
+ * if asked for, in front of every line. Returns how many characters it
+ * added to the text. Called with logbuf_lock held.
+ */
+static int emit_log_text(const char *p, int this_cpu)
 {
-	int printed_len = 0;
 	int current_log_level = default_message_loglevel;
-	unsigned long flags;
-	int this_cpu;
-	char *p;
-
-	boot_delay_msec();
-	printk_delay();
-
-	preempt_disable();
-	/* This stops the holder of console_sem just where we want him */
-	raw_local_irq_save(flags);
-	this_cpu = smp_processor_id();
-
-	/*
-	 * Ouch, printk recursed into itself!
-	 */
-	if (unlikely(printk_cpu == this_cpu)) {
-		/*
-		 * If a crash is occurring during printk() on this CPU,
-		 * then try to get the crash message out but make sure
-		 * we can't deadlock. Otherwise just return to avoid the
-		 * recursion and return - but flag the recursion so that
-		 * it can be printed at the next appropriate moment:
-		 */
-		if (!oops_in_progress) {
-			recursion_bug = 1;
-			goto out_restore_irqs;
-		}
-		zap_locks();
-	}
-
-	lockdep_off();
-	spin_lock(&logbuf_lock);
-	printk_cpu = this_cpu;
-
-	if (recursion_bug) {
-		recursion_bug = 0;
-		strcpy(printk_buf, recursion_bug_msg);
-		printed_len = strlen(recursion_bug_msg);
-	}
-	/* Emit the output into the temporary buffer */
-	printed_len += vscnprintf(printk_buf + printed_len,
-				  sizeof(printk_buf) - printed_len, fmt, args);
-
-#ifdef	CONFIG_DEBUG_LL
-	printascii(printk_buf);
-#endif
-
-	p = printk_buf;
+	int added = 0;
 
 	/* Do we have a loglevel in the string? */
 	if (p[0] == '<') {
@@ -925,7 +919,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 			emit_log_char('<');
 			emit_log_char(current_log_level + '0');
 			emit_log_char('>');
-			printed_len += 3;
+			added += 3;
 			new_text_line = 0;
 
 			if (printk_time) {
@@ -935,7 +929,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 				unsigned long long t;
 				unsigned long nanosec_rem;
 
-				t = cpu_clock(printk_cpu);
+				t = cpu_clock(this_cpu);
 				nanosec_rem = do_div(t, 1000000000);
 				tlen = sprintf(tbuf, "[%5lu.%06lu] ",
 						(unsigned long) t,
@@ -943,7 +937,7 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 
 				for (tp = tbuf; tp < tbuf + tlen; tp++)
 					emit_log_char(*tp);
-				printed_len += tlen;
+				added += tlen;
 			}
 
 			if (!*p)
@@ -955,22 +949,95 @@ asmlinkage int vprintk(const char *fmt, va_list args)
 			new_text_line = 1;
 	}
 
+	return added;
+}
+
+asmlinkage int vprintk(const char *fmt, va_list args)
+{
+	int printed_len = 0;
+	int wake_console = 0;
+	unsigned long flags;
+	int this_cpu;
+	char *buf;
+
+	boot_delay_msec();
+	printk_delay();
+
+	preempt_disable();
+	/* This stops the holder of console_sem just where we want him */
+	raw_local_irq_save(flags);
+	this_cpu = smp_processor_id();
+
 	/*
-	 * Try to acquire and then immediately release the
-	 * console semaphore. The release will do all the
-	 * actual magic (print out buffers, wake up klogd,
-	 * etc). 
-	 *
-	 * The acquire_console_semaphore_for_printk() function
-	 * will release 'logbuf_lock' regardless of whether it
-	 * actually gets the semaphore or not.
+	 * Ouch, printk recursed into itself!
 	 */
-	if (acquire_console_semaphore_for_printk(this_cpu))
+	if (unlikely(per_cpu(printk_active, this_cpu))) {
+		/*
+		 * If a crash is occurring during printk() on this CPU,
+		 * then try to get the crash message out but make sure
+		 * we can't deadlock. Otherwise just return to avoid the
+		 * recursion and return - but flag the recursion so that
+		 * it can be printed at the next appropriate moment:
+		 */
+		if (!oops_in_progress) {
+			recursion_bug = 1;
+			goto out_restore_irqs;
+		}
+		zap_locks();
+	}
+	per_cpu(printk_active, this_cpu) = 1;
+
+	/* Emit the output into the temporary buffer */
+	buf = per_cpu(printk_buf, this_cpu);
+	printed_len = vscnprintf(buf, sizeof(printk_buf), fmt, args);
+
+#ifdef	CONFIG_DEBUG_LL
+	printascii(buf);
+#endif
+
+	lockdep_off();
+	spin_lock(&logbuf_lock);
+
+	if (recursion_bug) {
+		recursion_bug = 0;
+		printed_len += strlen(recursion_bug_msg) +
+			emit_log_text(recursion_bug_msg, this_cpu);
+	}
+	printed_len += emit_log_text(buf, this_cpu);
+
+	if (printk_defer_console()) {
+		/* Leave it to printk_console_thread() */
+		per_cpu(printk_active, this_cpu) = 0;
+		spin_unlock(&logbuf_lock);
+		wake_console = 1;
+	} else if (acquire_console_semaphore_for_printk(this_cpu)) {
+		/*
+		 * Try to acquire and then immediately release the
+		 * console semaphore. The release will do all the
+		 * actual magic (print out buffers, wake up klogd,
+		 * etc).
+		 *
+		 * The acquire_console_semaphore_for_printk() function
+		 * will release 'logbuf_lock' regardless of whether it
+		 * actually gets the semaphore or not.
+		 */
 		release_console_sem();
+	}
 
 	lockdep_on();
 out_restore_irqs:
+	/*
+	 * The thread can only be woken here if the caller had interrupts
+	 * on, and so can not be holding a runqueue lock. Otherwise the
+	 * next tick does it.
+	 */
+	if (wake_console && raw_irqs_disabled_flags(flags)) {
+		__get_cpu_var(printk_pending) |= PRINTK_PENDING_OUTPUT;
+		wake_console = 0;
+	}
 	raw_local_irq_restore(flags);
+	if (wake_console)
+		wake_up_process(printk_console_task);
 
 	preempt_enable();
 	return printed_len;
@@ -978,6 +1045,68 @@ out_restore_irqs:
 EXPORT_SYMBOL(printk);
 EXPORT_SYMBOL(vprintk);
 
+static int printk_console_thread(void *unused)
+{
+	for (;;) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		/* resume_console() prints what piled up while suspended */
+		if (ACCESS_ONCE(con_start) == ACCESS_ONCE(log_end) ||
+		    console_suspended) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		acquire_console_sem();
+		release_console_sem();
+	}
+
+	return 0;
+}
+
+/*
+ * Late in a suspend or hibernation the CPUs that could run the thread
+ * go offline and interrupts go off, so what drivers print there, with
+ * no_console_suspend, would only come out if the system wakes up again.
+ */
+static int printk_pm_notify(struct notifier_block *nb, unsigned long event,
+			    void *unused)
+{
+	switch (event) {
+	case PM_SUSPEND_PREPARE:
+	case PM_HIBERNATION_PREPARE:
+	case PM_RESTORE_PREPARE:
+		printk_pm_sync = 1;
+		break;
+	case PM_POST_SUSPEND:
+	case PM_POST_HIBERNATION:
+	case PM_POST_RESTORE:
+		printk_pm_sync = 0;
+		break;
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block printk_pm_nb = {
+	.notifier_call = printk_pm_notify,
+};
+
+static int __init printk_console_thread_init(void)
+{
+	struct task_struct *p;
+
+	p = kthread_run(printk_console_thread, NULL, "kconsoled");
+	if (IS_ERR(p)) {
+		printk(KERN_ERR "printk: no console thread, printing "
+		       "synchronously\n");
+		return PTR_ERR(p);
+	}
+	printk_console_task = p;
+	register_pm_notifier(&printk_pm_nb);
+	return 0;
+}
+early_initcall(printk_console_thread_init);
+
 #else
 
 static void call_console_drivers(unsigned start, unsigned end)
@@ -1179,13 +1308,16 @@ int is_console_locked(void)
 	return console_locked;
 }
 
-static DEFINE_PER_CPU(int, printk_pending);
-
 void printk_tick(void)
 {
-	if (__get_cpu_var(printk_pending)) {
+	int pending = __get_cpu_var(printk_pending);
+
+	if (pending) {
 		__get_cpu_var(printk_pending) = 0;
-		wake_up_interruptible(&log_wait);
+		if (pending & PRINTK_PENDING_WAKEUP)
+			wake_up_interruptible(&log_wait);
+		if (pending & PRINTK_PENDING_OUTPUT)
+			wake_up_process(printk_console_task);
 	}
 }
 
@@ -1199,7 +1331,7 @@ int printk_needs_cpu(int cpu)
 void wake_up_klogd(void)
 {
 	if (waitqueue_active(&log_wait))
-		this_cpu_write(printk_pending, 1);
+		this_cpu_or(printk_pending, PRINTK_PENDING_WAKEUP);
 }
 
 /**
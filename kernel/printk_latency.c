@@ -0,0 +1,129 @@
+/*
+ * printk() latency test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * One kthread per online CPU (or "nthreads") calls printk() for
+ * "duration" seconds, with "gap" iterations of cpu_relax() between
+ * calls, and times each call.  When loaded it reports the number of
+ * calls and percentiles of the time they took.  "level" is the loglevel
+ * of the messages: below console_loglevel they go to the consoles, so
+ * that a slow serial console shows up in the numbers unless printk
+ * leaves the printing to its thread.  With "irqoff" the calls are made
+ * with interrupts disabled.  Compare with printk.synchronous=1.
+ *
+ * Expect the log to be flooded.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/cpumask.h>
+#include <linux/stress_test.h>
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Number of threads (default: one per CPU)");
+
+static int duration = 5;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Seconds to run");
+
+static int level = 6;
+module_param(level, int, 0444);
+MODULE_PARM_DESC(level, "Loglevel of the messages, 0 to 7");
+
+static int gap = 1000;
+module_param(gap, int, 0444);
+MODULE_PARM_DESC(gap, "cpu_relax() loops between printk() calls");
+
+static int irqoff;
+module_param(irqoff, bool, 0444);
+MODULE_PARM_DESC(irqoff, "Call printk() with interrupts disabled");
+
+struct latency_thread {
+	int id;
+	struct lat_hist lat;
+};
+
+static int latency_thread_fn(void *arg)
+{
+	struct latency_thread *t = arg;
+	unsigned long flags = 0;
+	ktime_t start;
+	int loops;
+	u64 ns;
+
+	while (!kthread_should_stop()) {
+		if (irqoff)
+			local_irq_save(flags);
+		start = ktime_get();
+		printk("<%d>printk_latency/%d: message %lu\n", level, t->id,
+		       t->lat.count);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (irqoff)
+			local_irq_restore(flags);
+
+		lat_hist_add(&t->lat, ns);
+
+		for (loops = gap; loops > 0; loops--)
+			cpu_relax();
+		if (!(t->lat.count & 63))
+			cond_resched();
+	}
+	return 0;
+}
+
+static void latency_report(struct latency_thread *threads)
+{
+	static struct lat_hist lat;
+	int n;
+
+	for (n = 0; n < nthreads; n++)
+		lat_hist_merge(&lat, &threads[n].lat);
+
+	printk(KERN_INFO "printk_latency: %d threads, %lu calls at level %d "
+	       "in %d s%s\n", nthreads, lat.count, level, duration,
+	       irqoff ? ", interrupts off" : "");
+	lat_hist_print(&lat, "printk_latency");
+}
+
+static int __init printk_latency_init(void)
+{
+	struct latency_thread *threads;
+	int n, err;
+
+	if (level < 0 || level > 7)
+		return -EINVAL;
+	if (nthreads <= 0)
+		nthreads = num_online_cpus();
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+	for (n = 0; n < nthreads; n++)
+		threads[n].id = n;
+
+	err = stress_run_threads(latency_thread_fn, threads, sizeof(*threads),
+				 nthreads, duration, "printk_latency");
+	if (!err)
+		latency_report(threads);
+
+	kfree(threads);
+	return err;
+}
+
+static void __exit printk_latency_exit(void)
+{
+}
+
+module_init(printk_latency_init);
+module_exit(printk_latency_exit);
+
+MODULE_DESCRIPTION("printk() latency test");
+MODULE_LICENSE("GPL");
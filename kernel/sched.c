@@ -4048,13 +4048,17 @@ need_resched_nonpreemptible:
 }
 EXPORT_SYMBOL(schedule);
 
-#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+#if defined(CONFIG_MUTEX_SPIN_ON_OWNER) || defined(CONFIG_RWSEM_SPIN_ON_OWNER)
 /*
+ * Spin while *@ownerp is @owner and @owner is running.  Returns 0 to
+ * stop spinning: the owner is not running, or the lock has changed hands.
+ *
  * Look out! "owner" is an entirely speculative pointer
  * access and not reliable.
  */
-int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner)
+static int spin_on_owner(struct thread_info **ownerp, struct thread_info *owner)
 {
+	struct thread_info *cur;
 	unsigned int cpu;
 	struct rq *rq;
 
@@ -4065,7 +4069,7 @@ int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner)
 	/*
 	 * Need to access the cpu field knowing that
 	 * DEBUG_PAGEALLOC could have unmapped it if
-	 * the mutex owner just released it and exited.
+	 * the lock owner just released it and exited.
 	 */
 	if (probe_kernel_address(&owner->cpu, cpu))
 		return 0;
@@ -4093,13 +4097,14 @@ int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner)
 		/*
 		 * Owner changed, break to re-assess state.
 		 */
-		if (lock->owner != owner) {
+		cur = ACCESS_ONCE(*ownerp);
+		if (cur != owner) {
 			/*
 			 * If the lock has switched to a different owner,
 			 * we likely have heavy contention. Return 0 to quit
 			 * optimistic spinning and not contend further:
 			 */
-			if (lock->owner)
+			if (cur)
 				return 0;
 			break;
 		}
@@ -4117,6 +4122,20 @@ int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner)
 }
 #endif
 
+#ifdef CONFIG_MUTEX_SPIN_ON_OWNER
+int mutex_spin_on_owner(struct mutex *lock, struct thread_info *owner)
+{
+	return spin_on_owner(&lock->owner, owner);
+}
+#endif
+
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+int rwsem_spin_on_owner(struct rw_semaphore *sem, struct thread_info *owner)
+{
+	return spin_on_owner(&sem->owner, owner);
+}
+#endif
+
 #ifdef CONFIG_PREEMPT
 /*
  * this is the entry point to schedule() from in-kernel preemption
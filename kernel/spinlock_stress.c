@@ -0,0 +1,215 @@
+/*
+ * Spinlock and rwlock contention stress test
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * One kthread per online CPU (or "nthreads") hammers a single lock for
+ * "duration" seconds, holding it for "hold" and then staying away for
+ * "gap" iterations of cpu_relax().  When loaded it reports:
+ *
+ *  - how evenly the acquisitions were spread over the threads: the
+ *    least and most acquisitions by one thread, and Jain's fairness
+ *    index (1000 is perfectly even, 1000/nthreads is one thread only);
+ *  - the time from asking for the lock to getting it, as percentiles
+ *    over all acquisitions.  These include the cost of ktime_get().
+ *
+ * It also checks mutual exclusion with a counter that is updated
+ * non-atomically inside the lock.  "type" is "spin" or "rw"; with "rw"
+ * the first "readers" threads take the lock for reading.
+ */
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/cpumask.h>
+#include <linux/stress_test.h>
+
+static char *type = "spin";
+module_param(type, charp, 0444);
+MODULE_PARM_DESC(type, "Lock to stress: spin or rw");
+
+static int nthreads;
+module_param(nthreads, int, 0444);
+MODULE_PARM_DESC(nthreads, "Number of threads (default: one per CPU)");
+
+static int readers;
+module_param(readers, int, 0444);
+MODULE_PARM_DESC(readers, "Threads taking the rwlock for reading");
+
+static int duration = 10;
+module_param(duration, int, 0444);
+MODULE_PARM_DESC(duration, "Seconds to run");
+
+static int hold = 10;
+module_param(hold, int, 0444);
+MODULE_PARM_DESC(hold, "cpu_relax() loops with the lock held");
+
+static int gap = 10;
+module_param(gap, int, 0444);
+MODULE_PARM_DESC(gap, "cpu_relax() loops between acquisitions");
+
+struct stress_thread {
+	bool reader;
+	struct lat_hist lat;	/* one sample per acquisition */
+};
+
+static DEFINE_SPINLOCK(stress_spin);
+static DEFINE_RWLOCK(stress_rw);
+static unsigned long stress_counter;
+static int stress_writer_in;
+static atomic_t stress_errors = ATOMIC_INIT(0);
+static bool stress_rw_mode;
+
+static void stress_spin_delay(int loops)
+{
+	while (loops-- > 0)
+		cpu_relax();
+}
+
+static void stress_locked(struct stress_thread *t)
+{
+	unsigned long c;
+
+	if (t->reader) {
+		if (ACCESS_ONCE(stress_writer_in))
+			atomic_inc(&stress_errors);
+		stress_spin_delay(hold);
+		return;
+	}
+
+	ACCESS_ONCE(stress_writer_in) = 1;
+	c = ACCESS_ONCE(stress_counter);
+	stress_spin_delay(hold);
+	ACCESS_ONCE(stress_counter) = c + 1;
+	ACCESS_ONCE(stress_writer_in) = 0;
+}
+
+static int stress_thread_fn(void *arg)
+{
+	struct stress_thread *t = arg;
+	ktime_t start;
+	u64 ns;
+
+	while (!kthread_should_stop()) {
+		start = ktime_get();
+		if (!stress_rw_mode)
+			spin_lock(&stress_spin);
+		else if (t->reader)
+			read_lock(&stress_rw);
+		else
+			write_lock(&stress_rw);
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		stress_locked(t);
+
+		if (!stress_rw_mode)
+			spin_unlock(&stress_spin);
+		else if (t->reader)
+			read_unlock(&stress_rw);
+		else
+			write_unlock(&stress_rw);
+
+		lat_hist_add(&t->lat, ns);
+
+		stress_spin_delay(gap);
+		if (!(t->lat.count & 1023))
+			cond_resched();
+	}
+	return 0;
+}
+
+static void stress_report(const char *what, struct stress_thread *threads,
+			  int first, int last)
+{
+	static struct lat_hist lat;
+	unsigned long lo = ULONG_MAX, hi = 0;
+	u64 sum_sq = 0;
+	char prefix[32];
+	int n;
+
+	if (first >= last)
+		return;
+
+	memset(&lat, 0, sizeof(lat));
+	for (n = first; n < last; n++) {
+		unsigned long acquired = threads[n].lat.count;
+
+		lo = min(lo, acquired);
+		hi = max(hi, acquired);
+		sum_sq += (u64)acquired * acquired;
+		lat_hist_merge(&lat, &threads[n].lat);
+	}
+
+	printk(KERN_INFO "spinlock_stress: %s: %d threads, %lu acquisitions, "
+	       "per thread min %lu max %lu, fairness %llu/1000\n",
+	       what, last - first, lat.count, lo, hi,
+	       sum_sq ? div64_u64((u64)lat.count * lat.count * 1000,
+				  sum_sq * (last - first)) : 0);
+	snprintf(prefix, sizeof(prefix), "spinlock_stress: %s", what);
+	lat_hist_print(&lat, prefix);
+}
+
+static int __init spinlock_stress_init(void)
+{
+	struct stress_thread *threads;
+	int n, err;
+
+	if (!strcmp(type, "rw"))
+		stress_rw_mode = true;
+	else if (strcmp(type, "spin"))
+		return -EINVAL;
+
+	if (nthreads <= 0)
+		nthreads = num_online_cpus();
+	if (readers < 0 || readers >= nthreads || (readers && !stress_rw_mode))
+		return -EINVAL;
+
+	threads = kcalloc(nthreads, sizeof(*threads), GFP_KERNEL);
+	if (!threads)
+		return -ENOMEM;
+
+	for (n = 0; n < nthreads; n++)
+		threads[n].reader = n < readers;
+
+	err = stress_run_threads(stress_thread_fn, threads, sizeof(*threads),
+				 nthreads, duration, "spinlock_stress");
+	if (err)
+		goto out;
+
+	if (stress_rw_mode) {
+		stress_report("read_lock", threads, 0, readers);
+		stress_report("write_lock", threads, readers, nthreads);
+	} else {
+		stress_report("spin_lock", threads, 0, nthreads);
+	}
+
+	for (n = readers; n < nthreads; n++)
+		stress_counter -= threads[n].lat.count;
+	if (stress_counter || atomic_read(&stress_errors)) {
+		printk(KERN_ERR "spinlock_stress: mutual exclusion FAILED: "
+		       "%ld lost updates, %d readers saw a writer\n",
+		       (long)-stress_counter, atomic_read(&stress_errors));
+		err = -EIO;
+	}
+
+out:
+	kfree(threads);
+	return err;
+}
+
+static void __exit spinlock_stress_exit(void)
+{
+}
+
+module_init(spinlock_stress_init);
+module_exit(spinlock_stress_exit);
+
+MODULE_DESCRIPTION("Spinlock and rwlock fairness and latency stress test");
+MODULE_LICENSE("GPL");
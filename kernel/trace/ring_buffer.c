@@ -5,6 +5,7 @@
  */
 #include <linux/ring_buffer.h>
 #include <linux/trace_clock.h>
+#include <linux/trace_mmap.h>
 #include <linux/ftrace_irq.h>
 #include <linux/spinlock.h>
 #include <linux/debugfs.h>
@@ -21,6 +22,7 @@
 #include <linux/cpu.h>
 #include <linux/fs.h>
 
+#include <asm/cacheflush.h>
 #include <asm/local.h>
 #include "trace.h"
 
@@ -345,6 +347,7 @@ struct buffer_page {
 	local_t		 entries;	/* entries on this page */
 	unsigned long	 real_end;	/* real end of data */
 	struct buffer_data_page *page;	/* Actual data page */
+	unsigned	 id;		/* sub-buffer index when mapped */
 };
 
 /*
@@ -463,6 +466,10 @@ struct ring_buffer_per_cpu {
 	u64				write_stamp;
 	u64				read_stamp;
 	atomic_t			record_disabled;
+	/* mmap() of the pages, serialized by buffer->mutex and reader_lock */
+	unsigned int			mapped;
+	struct trace_buffer_meta	*meta_page;
+	unsigned long			*subbuf_ids;	/* page address by id */
 };
 
 struct ring_buffer {
@@ -1069,6 +1076,10 @@ static void rb_free_cpu_buffer(struct ring_buffer_per_cpu *cpu_buffer)
 
 	free_buffer_page(cpu_buffer->reader_page);
 
+	/* Pages still mapped by user space are held by the mapping */
+	free_page((unsigned long)cpu_buffer->meta_page);
+	kfree(cpu_buffer->subbuf_ids);
+
 	rb_head_page_deactivate(cpu_buffer);
 
 	if (head) {
@@ -1310,6 +1321,16 @@ int ring_buffer_resize(struct ring_buffer *buffer, unsigned long size)
 	mutex_lock(&buffer->mutex);
 	get_online_cpus();
 
+	/* Mapped pages stay where they are */
+	for_each_buffer_cpu(buffer, cpu) {
+		if (buffer->buffers[cpu]->mapped) {
+			put_online_cpus();
+			mutex_unlock(&buffer->mutex);
+			atomic_dec(&buffer->record_disabled);
+			return -EBUSY;
+		}
+	}
+
 	nr_pages = DIV_ROUND_UP(size, BUF_PAGE_SIZE);
 
 	if (size < buffer_size) {
@@ -3054,6 +3075,28 @@ static int rb_lost_events(struct ring_buffer_per_cpu *cpu_buffer)
 	return cpu_buffer->lost_events;
 }
 
+/*
+ * Tell a mapping where the reader page is now. Called with the
+ * reader_lock held.
+ */
+static void rb_update_meta_page(struct ring_buffer_per_cpu *cpu_buffer)
+{
+	struct trace_buffer_meta *meta = cpu_buffer->meta_page;
+
+	meta->reader.id = cpu_buffer->reader_page->id;
+	meta->reader.read = cpu_buffer->reader_page->read;
+	meta->reader.lost_events = cpu_buffer->lost_events;
+	cpu_buffer->lost_events = 0;
+
+	meta->entries = local_read(&cpu_buffer->entries);
+	meta->overrun = local_read(&cpu_buffer->overrun);
+	meta->read = cpu_buffer->read;
+
+	/* The user mapping may be a different cache colour */
+	flush_dcache_page(virt_to_page(cpu_buffer->reader_page->page));
+	flush_dcache_page(virt_to_page(meta));
+}
+
 static struct ring_buffer_event *
 rb_buffer_peek(struct ring_buffer_per_cpu *cpu_buffer, u64 *ts,
 	       unsigned long *lost_events)
@@ -3544,6 +3587,9 @@ void ring_buffer_reset_cpu(struct ring_buffer *buffer, int cpu)
 
 	arch_spin_unlock(&cpu_buffer->lock);
 
+	if (cpu_buffer->mapped)
+		rb_update_meta_page(cpu_buffer);
+
  out:
 	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
 
@@ -3673,6 +3719,10 @@ int ring_buffer_swap_cpu(struct ring_buffer *buffer_a,
 	if (atomic_read(&cpu_buffer_b->record_disabled))
 		goto out;
 
+	ret = -EBUSY;
+	if (cpu_buffer_a->mapped || cpu_buffer_b->mapped)
+		goto out;
+
 	/*
 	 * We can't do a synchronize_sched here because this
 	 * function can be called in atomic context.
@@ -3833,12 +3883,14 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 	/*
 	 * If this page has been partially read or
 	 * if len is not big enough to read the rest of the page or
-	 * a writer is still on the page, then
+	 * a writer is still on the page or
+	 * the pages are mapped to user space, then
 	 * we must copy the data from the page to the buffer.
 	 * Otherwise, we can simply swap the page with the one passed in.
 	 */
 	if (read || (len < (commit - read)) ||
-	    cpu_buffer->reader_page == cpu_buffer->commit_page) {
+	    cpu_buffer->reader_page == cpu_buffer->commit_page ||
+	    cpu_buffer->mapped) {
 		struct buffer_data_page *rpage = cpu_buffer->reader_page->page;
 		unsigned int rpos = read;
 		unsigned int pos = 0;
@@ -3937,6 +3989,212 @@ int ring_buffer_read_page(struct ring_buffer *buffer,
 }
 EXPORT_SYMBOL_GPL(ring_buffer_read_page);
 
+/*
+ * Number the reader page 0 and the pages of the ring from 1 in list
+ * order, and remember their addresses by number.
+ */
+static void rb_setup_ids(struct ring_buffer_per_cpu *cpu_buffer,
+			 unsigned long *subbuf_ids)
+{
+	struct buffer_page *first, *bpage;
+	unsigned id = 0;
+
+	cpu_buffer->reader_page->id = id;
+	subbuf_ids[id++] = (unsigned long)cpu_buffer->reader_page->page;
+
+	first = bpage = cpu_buffer->head_page;
+	do {
+		bpage->id = id;
+		subbuf_ids[id++] = (unsigned long)bpage->page;
+		bpage = list_entry(rb_list_head(bpage->list.next),
+				   struct buffer_page, list);
+	} while (bpage != first && id <= cpu_buffer->buffer->pages);
+
+	RB_WARN_ON(cpu_buffer, bpage != first);
+}
+
+/**
+ * ring_buffer_map - set up a per cpu buffer to be mapped
+ * @buffer: the ring buffer
+ * @cpu: the cpu buffer to map
+ *
+ * Takes a reference on the mapping of @cpu's pages, setting up the
+ * meta page (see linux/trace_mmap.h) the first time. The pages are
+ * then found with ring_buffer_map_page(), and the reader page is
+ * advanced with ring_buffer_map_get_reader(). While mapped, the
+ * buffer can not be resized or swapped, and ring_buffer_read_page()
+ * copies rather than takes pages.
+ *
+ * Returns 0 on success, or a negative error.
+ */
+int ring_buffer_map(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta;
+	unsigned long *subbuf_ids;
+	unsigned long flags;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+
+	if (cpu_buffer->mapped) {
+		spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+		cpu_buffer->mapped++;
+		spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+		mutex_unlock(&buffer->mutex);
+		return 0;
+	}
+
+	meta = (void *)get_zeroed_page(GFP_KERNEL);
+	subbuf_ids = kcalloc(buffer->pages + 1, sizeof(*subbuf_ids),
+			     GFP_KERNEL);
+	if (!meta || !subbuf_ids) {
+		free_page((unsigned long)meta);
+		kfree(subbuf_ids);
+		mutex_unlock(&buffer->mutex);
+		return -ENOMEM;
+	}
+
+	meta->meta_page_size = PAGE_SIZE;
+	meta->meta_struct_len = sizeof(*meta);
+	meta->subbuf_size = PAGE_SIZE;
+	meta->nr_subbufs = buffer->pages + 1;
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+	rb_setup_ids(cpu_buffer, subbuf_ids);
+	cpu_buffer->meta_page = meta;
+	cpu_buffer->subbuf_ids = subbuf_ids;
+	cpu_buffer->mapped = 1;
+	rb_update_meta_page(cpu_buffer);
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	mutex_unlock(&buffer->mutex);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map);
+
+/**
+ * ring_buffer_unmap - drop a reference taken by ring_buffer_map()
+ * @buffer: the ring buffer
+ * @cpu: the mapped cpu buffer
+ */
+void ring_buffer_unmap(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct trace_buffer_meta *meta = NULL;
+	unsigned long *subbuf_ids = NULL;
+	unsigned long flags;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	mutex_lock(&buffer->mutex);
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!RB_WARN_ON(cpu_buffer, !cpu_buffer->mapped) &&
+	    !--cpu_buffer->mapped) {
+		meta = cpu_buffer->meta_page;
+		subbuf_ids = cpu_buffer->subbuf_ids;
+		cpu_buffer->meta_page = NULL;
+		cpu_buffer->subbuf_ids = NULL;
+	}
+
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+	mutex_unlock(&buffer->mutex);
+
+	free_page((unsigned long)meta);
+	kfree(subbuf_ids);
+}
+EXPORT_SYMBOL_GPL(ring_buffer_unmap);
+
+/**
+ * ring_buffer_map_page - address of a page of a mapped cpu buffer
+ * @buffer: the ring buffer
+ * @cpu: the mapped cpu buffer
+ * @pgoff: page offset into the mapping
+ *
+ * Page 0 is the meta page, page 1 + N is sub-buffer N.
+ *
+ * Returns the kernel address of the page, or NULL if @pgoff is past
+ * the end or the buffer is not mapped.
+ */
+void *ring_buffer_map_page(struct ring_buffer *buffer, int cpu,
+			   unsigned long pgoff)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return NULL;
+
+	cpu_buffer = buffer->buffers[cpu];
+	if (!cpu_buffer->mapped)
+		return NULL;
+
+	if (!pgoff)
+		return cpu_buffer->meta_page;
+	if (pgoff > cpu_buffer->meta_page->nr_subbufs)
+		return NULL;
+	return (void *)cpu_buffer->subbuf_ids[pgoff - 1];
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_page);
+
+/**
+ * ring_buffer_map_get_reader - hand the next page to a mapping
+ * @buffer: the ring buffer
+ * @cpu: the mapped cpu buffer
+ *
+ * The mapping has read the reader page up to its commit. Consume it,
+ * swap in the next page if the writer has left it, and update the
+ * meta page.
+ *
+ * Returns 0, or -EINVAL if the buffer is not mapped.
+ */
+int ring_buffer_map_get_reader(struct ring_buffer *buffer, int cpu)
+{
+	struct ring_buffer_per_cpu *cpu_buffer;
+	struct buffer_page *reader;
+	unsigned long flags;
+	int ret = 0;
+
+	if (!cpumask_test_cpu(cpu, buffer->cpumask))
+		return -EINVAL;
+
+	cpu_buffer = buffer->buffers[cpu];
+
+	spin_lock_irqsave(&cpu_buffer->reader_lock, flags);
+
+	if (!cpu_buffer->mapped) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	reader = cpu_buffer->reader_page;
+	if (!reader->read) {
+		cpu_buffer->read += rb_page_entries(reader);
+		reader->read = rb_page_size(reader);
+	} else {
+		/* Partly consumed by a kernel reader, count what is left */
+		while (reader->read < rb_page_size(reader))
+			rb_advance_reader(cpu_buffer);
+	}
+
+	rb_get_reader_page(cpu_buffer);
+	rb_update_meta_page(cpu_buffer);
+
+ out:
+	spin_unlock_irqrestore(&cpu_buffer->reader_lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL_GPL(ring_buffer_map_get_reader);
+
 #ifdef CONFIG_TRACING
 static ssize_t
 rb_simple_read(struct file *filp, char __user *ubuf,
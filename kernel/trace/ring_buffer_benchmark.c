@@ -8,6 +8,8 @@
 #include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/time.h>
+#include <linux/percpu.h>
+#include <linux/trace_mmap.h>
 #include <asm/local.h>
 
 struct rb_page {
@@ -58,8 +60,16 @@ MODULE_PARM_DESC(producer_fifo, "fifo prio for producer");
 module_param(consumer_fifo, uint, 0644);
 MODULE_PARM_DESC(consumer_fifo, "fifo prio for consumer");
 
+static int read_mapped;
+module_param(read_mapped, uint, 0444);
+MODULE_PARM_DESC(read_mapped, "read pages in place through ring_buffer_map()");
+
 static int read_events;
 
+/* reader page id and offset a mapped reader got to, per cpu */
+static DEFINE_PER_CPU(unsigned int, map_id);
+static DEFINE_PER_CPU(unsigned long, map_pos);
+
 static int kill_test;
 
 #define KILL_TEST()				\
@@ -95,16 +105,70 @@ static enum event_status read_event(int cpu)
 	return EVENT_FOUND;
 }
 
-static enum event_status read_page(int cpu)
+static void read_page_data(int cpu, struct rb_page *rpage,
+			   unsigned long i, unsigned long commit)
 {
 	struct ring_buffer_event *event;
+	int *entry;
+	int inc;
+
+	for (; i < commit && !kill_test; i += inc) {
+
+		if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
+			KILL_TEST();
+			break;
+		}
+
+		inc = -1;
+		event = (void *)&rpage->data[i];
+		switch (event->type_len) {
+		case RINGBUF_TYPE_PADDING:
+			/* failed writes may be discarded events */
+			if (!event->time_delta)
+				KILL_TEST();
+			inc = event->array[0] + 4;
+			break;
+		case RINGBUF_TYPE_TIME_EXTEND:
+			inc = 8;
+			break;
+		case 0:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
+				KILL_TEST();
+				break;
+			}
+			read++;
+			if (!event->array[0]) {
+				KILL_TEST();
+				break;
+			}
+			inc = event->array[0] + 4;
+			break;
+		default:
+			entry = ring_buffer_event_data(event);
+			if (*entry != cpu) {
+				KILL_TEST();
+				break;
+			}
+			read++;
+			inc = ((event->type_len + 1) * 4);
+		}
+		if (kill_test)
+			break;
+
+		if (inc <= 0) {
+			KILL_TEST();
+			break;
+		}
+	}
+}
+
+static enum event_status read_page(int cpu)
+{
 	struct rb_page *rpage;
 	unsigned long commit;
 	void *bpage;
-	int *entry;
 	int ret;
-	int inc;
-	int i;
 
 	bpage = ring_buffer_alloc_read_page(buffer);
 	if (!bpage)
@@ -115,68 +179,69 @@ static enum event_status read_page(int cpu)
 		rpage = bpage;
 		/* The commit may have missed event flags set, clear them */
 		commit = local_read(&rpage->commit) & 0xfffff;
-		for (i = 0; i < commit && !kill_test; i += inc) {
+		read_page_data(cpu, rpage, 0, commit);
+	}
+	ring_buffer_free_read_page(buffer, bpage);
 
-			if (i >= (PAGE_SIZE - offsetof(struct rb_page, data))) {
-				KILL_TEST();
-				break;
-			}
+	if (ret < 0)
+		return EVENT_DROPPED;
+	return EVENT_FOUND;
+}
 
-			inc = -1;
-			event = (void *)&rpage->data[i];
-			switch (event->type_len) {
-			case RINGBUF_TYPE_PADDING:
-				/* failed writes may be discarded events */
-				if (!event->time_delta)
-					KILL_TEST();
-				inc = event->array[0] + 4;
-				break;
-			case RINGBUF_TYPE_TIME_EXTEND:
-				inc = 8;
-				break;
-			case 0:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				if (!event->array[0]) {
-					KILL_TEST();
-					break;
-				}
-				inc = event->array[0] + 4;
-				break;
-			default:
-				entry = ring_buffer_event_data(event);
-				if (*entry != cpu) {
-					KILL_TEST();
-					break;
-				}
-				read++;
-				inc = ((event->type_len + 1) * 4);
-			}
-			if (kill_test)
-				break;
+/*
+ * Read the reader page in place, from where we got to last time (or
+ * from where the kernel left it, if it is a new page), then hand it
+ * back with ring_buffer_map_get_reader(). No page is copied.
+ */
+static enum event_status read_mapped_page(int cpu)
+{
+	struct trace_buffer_meta *meta;
+	struct rb_page *rpage;
+	unsigned long commit;
+	unsigned long pos;
+	unsigned int id;
 
-			if (inc <= 0) {
-				KILL_TEST();
-				break;
-			}
-		}
+	meta = ring_buffer_map_page(buffer, cpu, 0);
+	if (!meta)
+		return EVENT_DROPPED;
+
+	id = ACCESS_ONCE(meta->reader.id);
+	pos = per_cpu(map_pos, cpu);
+	if (id != per_cpu(map_id, cpu))
+		pos = meta->reader.read;
+
+	rpage = ring_buffer_map_page(buffer, cpu, 1 + id);
+	if (!rpage) {
+		KILL_TEST();
+		return EVENT_DROPPED;
 	}
-	ring_buffer_free_read_page(buffer, bpage);
 
-	if (ret < 0)
+	commit = local_read(&rpage->commit);
+	smp_rmb();
+	if (commit > pos)
+		read_page_data(cpu, rpage, pos, commit);
+
+	ring_buffer_map_get_reader(buffer, cpu);
+
+	per_cpu(map_id, cpu) = id;
+	per_cpu(map_pos, cpu) = commit;
+
+	if (commit <= pos && ACCESS_ONCE(meta->reader.id) == id)
 		return EVENT_DROPPED;
 	return EVENT_FOUND;
 }
 
 static void ring_buffer_consumer(void)
 {
+	int cpu;
+
 	/* toggle between reading pages and events */
 	read_events ^= 1;
 
+	/* the producer reset the buffer, forget where the last run got to */
+	for_each_online_cpu(cpu)
+		per_cpu(map_id, cpu) = UINT_MAX;
+
 	read = 0;
 	while (!reader_finish && !kill_test) {
 		int found;
@@ -190,6 +255,8 @@ static void ring_buffer_consumer(void)
 
 				if (read_events)
 					stat = read_event(cpu);
+				else if (read_mapped)
+					stat = read_mapped_page(cpu);
 				else
 					stat = read_page(cpu);
 
@@ -317,7 +384,8 @@ static void ring_buffer_producer(void)
 		trace_printk("Read:     (reader disabled)\n");
 	else
 		trace_printk("Read:     %ld  (by %s)\n", read,
-			read_events ? "events" : "pages");
+			read_events ? "events" :
+			read_mapped ? "mapped pages" : "pages");
 	trace_printk("Entries:  %lld\n", entries);
 	trace_printk("Total:    %lld\n", entries + overruns + read);
 	trace_printk("Missed:   %ld\n", missed);
@@ -416,15 +484,43 @@ static int ring_buffer_producer_thread(void *arg)
 	return 0;
 }
 
+/* unmap the cpu buffers mapped at init, those before @last if not -1 */
+static void unmap_buffer(int last)
+{
+	int cpu;
+
+	for_each_online_cpu(cpu) {
+		if (cpu == last)
+			break;
+		ring_buffer_unmap(buffer, cpu);
+	}
+}
+
 static int __init ring_buffer_benchmark_init(void)
 {
 	int ret;
+	int cpu;
 
 	/* make a one meg buffer in overwite mode */
 	buffer = ring_buffer_alloc(1000000, RB_FL_OVERWRITE);
 	if (!buffer)
 		return -ENOMEM;
 
+	if (disable_reader)
+		read_mapped = 0;
+
+	if (read_mapped) {
+		for_each_online_cpu(cpu) {
+			ret = ring_buffer_map(buffer, cpu);
+			if (ret < 0) {
+				/* drop the ones we got */
+				unmap_buffer(cpu);
+				read_mapped = 0;
+				goto out_fail;
+			}
+		}
+	}
+
 	if (!disable_reader) {
 		consumer = kthread_create(ring_buffer_consumer_thread,
 					  NULL, "rb_consumer");
@@ -468,6 +564,8 @@ static int __init ring_buffer_benchmark_init(void)
 		kthread_stop(consumer);
 
  out_fail:
+	if (read_mapped)
+		unmap_buffer(-1);
 	ring_buffer_free(buffer);
 	return ret;
 }
@@ -477,6 +575,8 @@ static void __exit ring_buffer_benchmark_exit(void)
 	kthread_stop(producer);
 	if (consumer)
 		kthread_stop(consumer);
+	if (read_mapped)
+		unmap_buffer(-1);
 	ring_buffer_free(buffer);
 }
 
@@ -33,6 +33,7 @@
 #include <linux/kdebug.h>
 #include <linux/string.h>
 #include <linux/rwsem.h>
+#include <linux/trace_mmap.h>
 #include <linux/slab.h>
 #include <linux/ctype.h>
 #include <linux/init.h>
@@ -3644,6 +3645,8 @@ struct ftrace_buffer_info {
 	void			*spare;
 	int			cpu;
 	unsigned int		read;
+	/* the buffer first mapped, tr->buffer may be swapped later */
+	struct ring_buffer	*map_buffer;
 };
 
 static int tracing_buffers_open(struct inode *inode, struct file *filp)
@@ -3892,11 +3895,102 @@ out:
 	return ret;
 }
 
+static long tracing_buffers_ioctl(struct file *file, unsigned int cmd,
+				  unsigned long arg)
+{
+	struct ftrace_buffer_info *info = file->private_data;
+	int ret;
+
+	if (cmd != TRACE_MMAP_IOCTL_GET_READER)
+		return -ENOTTY;
+
+	if (!info->map_buffer)
+		return -EINVAL;
+
+	trace_access_lock(info->cpu);
+	ret = ring_buffer_map_get_reader(info->map_buffer, info->cpu);
+	trace_access_unlock(info->cpu);
+
+	return ret;
+}
+
+/* Split vmas each hold a reference on the mapping */
+static void tracing_buffers_mmap_open(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_private_data;
+
+	WARN_ON(ring_buffer_map(info->map_buffer, info->cpu));
+}
+
+static void tracing_buffers_mmap_close(struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = vma->vm_private_data;
+
+	ring_buffer_unmap(info->map_buffer, info->cpu);
+}
+
+static const struct vm_operations_struct tracing_buffers_vmops = {
+	.open		= tracing_buffers_mmap_open,
+	.close		= tracing_buffers_mmap_close,
+};
+
+/*
+ * Map the meta page and the sub-buffers of one cpu's ring buffer read
+ * only, see linux/trace_mmap.h.
+ */
+static int tracing_buffers_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct ftrace_buffer_info *info = filp->private_data;
+	unsigned long npages = vma_pages(vma);
+	unsigned long i;
+	void *page;
+	int ret;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	if (!info->map_buffer)
+		info->map_buffer = info->tr->buffer;
+
+	ret = ring_buffer_map(info->map_buffer, info->cpu);
+	if (ret)
+		return ret;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTCOPY | VM_DONTEXPAND | VM_RESERVED;
+
+	for (i = 0; i < npages; i++) {
+		page = ring_buffer_map_page(info->map_buffer, info->cpu,
+					    vma->vm_pgoff + i);
+		if (!page) {
+			ret = -EINVAL;
+			break;
+		}
+		ret = vm_insert_page(vma, vma->vm_start + i * PAGE_SIZE,
+				     virt_to_page(page));
+		if (ret)
+			break;
+	}
+
+	if (ret) {
+		/* mmap_region() zaps whatever got inserted */
+		ring_buffer_unmap(info->map_buffer, info->cpu);
+		return ret;
+	}
+
+	vma->vm_ops = &tracing_buffers_vmops;
+	vma->vm_private_data = info;
+
+	return 0;
+}
+
 static const struct file_operations tracing_buffers_fops = {
 	.open		= tracing_buffers_open,
 	.read		= tracing_buffers_read,
 	.release	= tracing_buffers_release,
 	.splice_read	= tracing_buffers_splice_read,
+	.unlocked_ioctl	= tracing_buffers_ioctl,
+	.mmap		= tracing_buffers_mmap,
 	.llseek		= no_llseek,
 };
 
@@ -28,291 +28,184 @@
 #include <linux/module.h>
 #include <linux/compiler.h>
 #include <linux/types.h>
+#include <linux/cache.h>
 #include <linux/init.h>
 #include <asm/atomic.h>
 #include "crc32defs.h"
 
 #if CRC_LE_BITS > 8
-# define tole(x) (__force u32) __constant_cpu_to_le32(x)
+# define tole(x) ((__force u32) __constant_cpu_to_le32(x))
 #else
 # define tole(x) (x)
 #endif
 
 #if CRC_BE_BITS > 8
-# define tobe(x) (__force u32) __constant_cpu_to_be32(x)
+# define tobe(x) ((__force u32) __constant_cpu_to_be32(x))
 #else
 # define tobe(x) (x)
 #endif
 #include "crc32table.h"
 
 MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
-MODULE_DESCRIPTION("Ethernet CRC32 calculations");
+MODULE_DESCRIPTION("Various CRC32 calculations");
 MODULE_LICENSE("GPL");
 
-#if CRC_LE_BITS > 8
-static inline u32 crc32_le_body(u32 crc, u8 const *buf, size_t len)
-{
-	const u8 *p8;
-	const u32 *p32;
-	int init_bytes, end_bytes;
-	size_t words;
-	int i;
-	u32 q;
-	u8 i0, i1, i2, i3;
-
-	crc = (__force u32) __cpu_to_le32(crc);
-
-#if CRC_LE_BITS == 64
-	p8 = buf;
-	p32 = (u32 *)(((uintptr_t)p8 + 7) & ~7);
-
-	init_bytes = (uintptr_t)p32 - (uintptr_t)p8;
-	if (init_bytes > len)
-		init_bytes = len;
-	words = (len - init_bytes) >> 3;
-	end_bytes = (len - init_bytes) & 7;
-#else
-	p8 = buf;
-	p32 = (u32 *)(((uintptr_t)p8 + 3) & ~3);
-
-	init_bytes = (uintptr_t)p32 - (uintptr_t)p8;
-	if (init_bytes > len)
-		init_bytes = len;
-	words = (len - init_bytes) >> 2;
-	end_bytes = (len - init_bytes) & 3;
-#endif
-
-	for (i = 0; i < init_bytes; i++) {
-#ifdef __LITTLE_ENDIAN
-		i0 = *p8++ ^ crc;
-		crc = t0_le[i0] ^ (crc >> 8);
-#else
-		i0 = *p8++ ^ (crc >> 24);
-		crc = t0_le[i0] ^ (crc << 8);
-#endif
-	}
+#if CRC_LE_BITS > 8 || CRC_BE_BITS > 8
 
-	for (i = 0; i < words; i++) {
-#ifdef __LITTLE_ENDIAN
-#  if CRC_LE_BITS == 64
-		/* slice by 8 algorithm */
-		q = *p32++ ^ crc;
-		i3 = q;
-		i2 = q >> 8;
-		i1 = q >> 16;
-		i0 = q >> 24;
-		crc = t7_le[i3] ^ t6_le[i2] ^ t5_le[i1] ^ t4_le[i0];
-
-		q = *p32++;
-		i3 = q;
-		i2 = q >> 8;
-		i1 = q >> 16;
-		i0 = q >> 24;
-		crc ^= t3_le[i3] ^ t2_le[i2] ^ t1_le[i1] ^ t0_le[i0];
-#  else
-		/* slice by 4 algorithm */
-		q = *p32++ ^ crc;
-		i3 = q;
-		i2 = q >> 8;
-		i1 = q >> 16;
-		i0 = q >> 24;
-		crc = t3_le[i3] ^ t2_le[i2] ^ t1_le[i1] ^ t0_le[i0];
-#  endif
-#else
-#  if CRC_LE_BITS == 64
-		q = *p32++ ^ crc;
-		i3 = q >> 24;
-		i2 = q >> 16;
-		i1 = q >> 8;
-		i0 = q;
-		crc = t7_le[i3] ^ t6_le[i2] ^ t5_le[i1] ^ t4_le[i0];
-
-		q = *p32++;
-		i3 = q >> 24;
-		i2 = q >> 16;
-		i1 = q >> 8;
-		i0 = q;
-		crc ^= t3_le[i3] ^ t2_le[i2] ^ t1_le[i1] ^ t0_le[i0];
-#  else
-		q = *p32++ ^ crc;
-		i3 = q >> 24;
-		i2 = q >> 16;
-		i1 = q >> 8;
-		i0 = q;
-		crc = t3_le[i3] ^ t2_le[i2] ^ t1_le[i1] ^ t0_le[i0];
-#  endif
-#endif
-	}
-
-	p8 = (u8 *)p32;
-
-	for (i = 0; i < end_bytes; i++) {
-#ifdef __LITTLE_ENDIAN
-		i0 = *p8++ ^ crc;
-		crc = t0_le[i0] ^ (crc >> 8);
-#else
-		i0 = *p8++ ^ (crc >> 24);
-		crc = t0_le[i0] ^ (crc << 8);
-#endif
-	}
-
-	return __le32_to_cpu((__force __le32)crc);
-}
-#endif
-
-#if CRC_BE_BITS > 8
-static inline u32 crc32_be_body(u32 crc, u8 const *buf, size_t len)
+/*
+ * Slice by 4 and slice by 8 share this body.  The tables hold the CRC
+ * already in the byte order of a little endian (or, for crc32_be, big
+ * endian) word, so a whole aligned word of data can be xored into it
+ * and split into table indices without swapping.  Rows 0..3 cover the
+ * word that is xored with the CRC and rows 4..7, for slice by 8, the
+ * word after it.
+ */
+static inline u32
+crc32_body(u32 crc, unsigned char const *buf, size_t len, const u32 (*tab)[256],
+	   int bits)
 {
-	const u8 *p8;
-	const u32 *p32;
-	int init_bytes, end_bytes;
-	size_t words;
-	int i;
+# ifdef __LITTLE_ENDIAN
+#  define DO_CRC(x) (crc = t0[(crc ^ (x)) & 255] ^ (crc >> 8))
+#  define DO_CRC4(q) (t3[(q) & 255] ^ t2[((q) >> 8) & 255] ^ \
+		      t1[((q) >> 16) & 255] ^ t0[((q) >> 24) & 255])
+#  define DO_CRC8(q) (t7[(q) & 255] ^ t6[((q) >> 8) & 255] ^ \
+		      t5[((q) >> 16) & 255] ^ t4[((q) >> 24) & 255])
+# else
+#  define DO_CRC(x) (crc = t0[((crc >> 24) ^ (x)) & 255] ^ (crc << 8))
+#  define DO_CRC4(q) (t0[(q) & 255] ^ t1[((q) >> 8) & 255] ^ \
+		      t2[((q) >> 16) & 255] ^ t3[((q) >> 24) & 255])
+#  define DO_CRC8(q) (t4[(q) & 255] ^ t5[((q) >> 8) & 255] ^ \
+		      t6[((q) >> 16) & 255] ^ t7[((q) >> 24) & 255])
+# endif
+	const u32 *t0 = tab[0], *t1 = tab[1], *t2 = tab[2], *t3 = tab[3];
+	const u32 *t4 = tab[bits == 64 ? 4 : 0], *t5 = tab[bits == 64 ? 5 : 0];
+	const u32 *t6 = tab[bits == 64 ? 6 : 0], *t7 = tab[bits == 64 ? 7 : 0];
+	const u32 *b;
+	size_t rem_len;
 	u32 q;
-	u8 i0, i1, i2, i3;
-
-	crc = (__force u32) __cpu_to_be32(crc);
-
-#if CRC_LE_BITS == 64
-	p8 = buf;
-	p32 = (u32 *)(((uintptr_t)p8 + 7) & ~7);
 
-	init_bytes = (uintptr_t)p32 - (uintptr_t)p8;
-	if (init_bytes > len)
-		init_bytes = len;
-	words = (len - init_bytes) >> 3;
-	end_bytes = (len - init_bytes) & 7;
-#else
-	p8 = buf;
-	p32 = (u32 *)(((uintptr_t)p8 + 3) & ~3);
-
-	init_bytes = (uintptr_t)p32 - (uintptr_t)p8;
-	if (init_bytes > len)
-		init_bytes = len;
-	words = (len - init_bytes) >> 2;
-	end_bytes = (len - init_bytes) & 3;
-#endif
-
-	for (i = 0; i < init_bytes; i++) {
-#ifdef __LITTLE_ENDIAN
-		i0 = *p8++ ^ crc;
-		crc = t0_be[i0] ^ (crc >> 8);
-#else
-		i0 = *p8++ ^ (crc >> 24);
-		crc = t0_be[i0] ^ (crc << 8);
-#endif
+	/* Align it */
+	while (unlikely((unsigned long)buf & 3) && len) {
+		DO_CRC(*buf++);
+		len--;
 	}
 
-	for (i = 0; i < words; i++) {
-#ifdef __LITTLE_ENDIAN
-#  if CRC_LE_BITS == 64
-		/* slice by 8 algorithm */
-		q = *p32++ ^ crc;
-		i3 = q;
-		i2 = q >> 8;
-		i1 = q >> 16;
-		i0 = q >> 24;
-		crc = t7_be[i3] ^ t6_be[i2] ^ t5_be[i1] ^ t4_be[i0];
-
-		q = *p32++;
-		i3 = q;
-		i2 = q >> 8;
-		i1 = q >> 16;
-		i0 = q >> 24;
-		crc ^= t3_be[i3] ^ t2_be[i2] ^ t1_be[i1] ^ t0_be[i0];
-#  else
-		/* slice by 4 algorithm */
-		q = *p32++ ^ crc;
-		i3 = q;
-		i2 = q >> 8;
-		i1 = q >> 16;
-		i0 = q >> 24;
-		crc = t3_be[i3] ^ t2_be[i2] ^ t1_be[i1] ^ t0_be[i0];
-#  endif
-#else
-#  if CRC_LE_BITS == 64
-		q = *p32++ ^ crc;
-		i3 = q >> 24;
-		i2 = q >> 16;
-		i1 = q >> 8;
-		i0 = q;
-		crc = t7_be[i3] ^ t6_be[i2] ^ t5_be[i1] ^ t4_be[i0];
-
-		q = *p32++;
-		i3 = q >> 24;
-		i2 = q >> 16;
-		i1 = q >> 8;
-		i0 = q;
-		crc ^= t3_be[i3] ^ t2_be[i2] ^ t1_be[i1] ^ t0_be[i0];
-#  else
-		q = *p32++ ^ crc;
-		i3 = q >> 24;
-		i2 = q >> 16;
-		i1 = q >> 8;
-		i0 = q;
-		crc = t3_be[i3] ^ t2_be[i2] ^ t1_be[i1] ^ t0_be[i0];
-#  endif
-#endif
+	if (bits == 64) {
+		rem_len = len & 7;
+		len >>= 3;
+	} else {
+		rem_len = len & 3;
+		len >>= 2;
 	}
 
-	p8 = (u8 *)p32;
-
-	for (i = 0; i < end_bytes; i++) {
-#ifdef __LITTLE_ENDIAN
-		i0 = *p8++ ^ crc;
-		crc = t0_be[i0] ^ (crc >> 8);
-#else
-		i0 = *p8++ ^ (crc >> 24);
-		crc = t0_be[i0] ^ (crc << 8);
-#endif
+	b = (const u32 *)buf;
+	for (; len; len--) {
+		q = crc ^ *b++;
+		if (bits == 64) {
+			crc = DO_CRC8(q);
+			q = *b++;
+			crc ^= DO_CRC4(q);
+		} else {
+			crc = DO_CRC4(q);
+		}
 	}
 
-	return __be32_to_cpu((__force __be32)crc);
+	buf = (const unsigned char *)b;
+	while (rem_len--)
+		DO_CRC(*buf++);
+
+	return crc;
+#undef DO_CRC
+#undef DO_CRC4
+#undef DO_CRC8
 }
 #endif
 
 /**
- * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
- * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
- *	other uses, or the previous crc32 value if computing incrementally.
+ * crc32_le_generic() - Calculate bitwise little-endian CRC32
+ * @crc: seed value for computation.
  * @p: pointer to buffer over which CRC is run
  * @len: length of buffer @p
+ * @tab: little-endian table for the polynomial
+ * @polynomial: CRC32 LE polynomial, for the bit at a time version
  */
-u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+static inline u32 __pure crc32_le_generic(u32 crc, unsigned char const *p,
+					  size_t len, const u32 (*tab)[256],
+					  u32 polynomial)
 {
 #if CRC_LE_BITS == 1
 	int i;
 	while (len--) {
 		crc ^= *p++;
 		for (i = 0; i < 8; i++)
-			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+			crc = (crc >> 1) ^ ((crc & 1) ? polynomial : 0);
 	}
 # elif CRC_LE_BITS == 2
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 2) ^ t0_le[crc & 0x03];
-		crc = (crc >> 2) ^ t0_le[crc & 0x03];
-		crc = (crc >> 2) ^ t0_le[crc & 0x03];
-		crc = (crc >> 2) ^ t0_le[crc & 0x03];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
+		crc = (crc >> 2) ^ tab[0][crc & 3];
 	}
 # elif CRC_LE_BITS == 4
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 4) ^ t0_le[crc & 0x0f];
-		crc = (crc >> 4) ^ t0_le[crc & 0x0f];
+		crc = (crc >> 4) ^ tab[0][crc & 15];
+		crc = (crc >> 4) ^ tab[0][crc & 15];
 	}
 # elif CRC_LE_BITS == 8
+	/* aka Sarwate algorithm */
 	while (len--) {
 		crc ^= *p++;
-		crc = (crc >> 8) ^ t0_le[crc & 0xff];
+		crc = (crc >> 8) ^ tab[0][crc & 255];
 	}
 # else
-	crc = crc32_le_body(crc, p, len);
-# endif
+	crc = (__force u32) __cpu_to_le32(crc);
+	crc = crc32_body(crc, p, len, tab, CRC_LE_BITS);
+	crc = __le32_to_cpu((__force __le32)crc);
+#endif
 	return crc;
 }
+
+/**
+ * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
+ * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
+ *	other uses, or the previous crc32 value if computing incrementally.
+ * @p: pointer to buffer over which CRC is run
+ * @len: length of buffer @p
+ */
+u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
+{
+#if CRC_LE_BITS == 1
+	return crc32_le_generic(crc, p, len, NULL, CRCPOLY_LE);
+#else
+	return crc32_le_generic(crc, p, len, crc32table_le, CRCPOLY_LE);
+#endif
+}
 EXPORT_SYMBOL(crc32_le);
 
+/**
+ * __crc32c_le() - Calculate bitwise little-endian Castagnoli CRC32c
+ * @crc: seed value for computation.  ~0 for iSCSI and most other users,
+ *	or the previous crc32c value if computing incrementally.
+ * @p: pointer to buffer over which CRC is run
+ * @len: length of buffer @p
+ *
+ * This is the table driven implementation behind the "crc32c-generic"
+ * crypto driver; most users should go through libcrc32c, which picks
+ * the fastest driver that is registered.
+ */
+u32 __pure __crc32c_le(u32 crc, unsigned char const *p, size_t len)
+{
+#if CRC_LE_BITS == 1
+	return crc32_le_generic(crc, p, len, NULL, CRC32C_POLY_LE);
+#else
+	return crc32_le_generic(crc, p, len, crc32ctable_le, CRC32C_POLY_LE);
+#endif
+}
+EXPORT_SYMBOL(__crc32c_le);
+
 /**
  * crc32_be() - Calculate bitwise big-endian Ethernet AUTODIN II CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
@@ -333,24 +226,26 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 # elif CRC_BE_BITS == 2
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 2) ^ t0_be[crc >> 30];
-		crc = (crc << 2) ^ t0_be[crc >> 30];
-		crc = (crc << 2) ^ t0_be[crc >> 30];
-		crc = (crc << 2) ^ t0_be[crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
+		crc = (crc << 2) ^ crc32table_be[0][crc >> 30];
 	}
 # elif CRC_BE_BITS == 4
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 4) ^ t0_be[crc >> 28];
-		crc = (crc << 4) ^ t0_be[crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
+		crc = (crc << 4) ^ crc32table_be[0][crc >> 28];
 	}
 # elif CRC_BE_BITS == 8
 	while (len--) {
 		crc ^= *p++ << 24;
-		crc = (crc << 8) ^ t0_be[crc >> 24];
+		crc = (crc << 8) ^ crc32table_be[0][crc >> 24];
 	}
 # else
-	crc = crc32_be_body(crc, p, len);
+	crc = (__force u32) __cpu_to_be32(crc);
+	crc = crc32_body(crc, p, len, crc32table_be, CRC_BE_BITS);
+	crc = __be32_to_cpu((__force __be32)crc);
 # endif
 	return crc;
 }
@@ -483,6 +378,134 @@ EXPORT_SYMBOL(crc32_be);
  * the same way on decoding, it doesn't make a difference.
  */
 
+#ifdef CONFIG_CRC32_SELFTEST
+
+#include <linux/vmalloc.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+
+#define CRC32_TEST_SIZE		(64 << 10)
+#define CRC32_TEST_CASES	1000
+#define CRC32_BENCH_BYTES	(4 << 20)
+
+/* keeps the benchmark loops from being optimised away */
+static volatile u32 crc32_bench_sink __initdata;
+
+/* The bit at a time definitions, independent of the tables */
+static u32 __init crc32_le_ref(u32 crc, const u8 *p, size_t len, u32 poly)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? poly : 0);
+	}
+	return crc;
+}
+
+static u32 __init crc32_be_ref(u32 crc, const u8 *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^
+			      ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+	}
+	return crc;
+}
+
+static void __init crc32_bench(const u8 *buf, size_t len)
+{
+	static const char * const name[] = { "crc32_le", "__crc32c_le",
+					     "crc32_be" };
+	unsigned int i, n, loops = CRC32_BENCH_BYTES / len;
+	u32 crc = 0;
+	s64 ns;
+	ktime_t start;
+
+	for (i = 0; i < ARRAY_SIZE(name); i++) {
+		start = ktime_get();
+		for (n = 0; n < loops; n++) {
+			if (i == 0)
+				crc = crc32_le(crc, buf, len);
+			else if (i == 1)
+				crc = __crc32c_le(crc, buf, len);
+			else
+				crc = crc32_be(crc, buf, len);
+		}
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		pr_info("crc32: %-11s %6zu bytes: %7llu ns/call, %5llu MB/s\n",
+			name[i], len,
+			(unsigned long long)div_s64(ns, loops),
+			ns ? (unsigned long long)div_s64((s64)loops * len * 1000,
+							 ns) : 0);
+	}
+	crc32_bench_sink = crc;
+}
+
+/*
+ * Check the table driven code against the bit at a time definitions on
+ * random lengths, alignments and seeds, and time all three functions on
+ * buffers from 64 bytes to 64KB.
+ */
+static int __init crc32_selftest(void)
+{
+	static const u8 check[] __initconst = "123456789";
+	unsigned int i, off, errors = 0;
+	size_t len, size;
+	u32 seed, x = 0x9e3779b9;
+	u8 *buf;
+
+	/* the standard check values */
+	if (~crc32_le(~0, check, 9) != 0xcbf43926 ||
+	    ~__crc32c_le(~0, check, 9) != 0xe3069283 ||
+	    ~crc32_be(~0, check, 9) != 0xfc891918)
+		errors++;
+
+	buf = vmalloc(CRC32_TEST_SIZE + 8);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; i < CRC32_TEST_SIZE + 8; i++) {
+		x = x * 1103515245 + 12345;
+		buf[i] = x >> 16;
+	}
+
+	for (i = 0; i < CRC32_TEST_CASES; i++) {
+		x = x * 1103515245 + 12345;
+		off = x & 7;
+		len = (x >> 3) % 1024;
+		seed = x ^ (x << 13);
+		if (crc32_le(seed, buf + off, len) !=
+		    crc32_le_ref(seed, buf + off, len, CRCPOLY_LE))
+			errors++;
+		if (__crc32c_le(seed, buf + off, len) !=
+		    crc32_le_ref(seed, buf + off, len, CRC32C_POLY_LE))
+			errors++;
+		if (crc32_be(seed, buf + off, len) !=
+		    crc32_be_ref(seed, buf + off, len))
+			errors++;
+	}
+
+	if (errors)
+		pr_warning("crc32: self tests failed (%u errors)\n", errors);
+	else
+		pr_info("crc32: self tests passed, %d bits at a time\n",
+			CRC_LE_BITS);
+
+	for (size = 64; size <= CRC32_TEST_SIZE; size <<= 2)
+		crc32_bench(buf, size);
+
+	vfree(buf);
+	return errors ? -EINVAL : 0;
+}
+
+module_init(crc32_selftest);
+
+#endif /* CONFIG_CRC32_SELFTEST */
+
 #ifdef UNITTEST
 
 #include <stdlib.h>
@@ -0,0 +1,149 @@
+/*
+ * LZ4 decompressor for the Linux kernel, for compressed kernel images
+ * and initramfs.
+ *
+ * Reads the "legacy" LZ4 stream format written by "lz4 -l": the magic
+ * number 0x184c2102, then chunks that each decompress to 8MB (the last
+ * one to less), each preceded by its compressed length as a 32 bit little
+ * endian number.  The stream has no end marker, so it ends where the
+ * input does.  When the input is passed as a buffer, a tail of up to four
+ * bytes, such as the length that is appended to kernel images, is ignored.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifdef STATIC
+#include "lz4/lz4_decompress.c"
+#else
+#include <linux/slab.h>
+#include <linux/decompress/unlz4.h>
+#endif
+
+#include <linux/types.h>
+#include <linux/lz4.h>
+#include <linux/decompress/mm.h>
+
+#include <linux/compiler.h>
+#include <asm/unaligned.h>
+
+#define LZ4_LEGACY_MAGIC	0x184c2102
+#define LZ4_CHUNK_SIZE		(8 << 20)
+
+STATIC inline int INIT unlz4(u8 *input, int in_len,
+				int (*fill) (void *, unsigned int),
+				int (*flush) (void *, unsigned int),
+				u8 *output, int *posp,
+				void (*error) (char *x))
+{
+	const size_t chunk_max = lz4_worst_compress(LZ4_CHUNK_SIZE);
+	u8 *in_buf = NULL, *out_buf, *inp;
+	long size = in_len;
+	size_t dst_len;
+	u32 chunk;
+	int ret = -1;
+
+	if (output) {
+		out_buf = output;
+	} else if (!flush) {
+		error("NULL output pointer and no flush function provided");
+		goto exit;
+	} else {
+		out_buf = large_malloc(LZ4_CHUNK_SIZE);
+		if (!out_buf) {
+			error("Could not allocate output buffer");
+			goto exit;
+		}
+	}
+
+	if (input && fill) {
+		error("Both input pointer and fill function provided, don't know what to do");
+		goto exit_1;
+	} else if (input) {
+		inp = input;
+	} else if (!fill) {
+		error("NULL input pointer and missing fill function");
+		goto exit_1;
+	} else {
+		in_buf = large_malloc(chunk_max);
+		if (!in_buf) {
+			error("Could not allocate input buffer");
+			goto exit_1;
+		}
+		inp = in_buf;
+	}
+
+	if (posp)
+		*posp = 0;
+
+	if (fill)
+		size = fill(inp, 4);
+	if (size < 4 || get_unaligned_le32(inp) != LZ4_LEGACY_MAGIC) {
+		error("invalid header");
+		goto exit_2;
+	}
+	inp += 4;
+	size -= 4;
+	if (posp)
+		*posp += 4;
+
+	for (;;) {
+		if (fill) {
+			inp = in_buf;
+			size = fill(inp, 4);
+		}
+		if (size < 4 || (!fill && size == 4))
+			break;
+
+		chunk = get_unaligned_le32(inp);
+		inp += 4;
+		size -= 4;
+		if (posp)
+			*posp += 4;
+
+		/* concatenated streams */
+		if (chunk == LZ4_LEGACY_MAGIC)
+			continue;
+
+		if (chunk > chunk_max) {
+			error("chunk longer than the largest possible");
+			goto exit_2;
+		}
+		if (fill) {
+			inp = in_buf;
+			size = fill(inp, chunk);
+		}
+		if (size < chunk) {
+			error("input is truncated");
+			goto exit_2;
+		}
+
+		dst_len = LZ4_CHUNK_SIZE;
+		if (lz4_decompress_safe(inp, chunk, out_buf, &dst_len)) {
+			error("Compressed data violation");
+			goto exit_2;
+		}
+
+		if (flush)
+			flush(out_buf, dst_len);
+		if (output)
+			out_buf += dst_len;
+		if (posp)
+			*posp += chunk;
+		inp += chunk;
+		size -= chunk;
+	}
+
+	ret = 0;
+exit_2:
+	if (!input)
+		large_free(in_buf);
+exit_1:
+	if (!output)
+		large_free(out_buf);
+exit:
+	return ret;
+}
+
+#define decompress unlz4
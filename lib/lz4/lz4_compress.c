@@ -0,0 +1,91 @@
+/*
+ * LZ4 compressor
+ *
+ * A single hash table of recent positions, one probe per position and a
+ * probe step that grows while nothing matches, so incompressible data is
+ * skipped over quickly.  The block format is that of LZ4 by Yann Collet:
+ * http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+#define LZ4_HASH_LOG	12
+#define SKIP_STRENGTH	6
+
+static inline u32 lz4_hash(const u8 *p)
+{
+	return (lz4_read32le(p) * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+int lz4_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const u8 * const iend = src + src_len;
+	const u8 * const mflimit = iend - MFLIMIT;
+	const u8 * const matchlimit = iend - LASTLITERALS;
+	const u8 *ip = src, *anchor = src, *ref;
+	u32 *hash_table = wrkmem;
+	u8 *op = dst;
+	size_t len;
+
+	BUILD_BUG_ON((1 << LZ4_HASH_LOG) * sizeof(u32) > LZ4_MEM_COMPRESS);
+
+	if (src_len < MINLENGTH)
+		goto last_literals;
+
+	memset(hash_table, 0, (1 << LZ4_HASH_LOG) * sizeof(u32));
+	ip++;
+
+	for (;;) {
+		unsigned int search = 1 << SKIP_STRENGTH;
+		u32 h;
+
+		/* Find a match, stepping further the longer there is none */
+		for (;;) {
+			h = lz4_hash(ip);
+			ref = src + hash_table[h];
+			hash_table[h] = ip - src;
+			if (ip - ref <= MAX_DISTANCE &&
+			    lz4_read32(ref) == lz4_read32(ip))
+				break;
+			ip += search++ >> SKIP_STRENGTH;
+			if (unlikely(ip > mflimit))
+				goto last_literals;
+		}
+
+		/* Extend it backwards over the pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		len = MINMATCH + lz4_count(ip + MINMATCH, ref + MINMATCH,
+					   matchlimit);
+		op = lz4_put_sequence(op, anchor, ip, ref, len);
+		ip += len;
+		anchor = ip;
+		if (ip > mflimit)
+			break;
+
+		/* Index a position inside the match, then probe right here */
+		hash_table[lz4_hash(ip - 2)] = ip - 2 - src;
+	}
+
+last_literals:
+	op = lz4_put_last_literals(op, anchor, iend);
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Compressor");
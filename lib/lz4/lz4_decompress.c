@@ -0,0 +1,151 @@
+/*
+ * LZ4 decompressor
+ *
+ * Checks every length against both buffers, so it is safe on corrupt or
+ * hostile input.  The block format is that of LZ4 by Yann Collet:
+ * http://code.google.com/p/lz4/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef STATIC
+#include <linux/module.h>
+#include <linux/kernel.h>
+#endif
+
+#include <asm/unaligned.h>
+#include <linux/lz4.h>
+#include "lz4defs.h"
+
+/*
+ * Where unaligned words are cheap, literals and matches are copied eight
+ * bytes at a time and may spill up to seven bytes past their end, so that
+ * is only done with COPYLENGTH bytes to spare in both buffers.
+ */
+int lz4_decompress_safe(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char * const iend = src + src_len;
+	unsigned char * const oend = dst + *dst_len;
+	const unsigned char *ip = src, *ref;
+	unsigned char *op = dst, *cpy;
+	unsigned int token, s;
+	size_t length, offset;
+
+	for (;;) {
+		if (unlikely(ip >= iend))
+			goto fail;
+		token = *ip++;
+
+		/* literals */
+		length = token >> ML_BITS;
+		if (length == RUN_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto fail;
+				s = *ip++;
+				length += s;
+				if (unlikely(length > src_len))
+					goto fail;
+			} while (s == 255);
+		}
+		if (unlikely(length > (size_t)(iend - ip) ||
+			     length > (size_t)(oend - op)))
+			goto fail;
+		cpy = op + length;
+#ifdef LZ4_UNALIGNED_OK
+		if (likely((size_t)(iend - ip) >= length + COPYLENGTH &&
+			   (size_t)(oend - op) >= length + COPYLENGTH)) {
+			while (op < cpy) {
+				LZ4_COPY8(op, ip);
+				op += 8;
+				ip += 8;
+			}
+			ip -= op - cpy;
+			op = cpy;
+		} else
+#endif
+		{
+			while (op < cpy)
+				*op++ = *ip++;
+		}
+
+		/* the last sequence has no match */
+		if (ip == iend)
+			break;
+
+		/* match */
+		if (unlikely(iend - ip < 2))
+			goto fail;
+		offset = get_unaligned_le16(ip);
+		ip += 2;
+		if (unlikely(!offset || offset > (size_t)(op - dst)))
+			goto fail;
+		ref = op - offset;
+
+		length = token & ML_MASK;
+		if (length == ML_MASK) {
+			do {
+				if (unlikely(ip >= iend))
+					goto fail;
+				s = *ip++;
+				length += s;
+				if (unlikely(length > (size_t)(oend - op)))
+					goto fail;
+			} while (s == 255);
+		}
+		length += MINMATCH;
+		if (unlikely(length > (size_t)(oend - op)))
+			goto fail;
+		cpy = op + length;
+#ifdef LZ4_UNALIGNED_OK
+		if (likely((size_t)(oend - op) >= length + COPYLENGTH)) {
+			if (unlikely(offset < 8)) {
+				/*
+				 * The match overlaps its own output: a run
+				 * with a period of offset bytes.  Lay down
+				 * the first multiple of the period that is at
+				 * least 8 a byte at a time, then copy from
+				 * that far back in whole words.
+				 */
+				size_t period = offset;
+				unsigned char *pe;
+
+				while (period < 8)
+					period += offset;
+				pe = op + period - offset;
+				if (pe > cpy)
+					pe = cpy;
+				do {
+					*op++ = *ref++;
+				} while (op < pe);
+				ref = op - period;
+			}
+			while (op < cpy) {
+				LZ4_COPY8(op, ref);
+				op += 8;
+				ref += 8;
+			}
+			op = cpy;
+		} else
+#endif
+		{
+			while (op < cpy)
+				*op++ = *ref++;
+		}
+	}
+
+	*dst_len = op - dst;
+	return 0;
+
+fail:
+	return -1;
+}
+#ifndef STATIC
+EXPORT_SYMBOL_GPL(lz4_decompress_safe);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 Decompressor");
+#endif
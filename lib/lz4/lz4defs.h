@@ -0,0 +1,150 @@
+/*
+ *  lz4defs.h -- definitions shared by the LZ4 compressors and decompressor
+ *
+ *  An LZ4 block is a series of sequences.  Each starts with a token whose
+ *  high four bits count the literals that follow it and whose low four
+ *  bits give the length of the match after them, less MINMATCH.  A nibble
+ *  of 15 is continued by bytes that are added to it until one is not 255.
+ *  The literals are followed by the little endian 16 bit match offset and
+ *  by the match length bytes, if any.  The last sequence has literals only,
+ *  at least LASTLITERALS of them, and no match may start in the last
+ *  MFLIMIT bytes of the input.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ */
+
+#define MINMATCH	4
+#define COPYLENGTH	8
+#define LASTLITERALS	5
+#define MFLIMIT		(COPYLENGTH + MINMATCH)
+#define MINLENGTH	(MFLIMIT + 1)
+#define MAX_DISTANCE	65535
+
+#define ML_BITS		4
+#define ML_MASK		((1U << ML_BITS) - 1)
+#define RUN_BITS	(8 - ML_BITS)
+#define RUN_MASK	((1U << RUN_BITS) - 1)
+
+/* Word access, under the same rules as in lib/lzo/lzodefs.h */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 7 && !defined(STATIC)
+#define LZ4_UNALIGNED_OK	1
+
+static inline u32 lz4_read32(const void *p)
+{
+	u32 v;
+
+	asm("ldr	%0, [%1]" : "=r" (v) : "r" (p), "m" (*(const u32 *)p));
+	return v;
+}
+
+static inline void lz4_write32(void *p, u32 v)
+{
+	asm("str	%1, [%2]" : "=m" (*(u32 *)p) : "r" (v), "r" (p));
+}
+#elif defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS)
+#define LZ4_UNALIGNED_OK	1
+#define lz4_read32(p)		get_unaligned((const u32 *)(p))
+#define lz4_write32(p, v)	put_unaligned(v, (u32 *)(p))
+#else
+#define lz4_read32(p)		get_unaligned((const u32 *)(p))
+#endif
+
+#ifdef LZ4_UNALIGNED_OK
+#define LZ4_COPY8(dst, src)	\
+		do {							\
+			lz4_write32(dst, lz4_read32(src));		\
+			lz4_write32((dst) + 4, lz4_read32((src) + 4));	\
+		} while (0)
+#endif
+
+#ifndef STATIC
+/*
+ * The compressors hash the little endian value of the next four bytes,
+ * so that they produce the same output everywhere.
+ */
+#if defined(LZ4_UNALIGNED_OK) && defined(__LITTLE_ENDIAN)
+#define lz4_read32le(p)		lz4_read32(p)
+#else
+#define lz4_read32le(p)		get_unaligned_le32(p)
+#endif
+
+/* Number of bytes from ip on that equal those from ref, up to limit */
+static inline unsigned int lz4_count(const u8 *ip, const u8 *ref,
+				     const u8 *limit)
+{
+	const u8 *start = ip;
+
+#ifdef LZ4_UNALIGNED_OK
+	while (likely(limit - ip >= 4)) {
+		u32 x = lz4_read32(ref) ^ lz4_read32(ip);
+
+		if (x) {
+#ifdef __LITTLE_ENDIAN
+			return ip - start + (__ffs(x) >> 3);
+#else
+			return ip - start + ((31 - __fls(x)) >> 3);
+#endif
+		}
+		ip += 4;
+		ref += 4;
+	}
+#endif
+	while (ip < limit && *ip == *ref) {
+		ip++;
+		ref++;
+	}
+	return ip - start;
+}
+
+static inline u8 *lz4_put_length(u8 *op, size_t len)
+{
+	for (; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/* Emit the literals from anchor to ip, then a match of len bytes at ref */
+static inline u8 *lz4_put_sequence(u8 *op, const u8 *anchor, const u8 *ip,
+				   const u8 *ref, size_t len)
+{
+	size_t lit_len = ip - anchor;
+	u8 *token = op++;
+
+	if (lit_len >= RUN_MASK) {
+		*token = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else
+		*token = lit_len << ML_BITS;
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	put_unaligned_le16(ip - ref, op);
+	op += 2;
+
+	len -= MINMATCH;
+	if (len >= ML_MASK) {
+		*token |= ML_MASK;
+		op = lz4_put_length(op, len - ML_MASK);
+	} else
+		*token |= len;
+	return op;
+}
+
+/* The final sequence: everything from anchor to the end, as literals */
+static inline u8 *lz4_put_last_literals(u8 *op, const u8 *anchor,
+					const u8 *iend)
+{
+	size_t lit_len = iend - anchor;
+
+	if (lit_len >= RUN_MASK) {
+		*op++ = RUN_MASK << ML_BITS;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else
+		*op++ = lit_len << ML_BITS;
+	memcpy(op, anchor, lit_len);
+	return op + lit_len;
+}
+#endif
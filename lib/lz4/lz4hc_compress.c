@@ -0,0 +1,135 @@
+/*
+ * LZ4 HC compressor
+ *
+ * Chains every position of the last 64KB by hash, walks the chain for
+ * the longest match and takes a longer one starting a byte later when
+ * there is one.  Slower to compress than lz4_compress() but denser, for
+ * data that is written once and read many times, such as kernel images
+ * and read-only file systems.  Decompression is as fast as ever.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/lz4.h>
+#include <asm/unaligned.h>
+#include "lz4defs.h"
+
+#define LZ4HC_HASH_LOG		15
+#define LZ4HC_DICT_SIZE		(1 << 16)
+#define LZ4HC_MAX_ATTEMPTS	256
+
+struct lz4hc_data {
+	u32 hash_table[1 << LZ4HC_HASH_LOG];	/* latest position */
+	u16 chain_table[LZ4HC_DICT_SIZE];	/* distance to previous one */
+};
+
+static inline u32 lz4hc_hash(const u8 *p)
+{
+	return (lz4_read32le(p) * 2654435761U) >> (32 - LZ4HC_HASH_LOG);
+}
+
+/* Add positions up to (not including) target to the chains */
+static inline void lz4hc_insert(struct lz4hc_data *hc, const u8 *src,
+				u32 *next, u32 target)
+{
+	u32 pos, delta;
+	u32 h;
+
+	for (pos = *next; pos < target; pos++) {
+		h = lz4hc_hash(src + pos);
+		delta = pos - hc->hash_table[h];
+		if (delta > MAX_DISTANCE)
+			delta = MAX_DISTANCE;
+		hc->chain_table[pos & (LZ4HC_DICT_SIZE - 1)] = delta;
+		hc->hash_table[h] = pos;
+	}
+	*next = target;
+}
+
+static unsigned int lz4hc_find(struct lz4hc_data *hc, const u8 *src,
+			       const u8 *ip, const u8 *limit, u32 *next,
+			       const u8 **match)
+{
+	u32 pos = ip - src, p, delta;
+	unsigned int attempts = LZ4HC_MAX_ATTEMPTS;
+	unsigned int best = 0, len;
+	const u8 *ref;
+
+	lz4hc_insert(hc, src, next, pos);
+	p = hc->hash_table[lz4hc_hash(ip)];
+
+	while (attempts-- && p < pos && pos - p <= MAX_DISTANCE) {
+		ref = src + p;
+		if (ref[best] == ip[best] &&
+		    lz4_read32(ref) == lz4_read32(ip)) {
+			len = MINMATCH + lz4_count(ip + MINMATCH,
+						   ref + MINMATCH, limit);
+			if (len > best) {
+				best = len;
+				*match = ref;
+			}
+		}
+		delta = hc->chain_table[p & (LZ4HC_DICT_SIZE - 1)];
+		if (!delta || delta > p)
+			break;
+		p -= delta;
+	}
+	return best;
+}
+
+int lz4hc_compress(const unsigned char *src, size_t src_len,
+		unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	const u8 * const iend = src + src_len;
+	const u8 * const mflimit = iend - MFLIMIT;
+	const u8 * const matchlimit = iend - LASTLITERALS;
+	const u8 *ip = src, *anchor = src, *ref, *ref2;
+	struct lz4hc_data *hc = wrkmem;
+	unsigned int len, len2;
+	u8 *op = dst;
+	u32 next = 0;
+
+	BUILD_BUG_ON(sizeof(struct lz4hc_data) > LZ4HC_MEM_COMPRESS);
+
+	if (src_len < MINLENGTH)
+		goto last_literals;
+
+	memset(hc->hash_table, 0, sizeof(hc->hash_table));
+
+	while (ip <= mflimit) {
+		len = lz4hc_find(hc, src, ip, matchlimit, &next, &ref);
+		if (len < MINMATCH) {
+			ip++;
+			continue;
+		}
+
+		/* A longer match one byte on is worth a literal */
+		while (ip + 1 <= mflimit) {
+			len2 = lz4hc_find(hc, src, ip + 1, matchlimit, &next,
+					  &ref2);
+			if (len2 <= len)
+				break;
+			ip++;
+			len = len2;
+			ref = ref2;
+		}
+
+		op = lz4_put_sequence(op, anchor, ip, ref, len);
+		ip += len;
+		anchor = ip;
+	}
+
+last_literals:
+	op = lz4_put_last_literals(op, anchor, iend);
+	*dst_len = op - dst;
+	return 0;
+}
+EXPORT_SYMBOL_GPL(lz4hc_compress);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("LZ4 HC Compressor");
@@ -17,6 +17,17 @@
 #include <asm/unaligned.h>
 #include "lzodefs.h"
 
+#ifdef LZO_UNALIGNED_OK
+/* Number of equal leading bytes in two words that differ, x = a ^ b */
+#ifdef __LITTLE_ENDIAN
+#define lzo_equal_bytes(x)	(__ffs(x) >> 3)
+#define LZO_LOW3_MASK		0x00ffffff
+#else
+#define lzo_equal_bytes(x)	((31 - __fls(x)) >> 3)
+#define LZO_LOW3_MASK		0xffffff00
+#endif
+#endif
+
 static noinline size_t
 _lzo1x_1_do_compress(const unsigned char *in, size_t in_len,
 		unsigned char *out, size_t *out_len, void *wrkmem)
@@ -61,11 +72,16 @@ _lzo1x_1_do_compress(const unsigned char *in, size_t in_len,
 		goto literal;
 
 try_match:
+#ifdef LZO_UNALIGNED_OK
+		if (!((lzo_read32(m_pos) ^ lzo_read32(ip)) & LZO_LOW3_MASK))
+			goto match;
+#else
 		if (get_unaligned((const unsigned short *)m_pos)
 				== get_unaligned((const unsigned short *)ip)) {
 			if (likely(m_pos[2] == ip[2]))
 					goto match;
 		}
+#endif
 
 literal:
 		dict[dindex] = ip;
@@ -93,9 +109,29 @@ match:
 				}
 				*op++ = tt;
 			}
+#ifdef LZO_UNALIGNED_OK
+			/*
+			 * The last word may store up to three bytes past
+			 * the run, and read as far past ip, which is at
+			 * least M2_MAX_LEN + 5 short of in_end.  The match
+			 * and end marker that follow overwrite them.
+			 */
+			{
+				unsigned char *oe = op + t;
+
+				do {
+					COPY4(op, ii);
+					op += 4;
+					ii += 4;
+				} while (op < oe);
+				op = oe;
+				ii = ip;
+			}
+#else
 			do {
 				*op++ = *ii++;
 			} while (--t > 0);
+#endif
 		}
 
 		ip += 3;
@@ -125,6 +161,19 @@ match:
 			end = in_end;
 			m = m_pos + M2_MAX_LEN + 1;
 
+#ifdef LZO_UNALIGNED_OK
+			while (likely(end - ip >= 4)) {
+				u32 x = lzo_read32(m) ^ lzo_read32(ip);
+
+				if (x) {
+					m += lzo_equal_bytes(x);
+					ip += lzo_equal_bytes(x);
+					break;
+				}
+				m += 4;
+				ip += 4;
+			}
+#endif
 			while (ip < end && *m == *ip) {
 				m++;
 				ip++;
@@ -207,9 +256,21 @@ int lzo1x_1_compress(const unsigned char *in, size_t in_len, unsigned char *out,
 
 			*op++ = tt;
 		}
+#ifdef LZO_UNALIGNED_OK
+		for (; t >= 4; t -= 4) {
+			COPY4(op, ii);
+			op += 4;
+			ii += 4;
+		}
+		while (t > 0) {
+			*op++ = *ii++;
+			t--;
+		}
+#else
 		do {
 			*op++ = *ii++;
 		} while (--t > 0);
+#endif
 	}
 
 	*op++ = M4_MARKER | 1;
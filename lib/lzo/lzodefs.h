@@ -41,3 +41,44 @@
 #define DX2(p, s1, s2)	(((((size_t)((p)[2]) << (s2)) ^ (p)[1]) \
 							<< (s1)) ^ (p)[0])
 #define DX3(p, s1, s2, s3)	((DX2((p)+1, s2, s3) << (s1)) ^ (p)[0])
+
+/*
+ * Word sized copies for the literal and match loops, and word sized
+ * compares for the compressor's match length search.
+ *
+ * ARMv7 handles unaligned LDR and STR in hardware (SCTLR.A is cleared by
+ * alignment_init() long before anything decompresses with LZO), but LDM,
+ * STM, LDRD and STRD still trap.  gcc happily merges neighbouring u32
+ * accesses into those, so on ARM the loads and stores go through asm.
+ * The boot decompressor may run with alignment checking on and keeps the
+ * byte loops.
+ */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 7 && !defined(STATIC)
+#define LZO_UNALIGNED_OK	1
+
+static inline u32 lzo_read32(const void *p)
+{
+	u32 v;
+
+	asm("ldr	%0, [%1]" : "=r" (v) : "r" (p), "m" (*(const u32 *)p));
+	return v;
+}
+
+static inline void lzo_write32(void *p, u32 v)
+{
+	asm("str	%1, [%2]" : "=m" (*(u32 *)p) : "r" (v), "r" (p));
+}
+#elif defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS)
+#define LZO_UNALIGNED_OK	1
+#define lzo_read32(p)		get_unaligned((const u32 *)(p))
+#define lzo_write32(p, v)	put_unaligned(v, (u32 *)(p))
+#endif
+
+#ifdef LZO_UNALIGNED_OK
+#define COPY4(dst, src)		lzo_write32(dst, lzo_read32(src))
+#define COPY8(dst, src)		\
+		do {							\
+			COPY4(dst, src);				\
+			COPY4((dst) + 4, (src) + 4);			\
+		} while (0)
+#endif
@@ -24,6 +24,9 @@ void __init_rwsem(struct rw_semaphore *sem, const char *name,
 	sem->count = RWSEM_UNLOCKED_VALUE;
 	spin_lock_init(&sem->wait_lock);
 	INIT_LIST_HEAD(&sem->wait_list);
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+	sem->owner = NULL;
+#endif
 }
 
 EXPORT_SYMBOL(__init_rwsem);
@@ -199,6 +202,106 @@ rwsem_down_read_failed(struct rw_semaphore *sem)
 	return sem;
 }
 
+#ifdef CONFIG_RWSEM_SPIN_ON_OWNER
+/*
+ * Take the write lock if nobody holds it, even if others are queued:
+ * whoever releases it next wakes them.
+ */
+static inline int rwsem_try_write_lock_unqueued(struct rw_semaphore *sem)
+{
+	signed long count = ACCESS_ONCE(sem->count);
+	signed long old;
+
+	while (!(count & RWSEM_ACTIVE_MASK)) {
+		old = cmpxchg(&sem->count, count,
+			      count + RWSEM_ACTIVE_WRITE_BIAS);
+		if (old == count)
+			return 1;
+		count = old;
+	}
+	return 0;
+}
+
+/*
+ * Optimistic spinning for writers, as in mutex_lock(): while the writer
+ * holding the semaphore runs, it is likely to release it before we could
+ * sleep and be woken again.  Called with our write bias still in the
+ * count, and returns with it there, either holding the lock (1) or to go
+ * and queue (0).
+ */
+static int rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	struct thread_info *owner;
+	int taken = 0;
+
+	/*
+	 * Readers are not tracked and may sleep while holding the
+	 * semaphore, and the owner of the BKL must not spin either, see
+	 * __mutex_lock_common().
+	 */
+	owner = ACCESS_ONCE(sem->owner);
+	if (!owner || owner == RWSEM_READER_OWNED || current->lock_depth >= 0)
+		return 0;
+
+	preempt_disable();
+
+	/*
+	 * Nobody else can take the lock while our bias is in the count, so
+	 * once the owner is gone it is ours, unless some other task is in
+	 * the middle of a fast path too.
+	 */
+	if (!rwsem_spin_on_owner(sem, owner))
+		goto out;
+	if ((ACCESS_ONCE(sem->count) & RWSEM_ACTIVE_MASK) == RWSEM_ACTIVE_BIAS) {
+		smp_mb();
+		taken = 1;
+		goto out;
+	}
+
+	/*
+	 * Others are spinning or about to queue.  Back out, the same way
+	 * up_write() would, and compete for the lock with cmpxchg().  If
+	 * that leaves the lock free with waiters queued, either we take
+	 * it, or whoever does wakes them when releasing it.
+	 */
+	rwsem_atomic_update(-RWSEM_ACTIVE_WRITE_BIAS, sem);
+	for (;;) {
+		if (rwsem_try_write_lock_unqueued(sem)) {
+			taken = 1;
+			goto out;
+		}
+
+		owner = ACCESS_ONCE(sem->owner);
+		if (owner == RWSEM_READER_OWNED)
+			break;
+		if (owner && !rwsem_spin_on_owner(sem, owner))
+			break;
+
+		/*
+		 * No owner: it has just been taken or released, see
+		 * __mutex_lock_common() for why RT tasks give up here.
+		 */
+		if (!owner && (need_resched() || rt_task(current)))
+			break;
+
+		cpu_relax();
+	}
+
+	/* Put the bias back, as down_write() does */
+	if ((rwsem_atomic_update(RWSEM_ACTIVE_WRITE_BIAS, sem) &
+	     RWSEM_ACTIVE_MASK) == RWSEM_ACTIVE_BIAS)
+		taken = 1;
+out:
+	preempt_enable();
+	return taken;
+}
+#else
+static inline int rwsem_optimistic_spin(struct rw_semaphore *sem)
+{
+	return 0;
+}
+#endif
+
 /*
  * wait for the write lock to be granted
  */
@@ -207,6 +310,9 @@ rwsem_down_write_failed(struct rw_semaphore *sem)
 {
 	struct rwsem_waiter waiter;
 
+	if (rwsem_optimistic_spin(sem))
+		return sem;
+
 	waiter.flags = RWSEM_WAITING_FOR_WRITE;
 	rwsem_down_failed_common(sem, &waiter, -RWSEM_ACTIVE_BIAS);
 
@@ -0,0 +1,149 @@
+/*
+ * Helpers shared by the stress and latency test modules: a log-linear
+ * latency histogram, and a harness that runs one kthread per CPU for a
+ * while.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/slab.h>
+#include <linux/sched.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+#include <linux/cpumask.h>
+#include <linux/err.h>
+#include <linux/stress_test.h>
+
+static unsigned int lat_bucket(u64 ns)
+{
+	unsigned int order;
+
+	if (ns < (1 << LAT_HIST_SUB_BITS))
+		return ns;
+	order = fls64(ns) - 1;
+	if (order > 32)
+		return LAT_HIST_BUCKETS - 1;
+	return ((order - LAT_HIST_SUB_BITS + 1) << LAT_HIST_SUB_BITS) +
+		((ns >> (order - LAT_HIST_SUB_BITS)) &
+		 ((1 << LAT_HIST_SUB_BITS) - 1));
+}
+
+/* Largest latency that falls in @bucket */
+static u64 lat_bucket_ns(unsigned int bucket)
+{
+	unsigned int order = bucket >> LAT_HIST_SUB_BITS;
+	unsigned int sub = bucket & ((1 << LAT_HIST_SUB_BITS) - 1);
+
+	if (!order)
+		return sub;
+	order += LAT_HIST_SUB_BITS - 1;
+	return ((u64)((1 << LAT_HIST_SUB_BITS) + sub + 1) <<
+		(order - LAT_HIST_SUB_BITS)) - 1;
+}
+
+void lat_hist_add(struct lat_hist *h, u64 ns)
+{
+	h->count++;
+	h->buckets[lat_bucket(ns)]++;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+}
+EXPORT_SYMBOL_GPL(lat_hist_add);
+
+void lat_hist_merge(struct lat_hist *to, const struct lat_hist *from)
+{
+	unsigned int i;
+
+	to->count += from->count;
+	to->max_ns = max(to->max_ns, from->max_ns);
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		to->buckets[i] += from->buckets[i];
+}
+EXPORT_SYMBOL_GPL(lat_hist_merge);
+
+/* Smallest latency that at least @permille of the samples beat */
+u64 lat_hist_percentile(const struct lat_hist *h, unsigned int permille)
+{
+	u64 want = div_u64((u64)h->count * permille + 999, 1000);
+	u64 seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			return lat_bucket_ns(i);
+	}
+	return lat_bucket_ns(LAT_HIST_BUCKETS - 1);
+}
+EXPORT_SYMBOL_GPL(lat_hist_percentile);
+
+void lat_hist_print(const struct lat_hist *h, const char *prefix)
+{
+	printk(KERN_INFO "%s: latency ns p50 <=%llu p90 <=%llu p99 <=%llu "
+	       "p99.9 <=%llu max %llu\n", prefix,
+	       lat_hist_percentile(h, 500), lat_hist_percentile(h, 900),
+	       lat_hist_percentile(h, 990), lat_hist_percentile(h, 999),
+	       h->max_ns);
+}
+EXPORT_SYMBOL_GPL(lat_hist_print);
+
+/**
+ * stress_run_threads - run a kthread per CPU for a while
+ * @fn:		thread function, returns once kthread_should_stop()
+ * @data:	array of @nthreads per thread arguments
+ * @size:	size of one element of @data
+ * @nthreads:	number of threads, spread round robin over the online CPUs
+ * @seconds:	how long to let them run
+ * @name:	threads are called @name/0, @name/1, ...
+ *
+ * All threads are created and bound before any of them is woken, and
+ * all are stopped before this returns.  Returns 0, or the error from
+ * creating a thread, in which case none of them was run.
+ */
+int stress_run_threads(int (*fn)(void *), void *data, size_t size,
+		       int nthreads, int seconds, const char *name)
+{
+	struct task_struct **tasks;
+	unsigned int cpu;
+	int n, err = 0;
+
+	tasks = kcalloc(nthreads, sizeof(*tasks), GFP_KERNEL);
+	if (!tasks)
+		return -ENOMEM;
+
+	cpu = cpumask_first(cpu_online_mask);
+	for (n = 0; n < nthreads; n++) {
+		tasks[n] = kthread_create(fn, data + n * size, "%s/%d",
+					  name, n);
+		if (IS_ERR(tasks[n])) {
+			err = PTR_ERR(tasks[n]);
+			tasks[n] = NULL;
+			break;
+		}
+		kthread_bind(tasks[n], cpu);
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+
+	if (!err) {
+		for (n = 0; n < nthreads; n++)
+			wake_up_process(tasks[n]);
+		ssleep(seconds);
+	}
+
+	for (n = 0; n < nthreads && tasks[n]; n++)
+		kthread_stop(tasks[n]);
+
+	kfree(tasks);
+	return err;
+}
+EXPORT_SYMBOL_GPL(stress_run_threads);
+
+MODULE_DESCRIPTION("Helpers for the stress and latency test modules");
+MODULE_LICENSE("GPL");
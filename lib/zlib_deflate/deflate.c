@@ -704,6 +704,15 @@ static uInt longest_match(
     register Byte *strend = s->window + s->strstart + MAX_MATCH - 1;
     register ush scan_start = *(ush*)scan;
     register ush scan_end   = *(ush*)(scan+best_len-1);
+#elif defined(DEFLATE_WORD_OK)
+    /* Same as the byte compares below, see the comments there; the
+     * lookahead check is made every 4 bytes, the last word compared ends
+     * at strstart+257.
+     */
+    register Byte *strend = s->window + s->strstart + MAX_MATCH;
+    register u16 scan_start = deflate_read16(scan);
+    register u16 scan_end   = deflate_read16(scan+best_len-1);
+    register u32 diff;
 #else
     register Byte *strend = s->window + s->strstart + MAX_MATCH;
     register Byte scan_end1  = scan[best_len-1];
@@ -766,6 +775,27 @@ static uInt longest_match(
         len = (MAX_MATCH - 1) - (int)(strend-scan);
         scan = strend - (MAX_MATCH-1);
 
+#elif defined(DEFLATE_WORD_OK)
+
+        if (deflate_read16(match+best_len-1) != scan_end ||
+            deflate_read16(match) != scan_start) continue;
+
+        Assert(scan[2] == match[2], "match[2]?");
+        scan += 2, match += 2;
+        do {
+            diff = deflate_read32(scan) ^ deflate_read32(match);
+            if (diff) {
+                scan += deflate_equal_bytes(diff);
+                break;
+            }
+            scan += 4, match += 4;
+        } while (scan < strend);
+
+        Assert(scan <= strend, "wild scan");
+
+        len = MAX_MATCH - (int)(strend - scan);
+        scan = strend - MAX_MATCH;
+
 #else /* UNALIGNED_OK */
 
         if (match[best_len]   != scan_end  ||
@@ -805,6 +835,8 @@ static uInt longest_match(
             if (len >= nice_match) break;
 #ifdef UNALIGNED_OK
             scan_end = *(ush*)(scan+best_len-1);
+#elif defined(DEFLATE_WORD_OK)
+            scan_end = deflate_read16(scan+best_len-1);
 #else
             scan_end1  = scan[best_len-1];
             scan_end   = scan[best_len];
@@ -263,6 +263,49 @@ typedef struct deflate_workspace {
  * distances are limited to MAX_DIST instead of WSIZE.
  */
 
+/* Word sized loads for longest_match().  ARMv7 does unaligned LDR and
+ * LDRH in hardware, but gcc may merge neighbouring word loads into LDM or
+ * LDRD, which trap, so the ARM accessors are asm.
+ */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 7
+#define DEFLATE_WORD_OK
+
+static inline u32 deflate_read32(const Byte *p)
+{
+	u32 v;
+
+	asm("ldr	%0, [%1]" : "=r" (v) : "r" (p), "m" (*(const u32 *)p));
+	return v;
+}
+
+static inline u16 deflate_read16(const Byte *p)
+{
+	u16 v;
+
+	asm("ldrh	%0, [%1]" : "=r" (v) : "r" (p), "m" (*(const u16 *)p));
+	return v;
+}
+#elif defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS)
+#include <asm/unaligned.h>
+#define DEFLATE_WORD_OK
+#define deflate_read32(p)	get_unaligned((const u32 *)(p))
+#define deflate_read16(p)	get_unaligned((const u16 *)(p))
+#endif
+
+#ifdef DEFLATE_WORD_OK
+#include <linux/bitops.h>
+
+/* Number of leading bytes in memory order that are equal, given x ^ y != 0 */
+static inline int deflate_equal_bytes(u32 diff)
+{
+#ifdef __LITTLE_ENDIAN
+	return __ffs(diff) >> 3;
+#else
+	return (31 - __fls(diff)) >> 3;
+#endif
+}
+#endif
+
         /* in trees.c */
 void zlib_tr_init         (deflate_state *s);
 int  zlib_tr_tally        (deflate_state *s, unsigned dist, unsigned lc);
@@ -48,6 +48,73 @@ get_unaligned16(const unsigned short *p)
 #  define UP_UNALIGNED(a) get_unaligned16(++(a))
 #endif
 
+/*
+   Word sized accesses for the bit buffer refill and for match copies.
+
+   ARMv7 does unaligned LDR and STR in hardware, but gcc merges neighbouring
+   word accesses into LDM/STM/LDRD/STRD, which still trap, so the ARM
+   accessors are asm.  The boot decompressors (STATIC) may run with
+   alignment checking on, or with the MMU off, and keep the byte loops.
+ */
+#if defined(CONFIG_ARM) && __LINUX_ARM_ARCH__ >= 7 && !defined(STATIC)
+#  define INF_WORD_OK
+static inline unsigned int inf_read32(const unsigned char *p)
+{
+	unsigned int v;
+
+	asm("ldr	%0, [%1]" : "=r" (v) : "r" (p), "m" (*(const unsigned int *)p));
+	return v;
+}
+
+static inline void inf_write32(unsigned char *p, unsigned int v)
+{
+	asm("str	%1, [%2]" : "=m" (*(unsigned int *)p) : "r" (v), "r" (p));
+}
+#elif defined(CONFIG_HAVE_EFFICIENT_UNALIGNED_ACCESS) && !defined(STATIC)
+#  define INF_WORD_OK
+struct inf_una32 {
+	unsigned int x;
+} __attribute__((packed));
+
+#  define inf_read32(p)	(((const struct inf_una32 *)(p))->x)
+#  define inf_write32(p, v) (((struct inf_una32 *)(p))->x = (v))
+#endif
+
+/*
+   With little endian word loads the bit buffer is topped up to 24..31 bits
+   in one go, without a branch: the whole word is or-ed in above the bits
+   already held and the pointer only advances over the bytes that fit.  The
+   bits above "bits" always hold the input that follows (or zeroes), so
+   or-ing in the same bytes again is harmless.  24 bits cover a length code
+   and its extra bits, or a distance code; the distance extra bits may need
+   a second refill.
+
+   This reads up to 13 bytes ahead of the input at the top of the loop,
+   hence INFLATE_FAST_MIN_INPUT.
+ */
+#if defined(INF_WORD_OK) && defined(__LITTLE_ENDIAN)
+#  define REFILL() \
+    do { \
+        hold |= (unsigned long)inf_read32(in + OFF) << bits; \
+        in += (31 - bits) >> 3; \
+        bits |= 24; \
+    } while (0)
+#  define NEEDBITS(n) \
+    do { \
+        if (bits < (unsigned)(n)) \
+            REFILL(); \
+    } while (0)
+#else
+#  define REFILL() NEEDBITS(15)
+#  define NEEDBITS(n) \
+    do { \
+        while (bits < (unsigned)(n)) { \
+            hold += (unsigned long)(PUP(in)) << bits; \
+            bits += 8; \
+        } \
+    } while (0)
+#endif
+
 /*
    Decode literal, length, and distance codes and write out the resulting
    literal and match bytes until either not enough input or output is
@@ -59,7 +126,7 @@ get_unaligned16(const unsigned short *p)
    Entry assumptions:
 
         state->mode == LEN
-        strm->avail_in >= 6
+        strm->avail_in >= INFLATE_FAST_MIN_INPUT
         strm->avail_out >= 258
         start >= strm->avail_out
         state->bits < 8
@@ -76,7 +143,8 @@ get_unaligned16(const unsigned short *p)
       length code, 5 bits for the length extra, 15 bits for the distance code,
       and 13 bits for the distance extra.  This totals 48 bits, or six bytes.
       Therefore if strm->avail_in >= 6, then there is enough input to avoid
-      checking for available input while decoding.
+      checking for available input while decoding.  The word refill also
+      looks ahead of what it consumes, see INFLATE_FAST_MIN_INPUT.
 
     - The maximum bytes that a single length/distance pair can output is 258
       bytes, which is the maximum length that can be coded.  inflate_fast()
@@ -116,7 +184,7 @@ void inflate_fast(z_streamp strm, unsigned start)
     /* copy state to local variables */
     state = (struct inflate_state *)strm->state;
     in = strm->next_in - OFF;
-    last = in + (strm->avail_in - 5);
+    last = in + (strm->avail_in - (INFLATE_FAST_MIN_INPUT - 1));
     out = strm->next_out - OFF;
     beg = out - (start - strm->avail_out);
     end = out + (strm->avail_out - 257);
@@ -137,12 +205,7 @@ void inflate_fast(z_streamp strm, unsigned start)
     /* decode literals and length/distances until end-of-block or not enough
        input data or output space */
     do {
-        if (bits < 15) {
-            hold += (unsigned long)(PUP(in)) << bits;
-            bits += 8;
-            hold += (unsigned long)(PUP(in)) << bits;
-            bits += 8;
-        }
+        REFILL();
         this = lcode[hold & lmask];
       dolen:
         op = (unsigned)(this.bits);
@@ -156,20 +219,12 @@ void inflate_fast(z_streamp strm, unsigned start)
             len = (unsigned)(this.val);
             op &= 15;                           /* number of extra bits */
             if (op) {
-                if (bits < op) {
-                    hold += (unsigned long)(PUP(in)) << bits;
-                    bits += 8;
-                }
+                NEEDBITS(op);
                 len += (unsigned)hold & ((1U << op) - 1);
                 hold >>= op;
                 bits -= op;
             }
-            if (bits < 15) {
-                hold += (unsigned long)(PUP(in)) << bits;
-                bits += 8;
-                hold += (unsigned long)(PUP(in)) << bits;
-                bits += 8;
-            }
+            REFILL();
             this = dcode[hold & dmask];
           dodist:
             op = (unsigned)(this.bits);
@@ -179,14 +234,7 @@ void inflate_fast(z_streamp strm, unsigned start)
             if (op & 16) {                      /* distance base */
                 dist = (unsigned)(this.val);
                 op &= 15;                       /* number of extra bits */
-                if (bits < op) {
-                    hold += (unsigned long)(PUP(in)) << bits;
-                    bits += 8;
-                    if (bits < op) {
-                        hold += (unsigned long)(PUP(in)) << bits;
-                        bits += 8;
-                    }
-                }
+                NEEDBITS(op);
                 dist += (unsigned)hold & ((1U << op) - 1);
 #ifdef INFLATE_STRICT
                 if (dist > dmax) {
@@ -257,6 +305,19 @@ void inflate_fast(z_streamp strm, unsigned start)
                             PUP(out) = PUP(from);
                     }
                 }
+#ifdef INF_WORD_OK
+                else if (dist >= 4) {
+                    /* copy direct from output, words never overlap */
+                    from = out - dist;
+                    for (; len >= 4; len -= 4) {
+                        inf_write32(out + OFF, inf_read32(from + OFF));
+                        out += 4;
+                        from += 4;
+                    }
+                    for (; len; len--)
+                        PUP(out) = PUP(from);
+                }
+#endif
                 else {
 		    unsigned short *sout;
 		    unsigned long loops;
@@ -338,7 +399,9 @@ void inflate_fast(z_streamp strm, unsigned start)
     /* update state and return */
     strm->next_in = in + OFF;
     strm->next_out = out + OFF;
-    strm->avail_in = (unsigned)(in < last ? 5 + (last - in) : 5 - (in - last));
+    strm->avail_in = (unsigned)(in < last ?
+                                (INFLATE_FAST_MIN_INPUT - 1) + (last - in) :
+                                (INFLATE_FAST_MIN_INPUT - 1) - (in - last));
     strm->avail_out = (unsigned)(out < end ?
                                  257 + (end - out) : 257 - (out - end));
     state->hold = hold;
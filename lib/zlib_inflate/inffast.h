@@ -8,4 +8,11 @@
    subject to change. Applications should only use zlib.h.
  */
 
+/*
+ * inflate_fast() needs this much input: 6 bytes for the longest
+ * length/distance pair, plus what the word sized bit buffer refill reads
+ * ahead of that.
+ */
+#define INFLATE_FAST_MIN_INPUT 16
+
 void inflate_fast (z_streamp strm, unsigned start);
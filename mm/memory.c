@@ -57,6 +57,7 @@
 #include <linux/swapops.h>
 #include <linux/elf.h>
 #include <linux/gfp.h>
+#include <linux/rcupdate.h>
 
 #include <asm/io.h>
 #include <asm/pgalloc.h>
@@ -3291,6 +3292,238 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return handle_pte_fault(mm, vma, address, pte, pmd, flags);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Bound on the rbtree walk: a walk racing with a rebalance can go
+ * round in circles.
+ */
+#define SPF_MAX_DEPTH	64
+
+/*
+ * find_vma() without mmap_sem: whatever this returns must be checked
+ * against its vm_sequence before it can be trusted.
+ */
+static struct vm_area_struct *spf_find_vma(struct mm_struct *mm,
+					   unsigned long addr)
+{
+	struct rb_node *node = ACCESS_ONCE(mm->mm_rb.rb_node);
+	int depth = 0;
+
+	while (node && depth++ < SPF_MAX_DEPTH) {
+		struct vm_area_struct *vma;
+
+		smp_read_barrier_depends();
+		vma = rb_entry(node, struct vm_area_struct, vm_rb);
+		if (ACCESS_ONCE(vma->vm_end) > addr) {
+			if (ACCESS_ONCE(vma->vm_start) <= addr)
+				return vma;
+			node = ACCESS_ONCE(node->rb_left);
+		} else
+			node = ACCESS_ONCE(node->rb_right);
+	}
+	return NULL;
+}
+
+/*
+ * Map a cached, uptodate page of a filemap_fault() backed vma for a
+ * read fault, like __do_fault() would.  Returns the page locked with
+ * the reference that the pte is going to own, or NULL.
+ */
+static struct page *spf_find_file_page(struct vm_area_struct *vma,
+				       struct file *file, unsigned long address)
+{
+	struct address_space *mapping = file->f_mapping;
+	struct page *page;
+	pgoff_t pgoff, size;
+
+	pgoff = (((address & PAGE_MASK) - vma->vm_start) >> PAGE_SHIFT) +
+		vma->vm_pgoff;
+	page = find_get_page(mapping, pgoff);
+	if (!page)
+		return NULL;
+	/* Leave readahead to filemap_fault() */
+	if (PageReadahead(page) || !trylock_page(page))
+		goto out_release;
+	if (page->mapping != mapping || !PageUptodate(page) ||
+	    PageHWPoison(page))
+		goto out_unlock;
+	size = (i_size_read(mapping->host) + PAGE_CACHE_SIZE - 1) >>
+		PAGE_CACHE_SHIFT;
+	if (pgoff >= size)
+		goto out_unlock;
+	return page;
+
+out_unlock:
+	unlock_page(page);
+out_release:
+	page_cache_release(page);
+	return NULL;
+}
+
+/**
+ * handle_speculative_fault - handle a user fault without mmap_sem
+ * @mm: the faulting mm, current->mm
+ * @address: the faulting address
+ * @flags: FAULT_FLAG_xxx
+ * @vm_flags: VM_xxx flags of which the vma needs at least one
+ *
+ * Handles a fault on a pte_none() entry of a linear vma if all it takes
+ * is the zero page or a new page in a vma that already has an anon_vma,
+ * or a read fault on a file page that is already in the page cache.
+ * The vma is found under RCU and has to keep its vm_sequence until the
+ * pte is set under the pte lock; vmas and pte tables are freed after a
+ * grace period, so they can be looked at meanwhile.
+ *
+ * Returns 0 when the fault was handled, otherwise VM_FAULT_RETRY and
+ * the caller takes mmap_sem and calls handle_mm_fault() as usual.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     unsigned int flags, unsigned long vm_flags)
+{
+	struct vm_area_struct *vma;
+	struct page *new_page = NULL, *page = NULL;
+	struct file *file = NULL;
+	spinlock_t *ptl;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t pmdval;
+	pte_t *pte, entry;
+	unsigned int seq;
+	int ret = VM_FAULT_RETRY;
+
+again:
+	rcu_read_lock();
+	vma = spf_find_vma(mm, address);
+	if (!vma)
+		goto out_unlock;
+	seq = ACCESS_ONCE(vma->vm_sequence.sequence);
+	smp_rmb();
+	if (seq & 1)
+		goto out_unlock;
+	if (address < vma->vm_start || address >= vma->vm_end ||
+	    !(vma->vm_flags & vm_flags))
+		goto out_unlock;
+	/*
+	 * Stacks change vm_start without mmap_sem held for writing, and
+	 * the rest needs more than a pte_none() fault.
+	 */
+	if (vma->vm_flags & (VM_GROWSDOWN | VM_GROWSUP | VM_LOCKED |
+			     VM_NONLINEAR | VM_HUGETLB | VM_PFNMAP |
+			     VM_MIXEDMAP))
+		goto out_unlock;
+
+	/*
+	 * The pmd is read once: free_pgtables() may clear it, but the
+	 * table it points to stays around until rcu_read_unlock().
+	 */
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_unlock;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_unlock;
+	pmdval = *pmd_offset(pud, address);
+	barrier();
+	if (pmd_none(pmdval) || unlikely(pmd_bad(pmdval)))
+		goto out_unlock;
+	pte = pte_offset_map(&pmdval, address);
+	entry = *pte;
+	pte_unmap(pte);
+	if (!pte_none(entry))
+		goto out_unlock;
+
+	if (vma->vm_ops) {
+		if ((flags & FAULT_FLAG_WRITE) ||
+		    vma->vm_ops->fault != filemap_fault)
+			goto out_unlock;
+		file = vma->vm_file;
+		if (!file || !atomic_long_inc_not_zero(&file->f_count)) {
+			file = NULL;
+			goto out_unlock;
+		}
+		page = spf_find_file_page(vma, file, address);
+		if (!page)
+			goto out_unlock;
+		entry = mk_pte(page, vma->vm_page_prot);
+	} else if (flags & FAULT_FLAG_WRITE) {
+		if (!ACCESS_ONCE(vma->anon_vma))
+			goto out_unlock;
+		if (!new_page) {
+			/* Allocate and charge outside RCU, then look again */
+			rcu_read_unlock();
+			new_page = alloc_zeroed_user_highpage_movable(NULL,
+								      address);
+			if (!new_page)
+				return VM_FAULT_RETRY;
+			__SetPageUptodate(new_page);
+			if (mem_cgroup_newpage_charge(new_page, mm, GFP_KERNEL)) {
+				page_cache_release(new_page);
+				return VM_FAULT_RETRY;
+			}
+			goto again;
+		}
+		entry = mk_pte(new_page, vma->vm_page_prot);
+		if (vma->vm_flags & VM_WRITE)
+			entry = pte_mkwrite(pte_mkdirty(entry));
+	} else {
+		entry = pte_mkspecial(pfn_pte(my_zero_pfn(address),
+						vma->vm_page_prot));
+	}
+
+	pte = pte_offset_map(&pmdval, address);
+	ptl = pte_lockptr(mm, &pmdval);
+	spin_lock(ptl);
+	if (!pte_none(*pte) || read_seqcount_retry(&vma->vm_sequence, seq)) {
+		pte_unmap_unlock(pte, ptl);
+		goto out_unlock;
+	}
+	if (page) {
+		flush_icache_page(vma, page);
+		inc_mm_counter_fast(mm, MM_FILEPAGES);
+		page_add_file_rmap(page);
+	} else if (new_page) {
+		inc_mm_counter_fast(mm, MM_ANONPAGES);
+		page_add_new_anon_rmap(new_page, vma, address);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, pte);
+	pte_unmap_unlock(pte, ptl);
+
+	if (page) {
+		/* The pte owns the page cache reference now */
+		unlock_page(page);
+		page = NULL;
+		count_vm_event(SPF_FILE);
+	} else {
+		new_page = NULL;
+		count_vm_event(SPF_ANON);
+	}
+	ret = 0;
+
+out_unlock:
+	rcu_read_unlock();
+	if (page) {
+		unlock_page(page);
+		page_cache_release(page);
+	}
+	if (file)
+		fput(file);
+	if (new_page) {
+		mem_cgroup_uncharge_page(new_page);
+		page_cache_release(new_page);
+	}
+	if (ret) {
+		count_vm_event(SPF_ABORT);
+		return ret;
+	}
+	count_vm_event(PGFAULT);
+	check_sync_rss_stat(current);
+	return 0;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
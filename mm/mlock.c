@@ -420,7 +420,9 @@ success:
 	 */
 
 	if (lock) {
+		vma_write_begin(vma);
 		vma->vm_flags = newflags;
+		vma_write_end(vma);
 		ret = __mlock_vma_pages_range(vma, start, end);
 		if (ret < 0)
 			ret = __mlock_posix_error_return(ret);
@@ -14,9 +14,18 @@
  * Author: Mike Chan (mike@android.com)
  */
 
+#include <linux/moduleparam.h>
+#include <linux/netdevice.h>
 #include <linux/proc_fs.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
 #include <linux/suspend.h>
+#include <linux/timer.h>
+#include <net/activity_stats.h>
 #include <net/net_namespace.h>
+#include <net/sock.h>
+#include <net/uid_acct.h>
 
 /*
  * Track transmission rates in buckets (power of 2).
@@ -33,16 +42,109 @@ static ktime_t last_transmit;
 static ktime_t suspend_time;
 static DEFINE_SPINLOCK(activity_lock);
 
-void activity_stats_update(void)
+/*
+ * Radio model.  After the last packet the modem stays in its high power
+ * state for tail_ms before dropping back to idle; every packet that
+ * finds the radio idle pays for a promotion and a full tail.  tail_mw is
+ * the power drawn during the tail, used to turn tail time into energy.
+ * Both depend on the modem and the network and must be calibrated; with
+ * tail_mw left at 0 only tail time is reported.
+ */
+static unsigned int tail_ms = 5000;
+module_param(tail_ms, uint, 0644);
+MODULE_PARM_DESC(tail_ms, "Radio high power tail after last packet (ms)");
+
+static unsigned int tail_mw;
+module_param(tail_mw, uint, 0644);
+MODULE_PARM_DESC(tail_mw, "Radio power during the tail (mW)");
+
+/*
+ * Jiffy of the last packet seen.  Read locklessly on every packet and
+ * written at most once per jiffy, so the fast path only takes
+ * activity_lock when the clock has moved on since the previous packet.
+ */
+static unsigned long last_jiffies;
+
+/* Set on resume until the first received packet claims the wakeup */
+#define WAKE_WINDOW		HZ
+static int wake_pending;
+static unsigned long resume_jiffies;
+
+/* The last few idle breaks, to see which socket woke the radio */
+#define ACT_EVENTS		32
+
+struct activity_event {
+	ktime_t		time;
+	uid_t		uid;
+	unsigned long	ino;
+	unsigned int	idle_ms;
+	char		dir;		/* 't'x, 'r'x or 'w'akeup */
+};
+
+static struct activity_event activity_events[ACT_EVENTS];
+static unsigned int activity_event_next;
+
+/*
+ * Deferred transmissions.  Packets from sockets with SO_TX_DEFER that
+ * would find the radio idle are held here until some other traffic
+ * brings the radio up, or until the earliest deadline expires.
+ */
+#define ACT_DEFER_MAX		256
+
+struct activity_defer_cb {
+	unsigned long	deadline;
+	uid_t		uid;
+	u32		tag;
+	int		promoter;	/* would have promoted the radio */
+};
+
+#define ACT_DEFER_CB(skb) ((struct activity_defer_cb *)(skb)->cb)
+
+static struct sk_buff_head defer_queue;
+static unsigned long last_defer_jiffies;
+static void activity_defer_flush(unsigned long data);
+static DEFINE_TIMER(defer_timer, activity_defer_flush, 0, 0);
+/* Set while the flush timer resends, so nothing is deferred twice */
+static DEFINE_PER_CPU(int, defer_flushing);
+
+static void activity_event_record(uid_t uid, unsigned long ino,
+				  s64 idle_ns, char dir)
+{
+	struct activity_event *ev;
+	unsigned long flags;
+
+	spin_lock_irqsave(&activity_lock, flags);
+	ev = &activity_events[activity_event_next++ % ACT_EVENTS];
+	ev->time = ktime_get();
+	ev->uid = uid;
+	ev->ino = ino;
+	ev->idle_ms = min_t(s64, div_s64(idle_ns, NSEC_PER_MSEC), UINT_MAX);
+	ev->dir = dir;
+	spin_unlock_irqrestore(&activity_lock, flags);
+}
+
+static inline int radio_idle(unsigned long now)
+{
+	return time_after_eq(now, ACCESS_ONCE(last_jiffies) +
+				  msecs_to_jiffies(tail_ms));
+}
+
+/*
+ * Slow path, at most once per jiffy: update the interval histogram and
+ * return how long the network was idle before this packet.
+ */
+static s64 activity_stats_tick(void)
 {
 	int i;
 	unsigned long flags;
 	ktime_t now;
-	s64 delta;
+	s64 delta, idle;
 
 	spin_lock_irqsave(&activity_lock, flags);
 	now = ktime_get();
-	delta = ktime_to_ns(ktime_sub(now, last_transmit));
+	idle = ktime_to_ns(ktime_sub(now, last_transmit));
+	last_jiffies = jiffies;
+	delta = idle;
 
 	for (i = BUCKET_MAX - 1; i >= 0; i--) {
 		/*
@@ -53,12 +155,235 @@ void activity_stats_update(void)
 			continue;
 
 		activity_stats[i]++;
-		last_transmit = now;
 		break;
 	}
+	last_transmit = now;
 	spin_unlock_irqrestore(&activity_lock, flags);
+
+	return idle;
+}
+
+/*
+ * Per-uid counts live in the uid_acct table, keyed like the traffic they
+ * go with, and are not kept without CONFIG_NET_UID_ACCT.  Devices
+ * outside the initial namespace are charged to no interface.
+ */
+static inline int activity_ifindex(struct net_device *dev)
+{
+	return net_eq(dev_net(dev), &init_net) ? dev->ifindex : 0;
+}
+
+static void activity_stats_promote(uid_t uid, u32 tag, int ifindex,
+				   unsigned long ino, s64 idle, char dir)
+{
+	uid_acct_event(uid, tag, ifindex, dir == 'r' ?
+		       UID_ACCT_RX_PROMOTIONS : UID_ACCT_TX_PROMOTIONS);
+	activity_event_record(uid, ino, idle, dir);
+}
+
+static void activity_stats_event(struct sock *sk, int ifindex, char dir)
+{
+	s64 idle;
+
+	if (likely(ACCESS_ONCE(last_jiffies) == jiffies))
+		return;
+
+	idle = activity_stats_tick();
+
+	/* The radio is up now, anything deferred can go with this packet */
+	if (!skb_queue_empty(&defer_queue))
+		mod_timer(&defer_timer, jiffies);
+
+	if (idle < (s64)tail_ms * NSEC_PER_MSEC)
+		return;
+
+	if (sk && sk->sk_socket)
+		activity_stats_promote(uid_acct_sk_uid(sk), uid_acct_sk_tag(sk),
+				       ifindex, sock_i_ino(sk), idle, dir);
+	else
+		activity_stats_promote((uid_t)-1, 0, ifindex, 0, idle, dir);
+}
+
+static int activity_stats_defer(struct sk_buff *skb, struct net_device *dev)
+{
+	struct sock *sk = skb->sk;
+	unsigned long now = jiffies;
+	struct activity_defer_cb *cb;
+	unsigned long deadline;
+
+	if (skb_queue_len(&defer_queue) >= ACT_DEFER_MAX)
+		return 0;
+
+	deadline = now + msecs_to_jiffies(sk->sk_tx_defer);
+	cb = ACT_DEFER_CB(skb);
+	cb->deadline = deadline;
+	cb->uid = uid_acct_sk_uid(sk);
+	cb->tag = uid_acct_sk_tag(sk);
+	/*
+	 * Sent now, this packet would promote the radio unless an earlier
+	 * deferred one already had; those get merged into one promotion.
+	 */
+	cb->promoter = time_after_eq(now, ACCESS_ONCE(last_defer_jiffies) +
+					  msecs_to_jiffies(tail_ms));
+	last_defer_jiffies = now;
+
+	dev_hold(dev);
+	spin_lock_bh(&defer_queue.lock);
+	__skb_queue_tail(&defer_queue, skb);
+	/* The timer always fires by the earliest deadline */
+	if (!timer_pending(&defer_timer) ||
+	    time_before(deadline, defer_timer.expires))
+		mod_timer(&defer_timer, deadline);
+	spin_unlock_bh(&defer_queue.lock);
+
+	uid_acct_event(cb->uid, cb->tag, activity_ifindex(dev),
+		       UID_ACCT_DEFERRED);
+	return 1;
+}
+
+/*
+ * Called from dev_queue_xmit().  Returns 1 if the skb was taken for
+ * deferred transmission.
+ */
+int activity_stats_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct sock *sk = skb->sk;
+
+	if (dev->flags & IFF_LOOPBACK)
+		return 0;
+
+	if (sk && sk->sk_tx_defer && radio_idle(jiffies) &&
+	    !this_cpu_read(defer_flushing) &&
+	    activity_stats_defer(skb, dev))
+		return 1;
+
+	activity_stats_event(sk, activity_ifindex(dev), 't');
+	return 0;
+}
+
+/* Called once a socket has accepted @skb, see sk_filter() */
+void activity_stats_rx(struct sock *sk, const struct sk_buff *skb)
+{
+	int ifindex;
+
+	if (sk->sk_family != PF_INET && sk->sk_family != PF_INET6)
+		return;
+
+	ifindex = net_eq(sock_net(sk), &init_net) ? skb->skb_iif : 0;
+
+	if (unlikely(wake_pending) &&
+	    cmpxchg(&wake_pending, 1, 0) == 1 &&
+	    time_before(jiffies, resume_jiffies + WAKE_WINDOW)) {
+		uid_t uid = uid_acct_sk_uid(sk);
+
+		uid_acct_event(uid, uid_acct_sk_tag(sk), ifindex,
+			       UID_ACCT_WAKEUPS);
+		activity_event_record(uid, sock_i_ino(sk), 0, 'w');
+	}
+
+	activity_stats_event(sk, ifindex, 'r');
 }
 
+static void activity_defer_flush(unsigned long data)
+{
+	struct sk_buff_head queue;
+	struct sk_buff *skb;
+	unsigned long now = jiffies;
+	int idle = radio_idle(now);
+	int timeout = 0;
+	s64 idle_ns;
+
+	__skb_queue_head_init(&queue);
+
+	/*
+	 * Radio up: send everything.  Otherwise only once something has
+	 * reached its deadline; it promotes the radio and whatever else
+	 * is queued goes along with it.
+	 */
+	spin_lock(&defer_queue.lock);
+	if (idle) {
+		unsigned long next = 0;
+
+		skb_queue_walk(&defer_queue, skb) {
+			unsigned long deadline = ACT_DEFER_CB(skb)->deadline;
+
+			if (time_after_eq(now, deadline)) {
+				timeout = 1;
+				break;
+			}
+			if (!next || time_before(deadline, next))
+				next = deadline;
+		}
+		if (!timeout && next)
+			mod_timer(&defer_timer, next);
+	}
+	if (!idle || timeout)
+		skb_queue_splice_init(&defer_queue, &queue);
+	spin_unlock(&defer_queue.lock);
+
+	if (skb_queue_empty(&queue))
+		return;
+
+	if (timeout) {
+		/* Charge the promotion to the first packet in the batch */
+		skb = skb_peek(&queue);
+		idle_ns = activity_stats_tick();
+		activity_stats_promote(ACT_DEFER_CB(skb)->uid,
+				       ACT_DEFER_CB(skb)->tag,
+				       activity_ifindex(skb->dev),
+				       skb->sk ? sock_i_ino(skb->sk) : 0,
+				       idle_ns, 't');
+	}
+
+	__this_cpu_write(defer_flushing, 1);
+	while ((skb = __skb_dequeue(&queue))) {
+		struct activity_defer_cb *cb = ACT_DEFER_CB(skb);
+		struct net_device *dev = skb->dev;
+
+		/*
+		 * A packet that would have promoted the radio on its own
+		 * saved that promotion, except the one that paid for a
+		 * timed out batch.
+		 */
+		if (cb->promoter && !timeout)
+			uid_acct_event(cb->uid, cb->tag, activity_ifindex(dev),
+				       UID_ACCT_SAVED);
+		if (cb->promoter)
+			timeout = 0;
+
+		dev_queue_xmit(skb);
+		dev_put(dev);
+	}
+	__this_cpu_write(defer_flushing, 0);
+}
+
+/* Drop what is queued for a device that is going away */
+static int activity_stats_netdev_event(struct notifier_block *nb,
+				       unsigned long event, void *ptr)
+{
+	struct net_device *dev = ptr;
+	struct sk_buff *skb, *tmp;
+
+	if (event != NETDEV_DOWN)
+		return NOTIFY_DONE;
+
+	spin_lock_bh(&defer_queue.lock);
+	skb_queue_walk_safe(&defer_queue, skb, tmp) {
+		if (skb->dev != dev)
+			continue;
+		__skb_unlink(skb, &defer_queue);
+		kfree_skb(skb);
+		dev_put(dev);
+	}
+	spin_unlock_bh(&defer_queue.lock);
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block activity_stats_netdev_notifier = {
+	.notifier_call = activity_stats_netdev_event,
+};
+
 static int activity_stats_read_proc(char *page, char **start, off_t off,
 					int count, int *eof, void *data)
 {
@@ -84,6 +409,126 @@ static int activity_stats_read_proc(char *page, char **start, off_t off,
 	return p - page;
 }
 
+#ifdef CONFIG_NET_UID_ACCT
+static void *activity_uid_seq_start(struct seq_file *seq, loff_t *pos)
+	__acquires(RCU)
+{
+	rcu_read_lock();
+	return seq_list_start_head(&uid_acct_list, *pos);
+}
+
+static void *activity_uid_seq_next(struct seq_file *seq, void *v,
+				   loff_t *pos)
+{
+	return seq_list_next(v, &uid_acct_list, pos);
+}
+
+static void activity_uid_seq_stop(struct seq_file *seq, void *v)
+	__releases(RCU)
+{
+	rcu_read_unlock();
+}
+
+/*
+ * Tail time is what the promotions of each entry cost under the model
+ * above; saved time is what the promotions avoided by deferral would
+ * have cost.  Energy is tail time times tail_mw.  Entries that only
+ * ever saw traffic inside someone else's tail are left out.
+ */
+static int activity_uid_seq_show(struct seq_file *seq, void *v)
+{
+	struct uid_acct_entry *e;
+	unsigned long sum[UID_ACCT_EVENTS] = { 0 };
+	unsigned long long tail, saved;
+	int cpu, i, any = 0;
+
+	if (v == &uid_acct_list) {
+		seq_printf(seq, "# tail_ms %u tail_mw %u\n", tail_ms, tail_mw);
+		seq_puts(seq, "iface uid tag tx_promotions rx_promotions "
+			 "wakeups deferred saved tail_ms saved_ms tail_mJ "
+			 "saved_mJ\n");
+		return 0;
+	}
+
+	e = list_entry(v, struct uid_acct_entry, list);
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < UID_ACCT_EVENTS; i++)
+			sum[i] += per_cpu_ptr(e->counters, cpu)->events[i];
+	for (i = 0; i < UID_ACCT_EVENTS; i++)
+		any |= sum[i] != 0;
+	if (!any)
+		return 0;
+
+	tail = (unsigned long long)(sum[UID_ACCT_TX_PROMOTIONS] +
+				    sum[UID_ACCT_RX_PROMOTIONS]) * tail_ms;
+	saved = (unsigned long long)sum[UID_ACCT_SAVED] * tail_ms;
+
+	seq_printf(seq, "%s %d 0x%08x %lu %lu %lu %lu %lu %llu %llu %llu "
+		   "%llu\n", e->ifname, (int)e->uid, e->tag,
+		   sum[UID_ACCT_TX_PROMOTIONS], sum[UID_ACCT_RX_PROMOTIONS],
+		   sum[UID_ACCT_WAKEUPS], sum[UID_ACCT_DEFERRED],
+		   sum[UID_ACCT_SAVED], tail, saved,
+		   div_u64(tail * tail_mw, 1000),
+		   div_u64(saved * tail_mw, 1000));
+	return 0;
+}
+
+static const struct seq_operations activity_uid_seq_ops = {
+	.start	= activity_uid_seq_start,
+	.next	= activity_uid_seq_next,
+	.stop	= activity_uid_seq_stop,
+	.show	= activity_uid_seq_show,
+};
+
+static int activity_uid_seq_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &activity_uid_seq_ops);
+}
+
+static const struct file_operations activity_uid_fops = {
+	.owner		= THIS_MODULE,
+	.open		= activity_uid_seq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+#endif
+
+static int activity_events_show(struct seq_file *seq, void *v)
+{
+	struct activity_event events[ACT_EVENTS];
+	unsigned int next, i;
+	unsigned long flags;
+
+	spin_lock_irqsave(&activity_lock, flags);
+	memcpy(events, activity_events, sizeof(events));
+	next = activity_event_next;
+	spin_unlock_irqrestore(&activity_lock, flags);
+
+	seq_puts(seq, "time_ms dir uid inode idle_ms\n");
+	for (i = next > ACT_EVENTS ? next - ACT_EVENTS : 0; i < next; i++) {
+		struct activity_event *ev = &events[i % ACT_EVENTS];
+
+		seq_printf(seq, "%lld %c %d %lu %u\n",
+			   div_s64(ktime_to_ns(ev->time), NSEC_PER_MSEC),
+			   ev->dir, (int)ev->uid, ev->ino, ev->idle_ms);
+	}
+	return 0;
+}
+
+static int activity_events_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, activity_events_show, NULL);
+}
+
+static const struct file_operations activity_events_fops = {
+	.owner		= THIS_MODULE,
+	.open		= activity_events_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int activity_stats_notifier(struct notifier_block *nb,
 					unsigned long event, void *dummy)
 {
@@ -95,6 +540,8 @@ static int activity_stats_notifier(struct notifier_block *nb,
 		case PM_POST_SUSPEND:
 			suspend_time = ktime_sub(ktime_get_real(), suspend_time);
 			last_transmit = ktime_sub(last_transmit, suspend_time);
+			resume_jiffies = jiffies;
+			wake_pending = 1;
 	}
 
 	return 0;
@@ -106,10 +553,19 @@ static struct notifier_block activity_stats_notifier_block = {
 
 static int  __init activity_stats_init(void)
 {
+	skb_queue_head_init(&defer_queue);
+	last_defer_jiffies = last_jiffies = jiffies - msecs_to_jiffies(tail_ms);
+
 	create_proc_read_entry("activity", S_IRUGO,
 			init_net.proc_net_stat, activity_stats_read_proc, NULL);
+#ifdef CONFIG_NET_UID_ACCT
+	proc_create("activity_uid", S_IRUGO, init_net.proc_net_stat,
+		    &activity_uid_fops);
+#endif
+	proc_create("activity_events", S_IRUGO, init_net.proc_net_stat,
+		    &activity_events_fops);
+	register_netdevice_notifier(&activity_stats_netdev_notifier);
 	return register_pm_notifier(&activity_stats_notifier_block);
 }
 
 subsys_initcall(activity_stats_init);
-
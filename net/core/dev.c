@@ -132,6 +132,7 @@
 #include <trace/events/napi.h>
 #include <linux/pci.h>
 #include <linux/iface_stat.h>
+#include <net/activity_stats.h>
 
 #include "net-sysfs.h"
 
@@ -1492,6 +1493,9 @@ static inline void net_timestamp_check(struct sk_buff *skb)
  * The receiving device may be in another namespace, so
  * we have to clear all information in the skb that could
  * impact namespace isolation.
+ *
+ * Frames are queued with netif_rx_gro(), so they are merged
+ * if GRO is enabled on the receiving device.
  */
 int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 {
@@ -1507,7 +1511,7 @@ int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 	skb->tstamp.tv64 = 0;
 	skb->pkt_type = PACKET_HOST;
 	skb->protocol = eth_type_trans(skb, dev);
-	return netif_rx(skb);
+	return netif_rx_gro(skb);
 }
 EXPORT_SYMBOL_GPL(dev_forward_skb);
 
@@ -2153,6 +2157,10 @@ int dev_queue_xmit(struct sk_buff *skb)
 	struct Qdisc *q;
 	int rc = -ENOMEM;
 
+	/* Held back until the radio is up, see net/activity_stats.c */
+	if (activity_stats_xmit(skb, dev))
+		return NET_XMIT_SUCCESS;
+
 	/* GSO will handle the following emulations directly. */
 	if (netif_needs_gso(dev, skb))
 		goto gso;
@@ -2545,6 +2553,26 @@ int netif_rx(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_rx);
 
+/**
+ *	netif_rx_gro	-	post buffer to the network code through GRO
+ *	@skb: buffer to post
+ *
+ *	Same as netif_rx(), for drivers that do not use NAPI but still
+ *	want generic receive offload.  The buffer is queued to the per-CPU
+ *	backlog as usual; when the backlog is processed it is fed to GRO
+ *	instead of straight to the protocol layers, and whatever GRO is
+ *	still holding is flushed at the end of that backlog poll.  Segments
+ *	of one flow that arrive within a single softirq run are thus merged
+ *	and walk the stack once.  Nothing changes unless NETIF_F_GRO is set
+ *	on the device.
+ */
+int netif_rx_gro(struct sk_buff *skb)
+{
+	skb->rx_gro = 1;
+	return netif_rx(skb);
+}
+EXPORT_SYMBOL(netif_rx_gro);
+
 int netif_rx_ni(struct sk_buff *skb)
 {
 	int err;
@@ -3057,6 +3085,11 @@ static int napi_gro_complete(struct sk_buff *skb)
 	}
 
 out:
+	if (skb->rx_gro) {
+		/* From the backlog, RPS steering was done in netif_rx() */
+		skb->rx_gro = 0;
+		return __netif_receive_skb(skb);
+	}
 	return netif_receive_skb(skb);
 }
 
@@ -3355,6 +3388,34 @@ static void net_rps_action_and_irq_enable(struct softnet_data *sd)
 		local_irq_enable();
 }
 
+/*
+ * Like napi_gro_receive(), but GRO_NORMAL packets go straight to
+ * __netif_receive_skb(): they were steered by RPS in netif_rx()
+ * already and must not be queued to a backlog a second time.
+ * Packets GRO holds keep rx_gro set, so that napi_gro_complete()
+ * does the same for them.
+ */
+static void backlog_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
+{
+	skb_gro_reset_offset(skb);
+
+	switch (__napi_gro_receive(napi, skb)) {
+	case GRO_NORMAL:
+		skb->rx_gro = 0;
+		__netif_receive_skb(skb);
+		break;
+
+	case GRO_DROP:
+	case GRO_MERGED_FREE:
+		kfree_skb(skb);
+		break;
+
+	case GRO_HELD:
+	case GRO_MERGED:
+		break;
+	}
+}
+
 static int process_backlog(struct napi_struct *napi, int quota)
 {
 	int work = 0;
@@ -3377,13 +3438,14 @@ static int process_backlog(struct napi_struct *napi, int quota)
 
 		while ((skb = __skb_dequeue(&sd->process_queue))) {
 			local_irq_enable();
-			__netif_receive_skb(skb);
+			if (skb->rx_gro)
+				backlog_gro_receive(napi, skb);
+			else
+				__netif_receive_skb(skb);
 			local_irq_disable();
 			input_queue_head_incr(sd);
-			if (++work >= quota) {
-				local_irq_enable();
-				return work;
-			}
+			if (++work >= quota)
+				goto out;
 		}
 
 		rps_lock(sd);
@@ -3407,8 +3469,16 @@ static int process_backlog(struct napi_struct *napi, int quota)
 		}
 		rps_unlock(sd);
 	}
+out:
 	local_irq_enable();
 
+	/*
+	 * The backlog is completed inline above without napi_complete(),
+	 * so never keep packets on its gro_list across polls.
+	 */
+	if (napi->gro_list)
+		napi_gro_flush(napi);
+
 	return work;
 }
 
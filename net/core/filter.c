@@ -37,6 +37,8 @@
 #include <asm/uaccess.h>
 #include <asm/unaligned.h>
 #include <linux/filter.h>
+#include <net/uid_acct.h>
+#include <net/activity_stats.h>
 
 /* No hurry in this branch */
 static void *__load_pointer(struct sk_buff *skb, int k)
@@ -95,6 +97,10 @@ int sk_filter(struct sock *sk, struct sk_buff *skb)
 	}
 	rcu_read_unlock_bh();
 
+	if (!err) {
+		uid_acct_rx(sk, skb);
+		activity_stats_rx(sk, skb);
+	}
 	return err;
 }
 EXPORT_SYMBOL(sk_filter);
@@ -533,6 +533,7 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	skb_copy_queue_mapping(new, old);
 	new->priority		= old->priority;
 	new->deliver_no_wcard	= old->deliver_no_wcard;
+	new->rx_gro		= old->rx_gro;
 #if defined(CONFIG_IP_VS) || defined(CONFIG_IP_VS_MODULE)
 	new->ipvs_property	= old->ipvs_property;
 #endif
@@ -740,6 +740,28 @@ set_rcvbuf:
 		else
 			sock_reset_flag(sk, SOCK_RXQ_OVFL);
 		break;
+
+#ifdef CONFIG_NET_UID_ACCT
+	case SO_ACCT_TAG:
+		sk->sk_acct_tag = val;
+		break;
+#endif
+
+#ifdef CONFIG_NET_ACTIVITY_STATS
+	case SO_TX_DEFER:
+		/*
+		 * Holding segments of a stream back for seconds would only
+		 * make its sender retransmit them.
+		 */
+		if (sk->sk_type != SOCK_DGRAM)
+			ret = -EOPNOTSUPP;
+		else if (val < 0 || val > SOCK_TX_DEFER_MAX)
+			ret = -EINVAL;
+		else
+			sk->sk_tx_defer = val;
+		break;
+#endif
+
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -957,6 +979,18 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = !!sock_flag(sk, SOCK_RXQ_OVFL);
 		break;
 
+#ifdef CONFIG_NET_UID_ACCT
+	case SO_ACCT_TAG:
+		v.val = sk->sk_acct_tag;
+		break;
+#endif
+
+#ifdef CONFIG_NET_ACTIVITY_STATS
+	case SO_TX_DEFER:
+		v.val = sk->sk_tx_defer;
+		break;
+#endif
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -1979,6 +2013,15 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 
 	sk->sk_stamp = ktime_set(-1L, 0);
 
+#ifdef CONFIG_NET_UID_ACCT
+	sk->sk_acct_uid = sock ? SOCK_INODE(sock)->i_uid : 0;
+	sk->sk_acct_tag = 0;
+	sk->sk_acct_cache = NULL;
+#endif
+#ifdef CONFIG_NET_ACTIVITY_STATS
+	sk->sk_tx_defer = 0;
+#endif
+
 	/*
 	 * Before updating sk_refcnt, we must commit prior changes to memory
 	 * (Documentation/RCU/rculist_nulls.txt for details)
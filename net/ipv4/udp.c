@@ -1038,6 +1038,153 @@ out:
 }
 
 
+/*
+ * Readers dequeue from the per-socket reader_queue.  Whenever it runs
+ * dry, everything waiting on sk_receive_queue is spliced over with a
+ * single acquisition of the receive queue lock, so a recvmmsg() burst
+ * does not bounce that lock against softirq enqueueing once per
+ * datagram.  Called with reader_queue.lock held and BHs disabled.
+ */
+static void udp_refill_reader_queue(struct sock *sk)
+{
+	struct sk_buff_head *rcvq = &sk->sk_receive_queue;
+
+	if (!skb_queue_empty(&udp_sk(sk)->reader_queue) ||
+	    skb_queue_empty(rcvq))
+		return;
+
+	spin_lock(&rcvq->lock);
+	skb_queue_splice_tail_init(rcvq, &udp_sk(sk)->reader_queue);
+	spin_unlock(&rcvq->lock);
+}
+
+/*
+ * Wait for a datagram on either queue, like wait_for_packet() does for
+ * sk_receive_queue alone: datagrams another reader already spliced over
+ * to reader_queue must not be slept on.
+ */
+static int udp_wait_for_packet(struct sock *sk, int *err, long *timeo_p)
+{
+	int error;
+	DEFINE_WAIT(wait);
+
+	prepare_to_wait_exclusive(sk_sleep(sk), &wait, TASK_INTERRUPTIBLE);
+
+	/* Socket errors? */
+	error = sock_error(sk);
+	if (error)
+		goto out_err;
+
+	if (!skb_queue_empty(&udp_sk(sk)->reader_queue) ||
+	    !skb_queue_empty(&sk->sk_receive_queue))
+		goto out;
+
+	/* Socket shut down? */
+	if (sk->sk_shutdown & RCV_SHUTDOWN)
+		goto out_noerr;
+
+	/* handle signals */
+	if (signal_pending(current))
+		goto interrupted;
+
+	error = 0;
+	*timeo_p = schedule_timeout(*timeo_p);
+out:
+	finish_wait(sk_sleep(sk), &wait);
+	return error;
+interrupted:
+	error = sock_intr_errno(*timeo_p);
+out_err:
+	*err = error;
+	goto out;
+out_noerr:
+	*err = 0;
+	error = 1;
+	goto out;
+}
+
+/**
+ *	udp_recv_datagram - receive a datagram through the reader queue
+ *	@sk: socket
+ *	@flags: MSG_ flags
+ *	@peeked: returns non-zero if this packet has been seen before
+ *	@err: error code returned
+ *
+ *	Same semantics as __skb_recv_datagram(), but takes datagrams from
+ *	reader_queue, refilled from sk_receive_queue when it runs dry.
+ */
+struct sk_buff *udp_recv_datagram(struct sock *sk, unsigned int flags,
+				  int *peeked, int *err)
+{
+	struct sk_buff_head *rq = &udp_sk(sk)->reader_queue;
+	struct sk_buff *skb;
+	long timeo;
+	int error = sock_error(sk);
+
+	if (error)
+		goto no_packet;
+
+	timeo = sock_rcvtimeo(sk, flags & MSG_DONTWAIT);
+
+	do {
+		spin_lock_bh(&rq->lock);
+		udp_refill_reader_queue(sk);
+		skb = skb_peek(rq);
+		if (skb) {
+			*peeked = skb->peeked;
+			if (flags & MSG_PEEK) {
+				skb->peeked = 1;
+				atomic_inc(&skb->users);
+			} else
+				__skb_unlink(skb, rq);
+		}
+		spin_unlock_bh(&rq->lock);
+
+		if (skb)
+			return skb;
+
+		/* User doesn't want to wait */
+		error = -EAGAIN;
+		if (!timeo)
+			goto no_packet;
+
+	} while (!udp_wait_for_packet(sk, err, &timeo));
+
+	return NULL;
+
+no_packet:
+	*err = error;
+	return NULL;
+}
+EXPORT_SYMBOL(udp_recv_datagram);
+
+/**
+ *	udp_kill_datagram - free a datagram returned by udp_recv_datagram
+ *	@sk: socket
+ *	@skb: datagram
+ *	@flags: MSG_ flags passed to udp_recv_datagram
+ *
+ *	Like skb_kill_datagram(), a peeked datagram is also unlinked from
+ *	whichever queue it is still on.
+ */
+int udp_kill_datagram(struct sock *sk, struct sk_buff *skb, unsigned int flags)
+{
+	struct sk_buff_head *rq = &udp_sk(sk)->reader_queue;
+
+	if (flags & MSG_PEEK) {
+		spin_lock_bh(&rq->lock);
+		if (skb == skb_peek(rq)) {
+			__skb_unlink(skb, rq);
+			atomic_dec(&skb->users);
+			spin_unlock_bh(&rq->lock);
+			return skb_kill_datagram(sk, skb, 0);
+		}
+		spin_unlock_bh(&rq->lock);
+	}
+	return skb_kill_datagram(sk, skb, flags);
+}
+EXPORT_SYMBOL(udp_kill_datagram);
+
 /**
  *	first_packet_length	- return length of first packet in receive queue
  *	@sk: socket
@@ -1047,13 +1194,14 @@ out:
  */
 static unsigned int first_packet_length(struct sock *sk)
 {
-	struct sk_buff_head list_kill, *rcvq = &sk->sk_receive_queue;
+	struct sk_buff_head list_kill, *rcvq = &udp_sk(sk)->reader_queue;
 	struct sk_buff *skb;
 	unsigned int res;
 
 	__skb_queue_head_init(&list_kill);
 
 	spin_lock_bh(&rcvq->lock);
+	udp_refill_reader_queue(sk);
 	while ((skb = skb_peek(rcvq)) != NULL &&
 		udp_lib_checksum_complete(skb)) {
 		UDP_INC_STATS_BH(sock_net(sk), UDP_MIB_INERRORS,
@@ -1139,8 +1287,8 @@ int udp_recvmsg(struct kiocb *iocb, struct sock *sk, struct msghdr *msg,
 		return ip_recv_error(sk, msg, len);
 
 try_again:
-	skb = __skb_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
-				  &peeked, &err);
+	skb = udp_recv_datagram(sk, flags | (noblock ? MSG_DONTWAIT : 0),
+				&peeked, &err);
 	if (!skb)
 		goto out;
 
@@ -1205,7 +1353,7 @@ out:
 
 csum_copy_err:
 	slow = lock_sock_fast(sk);
-	if (!skb_kill_datagram(sk, skb, flags))
+	if (!udp_kill_datagram(sk, skb, flags))
 		UDP_INC_STATS_USER(sock_net(sk), UDP_MIB_INERRORS, is_udplite);
 	unlock_sock_fast(sk, slow);
 
@@ -1676,11 +1824,19 @@ int udp_rcv(struct sk_buff *skb)
 	return __udp4_lib_rcv(skb, &udp_table, IPPROTO_UDP);
 }
 
+int udp_init_sock(struct sock *sk)
+{
+	skb_queue_head_init(&udp_sk(sk)->reader_queue);
+	return 0;
+}
+EXPORT_SYMBOL(udp_init_sock);
+
 void udp_destroy_sock(struct sock *sk)
 {
 	bool slow = lock_sock_fast(sk);
 	udp_flush_pending_frames(sk);
 	unlock_sock_fast(sk, slow);
+	skb_queue_purge(&udp_sk(sk)->reader_queue);
 }
 
 /*
@@ -1868,6 +2024,9 @@ unsigned int udp_poll(struct file *file, struct socket *sock, poll_table *wait)
 	unsigned int mask = datagram_poll(file, sock, wait);
 	struct sock *sk = sock->sk;
 
+	if (!skb_queue_empty(&udp_sk(sk)->reader_queue))
+		mask |= POLLIN | POLLRDNORM;
+
 	/* Check for false positives due to checksum errors */
 	if ((mask & POLLRDNORM) && !(file->f_flags & O_NONBLOCK) &&
 	    !(sk->sk_shutdown & RCV_SHUTDOWN) && !first_packet_length(sk))
@@ -1885,6 +2044,7 @@ struct proto udp_prot = {
 	.connect	   = ip4_datagram_connect,
 	.disconnect	   = udp_disconnect,
 	.ioctl		   = udp_ioctl,
+	.init		   = udp_init_sock,
 	.destroy	   = udp_destroy_sock,
 	.setsockopt	   = udp_setsockopt,
 	.getsockopt	   = udp_getsockopt,
@@ -54,6 +54,7 @@
 #include <net/icmp.h>
 #include <net/xfrm.h>
 #include <net/checksum.h>
+#include <net/uid_acct.h>
 #include <linux/mroute6.h>
 
 static int ip6_fragment(struct sk_buff *skb, int (*output)(struct sk_buff *));
@@ -155,6 +156,7 @@ static inline int ip6_skb_dst_mtu(struct sk_buff *skb)
 
 static int ip6_finish_output(struct sk_buff *skb)
 {
+	uid_acct_tx(skb, skb_dst(skb)->dev);
 	if ((skb->len > ip6_skb_dst_mtu(skb) && !skb_is_gso(skb)) ||
 	    dst_allfrag(skb_dst(skb)))
 		return ip6_fragment(skb, ip6_finish_output2);
@@ -0,0 +1,356 @@
+/* net/uid_acct.c
+ *
+ * Per-UID traffic accounting without netfilter.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * Traffic of every IPv4/IPv6 socket in the initial network namespace is
+ * counted against (uid, tag, interface), where uid is the owner of the
+ * socket when it was created and tag is set with SO_ACCT_TAG (0 when
+ * untagged).  Transmit is counted in the IP output path after
+ * POSTROUTING, receive once the socket has accepted the packet in
+ * sk_filter().  All counters are dumped by /proc/net/uid_acct.
+ */
+
+#include <linux/init.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/proc_fs.h>
+#include <linux/rculist.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <net/net_namespace.h>
+#include <net/uid_acct.h>
+
+#define UID_ACCT_HASH_BITS	8
+#define UID_ACCT_HASH_SIZE	(1 << UID_ACCT_HASH_BITS)
+#define UID_ACCT_MAX_ENTRIES	4096
+#define UID_ACCT_BLOCK		64
+
+static struct hlist_head uid_acct_hash[UID_ACCT_HASH_SIZE];
+LIST_HEAD(uid_acct_list);
+static DEFINE_SPINLOCK(uid_acct_lock);
+static unsigned int uid_acct_count;
+
+/*
+ * alloc_percpu() may sleep, but entries are created from the packet
+ * path.  Their counters are handed out from per-CPU blocks of
+ * UID_ACCT_BLOCK instead, and a work item allocates the spare block
+ * as soon as the previous spare is taken into use.  Like the entries,
+ * blocks are never freed.
+ */
+static struct uid_acct_counters __percpu *uid_acct_block;
+static struct uid_acct_counters __percpu *uid_acct_spare;
+static unsigned int uid_acct_block_used = UID_ACCT_BLOCK;
+
+static void uid_acct_refill(struct work_struct *work)
+{
+	struct uid_acct_counters __percpu *c;
+
+	c = __alloc_percpu(UID_ACCT_BLOCK * sizeof(*c), __alignof__(*c));
+	if (!c)
+		return;
+
+	spin_lock_irq(&uid_acct_lock);
+	if (!uid_acct_spare) {
+		uid_acct_spare = c;
+		c = NULL;
+	}
+	spin_unlock_irq(&uid_acct_lock);
+	free_percpu(c);
+}
+
+static DECLARE_WORK(uid_acct_refill_work, uid_acct_refill);
+
+/* Called with uid_acct_lock held */
+static struct uid_acct_counters __percpu *uid_acct_alloc_counters(void)
+{
+	if (uid_acct_block_used == UID_ACCT_BLOCK) {
+		if (!uid_acct_spare)
+			return NULL;
+		uid_acct_block = uid_acct_spare;
+		uid_acct_spare = NULL;
+		uid_acct_block_used = 0;
+		schedule_work(&uid_acct_refill_work);
+	}
+	return uid_acct_block + uid_acct_block_used++;
+}
+
+#if BITS_PER_LONG == 32
+static inline void uid_acct_write_begin(struct uid_acct_counters *c)
+{
+	write_seqcount_begin(&c->seq);
+}
+
+static inline void uid_acct_write_end(struct uid_acct_counters *c)
+{
+	write_seqcount_end(&c->seq);
+}
+
+static inline unsigned int
+uid_acct_read_begin(const struct uid_acct_counters *c)
+{
+	return read_seqcount_begin(&c->seq);
+}
+
+static inline int uid_acct_read_retry(const struct uid_acct_counters *c,
+				      unsigned int start)
+{
+	return read_seqcount_retry(&c->seq, start);
+}
+#else
+static inline void uid_acct_write_begin(struct uid_acct_counters *c)
+{
+}
+
+static inline void uid_acct_write_end(struct uid_acct_counters *c)
+{
+}
+
+static inline unsigned int
+uid_acct_read_begin(const struct uid_acct_counters *c)
+{
+	return 0;
+}
+
+static inline int uid_acct_read_retry(const struct uid_acct_counters *c,
+				      unsigned int start)
+{
+	return 0;
+}
+#endif
+
+static inline struct hlist_head *uid_acct_bucket(uid_t uid, u32 tag,
+						 int ifindex)
+{
+	return &uid_acct_hash[jhash_3words(uid, tag, ifindex, 0) &
+			      (UID_ACCT_HASH_SIZE - 1)];
+}
+
+static struct uid_acct_entry *__uid_acct_find(struct hlist_head *head,
+					      uid_t uid, u32 tag, int ifindex)
+{
+	struct uid_acct_entry *e;
+	struct hlist_node *n;
+
+	hlist_for_each_entry_rcu(e, n, head, node)
+		if (e->uid == uid && e->tag == tag && e->ifindex == ifindex)
+			return e;
+	return NULL;
+}
+
+static struct uid_acct_entry *uid_acct_create(struct hlist_head *head,
+					      uid_t uid, u32 tag, int ifindex)
+{
+	struct uid_acct_entry *e, *new;
+	struct net_device *dev;
+	const char *why = "table full";
+	unsigned long flags;
+
+	new = kzalloc(sizeof(*new), GFP_ATOMIC);
+	if (!new)
+		return NULL;
+
+	new->uid = uid;
+	new->tag = tag;
+	new->ifindex = ifindex;
+	rcu_read_lock();
+	dev = dev_get_by_index_rcu(&init_net, ifindex);
+	strlcpy(new->ifname, dev ? dev->name : "-", IFNAMSIZ);
+	rcu_read_unlock();
+
+	spin_lock_irqsave(&uid_acct_lock, flags);
+	/* Lost a race with another CPU creating the same entry? */
+	e = __uid_acct_find(head, uid, tag, ifindex);
+	if (!e && uid_acct_count < UID_ACCT_MAX_ENTRIES) {
+		new->counters = uid_acct_alloc_counters();
+		why = "out of counters";
+	}
+	if (!e && new->counters) {
+		uid_acct_count++;
+		hlist_add_head_rcu(&new->node, head);
+		list_add_tail_rcu(&new->list, &uid_acct_list);
+		e = new;
+		new = NULL;
+	}
+	spin_unlock_irqrestore(&uid_acct_lock, flags);
+
+	if (new) {
+		if (!e && net_ratelimit())
+			pr_warning("uid_acct: %s, not counting "
+				   "uid %u tag 0x%08x on %s\n",
+				   why, uid, tag, new->ifname);
+		kfree(new);
+	}
+	return e;
+}
+
+static struct uid_acct_entry *uid_acct_get(uid_t uid, u32 tag, int ifindex)
+{
+	struct hlist_head *head = uid_acct_bucket(uid, tag, ifindex);
+	struct uid_acct_entry *e;
+
+	rcu_read_lock();
+	e = __uid_acct_find(head, uid, tag, ifindex);
+	rcu_read_unlock();
+	if (!e)
+		e = uid_acct_create(head, uid, tag, ifindex);
+	return e;
+}
+
+void uid_acct_skb(struct sock *sk, const struct sk_buff *skb, int ifindex,
+		  int dir)
+{
+	struct uid_acct_entry *e;
+	struct uid_acct_counters *c;
+	unsigned long flags;
+	uid_t uid;
+	u32 tag;
+
+	if (!net_eq(sock_net(sk), &init_net))
+		return;
+
+	uid = sk->sk_acct_uid;
+	tag = sk->sk_acct_tag;
+	e = ACCESS_ONCE(sk->sk_acct_cache);
+	if (unlikely(!e || e->uid != uid || e->tag != tag ||
+		     e->ifindex != ifindex)) {
+		e = uid_acct_get(uid, tag, ifindex);
+		if (!e)
+			return;
+		sk->sk_acct_cache = e;
+	}
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(e->counters);
+	uid_acct_write_begin(c);
+	/* Count from the network header, whatever has been pulled so far */
+	c->bytes[dir] += skb->len - skb_network_offset(skb);
+	c->packets[dir] += skb_is_gso(skb) ? skb_shinfo(skb)->gso_segs : 1;
+	uid_acct_write_end(c);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL(uid_acct_skb);
+
+#ifdef CONFIG_NET_ACTIVITY_STATS
+/*
+ * Charge a radio event, see net/activity_stats.c.  Those come at most
+ * once per jiffy or per deferred packet, so the hash lookup is fine.
+ */
+void uid_acct_event(uid_t uid, u32 tag, int ifindex, int event)
+{
+	struct uid_acct_entry *e = uid_acct_get(uid, tag, ifindex);
+	unsigned long flags;
+
+	if (!e)
+		return;
+
+	local_irq_save(flags);
+	this_cpu_ptr(e->counters)->events[event]++;
+	local_irq_restore(flags);
+}
+#endif
+
+static void *uid_acct_seq_start(struct seq_file *seq, loff_t *pos)
+	__acquires(RCU)
+{
+	rcu_read_lock();
+	return seq_list_start_head(&uid_acct_list, *pos);
+}
+
+static void *uid_acct_seq_next(struct seq_file *seq, void *v, loff_t *pos)
+{
+	return seq_list_next(v, &uid_acct_list, pos);
+}
+
+static void uid_acct_seq_stop(struct seq_file *seq, void *v)
+	__releases(RCU)
+{
+	rcu_read_unlock();
+}
+
+static int uid_acct_seq_show(struct seq_file *seq, void *v)
+{
+	struct uid_acct_entry *e;
+	u64 bytes[UID_ACCT_DIRS] = { 0 };
+	u64 packets[UID_ACCT_DIRS] = { 0 };
+	int cpu, dir;
+
+	if (v == &uid_acct_list) {
+		seq_puts(seq, "iface uid tag rx_bytes rx_packets "
+			 "tx_bytes tx_packets\n");
+		return 0;
+	}
+
+	e = list_entry(v, struct uid_acct_entry, list);
+	for_each_possible_cpu(cpu) {
+		struct uid_acct_counters *c = per_cpu_ptr(e->counters, cpu);
+		u64 b[UID_ACCT_DIRS], p[UID_ACCT_DIRS];
+		unsigned int start;
+
+		do {
+			start = uid_acct_read_begin(c);
+			for (dir = 0; dir < UID_ACCT_DIRS; dir++) {
+				b[dir] = c->bytes[dir];
+				p[dir] = c->packets[dir];
+			}
+		} while (uid_acct_read_retry(c, start));
+
+		for (dir = 0; dir < UID_ACCT_DIRS; dir++) {
+			bytes[dir] += b[dir];
+			packets[dir] += p[dir];
+		}
+	}
+
+	seq_printf(seq, "%s %u 0x%08x %llu %llu %llu %llu\n",
+		   e->ifname, e->uid, e->tag,
+		   (unsigned long long)bytes[UID_ACCT_RX],
+		   (unsigned long long)packets[UID_ACCT_RX],
+		   (unsigned long long)bytes[UID_ACCT_TX],
+		   (unsigned long long)packets[UID_ACCT_TX]);
+	return 0;
+}
+
+static const struct seq_operations uid_acct_seq_ops = {
+	.start	= uid_acct_seq_start,
+	.next	= uid_acct_seq_next,
+	.stop	= uid_acct_seq_stop,
+	.show	= uid_acct_seq_show,
+};
+
+static int uid_acct_seq_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &uid_acct_seq_ops);
+}
+
+static const struct file_operations uid_acct_fops = {
+	.owner		= THIS_MODULE,
+	.open		= uid_acct_seq_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+static int __init uid_acct_init(void)
+{
+	uid_acct_refill(NULL);
+	if (!uid_acct_spare)
+		return -ENOMEM;
+
+	if (!proc_net_fops_create(&init_net, "uid_acct", S_IRUGO,
+				  &uid_acct_fops))
+		return -ENOMEM;
+	return 0;
+}
+
+subsys_initcall(uid_acct_init);
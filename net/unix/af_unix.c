@@ -145,8 +145,26 @@ static inline void unix_set_secdata(struct scm_cookie *scm, struct sk_buff *skb)
  *  SMP locking strategy:
  *    hash table is protected with spinlock unix_table_lock
  *    each socket state is protected by separate spin lock.
+ *
+ *    Lookups first walk the hash chain under RCU.  unix_sock objects
+ *    come from a SLAB_DESTROY_BY_RCU cache, so a socket found that way
+ *    may have been freed and reused: it is only returned after its
+ *    refcount was taken and the name was checked again.  A walk may
+ *    also end early or stray into another chain when a socket is
+ *    unhashed under it, so a miss is retried under unix_table_lock.
  */
 
+/*
+ *  Small datagrams are sent in fixed size skbs.  Once the receiver has
+ *  consumed one, the skb is handed back to the sending socket's
+ *  skb_ring instead of being freed, still charged to the sender's
+ *  sk_wmem_alloc, and reused by its next small send.
+ */
+#define UNIX_SKB_SMALL		256
+#define UNIX_SKB_RING_MAX	16
+
+static struct lock_class_key af_unix_skb_ring_lock_key;
+
 static inline unsigned unix_hash_fold(__wsum n)
 {
 	unsigned hash = (__force unsigned)n;
@@ -184,10 +202,15 @@ static struct sock *unix_peer_get(struct sock *s)
 	return peer;
 }
 
+static void unix_free_addr_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct unix_address, rcu));
+}
+
 static inline void unix_release_addr(struct unix_address *addr)
 {
 	if (atomic_dec_and_test(&addr->refcnt))
-		kfree(addr);
+		call_rcu(&addr->rcu, unix_free_addr_rcu);
 }
 
 /*
@@ -222,13 +245,13 @@ static int unix_mkname(struct sockaddr_un *sunaddr, int len, unsigned *hashp)
 
 static void __unix_remove_socket(struct sock *sk)
 {
-	sk_del_node_init(sk);
+	sk_del_node_init_rcu(sk);
 }
 
 static void __unix_insert_socket(struct hlist_head *list, struct sock *sk)
 {
 	WARN_ON(!sk_unhashed(sk));
-	sk_add_node(sk, list);
+	sk_add_node_rcu(sk, list);
 }
 
 static inline void unix_remove_socket(struct sock *sk)
@@ -267,6 +290,44 @@ found:
 	return s;
 }
 
+static inline int unix_name_match(struct sock *s, struct net *net,
+				  struct sockaddr_un *sunname, int len,
+				  unsigned hash)
+{
+	struct unix_address *addr = rcu_dereference(unix_sk(s)->addr);
+
+	return addr && addr->hash == hash && addr->len == len &&
+	       net_eq(sock_net(s), net) && !memcmp(addr->name, sunname, len);
+}
+
+static struct sock *unix_find_socket_byname_rcu(struct net *net,
+						struct sockaddr_un *sunname,
+						int len, int type,
+						unsigned hash)
+{
+	struct sock *s;
+	struct hlist_node *node;
+
+	rcu_read_lock();
+	sk_for_each_rcu(s, node, &unix_socket_table[hash ^ type]) {
+		if (!unix_name_match(s, net, sunname, len, hash ^ type))
+			continue;
+		if (!atomic_inc_not_zero(&s->sk_refcnt))
+			break;
+		/* The socket may have been reused before we got our ref. */
+		if (unlikely(sk_unhashed(s) ||
+			     !unix_name_match(s, net, sunname, len,
+					      hash ^ type))) {
+			sock_put(s);
+			break;
+		}
+		rcu_read_unlock();
+		return s;
+	}
+	rcu_read_unlock();
+	return NULL;
+}
+
 static inline struct sock *unix_find_socket_byname(struct net *net,
 						   struct sockaddr_un *sunname,
 						   int len, int type,
@@ -274,6 +335,10 @@ static inline struct sock *unix_find_socket_byname(struct net *net,
 {
 	struct sock *s;
 
+	s = unix_find_socket_byname_rcu(net, sunname, len, type, hash);
+	if (s)
+		return s;
+
 	spin_lock(&unix_table_lock);
 	s = __unix_find_socket_byname(net, sunname, len, type, hash);
 	if (s)
@@ -282,11 +347,49 @@ static inline struct sock *unix_find_socket_byname(struct net *net,
 	return s;
 }
 
+/*
+ * u->dentry can only be dereferenced under the socket's state lock, so
+ * each candidate on the chain is pinned and checked there.
+ */
+static struct sock *unix_find_socket_byinode_rcu(struct net *net,
+						 struct inode *i)
+{
+	struct sock *s;
+	struct hlist_node *node;
+	struct dentry *dentry;
+
+	rcu_read_lock();
+	sk_for_each_rcu(s, node,
+			&unix_socket_table[i->i_ino & (UNIX_HASH_SIZE - 1)]) {
+		if (!net_eq(sock_net(s), net) || !unix_sk(s)->dentry)
+			continue;
+		if (!atomic_inc_not_zero(&s->sk_refcnt))
+			break;
+
+		unix_state_lock(s);
+		dentry = unix_sk(s)->dentry;
+		if (dentry && dentry->d_inode == i &&
+		    net_eq(sock_net(s), net) && !sk_unhashed(s)) {
+			unix_state_unlock(s);
+			rcu_read_unlock();
+			return s;
+		}
+		unix_state_unlock(s);
+		sock_put(s);
+	}
+	rcu_read_unlock();
+	return NULL;
+}
+
 static struct sock *unix_find_socket_byinode(struct net *net, struct inode *i)
 {
 	struct sock *s;
 	struct hlist_node *node;
 
+	s = unix_find_socket_byinode_rcu(net, i);
+	if (s)
+		return s;
+
 	spin_lock(&unix_table_lock);
 	sk_for_each(s, node,
 		    &unix_socket_table[i->i_ino & (UNIX_HASH_SIZE - 1)]) {
@@ -396,6 +499,9 @@ static int unix_release_sock(struct sock *sk, int embrion)
 	sk->sk_state = TCP_CLOSE;
 	unix_state_unlock(sk);
 
+	/* SOCK_DEAD is set, receivers no longer recycle skbs to us. */
+	skb_queue_purge(&u->skb_ring);
+
 	wake_up_interruptible_all(&u->peer_wait);
 
 	skpair = unix_peer(sk);
@@ -572,6 +678,7 @@ static struct proto unix_proto = {
 	.name			= "UNIX",
 	.owner			= THIS_MODULE,
 	.obj_size		= sizeof(struct unix_sock),
+	.slab_flags		= SLAB_DESTROY_BY_RCU,
 };
 
 /*
@@ -595,6 +702,13 @@ static struct sock *unix_create1(struct net *net, struct socket *sock)
 	if (!sk)
 		goto out;
 
+	/*
+	 * Lockless lookups may lock a socket as soon as sock_init_data()
+	 * makes its refcount non-zero.
+	 */
+	u	  = unix_sk(sk);
+	spin_lock_init(&u->lock);
+
 	sock_init_data(sock, sk);
 	lockdep_set_class(&sk->sk_receive_queue.lock,
 				&af_unix_sk_receive_queue_lock_key);
@@ -602,14 +716,14 @@ static struct sock *unix_create1(struct net *net, struct socket *sock)
 	sk->sk_write_space	= unix_write_space;
 	sk->sk_max_ack_backlog	= net->unx.sysctl_max_dgram_qlen;
 	sk->sk_destruct		= unix_sock_destructor;
-	u	  = unix_sk(sk);
 	u->dentry = NULL;
 	u->mnt	  = NULL;
-	spin_lock_init(&u->lock);
 	atomic_long_set(&u->inflight, 0);
 	INIT_LIST_HEAD(&u->link);
 	mutex_init(&u->readlock); /* single task reading lock */
 	init_waitqueue_head(&u->peer_wait);
+	skb_queue_head_init(&u->skb_ring);
+	lockdep_set_class(&u->skb_ring.lock, &af_unix_skb_ring_lock_key);
 	unix_insert_socket(unix_sockets_unbound, sk);
 out:
 	if (sk == NULL)
@@ -715,7 +829,7 @@ retry:
 	addr->hash ^= sk->sk_type;
 
 	__unix_remove_socket(sk);
-	u->addr = addr;
+	rcu_assign_pointer(u->addr, addr);
 	__unix_insert_socket(&unix_socket_table[addr->hash], sk);
 	spin_unlock(&unix_table_lock);
 	err = 0;
@@ -881,7 +995,7 @@ out_mknod_drop_write:
 
 	err = 0;
 	__unix_remove_socket(sk);
-	u->addr = addr;
+	rcu_assign_pointer(u->addr, addr);
 	__unix_insert_socket(list, sk);
 
 out_unlock:
@@ -1376,6 +1490,64 @@ static int unix_scm_to_skb(struct scm_cookie *scm, struct sk_buff *skb, bool sen
 	return err;
 }
 
+/*
+ *	Small datagram skbs are recycled through the sender's skb_ring.
+ */
+
+static struct sk_buff *unix_alloc_dgram_skb(struct sock *sk, size_t len,
+					    int noblock, int *err)
+{
+	struct sk_buff *skb;
+
+	if (len > UNIX_SKB_SMALL)
+		return sock_alloc_send_skb(sk, len, noblock, err);
+
+	skb = skb_dequeue(&unix_sk(sk)->skb_ring);
+	if (skb)
+		return skb;
+
+	return sock_alloc_send_skb(sk, UNIX_SKB_SMALL, noblock, err);
+}
+
+static bool unix_skb_recycle(struct sk_buff *skb)
+{
+	struct sock *owner = skb->sk;
+	struct sk_buff_head *ring;
+
+	if (!owner || skb->destructor != unix_destruct_scm ||
+	    UNIXCB(skb).fp || skb_shared(skb) || skb_cloned(skb) ||
+	    skb_is_nonlinear(skb) ||
+	    skb_end_pointer(skb) - skb->head != SKB_DATA_ALIGN(UNIX_SKB_SMALL))
+		return false;
+
+	/*
+	 * The skb keeps its charge on the owner's sk_wmem_alloc, which
+	 * keeps the owner around until the ring is purged on release.
+	 */
+	ring = &unix_sk(owner)->skb_ring;
+	spin_lock(&ring->lock);
+	if (sock_flag(owner, SOCK_DEAD) ||
+	    skb_queue_len(ring) >= UNIX_SKB_RING_MAX) {
+		spin_unlock(&ring->lock);
+		return false;
+	}
+
+	put_pid(UNIXCB(skb).pid);
+	UNIXCB(skb).pid = NULL;
+	if (UNIXCB(skb).cred)
+		put_cred(UNIXCB(skb).cred);
+	UNIXCB(skb).cred = NULL;
+
+	skb->data = skb->head;
+	skb_reset_tail_pointer(skb);
+	skb->len = 0;
+	skb->peeked = 0;
+
+	__skb_queue_tail(ring, skb);
+	spin_unlock(&ring->lock);
+	return true;
+}
+
 /*
  *	Send AF_UNIX data.
  */
@@ -1429,7 +1601,7 @@ static int unix_dgram_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	if (len > sk->sk_sndbuf - 32)
 		goto out;
 
-	skb = sock_alloc_send_skb(sk, len, msg->msg_flags&MSG_DONTWAIT, &err);
+	skb = unix_alloc_dgram_skb(sk, len, msg->msg_flags&MSG_DONTWAIT, &err);
 	if (skb == NULL)
 		goto out;
 
@@ -1763,7 +1935,8 @@ static int unix_dgram_recvmsg(struct kiocb *iocb, struct socket *sock,
 	scm_recv(sock, msg, siocb->scm, flags);
 
 out_free:
-	skb_free_datagram(sk, skb);
+	if (!unix_skb_recycle(skb))
+		skb_free_datagram(sk, skb);
 out_unlock:
 	mutex_unlock(&u->readlock);
 out:
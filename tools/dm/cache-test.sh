@@ -0,0 +1,158 @@
+#!/bin/sh
+#
+# cache-test.sh -- hit rate per replacement policy and write-back crash
+#                  recovery of the dm-cache target
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# usage: cache-test.sh [source MB [cache MB, a power of two]]
+#
+# Sets up a source and a cache device on loop devices, each behind a
+# linear mapping so that it can be swapped for the error target.
+#
+# For each replacement policy it reads a hot region over and over with a
+# scan of a large cold region between the passes, and reports the hit
+# rate, promotions and bypassed misses from the status line.
+#
+# It then writes to a write-back cache, "crashes" it by replacing both
+# devices with the error target before removing it, so that nothing is
+# written back or recorded clean on the way out, and reloads it from its
+# metadata.  The data must read back the same through the reloaded cache,
+# and must be on the source once that is removed cleanly.
+#
+# Needs root, losetup and dmsetup.  Exits 1 if recovery fails.
+#
+
+set -e
+
+src_mb=${1:-64}
+cache_mb=${2:-8}
+block=8				# sectors
+blocks=$((cache_mb * 128))	# of 4KB, half the cache device
+assoc=256
+hot_mb=$((cache_mb / 4))
+passes=8
+dir=$(mktemp -d /tmp/cache-test.XXXXXX)
+loops=
+
+die()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+new_loop()
+{
+	dd if=/dev/zero of=$dir/$1 bs=1M count=0 seek=$2 2>/dev/null
+	loop=$(losetup -f)
+	losetup $loop $dir/$1
+	loops="$loops $loop"
+}
+
+cleanup()
+{
+	dmsetup remove ct-cache 2>/dev/null || true
+	dmsetup remove ct-src 2>/dev/null || true
+	dmsetup remove ct-cdev 2>/dev/null || true
+	for loop in $loops; do
+		losetup -d $loop 2>/dev/null || true
+	done
+	rm -rf $dir
+}
+
+trap cleanup EXIT
+
+# linear <name> <loop>: map <name> straight onto <loop> again
+linear()
+{
+	echo 0 $(blockdev --getsz $2) linear $2 0 | dmsetup load $1
+	dmsetup resume $1
+}
+
+# fail <name>: make every I/O to <name> fail from now on
+fail()
+{
+	echo 0 $(blockdev --getsz /dev/mapper/$1) error | dmsetup load $1
+	dmsetup resume $1
+}
+
+# field <prefix>: the number after <prefix> in the status line
+field()
+{
+	dmsetup status ct-cache | sed -n "s/.*$1\([0-9.]*\).*/\1/p"
+}
+
+# read_mb <MB> <at MB>: direct reads through the cache
+read_mb()
+{
+	dd if=/dev/mapper/ct-cache of=/dev/null bs=64k \
+		count=$(($1 * 16)) skip=$(($2 * 16)) iflag=direct 2>/dev/null
+}
+
+new_loop src $src_mb
+src=$loop
+new_loop cdev $cache_mb
+cdev=$loop
+echo 0 $(blockdev --getsz $src) linear $src 0 | dmsetup create ct-src
+echo 0 $(blockdev --getsz $cdev) linear $cdev 0 | dmsetup create ct-cdev
+size=$(blockdev --getsz $src)
+
+# run <policy>: hot region reads with cold scans in between
+run()
+{
+	dd if=/dev/zero of=$cdev bs=1M count=$cache_mb conv=notrunc 2>/dev/null
+	echo 0 $size cache /dev/mapper/ct-src /dev/mapper/ct-cdev 0 \
+		$block $blocks $assoc 0 $1 | dmsetup create ct-cache
+
+	i=0
+	while [ $i -lt $passes ]; do
+		read_mb $hot_mb 0
+		read_mb $((src_mb - hot_mb)) $hot_mb
+		i=$((i + 1))
+	done
+
+	printf "%-4s hits %5s%%  promotions %8s  bypassed %8s\n" $1 \
+		$(field "cache hits([0-9]*, ") $(field "promotions(") \
+		$(field "bypassed(")
+	dmsetup remove ct-cache
+}
+
+for policy in lru mq lfu; do
+	run $policy
+done
+
+# Write-back crash recovery
+dd if=/dev/urandom of=$dir/data bs=1M count=$hot_mb 2>/dev/null
+dd if=/dev/zero of=$cdev bs=1M count=$cache_mb conv=notrunc 2>/dev/null
+echo 0 $size cache /dev/mapper/ct-src /dev/mapper/ct-cdev 0 \
+	$block $blocks $assoc 1 lru | dmsetup create ct-cache
+dd if=$dir/data of=/dev/mapper/ct-cache bs=64k oflag=direct \
+	conv=notrunc 2>/dev/null
+
+dirty=$(field "dirty blocks(")
+[ "$dirty" -gt 0 ] || die "no dirty blocks after writing to the cache"
+
+fail ct-src
+fail ct-cdev
+dmsetup remove --force ct-cache 2>/dev/null || true
+linear ct-src $src
+linear ct-cdev $cdev
+
+echo 0 $size cache /dev/mapper/ct-src /dev/mapper/ct-cdev 1 | \
+	dmsetup create ct-cache
+reloaded=$(field "dirty blocks(")
+echo "recovery: $dirty dirty blocks before the crash, $reloaded reloaded"
+[ "$reloaded" -gt 0 ] || die "recovery FAILED: dirty blocks were not reloaded"
+
+dd if=/dev/mapper/ct-cache bs=64k count=$((hot_mb * 16)) iflag=direct \
+	2>/dev/null | cmp -s - $dir/data || \
+	die "recovery FAILED: data read through the cache differs"
+
+dmsetup remove ct-cache
+dd if=/dev/mapper/ct-src bs=64k count=$((hot_mb * 16)) iflag=direct \
+	2>/dev/null | cmp -s - $dir/data || \
+	die "recovery FAILED: data was not written back to the source"
+
+echo "recovery: ok"
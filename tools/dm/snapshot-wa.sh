@@ -0,0 +1,167 @@
+#!/bin/sh
+#
+# snapshot-wa.sh -- write amplification of snapshots of one origin
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# usage: snapshot-wa.sh [max snapshots [origin MB [MB written]]]
+#
+# Sets up an origin on a loop device with 1 to <max snapshots> snapshots,
+# first each with its own persistent COW device (P), then all of them in
+# one shared COW device (S), writes to the origin, and reports how many
+# sectors that wrote to the COW devices per sector written to the origin.
+# The COW devices are loop devices too, and what was written to them is
+# read from /sys/block/loopN/stat.  Needs root, losetup and dmsetup.
+#
+
+set -e
+
+max=${1:-8}
+origin_mb=${2:-256}
+write_mb=${3:-64}
+chunk=16
+dir=$(mktemp -d /tmp/snapshot-wa.XXXXXX)
+loops=
+
+die()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+new_loop()
+{
+	dd if=/dev/zero of=$dir/$1 bs=1M count=0 seek=$2 2>/dev/null
+	loop=$(losetup -f)
+	losetup $loop $dir/$1
+	loops="$loops $loop"
+}
+
+written()
+{
+	# field 7 is sectors written
+	awk '{ print $7 }' /sys/block/${1#/dev/}/stat
+}
+
+cleanup()
+{
+	dmsetup remove wa-origin 2>/dev/null || true
+	i=0
+	while [ $i -lt $max ]; do
+		dmsetup remove wa-snap$i 2>/dev/null || true
+		i=$((i + 1))
+	done
+	dmsetup remove wa-real 2>/dev/null || true
+	for loop in $loops; do
+		losetup -d $loop 2>/dev/null || true
+	done
+	rm -rf $dir
+}
+
+trap cleanup EXIT
+
+[ $max -ge 1 ] || die "need at least one snapshot"
+
+new_loop origin $origin_mb
+origin_loop=$loop
+size=$(blockdev --getsz $origin_loop)
+echo 0 $size linear $origin_loop 0 | dmsetup create wa-real
+
+# One COW device per snapshot, and one for them all
+i=0
+while [ $i -lt $max ]; do
+	new_loop cow$i $((write_mb * 2))
+	eval cow$i=$loop
+	i=$((i + 1))
+done
+new_loop shared $((write_mb * 2))
+shared=$loop
+
+# cows <store> <snapshots>: the COW devices in use
+cows()
+{
+	if [ $1 = S ]; then
+		echo $shared
+		return
+	fi
+	i=0
+	while [ $i -lt $2 ]; do
+		eval echo \$cow$i
+		i=$((i + 1))
+	done
+}
+
+# sum of the sectors written to the COW devices
+cow_written()
+{
+	sum=0
+	for cow in $(cows $1 $2); do
+		sum=$((sum + $(written $cow)))
+	done
+	echo $sum
+}
+
+# run <store> <snapshots>: prints COW sectors written per origin sector
+run()
+{
+	store=$1
+	n=$2
+
+	# start from empty stores
+	for cow in $(cows $store $n); do
+		dd if=/dev/zero of=$cow bs=1M count=1 conv=notrunc 2>/dev/null
+	done
+
+	i=0
+	while [ $i -lt $n ]; do
+		if [ $store = S ]; then
+			cow=$shared
+			args="S $chunk $i"
+		else
+			eval cow=\$cow$i
+			args="P $chunk"
+		fi
+		echo 0 $size snapshot /dev/mapper/wa-real $cow $args | \
+			dmsetup create -r wa-snap$i
+		i=$((i + 1))
+	done
+	echo 0 $size snapshot-origin /dev/mapper/wa-real | \
+		dmsetup create wa-origin
+
+	before=$(cow_written $store $n)
+	origin_before=$(written $origin_loop)
+
+	# every other MB, so that each write needs its chunks copied
+	i=0
+	while [ $i -lt $write_mb ]; do
+		dd if=/dev/urandom of=/dev/mapper/wa-origin bs=1M count=1 \
+			seek=$((i * 2 % origin_mb)) oflag=direct \
+			conv=notrunc 2>/dev/null
+		i=$((i + 1))
+	done
+	sync
+
+	origin_written=$(($(written $origin_loop) - origin_before))
+	after=$(cow_written $store $n)
+
+	dmsetup remove wa-origin
+	i=0
+	while [ $i -lt $n ]; do
+		[ $store = S ] && dmsetup message wa-snap$i 0 release
+		dmsetup remove wa-snap$i
+		i=$((i + 1))
+	done
+
+	awk -v s=$store -v n=$n -v o=$origin_written -v c=$((after - before)) \
+		'BEGIN { printf "%s %3d snapshots: %10d origin %10d cow " \
+			 "sectors, %6.2f cow/origin\n", s, n, o, c, c / o }'
+}
+
+n=1
+while [ $n -le $max ]; do
+	run P $n
+	run S $n
+	n=$((n * 2))
+done
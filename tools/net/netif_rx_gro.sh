@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# netif_rx_gro.sh -- what GRO on a netif_rx() device saves, measured on veth
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2 as
+# published by the Free Software Foundation.
+#
+# usage: netif_rx_gro.sh [seconds]
+#
+# Moves one end of a veth pair into a new network namespace that runs
+# netserver, and sends it a bulk TCP stream with netperf from the host,
+# first with GRO off and then with GRO on on the receiving end.  veth
+# receives through dev_forward_skb(), i.e. netif_rx_gro(), and has no
+# TSO, so the receiver sees MTU-sized segments as it would from a USB
+# or Wi-Fi device.
+#
+# For each run it reports the throughput and how many packets went
+# through ip_rcv() in the namespace per MB received ("InReceives" in
+# the Ip: line of its /proc/net/snmp).  With GRO on, that should drop
+# by about the average number of segments merged per packet.
+#
+# Needs root, unshare, ip, ethtool, netperf and netserver.
+#
+
+set -e
+
+seconds=${1:-30}
+dir=$(mktemp -d /tmp/netif_rx_gro.XXXXXX)
+pid=
+
+die()
+{
+	echo "$*" >&2
+	exit 1
+}
+
+stop_ns()
+{
+	[ -n "$pid" ] && kill $pid 2>/dev/null || true
+	pid=
+	rm -f $dir/pid
+	ip link del veth0 2>/dev/null || true
+}
+
+cleanup()
+{
+	stop_ns
+	rm -rf $dir
+}
+
+trap cleanup EXIT
+
+# in_receives: Ip InReceives of the namespace
+in_receives()
+{
+	awk '/^Ip:/ && $4 ~ /^[0-9]+$/ { print $4 }' /proc/$pid/net/snmp
+}
+
+# run on|off
+run()
+{
+	# netserver is exec'ed, so $pid stays the task inside the namespace
+	unshare --net sh -c "
+		echo \$\$ > $dir/pid
+		while ! ip link show veth1 >/dev/null 2>&1; do
+			sleep 1
+		done
+		ip link set lo up
+		ip addr add 10.99.0.2/24 dev veth1
+		ip link set veth1 up
+		exec netserver -D
+	" >/dev/null 2>&1 &
+
+	i=0
+	while [ ! -s $dir/pid ]; do
+		i=$((i + 1))
+		[ $i -le 10 ] || die "namespace did not start"
+		sleep 1
+	done
+	pid=$(cat $dir/pid)
+
+	# veth needs receive checksumming on before it takes gro on
+	ip link add veth0 type veth peer name veth1
+	ethtool -K veth1 rx on gro $1
+	ip link set veth1 netns $pid
+	ip addr add 10.99.0.1/24 dev veth0
+	ip link set veth0 up
+
+	i=0
+	while ! netperf -H 10.99.0.2 -t TCP_STREAM -l 1 -P 0 >/dev/null 2>&1
+	do
+		i=$((i + 1))
+		[ $i -le 10 ] || die "netserver not reachable"
+		sleep 1
+	done
+
+	before=$(in_receives)
+	mbits=$(netperf -H 10.99.0.2 -t TCP_STREAM -l $seconds -P 0 | \
+		awk 'NF { m = $NF } END { print m }')
+	after=$(in_receives)
+
+	awk -v g=$1 -v m=$mbits -v s=$seconds -v p=$((after - before)) \
+		'BEGIN { printf "gro %-3s %10.2f Mbit/s %10.1f packets/MB\n", \
+			 g, m, p / (m * s / 8) }'
+
+	stop_ns
+}
+
+ip link show veth0 >/dev/null 2>&1 && die "veth0 exists already"
+
+run off
+run on
@@ -4,6 +4,11 @@
 extern int bench_sched_messaging(int argc, const char **argv, const char *prefix);
 extern int bench_sched_pipe(int argc, const char **argv, const char *prefix);
 extern int bench_mem_memcpy(int argc, const char **argv, const char *prefix __used);
+extern int bench_mem_fault(int argc, const char **argv, const char *prefix);
+extern int bench_net_unix(int argc, const char **argv, const char *prefix);
+extern int bench_net_udp(int argc, const char **argv, const char *prefix);
+extern int bench_fs_rw(int argc, const char **argv, const char *prefix);
+extern int bench_futex_mutex(int argc, const char **argv, const char *prefix);
 
 #define BENCH_FORMAT_DEFAULT_STR	"default"
 #define BENCH_FORMAT_DEFAULT		0
@@ -0,0 +1,213 @@
+/*
+ *
+ * fs-rw.c
+ *
+ * rw: sequential write and parallel read throughput of one file, e.g.
+ *     on an eCryptfs mount against the file system underneath it
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static const char *dir = ".";
+static const char *ref_dir;
+static int size_mb = 64;
+static int block_kb = 64;
+static int jobs = 1;
+static bool cold;
+
+static const struct option options[] = {
+	OPT_STRING('d', "dir", &dir, "dir",
+		   "Directory to create the test file in"),
+	OPT_STRING('r', "ref-dir", &ref_dir, "dir",
+		   "Also run in this directory, for comparison"),
+	OPT_INTEGER('s', "size", &size_mb,
+		    "Specify file size in MB"),
+	OPT_INTEGER('b', "block", &block_kb,
+		    "Specify read and write size in KB"),
+	OPT_INTEGER('j', "jobs", &jobs,
+		    "Number of processes reading the file in parallel"),
+	OPT_BOOLEAN('c', "cold", &cold,
+		    "Drop all caches before reading (needs root)"),
+	OPT_END()
+};
+
+static const char * const bench_fs_rw_usage[] = {
+	"perf bench fs rw <options>",
+	NULL
+};
+
+struct rw_result {
+	struct timeval write;
+	struct timeval read;
+};
+
+static unsigned long long to_usec(struct timeval *tv)
+{
+	return tv->tv_sec * 1000000ULL + tv->tv_usec;
+}
+
+static void drop_caches(int fd)
+{
+	int proc;
+
+	assert(!posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED));
+	if (!cold)
+		return;
+	sync();
+	proc = open("/proc/sys/vm/drop_caches", O_WRONLY);
+	assert(proc >= 0);
+	assert(write(proc, "3", 1) == 1);
+	close(proc);
+}
+
+static void write_file(int fd, char *buf)
+{
+	off_t total = (off_t)size_mb << 20;
+	size_t block = block_kb << 10;
+	off_t done;
+
+	for (done = 0; done < total; done += block)
+		assert(write(fd, buf, block) == (ssize_t)block);
+	assert(!fsync(fd));
+}
+
+/* Each job reads its own contiguous slice of the file */
+static void read_slice(const char *path, int job, char *buf)
+{
+	off_t total = (off_t)size_mb << 20;
+	off_t slice = total / jobs;
+	size_t block = block_kb << 10;
+	off_t pos, end;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0);
+	pos = slice * job;
+	end = job == jobs - 1 ? total : pos + slice;
+	while (pos < end) {
+		ret = pread(fd, buf, block, pos);
+		assert(ret > 0);
+		pos += ret;
+	}
+	close(fd);
+}
+
+static void run(const char *where, char *buf, struct rw_result *res)
+{
+	struct timeval start, stop;
+	char path[PATH_MAX];
+	int fd, i, wait_stat;
+	pid_t pid;
+
+	snprintf(path, sizeof(path), "%s/perf-bench-fs-rw.%d", where,
+		 getpid());
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+		exit(1);
+	}
+
+	gettimeofday(&start, NULL);
+	write_file(fd, buf);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &res->write);
+
+	drop_caches(fd);
+	close(fd);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < jobs; i++) {
+		pid = fork();
+		assert(pid >= 0);
+		if (!pid) {
+			read_slice(path, i, buf);
+			exit(0);
+		}
+	}
+	for (i = 0; i < jobs; i++)
+		wait(&wait_stat);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &res->read);
+
+	unlink(path);
+}
+
+static void print_result(const char *where, struct rw_result *res)
+{
+	double mb = size_mb;
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %s\n", where);
+		printf(" %14lf MB/sec write (including fsync)\n",
+		       mb * 1000000 / to_usec(&res->write));
+		printf(" %14lf MB/sec read by %d job%s\n\n",
+		       mb * 1000000 / to_usec(&res->read), jobs,
+		       jobs == 1 ? "" : "s");
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu %lu.%03lu\n",
+		       res->write.tv_sec,
+		       (unsigned long) (res->write.tv_usec / 1000),
+		       res->read.tv_sec,
+		       (unsigned long) (res->read.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+}
+
+int bench_fs_rw(int argc, const char **argv,
+		const char *prefix __used)
+{
+	struct rw_result res, ref_res;
+	char *buf;
+	int i;
+
+	argc = parse_options(argc, argv, options,
+			     bench_fs_rw_usage, 0);
+
+	assert(size_mb > 0 && block_kb > 0 && jobs > 0);
+	buf = malloc(block_kb << 10);
+	assert(buf);
+	/* incompressible, in case anything below compresses */
+	srand(getpid());
+	for (i = 0; i < (block_kb << 10); i++)
+		buf[i] = rand();
+
+	run(dir, buf, &res);
+	if (ref_dir)
+		run(ref_dir, buf, &ref_res);
+
+	if (bench_format == BENCH_FORMAT_DEFAULT)
+		printf("# Wrote and read back %d MB in %d KB blocks%s\n\n",
+		       size_mb, block_kb, cold ? ", cold caches" : "");
+	print_result(dir, &res);
+	if (ref_dir)
+		print_result(ref_dir, &ref_res);
+
+	free(buf);
+	return 0;
+}
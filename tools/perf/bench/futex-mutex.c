@@ -0,0 +1,222 @@
+/*
+ *
+ * futex-mutex.c
+ *
+ * mutex: pthread mutex contention, i.e. FUTEX_WAIT_PRIVATE and
+ *        FUTEX_WAKE_PRIVATE on one or a few hot futexes
+ *
+ * Every thread takes its mutex, spins --hold loops inside, drops it and
+ * goes again until the time is up.  With --processes each process runs
+ * its own set of threads and mutexes, so their private futexes only
+ * meet in the kernel's futex hash.  With --wake the threads instead call
+ * FUTEX_WAKE_PRIVATE on a word of their own that nobody waits on, which
+ * is what an uncontended unlock costs once the waiters bit got stale.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static int nthreads;
+static int nmutexes = 1;
+static int nprocs = 1;
+static int runtime = 5;
+static int hold;
+static bool wake_only;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nthreads,
+		    "Specify number of threads per process (default: online CPUs)"),
+	OPT_INTEGER('m', "mutexes", &nmutexes,
+		    "Specify number of mutexes the threads are spread over"),
+	OPT_INTEGER('p', "processes", &nprocs,
+		    "Specify number of processes"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_INTEGER('H', "hold", &hold,
+		    "Specify busy loops with the mutex held"),
+	OPT_BOOLEAN('w', "wake", &wake_only,
+		    "Only FUTEX_WAKE_PRIVATE a futex nobody waits on"),
+	OPT_END()
+};
+
+static const char * const bench_futex_mutex_usage[] = {
+	"perf bench futex mutex <options>",
+	NULL
+};
+
+/* Shared with the parent: one counter per thread, and the stop flag */
+static unsigned long *counts;
+static volatile int *stop;
+
+static pthread_mutex_t *mutexes;
+
+struct worker {
+	pthread_t thread;
+	int id;
+	unsigned long *count;
+};
+
+static void *mutex_worker(void *arg)
+{
+	struct worker *w = arg;
+	pthread_mutex_t *m = &mutexes[w->id % nmutexes];
+	unsigned long n = 0;
+	volatile int i;
+
+	while (!*stop) {
+		pthread_mutex_lock(m);
+		for (i = 0; i < hold; i++)
+			;
+		pthread_mutex_unlock(m);
+		n++;
+	}
+	*w->count = n;
+	return NULL;
+}
+
+static void *wake_worker(void *arg)
+{
+	struct worker *w = arg;
+	unsigned long n = 0;
+	int word = 0;
+
+	while (!*stop) {
+		syscall(SYS_futex, &word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		n++;
+	}
+	*w->count = n;
+	return NULL;
+}
+
+static void run_process(int proc)
+{
+	struct worker *workers;
+	int i;
+
+	workers = calloc(nthreads, sizeof(*workers));
+	mutexes = calloc(nmutexes, sizeof(*mutexes));
+	assert(workers && mutexes);
+	for (i = 0; i < nmutexes; i++)
+		assert(!pthread_mutex_init(&mutexes[i], NULL));
+
+	for (i = 0; i < nthreads; i++) {
+		workers[i].id = i;
+		workers[i].count = &counts[proc * nthreads + i];
+		assert(!pthread_create(&workers[i].thread, NULL,
+				       wake_only ? wake_worker : mutex_worker,
+				       &workers[i]));
+	}
+	for (i = 0; i < nthreads; i++)
+		assert(!pthread_join(workers[i].thread, NULL));
+
+	free(mutexes);
+	free(workers);
+}
+
+int bench_futex_mutex(int argc, const char **argv,
+		      const char *prefix __used)
+{
+	struct timeval start, stop_tv, diff;
+	unsigned long long total = 0, usec;
+	unsigned long lo = ~0UL, hi = 0;
+	int i, wait_stat;
+	size_t shared_size;
+	void *shared;
+	pid_t pid;
+
+	argc = parse_options(argc, argv, options,
+			     bench_futex_mutex_usage, 0);
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(nthreads > 0 && nmutexes > 0 && nprocs > 0 && runtime > 0);
+
+	shared_size = sizeof(unsigned long) +
+		sizeof(*counts) * nprocs * nthreads;
+	shared = mmap(NULL, shared_size, PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	assert(shared != MAP_FAILED);
+	counts = (unsigned long *)((char *)shared + sizeof(unsigned long));
+	stop = shared;
+
+	fflush(stdout);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nprocs; i++) {
+		pid = fork();
+		assert(pid >= 0);
+		if (!pid) {
+			run_process(i);
+			exit(0);
+		}
+	}
+
+	sleep(runtime);
+	*stop = 1;
+	for (i = 0; i < nprocs; i++) {
+		assert(wait(&wait_stat) > 0);
+		assert(WIFEXITED(wait_stat) && !WEXITSTATUS(wait_stat));
+	}
+	gettimeofday(&stop_tv, NULL);
+	timersub(&stop_tv, &start, &diff);
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	for (i = 0; i < nprocs * nthreads; i++) {
+		total += counts[i];
+		if (counts[i] < lo)
+			lo = counts[i];
+		if (counts[i] > hi)
+			hi = counts[i];
+	}
+	munmap(shared, shared_size);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		if (wake_only)
+			printf("# %d process%s of %d threads, FUTEX_WAKE_PRIVATE "
+			       "without waiters\n\n", nprocs,
+			       nprocs == 1 ? "" : "es", nthreads);
+		else
+			printf("# %d process%s of %d threads on %d mutex%s, "
+			       "hold %d\n\n", nprocs, nprocs == 1 ? "" : "es",
+			       nthreads, nmutexes, nmutexes == 1 ? "" : "es",
+			       hold);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14.0lf ops/sec\n", (double)total * 1000000 / usec);
+		printf(" %14lu ops by the slowest thread\n", lo);
+		printf(" %14lu ops by the fastest thread\n", hi);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf\n", (double)total * 1000000 / usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *
+ * mem-fault.c
+ *
+ * fault: page faults against mmap()/munmap() in one process, i.e. readers
+ *        against writers of mmap_sem
+ *
+ * Fault threads each touch every page of their own anonymous buffer, then
+ * drop it with MADV_DONTNEED so that the next pass faults again.  Mapper
+ * threads meanwhile mmap(), touch and munmap() a small area in a loop.
+ * Both kinds take mmap_sem, the faults for reading, mmap() and munmap()
+ * for writing.  With --file the fault threads read a shared file, which
+ * stays in the page cache, instead of writing anonymous memory.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <fcntl.h>
+
+static int nfaulters;
+static int nmappers = 1;
+static int size_kb = 1024;
+static int map_kb = 64;
+static int runtime = 5;
+static bool file_backed;
+
+static const struct option options[] = {
+	OPT_INTEGER('t', "threads", &nfaulters,
+		    "Specify number of faulting threads (default: online CPUs)"),
+	OPT_INTEGER('m', "mappers", &nmappers,
+		    "Specify number of threads doing mmap()/munmap()"),
+	OPT_INTEGER('s', "size", &size_kb,
+		    "Specify buffer size of each faulting thread in KB"),
+	OPT_INTEGER('M', "map-size", &map_kb,
+		    "Specify size of each mmap() in KB"),
+	OPT_INTEGER('r', "runtime", &runtime,
+		    "Specify runtime in seconds"),
+	OPT_BOOLEAN('f', "file", &file_backed,
+		    "Read fault pages of a cached file instead of anonymous memory"),
+	OPT_END()
+};
+
+static const char * const bench_mem_fault_usage[] = {
+	"perf bench mem fault <options>",
+	NULL
+};
+
+static volatile int stop;
+static long page_size;
+static int file_fd = -1;
+static volatile char sink;
+
+struct worker {
+	pthread_t thread;
+	unsigned long long ops;
+};
+
+static void *fault_worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)size_kb << 10;
+	size_t off;
+	char *buf;
+
+	if (file_fd >= 0)
+		buf = mmap(NULL, size, PROT_READ, MAP_SHARED, file_fd, 0);
+	else
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	assert(buf != MAP_FAILED);
+
+	while (!stop) {
+		for (off = 0; off < size; off += page_size) {
+			if (file_fd >= 0)
+				sink = buf[off];
+			else
+				buf[off] = 1;
+		}
+		w->ops += size / page_size;
+		assert(!madvise(buf, size, MADV_DONTNEED));
+	}
+
+	munmap(buf, size);
+	return NULL;
+}
+
+static void *map_worker(void *arg)
+{
+	struct worker *w = arg;
+	size_t size = (size_t)map_kb << 10;
+	char *buf;
+
+	while (!stop) {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		assert(buf != MAP_FAILED);
+		buf[0] = 1;
+		assert(!munmap(buf, size));
+		w->ops++;
+	}
+	return NULL;
+}
+
+/* An unlinked temporary file of --size KB, written so it is all cached */
+static int open_file(size_t size)
+{
+	char name[] = "/tmp/perf-bench-fault-XXXXXX";
+	char *page;
+	size_t off;
+	int fd;
+
+	fd = mkstemp(name);
+	assert(fd >= 0);
+	assert(!unlink(name));
+
+	page = malloc(page_size);
+	assert(page);
+	memset(page, 1, page_size);
+	for (off = 0; off < size; off += page_size)
+		assert(write(fd, page, page_size) == page_size);
+	free(page);
+	return fd;
+}
+
+static void start_workers(struct worker *workers, int n, void *(*fn)(void *))
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		assert(!pthread_create(&workers[i].thread, NULL, fn,
+				       &workers[i]));
+}
+
+static unsigned long long join_workers(struct worker *workers, int n)
+{
+	unsigned long long total = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		assert(!pthread_join(workers[i].thread, NULL));
+		total += workers[i].ops;
+	}
+	return total;
+}
+
+int bench_mem_fault(int argc, const char **argv,
+		    const char *prefix __used)
+{
+	struct worker *faulters, *mappers;
+	struct timeval start, stop_tv, diff;
+	unsigned long long faults, maps, usec;
+
+	argc = parse_options(argc, argv, options,
+			     bench_mem_fault_usage, 0);
+
+	page_size = sysconf(_SC_PAGESIZE);
+	if (nfaulters < 0)
+		nfaulters = 0;
+	else if (!nfaulters)
+		nfaulters = sysconf(_SC_NPROCESSORS_ONLN);
+	assert(nmappers >= 0 && (nfaulters || nmappers));
+	assert(size_kb > 0 && map_kb > 0 && runtime > 0);
+
+	if (file_backed)
+		file_fd = open_file((size_t)size_kb << 10);
+
+	faulters = calloc(nfaulters + 1, sizeof(*faulters));
+	mappers = calloc(nmappers + 1, sizeof(*mappers));
+	assert(faulters && mappers);
+
+	gettimeofday(&start, NULL);
+	start_workers(faulters, nfaulters, fault_worker);
+	start_workers(mappers, nmappers, map_worker);
+
+	sleep(runtime);
+	stop = 1;
+
+	faults = join_workers(faulters, nfaulters);
+	maps = join_workers(mappers, nmappers);
+	gettimeofday(&stop_tv, NULL);
+	timersub(&stop_tv, &start, &diff);
+	usec = diff.tv_sec * 1000000ULL + diff.tv_usec;
+
+	free(faulters);
+	free(mappers);
+	if (file_fd >= 0)
+		close(file_fd);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# %d faulting thread%s over %d KB %s, "
+		       "%d mapping thread%s of %d KB\n\n",
+		       nfaulters, nfaulters == 1 ? "" : "s", size_kb,
+		       file_backed ? "of one file" : "each",
+		       nmappers, nmappers == 1 ? "" : "s", map_kb);
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14.0lf page faults/sec\n",
+		       (double)faults * 1000000 / usec);
+		printf(" %14.0lf mmap()+munmap()/sec\n",
+		       (double)maps * 1000000 / usec);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%.0lf %.0lf\n", (double)faults * 1000000 / usec,
+		       (double)maps * 1000000 / usec);
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,253 @@
+/*
+ *
+ * net-udp.c
+ *
+ * udp: loopback datagram throughput, one syscall per datagram or
+ *      batched through sendmmsg()/recvmmsg()
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#ifndef __NR_sendmmsg
+# if defined(__arm__)
+#  define __NR_sendmmsg		(__NR_SYSCALL_BASE + 374)
+# elif defined(__x86_64__)
+#  define __NR_sendmmsg		307
+# elif defined(__i386__)
+#  define __NR_sendmmsg		345
+# endif
+#endif
+
+#ifndef __NR_recvmmsg
+# if defined(__arm__)
+#  define __NR_recvmmsg		(__NR_SYSCALL_BASE + 365)
+# elif defined(__x86_64__)
+#  define __NR_recvmmsg		299
+# elif defined(__i386__)
+#  define __NR_recvmmsg		337
+# endif
+#endif
+
+/* Same layout as the kernel's struct mmsghdr */
+struct bench_mmsghdr {
+	struct msghdr	msg_hdr;
+	unsigned int	msg_len;
+};
+
+#define PACKETS_DEFAULT 1000000
+static int packets = PACKETS_DEFAULT;
+static int msg_size = 64;
+static int batch = 1;
+
+static const struct option options[] = {
+	OPT_INTEGER('n', "packets", &packets,
+		    "Specify number of datagrams to send"),
+	OPT_INTEGER('s', "size", &msg_size,
+		    "Specify datagram payload size in bytes"),
+	OPT_INTEGER('b', "batch", &batch,
+		    "Datagrams per sendmmsg()/recvmmsg() call, 1 uses send()/recv()"),
+	OPT_END()
+};
+
+static const char * const bench_net_udp_usage[] = {
+	"perf bench net udp <options>",
+	NULL
+};
+
+static int sys_sendmmsg(int fd, struct bench_mmsghdr *vec, unsigned int vlen)
+{
+	return syscall(__NR_sendmmsg, fd, vec, vlen, 0);
+}
+
+static int sys_recvmmsg(int fd, struct bench_mmsghdr *vec, unsigned int vlen)
+{
+	return syscall(__NR_recvmmsg, fd, vec, vlen, 0, NULL);
+}
+
+static void setup_vec(struct bench_mmsghdr *vec, struct iovec *iov, char *buf)
+{
+	int i;
+
+	memset(vec, 0, batch * sizeof(*vec));
+	for (i = 0; i < batch; i++) {
+		iov[i].iov_base = buf + i * msg_size;
+		iov[i].iov_len = msg_size;
+		vec[i].msg_hdr.msg_iov = &iov[i];
+		vec[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+
+static void sender(int fd, char *buf)
+{
+	struct bench_mmsghdr *vec = calloc(batch, sizeof(*vec));
+	struct iovec *iov = calloc(batch, sizeof(*iov));
+	int sent = 0, ret;
+
+	assert(vec && iov);
+	setup_vec(vec, iov, buf);
+
+	while (sent < packets) {
+		int n = packets - sent < batch ? packets - sent : batch;
+
+		if (batch == 1) {
+			ret = send(fd, buf, msg_size, 0);
+			if (ret == msg_size)
+				ret = 1;
+		} else
+			ret = sys_sendmmsg(fd, vec, n);
+		if (ret < 0 && (errno == ENOBUFS || errno == EAGAIN))
+			continue;
+		assert(ret > 0);
+		sent += ret;
+	}
+
+	/* Zero length datagrams tell the receiver we are done */
+	for (;;) {
+		ret = send(fd, buf, 0, 0);
+		assert(ret == 0);
+		usleep(1000);
+	}
+}
+
+static int receiver(int fd, char *buf)
+{
+	struct bench_mmsghdr *vec = calloc(batch, sizeof(*vec));
+	struct iovec *iov = calloc(batch, sizeof(*iov));
+	int received = 0, ret, i;
+
+	assert(vec && iov);
+	setup_vec(vec, iov, buf);
+
+	for (;;) {
+		if (batch == 1) {
+			ret = recv(fd, buf, msg_size, 0);
+			assert(ret >= 0);
+			if (!ret)
+				break;
+			received++;
+			continue;
+		}
+
+		ret = sys_recvmmsg(fd, vec, batch);
+		assert(ret > 0);
+		for (i = 0; i < ret; i++)
+			if (!vec[i].msg_len)
+				goto out;
+		received += ret;
+	}
+out:
+	free(vec);
+	free(iov);
+	return received;
+}
+
+int bench_net_udp(int argc, const char **argv,
+		  const char *prefix __used)
+{
+	struct sockaddr_in addr;
+	socklen_t addr_len = sizeof(addr);
+	struct timeval start, stop, diff;
+	unsigned long long result_usec = 0;
+	int rx, tx, received, wait_stat, rcvbuf = 4 << 20;
+	pid_t pid;
+	char *buf;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_udp_usage, 0);
+
+	assert(msg_size > 0 && batch > 0);
+	buf = calloc(batch, msg_size);
+	assert(buf);
+
+	rx = socket(AF_INET, SOCK_DGRAM, 0);
+	tx = socket(AF_INET, SOCK_DGRAM, 0);
+	assert(rx >= 0 && tx >= 0);
+	setsockopt(rx, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	assert(!bind(rx, (struct sockaddr *)&addr, sizeof(addr)));
+	assert(!getsockname(rx, (struct sockaddr *)&addr, &addr_len));
+	assert(!connect(tx, (struct sockaddr *)&addr, sizeof(addr)));
+
+	pid = fork();
+	assert(pid >= 0);
+
+	if (!pid) {
+		close(rx);
+		sender(tx, buf);
+		exit(0);
+	}
+	close(tx);
+
+	gettimeofday(&start, NULL);
+	received = receiver(rx, buf);
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	kill(pid, SIGTERM);
+	waitpid(pid, &wait_stat, 0);
+	close(rx);
+	free(buf);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Sent %d %d-byte datagrams over loopback, %s\n\n",
+		       packets, msg_size,
+		       batch == 1 ? "one per syscall" : "batched");
+		if (batch > 1)
+			printf(" %14d datagrams per sendmmsg()/recvmmsg()\n",
+			       batch);
+
+		result_usec = diff.tv_sec * 1000000;
+		result_usec += diff.tv_usec;
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14d datagrams received (%d lost)\n",
+		       received, packets - received);
+		printf(" %14d datagrams/sec\n",
+		       (int)((double)received /
+			     ((double)result_usec / (double)1000000)));
+		printf(" %14lf MB/sec\n",
+		       (double)received * msg_size / (double)result_usec);
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ *
+ * net-unix.c
+ *
+ * unix: ping-pong latency of small messages over AF_UNIX sockets
+ *
+ * Two tasks bounce a message back and forth, the way logd, rild and
+ * netd talk to their clients.  By default the sockets are a connected
+ * socketpair(); with --named each side binds an abstract address and
+ * every message goes through sendto(), so each send also exercises
+ * the name lookup.
+ *
+ */
+
+#include "../perf.h"
+#include "../util/util.h"
+#include "../util/parse-options.h"
+#include "../builtin.h"
+#include "bench.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LOOPS_DEFAULT 1000000
+static int loops = LOOPS_DEFAULT;
+static int msg_size = 64;
+static bool use_seqpacket;
+static bool use_named;
+
+static const struct option options[] = {
+	OPT_INTEGER('l', "loop", &loops,
+		    "Specify number of round trips"),
+	OPT_INTEGER('s', "size", &msg_size,
+		    "Specify message size in bytes"),
+	OPT_BOOLEAN('p', "seqpacket", &use_seqpacket,
+		    "Use SOCK_SEQPACKET instead of SOCK_DGRAM"),
+	OPT_BOOLEAN('n', "named", &use_named,
+		    "Use bound abstract addresses and sendto()"),
+	OPT_END()
+};
+
+static const char * const bench_net_unix_usage[] = {
+	"perf bench net unix <options>",
+	NULL
+};
+
+static socklen_t abstract_addr(struct sockaddr_un *sun, int side)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	/* Leading NUL: abstract namespace */
+	snprintf(sun->sun_path + 1, sizeof(sun->sun_path) - 1,
+		 "perf-bench-unix-%d-%d", getpid(), side);
+	return offsetof(struct sockaddr_un, sun_path) + 1 +
+		strlen(sun->sun_path + 1);
+}
+
+static void pingpong(int fd, const struct sockaddr_un *peer,
+		     socklen_t peer_len, char *buf, bool first)
+{
+	ssize_t ret;
+	int i;
+
+	for (i = 0; i < loops; i++) {
+		if (!first) {
+			ret = recv(fd, buf, msg_size, 0);
+			assert(ret == msg_size);
+		}
+		if (peer)
+			ret = sendto(fd, buf, msg_size, 0,
+				     (const struct sockaddr *)peer, peer_len);
+		else
+			ret = send(fd, buf, msg_size, 0);
+		assert(ret == msg_size);
+		if (first) {
+			ret = recv(fd, buf, msg_size, 0);
+			assert(ret == msg_size);
+		}
+	}
+}
+
+int bench_net_unix(int argc, const char **argv,
+		   const char *prefix __used)
+{
+	struct sockaddr_un addr[2];
+	socklen_t addr_len[2];
+	struct timeval start, stop, diff;
+	unsigned long long result_usec = 0;
+	int type, fd[2], wait_stat;
+	pid_t pid, retpid;
+	char *buf;
+
+	argc = parse_options(argc, argv, options,
+			     bench_net_unix_usage, 0);
+
+	assert(msg_size > 0);
+	buf = calloc(1, msg_size);
+	assert(buf);
+
+	type = use_seqpacket ? SOCK_SEQPACKET : SOCK_DGRAM;
+
+	if (use_named) {
+		/* SEQPACKET needs a connection, so --named implies DGRAM */
+		type = SOCK_DGRAM;
+		fd[0] = socket(AF_UNIX, type, 0);
+		fd[1] = socket(AF_UNIX, type, 0);
+		assert(fd[0] >= 0 && fd[1] >= 0);
+		addr_len[0] = abstract_addr(&addr[0], 0);
+		addr_len[1] = abstract_addr(&addr[1], 1);
+		assert(!bind(fd[0], (struct sockaddr *)&addr[0], addr_len[0]));
+		assert(!bind(fd[1], (struct sockaddr *)&addr[1], addr_len[1]));
+	} else {
+		assert(!socketpair(AF_UNIX, type, 0, fd));
+	}
+
+	pid = fork();
+	assert(pid >= 0);
+
+	gettimeofday(&start, NULL);
+
+	if (!pid)
+		pingpong(fd[1], use_named ? &addr[0] : NULL, addr_len[0],
+			 buf, false);
+	else
+		pingpong(fd[0], use_named ? &addr[1] : NULL, addr_len[1],
+			 buf, true);
+
+	gettimeofday(&stop, NULL);
+	timersub(&stop, &start, &diff);
+
+	if (pid) {
+		retpid = waitpid(pid, &wait_stat, 0);
+		assert((retpid == pid) && WIFEXITED(wait_stat));
+	} else {
+		exit(0);
+	}
+
+	close(fd[0]);
+	close(fd[1]);
+	free(buf);
+
+	switch (bench_format) {
+	case BENCH_FORMAT_DEFAULT:
+		printf("# Executed %d %d-byte round trips over %s%s\n\n",
+		       loops, msg_size,
+		       type == SOCK_SEQPACKET ? "SOCK_SEQPACKET" : "SOCK_DGRAM",
+		       use_named ? " (named)" : "");
+
+		result_usec = diff.tv_sec * 1000000;
+		result_usec += diff.tv_usec;
+
+		printf(" %14s: %lu.%03lu [sec]\n\n", "Total time",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec/1000));
+
+		printf(" %14lf usecs/round trip\n",
+		       (double)result_usec / (double)loops);
+		printf(" %14d round trips/sec\n",
+		       (int)((double)loops /
+			     ((double)result_usec / (double)1000000)));
+		break;
+
+	case BENCH_FORMAT_SIMPLE:
+		printf("%lu.%03lu\n",
+		       diff.tv_sec,
+		       (unsigned long) (diff.tv_usec / 1000));
+		break;
+
+	default:
+		/* reaching here is something disaster */
+		fprintf(stderr, "Unknown format:%d\n", bench_format);
+		exit(1);
+		break;
+	}
+
+	return 0;
+}
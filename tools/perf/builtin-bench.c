@@ -13,6 +13,9 @@
  * Available subsystem list:
  *  sched ... scheduler and IPC mechanism
  *  mem   ... memory access performance
+ *  net   ... socket layer
+ *  fs    ... file system data path
+ *  futex ... futex and pthread mutex
  *
  */
 
@@ -52,12 +55,48 @@ static struct bench_suite mem_suites[] = {
 	{ "memcpy",
 	  "Simple memory copy in various ways",
 	  bench_mem_memcpy },
+	{ "fault",
+	  "Page faults against mmap()/munmap() in one process",
+	  bench_mem_fault },
 	suite_all,
 	{ NULL,
 	  NULL,
 	  NULL             }
 };
 
+static struct bench_suite net_suites[] = {
+	{ "unix",
+	  "Ping-pong of small messages over AF_UNIX sockets",
+	  bench_net_unix },
+	{ "udp",
+	  "Loopback UDP throughput with optional sendmmsg()/recvmmsg() batching",
+	  bench_net_udp },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL           }
+};
+
+static struct bench_suite fs_suites[] = {
+	{ "rw",
+	  "Sequential write and parallel read throughput of one file",
+	  bench_fs_rw },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL        }
+};
+
+static struct bench_suite futex_suites[] = {
+	{ "mutex",
+	  "Contention on pthread mutexes, or FUTEX_WAKE without waiters",
+	  bench_futex_mutex },
+	suite_all,
+	{ NULL,
+	  NULL,
+	  NULL              }
+};
+
 struct bench_subsys {
 	const char *name;
 	const char *summary;
@@ -71,6 +110,15 @@ static struct bench_subsys subsystems[] = {
 	{ "mem",
 	  "memory access performance",
 	  mem_suites },
+	{ "net",
+	  "socket layer",
+	  net_suites },
+	{ "fs",
+	  "file system data path",
+	  fs_suites },
+	{ "futex",
+	  "futex and pthread mutex",
+	  futex_suites },
 	{ "all",		/* sentinel: easy for help */
 	  "test all subsystem (pseudo subsystem)",
 	  NULL },
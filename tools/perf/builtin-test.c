@@ -12,6 +12,10 @@
 #include "util/symbol.h"
 #include "util/thread.h"
 
+#include "perf.h"
+
+#include <sys/prctl.h>
+
 static long page_size;
 
 static int vmlinux_matches_kallsyms_filter(struct map *map __used, struct symbol *sym)
@@ -219,6 +223,95 @@ out:
 	return err;
 }
 
+#define MUX_NR_EVENTS	16
+
+/*
+ * Open more cycle counters on ourselves than any PMU has, so that the
+ * kernel has to rotate them through the hardware, and check that each
+ * got some time on it and that, scaled up to the time it was enabled,
+ * each counted about as much as the others.
+ */
+static int test__counter_multiplexing(void)
+{
+	struct perf_event_attr attr;
+	int fds[MUX_NR_EVENTS];
+	u64 val[MUX_NR_EVENTS][3];
+	double scaled[MUX_NR_EVENTS], mean = 0;
+	struct timeval start, now;
+	volatile unsigned long loops = 0;
+	int i, nr, multiplexed = 0, err = -1;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CPU_CYCLES;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			   PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.disabled = 1;
+
+	for (nr = 0; nr < MUX_NR_EVENTS; nr++) {
+		fds[nr] = sys_perf_event_open(&attr, 0, -1, -1, 0);
+		if (fds[nr] < 0)
+			break;
+	}
+	if (nr < MUX_NR_EVENTS) {
+		if (!nr) {
+			pr_debug("no cycle counter, skipping: %s\n",
+				 strerror(errno));
+			return 0;
+		}
+		pr_debug("could only open %d of %d counters: %s\n",
+			 nr, MUX_NR_EVENTS, strerror(errno));
+		goto out_close;
+	}
+
+	prctl(PR_TASK_PERF_EVENTS_ENABLE);
+	gettimeofday(&start, NULL);
+	do {
+		for (i = 0; i < 100000; i++)
+			loops++;
+		gettimeofday(&now, NULL);
+	} while ((now.tv_sec - start.tv_sec) * 1000000 +
+		 (now.tv_usec - start.tv_usec) < 500000);
+	prctl(PR_TASK_PERF_EVENTS_DISABLE);
+
+	for (i = 0; i < nr; i++) {
+		if (read(fds[i], val[i], sizeof(val[i])) != sizeof(val[i])) {
+			pr_debug("read: %s\n", strerror(errno));
+			goto out_close;
+		}
+		pr_debug("counter %2d: %Lu enabled %Lu running %Lu\n",
+			 i, val[i][0], val[i][1], val[i][2]);
+		if (!val[i][2]) {
+			pr_debug("counter %d never ran\n", i);
+			goto out_close;
+		}
+		if (val[i][2] < val[i][1])
+			multiplexed = 1;
+		scaled[i] = (double)val[i][0] * val[i][1] / val[i][2];
+		mean += scaled[i] / nr;
+	}
+
+	/* No PMU has MUX_NR_EVENTS counters, so this means no rotation */
+	if (!multiplexed) {
+		pr_debug("all counters ran all the time, nothing was multiplexed\n");
+		goto out_close;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (scaled[i] < mean * 0.75 || scaled[i] > mean * 1.25) {
+			pr_debug("counter %d: %.0f scaled, mean %.0f\n",
+				 i, scaled[i], mean);
+			goto out_close;
+		}
+	}
+	err = 0;
+
+out_close:
+	for (i = 0; i < nr; i++)
+		close(fds[i]);
+	return err;
+}
+
 static struct test {
 	const char *desc;
 	int (*func)(void);
@@ -227,6 +320,10 @@ static struct test {
 		.desc = "vmlinux symtab matches kallsyms",
 		.func = test__vmlinux_matches_kallsyms,
 	},
+	{
+		.desc = "hardware counter multiplexing",
+		.func = test__counter_multiplexing,
+	},
 	{
 		.func = NULL,
 	},
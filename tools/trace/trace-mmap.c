@@ -0,0 +1,282 @@
+/* $(CROSS_COMPILE)cc -Wall -Wextra -O2 -I../../include -o trace-mmap trace-mmap.c */
+
+/*
+ * trace-mmap.c -- drain the per CPU ftrace ring buffers through mmap()
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * Consumes every CPU's buffer for a while, either in place through the
+ * mapping of per_cpu/cpuN/trace_pipe_raw (see linux/trace_mmap.h), or
+ * with -r by read()ing the same files a page at a time, and reports how
+ * many events it got and how much CPU time that took.  Run a tracer or
+ * enable some events first.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include <linux/trace_mmap.h>
+
+/* struct ring_buffer_event, see linux/ring_buffer.h */
+#define TYPE_LEN_MAX		28
+#define TYPE_PADDING		29
+#define TYPE_TIME_EXTEND	30
+#define TYPE_TIME_STAMP		31
+
+/* Flags read() sets in a page's commit */
+#define MISSED_EVENTS		(1UL << 31)
+#define MISSED_STORED		(1UL << 30)
+
+/* time stamp, then a long commit */
+#define SUBBUF_HDR_SIZE		(8 + sizeof(long))
+
+struct cpu_reader {
+	int			cpu;
+	int			fd;
+	struct trace_buffer_meta *meta;
+	size_t			map_size;
+	char			*page;		/* for read() */
+	unsigned int		id;		/* reader sub-buffer seen last */
+	unsigned long		pos;		/* bytes of it read so far */
+};
+
+static unsigned long long events, bytes, lost, pages;
+static long page_size;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+/* Count the events between @from and @to of a sub-buffer's data */
+static void parse(const char *data, unsigned long from, unsigned long to)
+{
+	const unsigned int *ev;
+	unsigned int type_len, len;
+
+	while (from + 4 <= to) {
+		ev = (const unsigned int *)(data + from);
+		type_len = *ev & 0x1f;
+
+		switch (type_len) {
+		case TYPE_PADDING:
+			/* without a time delta it pads to the end */
+			if (!(*ev >> 5))
+				return;
+			len = 4 + ev[1];
+			break;
+		case TYPE_TIME_EXTEND:
+			len = 8;
+			break;
+		case TYPE_TIME_STAMP:
+			len = 16;
+			break;
+		case 0:
+			len = 4 + ev[1];
+			events++;
+			break;
+		default:
+			len = 4 + type_len * 4;
+			events++;
+			break;
+		}
+		from += len;
+	}
+}
+
+static void map_cpu(struct cpu_reader *r)
+{
+	struct trace_buffer_meta *meta;
+	size_t size;
+
+	/* The meta page tells how much there is to map */
+	meta = mmap(NULL, page_size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (meta == MAP_FAILED)
+		die("mmap");
+	size = meta->meta_page_size +
+		(size_t)meta->nr_subbufs * meta->subbuf_size;
+	munmap(meta, page_size);
+
+	r->meta = mmap(NULL, size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (r->meta == MAP_FAILED)
+		die("mmap");
+	r->map_size = size;
+	r->id = r->meta->reader.id;
+	r->pos = r->meta->reader.read;
+}
+
+/* Returns non zero if there was anything new */
+static int consume_mapped(struct cpu_reader *r)
+{
+	volatile struct trace_buffer_meta *meta = r->meta;
+	const char *subbuf;
+	unsigned long commit;
+	int progress = 0;
+
+	for (;;) {
+		if (meta->reader.id != r->id) {
+			r->id = meta->reader.id;
+			r->pos = meta->reader.read;
+			lost += meta->reader.lost_events;
+			pages++;
+		}
+
+		subbuf = (const char *)r->meta + meta->meta_page_size +
+			(size_t)r->id * meta->subbuf_size;
+		commit = *(volatile const unsigned long *)(subbuf + 8);
+		if (commit > r->pos) {
+			parse(subbuf + SUBBUF_HDR_SIZE, r->pos, commit);
+			bytes += commit - r->pos;
+			r->pos = commit;
+			progress = 1;
+		}
+
+		if (ioctl(r->fd, TRACE_MMAP_IOCTL_GET_READER) < 0)
+			die("ioctl");
+
+		/* Still on the same page: the writer has not moved on */
+		if (meta->reader.id == r->id)
+			return progress;
+	}
+}
+
+static int consume_read(struct cpu_reader *r)
+{
+	unsigned long commit;
+	ssize_t n;
+
+	n = read(r->fd, r->page, page_size);
+	if (n < 0 && errno != EAGAIN)
+		die("read");
+	if (n < (ssize_t)SUBBUF_HDR_SIZE)
+		return 0;
+
+	commit = *(unsigned long *)(r->page + 8);
+	if (commit & MISSED_EVENTS)
+		lost++;
+	commit &= ~(MISSED_EVENTS | MISSED_STORED);
+	parse(r->page + SUBBUF_HDR_SIZE, 0, commit);
+	bytes += commit;
+	pages++;
+	return 1;
+}
+
+static double cpu_seconds(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-d tracing dir] [-c cpu] [-t seconds] [-r]\n"
+		"  -r  read() trace_pipe_raw instead of mapping it\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = "/sys/kernel/debug/tracing";
+	struct cpu_reader *readers;
+	struct timeval start, now;
+	int ncpus, only_cpu = -1, seconds = 10, use_read = 0;
+	int i, n = 0, opt, progress;
+	double cpu_time, wall;
+	char path[256];
+
+	while ((opt = getopt(argc, argv, "d:c:t:r")) != -1) {
+		switch (opt) {
+		case 'd':
+			dir = optarg;
+			break;
+		case 'c':
+			only_cpu = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		case 'r':
+			use_read = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+	ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	readers = calloc(ncpus, sizeof(*readers));
+	if (!readers)
+		die("calloc");
+
+	for (i = 0; i < ncpus; i++) {
+		struct cpu_reader *r = &readers[n];
+
+		if (only_cpu >= 0 && i != only_cpu)
+			continue;
+		snprintf(path, sizeof(path), "%s/per_cpu/cpu%d/trace_pipe_raw",
+			 dir, i);
+		r->fd = open(path, O_RDONLY | O_NONBLOCK);
+		if (r->fd < 0)
+			continue;
+		r->cpu = i;
+		if (use_read) {
+			r->page = malloc(page_size);
+			if (!r->page)
+				die("malloc");
+		} else {
+			map_cpu(r);
+		}
+		n++;
+	}
+	if (!n) {
+		fprintf(stderr, "no trace_pipe_raw under %s\n", dir);
+		return 1;
+	}
+
+	cpu_time = cpu_seconds();
+	gettimeofday(&start, NULL);
+	do {
+		progress = 0;
+		for (i = 0; i < n; i++)
+			progress |= use_read ? consume_read(&readers[i]) :
+					       consume_mapped(&readers[i]);
+		if (!progress)
+			usleep(1000);
+		gettimeofday(&now, NULL);
+	} while (now.tv_sec - start.tv_sec < seconds);
+
+	cpu_time = cpu_seconds() - cpu_time;
+	wall = (now.tv_sec - start.tv_sec) +
+		(now.tv_usec - start.tv_usec) / 1e6;
+
+	printf("%s: %d cpu buffer%s for %.1f s\n",
+	       use_read ? "read()" : "mmap()", n, n == 1 ? "" : "s", wall);
+	printf("  %llu events, %llu bytes, %llu pages, %llu lost\n",
+	       events, bytes, pages, lost);
+	printf("  %.3f s of CPU time, %.0f events per CPU second\n",
+	       cpu_time, cpu_time > 0 ? events / cpu_time : 0.0);
+
+	for (i = 0; i < n; i++) {
+		if (readers[i].meta)
+			munmap(readers[i].meta, readers[i].map_size);
+		free(readers[i].page);
+		close(readers[i].fd);
+	}
+	free(readers);
+
+	return 0;
+}